@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "book/level.h"
+
+using namespace coypu::book;
+
+// same layout as the CoinLevel in main
+struct BenchLevel {
+  uint64_t px;
+  uint64_t qty;
+  BenchLevel *next, *prev;
+
+  BenchLevel (uint64_t px, uint64_t qty) : px(px), qty(qty), next(nullptr), prev(nullptr) {
+  }
+
+  BenchLevel () : px(UINT64_MAX), qty(UINT64_MAX), next(nullptr), prev(nullptr) {
+  }
+
+  void Set (uint64_t px, uint64_t qty) {
+	 this->px = px;
+	 this->qty = qty;
+  }
+} __attribute__((packed, aligned(64)));
+
+typedef CBook<BenchLevel, 4096*16> bench_book_type;
+
+// Bids at 1000, 1002, ... so odd prices fall between existing levels
+static void FillBook (bench_book_type &book, int depth) {
+  int index = 0;
+  for (int i = 0; i < depth; ++i) {
+	 book.InsertBid(1000 + 2 * i, 1, index);
+  }
+}
+
+// Insert and erase an odd price level inside a book of range(0) levels, range(1) picks where:
+// 0 near the top of book (the end of the vector), 1 in the middle, 2 at the far end
+static void BM_BookInsertErase (benchmark::State &state) {
+  bench_book_type book(0);
+  const int depth = state.range(0);
+  FillBook(book, depth);
+
+  const int from = state.range(1) == 0 ? depth - 1 : state.range(1) == 1 ? depth / 2 : 0;
+  const uint64_t px = 1000 + 2 * from + 1;
+  int index = 0;
+  for (auto _ : state) {
+	 book.InsertBid(px, 1, index);
+	 book.EraseBid(px, index);
+  }
+  benchmark::DoNotOptimize(index);
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Quantity update on existing levels, spread across the book
+static void BM_BookUpdate (benchmark::State &state) {
+  bench_book_type book(0);
+  const int depth = state.range(0);
+  FillBook(book, depth);
+
+  int index = 0;
+  uint64_t i = 0;
+  for (auto _ : state) {
+	 const uint64_t level = (i * 7) % depth;
+	 book.UpdateBid(1000 + 2 * level, ++i, index);
+  }
+  benchmark::DoNotOptimize(index);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_BookInsertErase)->Args({100, 0})->Args({100, 1})->Args({5000, 0})->Args({5000, 1})->Args({5000, 2});
+BENCHMARK(BM_BookUpdate)->Arg(100)->Arg(5000);
@@ -0,0 +1,218 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "benchmark/benchmark.h"
+#include "buf/buf.h"
+#include "buf/fixed.h"
+#include "buf/mirror.h"
+#include "mem/mem.h"
+
+using namespace coypu::buf;
+using namespace coypu::mem;
+
+typedef BipBuf <char, uint64_t> bench_buf_type;
+
+// websocket upgrade request padded with header lines to about size bytes
+static std::string MakeHeader (size_t size) {
+  std::string h = "GET /websocket HTTP/1.1\r\nHost: localhost:8080\r\nUpgrade: websocket\r\n"
+	 "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n";
+  int i = 0;
+  while (h.size() + 4 < size) {
+	 h += "X-Header-" + std::to_string(i++) + ": coypu-bench-value\r\n";
+  }
+  h += "\r\n";
+  return h;
+}
+
+// byte at a time over both segments, as Find was before
+static bool ScalarFind (const char *data, const bench_buf_type &buf, char d, uint64_t &offset) {
+  offset = 0;
+  if (buf.IsEmpty()) return false;
+  const uint64_t head = buf.Head(), tail = buf.Tail(), capacity = buf.Capacity();
+  const uint64_t end = head > tail ? head : capacity;
+  for (uint64_t x = tail; x < end; ++x, ++offset) {
+	 if (data[x] == d) return true;
+  }
+  if (head <= tail) {
+	 for (uint64_t x = 0; x < head; ++x, ++offset) {
+		if (data[x] == d) return true;
+	 }
+  }
+  return false;
+}
+
+static bool ScalarFind (const char *data, const bench_buf_type &buf, const char *pattern, uint64_t len, uint64_t &offset) {
+  const uint64_t available = buf.Available(), tail = buf.Tail(), capacity = buf.Capacity();
+  for (offset = 0; offset + len <= available; ++offset) {
+	 uint64_t i = 0;
+	 for (; i < len; ++i) {
+		uint64_t x = tail + offset + i;
+		if (x >= capacity) x -= capacity;
+		if (data[x] != pattern[i]) break;
+	 }
+	 if (i == len) return true;
+  }
+  offset = 0;
+  return false;
+}
+
+// Find the blank line. range(0) header size, range(1) 1 to start the header just before the wrap
+template <bool Vector>
+static void BM_FindHeaderEnd (benchmark::State &state) {
+  const std::string header = MakeHeader(state.range(0));
+  const uint64_t capacity = 16384;
+  char *data = new char[capacity];
+  bench_buf_type buf(data, capacity);
+  if (state.range(1)) {
+	 std::string pad(capacity - 64, ' ');
+	 buf.Push(pad.c_str(), pad.size());
+	 buf.Pop(data, pad.size());
+  }
+  buf.Push(header.c_str(), header.size());
+
+  uint64_t offset = 0;
+  for (auto _ : state) {
+	 bool found = false;
+	 if (Vector) {
+		found = buf.Find("\r\n\r\n", 4, offset);
+	 } else {
+		found = ScalarFind(data, buf, "\r\n\r\n", 4, offset);
+	 }
+	 benchmark::DoNotOptimize(found);
+	 benchmark::DoNotOptimize(offset);
+  }
+  state.SetBytesProcessed(state.iterations() * header.size());
+  delete [] data;
+}
+
+// Single delimiter at the end of the readable data, as admin line parsing sees it
+template <bool Vector>
+static void BM_FindByte (benchmark::State &state) {
+  const uint64_t capacity = 16384;
+  char *data = new char[capacity];
+  bench_buf_type buf(data, capacity);
+  std::string line(state.range(0) - 1, 'a');
+  line += '\n';
+  if (state.range(1)) {
+	 std::string pad(capacity - line.size() / 2, ' ');
+	 buf.Push(pad.c_str(), pad.size());
+	 buf.Pop(data, pad.size());
+  }
+  buf.Push(line.c_str(), line.size());
+
+  uint64_t offset = 0;
+  for (auto _ : state) {
+	 bool found = Vector ? buf.Find('\n', offset) : ScalarFind(data, buf, '\n', offset);
+	 benchmark::DoNotOptimize(found);
+	 benchmark::DoNotOptimize(offset);
+  }
+  state.SetBytesProcessed(state.iterations() * line.size());
+  delete [] data;
+}
+
+BENCHMARK_TEMPLATE(BM_FindHeaderEnd, false)->Args({256, 0})->Args({512, 0})->Args({2048, 0})->Args({512, 1});
+BENCHMARK_TEMPLATE(BM_FindHeaderEnd, true)->Args({256, 0})->Args({512, 0})->Args({2048, 0})->Args({512, 1});
+BENCHMARK_TEMPLATE(BM_FindByte, false)->Args({64, 0})->Args({512, 0})->Args({4096, 0})->Args({512, 1});
+BENCHMARK_TEMPLATE(BM_FindByte, true)->Args({64, 0})->Args({512, 0})->Args({4096, 0})->Args({512, 1});
+
+// Ring throughput through Readv/Writev. range(0) chunk size, chunks are odd sized so the ring wraps
+// constantly. Socket 0 copies through iovecs in memory to show the buffer cost alone, 1 goes through
+// a unix socketpair.
+template <template <typename, typename> class BufType>
+static void BM_RingReadvWritev (benchmark::State &state) {
+  const uint64_t capacity = 65536;
+  char *data = static_cast<char *>(MemManager::MapMirror(capacity));
+  if (!data) {
+	 state.SkipWithError("MapMirror");
+	 return;
+  }
+
+  const size_t chunk = state.range(0);
+  const bool socket = state.range(1);
+  std::string src(chunk, 'c');
+  std::vector<char> sink(chunk);
+  int sv[2] = {-1, -1};
+  if (socket && ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) {
+	 state.SkipWithError("socketpair");
+	 MemManager::UnmapMirror(data, capacity);
+	 return;
+  }
+
+  std::function<int(int, const struct iovec *, int)> readv = [&] (int fd, const struct iovec *iov, int count) {
+	 if (socket) return static_cast<int>(::readv(fd, iov, count));
+	 size_t copied = 0;
+	 for (int i = 0; i < count && copied < chunk; ++i) {
+		const size_t x = std::min(chunk - copied, iov[i].iov_len);
+		::memcpy(iov[i].iov_base, src.data() + copied, x);
+		copied += x;
+	 }
+	 return static_cast<int>(copied);
+  };
+  std::function<int(int, const struct iovec *, int)> writev = [&] (int fd, const struct iovec *iov, int count) {
+	 if (socket) return static_cast<int>(::writev(fd, iov, count));
+	 size_t copied = 0;
+	 for (int i = 0; i < count && copied < chunk; ++i) {
+		const size_t x = std::min(chunk - copied, iov[i].iov_len);
+		::memcpy(sink.data() + copied, iov[i].iov_base, x);
+		copied += x;
+	 }
+	 return static_cast<int>(copied);
+  };
+
+  {
+	 BufType <char, uint64_t> buf(data, capacity);
+	 for (auto _ : state) {
+		if (socket && ::write(sv[1], src.data(), chunk) != static_cast<ssize_t>(chunk)) {
+		  state.SkipWithError("write");
+		  break;
+		}
+		buf.Readv(sv[0], readv);
+		buf.Writev(sv[0], writev);
+		if (socket && ::read(sv[1], sink.data(), chunk) < 0) {
+		  state.SkipWithError("read");
+		  break;
+		}
+	 }
+	 state.SetBytesProcessed(state.iterations() * chunk * 2);
+  }
+
+  if (socket) {
+	 ::close(sv[0]);
+	 ::close(sv[1]);
+  }
+  MemManager::UnmapMirror(data, capacity);
+}
+
+BENCHMARK_TEMPLATE(BM_RingReadvWritev, BipBuf)->Args({1000, 0})->Args({9000, 0})->Args({1000, 1})->Args({9000, 1});
+BENCHMARK_TEMPLATE(BM_RingReadvWritev, MirrorBuf)->Args({1000, 0})->Args({9000, 0})->Args({1000, 1})->Args({9000, 1});
+
+template <typename DataType, typename CapacityType>
+using FixedBuf64k = FixedBipBuf <DataType, CapacityType, 65536>;
+
+// Push then Pop of range(0) bytes, odd sized so the ring wraps constantly. Measures the index
+// arithmetic against the runtime capacity BipBuf.
+template <template <typename, typename> class BufType>
+static void BM_RingPushPop (benchmark::State &state) {
+  const uint64_t capacity = 65536;
+  std::vector<char> data(capacity);
+  const size_t chunk = state.range(0);
+  std::string src(chunk, 'c');
+  std::vector<char> sink(chunk);
+
+  BufType <char, uint64_t> buf(data.data(), capacity);
+  for (auto _ : state) {
+	 buf.Push(src.data(), chunk);
+	 buf.Pop(sink.data(), chunk);
+	 benchmark::DoNotOptimize(sink.data());
+  }
+  state.SetBytesProcessed(state.iterations() * chunk * 2);
+}
+
+BENCHMARK_TEMPLATE(BM_RingPushPop, BipBuf)->Arg(13)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_RingPushPop, FixedBuf64k)->Arg(13)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_RingReadvWritev, FixedBuf64k)->Args({1000, 0})->Args({9000, 0})->Args({1000, 1})->Args({9000, 1});
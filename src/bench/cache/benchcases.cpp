@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "cache/seqcache.h"
+
+using namespace coypu::cache;
+
+// same fields as the CoinCache record in main, not over aligned since the cache make_shares it
+// and C++14 new does not honour alignment past 16
+struct BenchCache {
+  char _key[64];
+  uint64_t _seqno;
+  uint64_t _origseqno;
+
+  uint32_t _seconds;
+  uint32_t _milliseconds;
+
+  double _high24;
+  double _low24;
+  double _vol24;
+  double _open;
+  double _last;
+
+  BenchCache () : _seqno(UINT64_MAX), _origseqno(0), _seconds(0), _milliseconds(0), _high24(0),
+						_low24(0), _vol24(0), _open(0), _last(0) {
+	 ::memset(_key, 0, sizeof(_key));
+  }
+} __attribute__ ((packed));
+
+// keeps the record out of the timing, the stream cost is measured in the store benchmarks
+struct BenchPublish {
+  BenchPublish () : _bytes(0) { }
+
+  int Push (const char *data, uint64_t len) {
+	 _bytes += len;
+	 return 0;
+  }
+
+  uint64_t _bytes;
+};
+
+// Push updates round robin over range(0) product keys, as the feed handlers do on each ticker
+static void BM_SequenceCachePush (benchmark::State &state) {
+  auto publish = std::make_shared<BenchPublish>();
+  SequenceCache<BenchCache, 128, BenchPublish, void> cache(publish);
+
+  std::vector<BenchCache> updates(state.range(0));
+  for (size_t i = 0; i < updates.size(); ++i) {
+	 ::snprintf(updates[i]._key, sizeof(updates[i]._key), "coypu-product-%zu", i);
+	 updates[i]._last = i;
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+	 BenchCache &c = updates[i++ % updates.size()];
+	 c._last += 1;
+	 cache.Push(c);
+  }
+  benchmark::DoNotOptimize(publish->_bytes);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_SequenceCachePush)->Arg(1)->Arg(64)->Arg(1024);
@@ -0,0 +1,105 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <functional>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/event_hlpr.h"
+#include "event/event_mgr.h"
+
+using namespace coypu::event;
+
+struct BenchLog {
+  void perror (int, const char *) { }
+  template <typename... Args> const void warn(const char *msg, Args... args) { }
+};
+
+class BenchHandler {
+public:
+  BenchHandler () : _count(0) { }
+
+  // leave the eventfd readable so every Wait returns a full batch
+  int Read (int fd) {
+	 ++_count;
+	 return 0;
+  }
+
+  // fan-out tick: nothing left to send so write interest is cleared again
+  int Write (int fd) {
+	 ++_count;
+	 return 0;
+  }
+
+  uint64_t _count;
+};
+
+template <typename BackendType, bool Static>
+static void BM_EventDispatch (benchmark::State &state) {
+  EventManager <BenchLog *, BackendType> eventMgr(nullptr);
+  eventMgr.Init();
+
+  BenchHandler handler;
+  std::vector<int> fds;
+  for (int i = 0; i < state.range(0); ++i) {
+	 int fd = EventFDHelper::CreateNonBlockEventFD(0);
+	 uint64_t x = 1;
+	 if (fd < 0 || ::write(fd, &x, sizeof(x)) != sizeof(x)) {
+		state.SkipWithError("eventfd");
+		return;
+	 }
+	 fds.push_back(fd);
+
+	 if (Static) {
+		eventMgr.template Register<BenchHandler, &BenchHandler::Read>(fd, &handler);
+	 } else {
+		std::function<int(int)> readCB = std::bind(&BenchHandler::Read, &handler, std::placeholders::_1);
+		eventMgr.Register(fd, readCB, nullptr, nullptr);
+	 }
+  }
+
+  for (auto _ : state) {
+	 eventMgr.Wait();
+  }
+  state.SetItemsProcessed(handler._count);
+
+  eventMgr.Close();
+  for (int fd : fds) ::close(fd);
+}
+
+BENCHMARK_TEMPLATE(BM_EventDispatch, EPollBackend, false)->Arg(16)->Arg(256)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_EventDispatch, EPollBackend, true)->Arg(16)->Arg(256)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_EventDispatch, IOUringBackend, true)->Arg(16)->Arg(256)->Arg(1024);
+
+// Arm write on every connection per tick as SetWriteAll does, interest churn is 2 changes per fd per tick
+template <typename BackendType>
+static void BM_WriteFanout (benchmark::State &state) {
+  EventManager <BenchLog *, BackendType> eventMgr(nullptr);
+  eventMgr.Init();
+
+  BenchHandler handler;
+  std::vector<int> fds;
+  for (int i = 0; i < state.range(0); ++i) {
+	 int pair[2];
+	 if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair)) {
+		state.SkipWithError("socketpair");
+		return;
+	 }
+	 fds.push_back(pair[0]);
+	 fds.push_back(pair[1]);
+	 eventMgr.template Register<BenchHandler, &BenchHandler::Read, &BenchHandler::Write>(pair[0], &handler);
+  }
+
+  for (auto _ : state) {
+	 for (size_t i = 0; i < fds.size(); i += 2) {
+		eventMgr.SetWrite(fds[i]);
+	 }
+	 eventMgr.Wait();
+  }
+  state.SetItemsProcessed(handler._count);
+
+  eventMgr.Close();
+  for (int fd : fds) ::close(fd);
+}
+
+BENCHMARK_TEMPLATE(BM_WriteFanout, EPollBackend)->Arg(16)->Arg(256)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_WriteFanout, IOUringBackend)->Arg(16)->Arg(256)->Arg(1024);
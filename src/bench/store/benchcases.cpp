@@ -0,0 +1,306 @@
+#include <string.h>
+#include <sys/uio.h>
+#include <x86intrin.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "benchmark/benchmark.h"
+#include "store/store.h"
+#include "file/file.h"
+#include "mem/mem.h"
+#include "util/histogram.h"
+
+using namespace coypu::store;
+using namespace coypu::file;
+using namespace coypu::mem;
+
+typedef LogRWStream<MMapShared, LRUCache, 16> bench_stream_type;
+typedef LogWindowStream<1ULL << 30, 64*1024*1024> bench_window_type;
+
+// File backed stream on a temp file, replaced once it reaches MAX_SIZE so a long run does not fill
+// the disk
+template <typename StreamType>
+class BenchStream {
+public:
+  static constexpr uint64_t MAX_SIZE = 64 * 1024 * 1024;
+
+  BenchStream () : _fd(-1) {
+	 Reset();
+  }
+
+  ~BenchStream () {
+	 Close();
+  }
+
+  bool IsOpen () const {
+	 return _fd > 0;
+  }
+
+  StreamType *operator-> () {
+	 return _stream.get();
+  }
+
+  void Reset () {
+	 Close();
+	 _fd = FileUtil::MakeTemp("coypubench", _path, sizeof(_path));
+	 if (_fd > 0) {
+		_stream.reset(new StreamType(64 * MemManager::GetPageSize(), 0, _fd, false));
+	 }
+  }
+
+private:
+  void Close () {
+	 _stream.reset();
+	 if (_fd > 0) {
+		FileUtil::Close(_fd);
+		FileUtil::Remove(_path);
+		_fd = -1;
+	 }
+  }
+
+  char _path[1024];
+  int _fd;
+  std::unique_ptr<StreamType> _stream;
+};
+
+// Push then Pop range(0) bytes at the read position. Odd sizes against 256k pages (the size the
+// stores use) so a share of the operations straddle a page boundary.
+template <typename StreamType>
+static void BM_StreamPushPop (benchmark::State &state) {
+  BenchStream<StreamType> stream;
+  if (!stream.IsOpen()) {
+	 state.SkipWithError("MakeTemp");
+	 return;
+  }
+
+  const uint64_t chunk = state.range(0);
+  std::string src(chunk, 's');
+  std::vector<char> sink(chunk);
+  uint64_t offset = 0;
+  for (auto _ : state) {
+	 if (offset + chunk > BenchStream<StreamType>::MAX_SIZE) {
+		state.PauseTiming();
+		stream.Reset();
+		offset = 0;
+		state.ResumeTiming();
+	 }
+	 stream->Push(src.data(), chunk);
+	 if (!stream->Pop(offset, sink.data(), chunk)) {
+		state.SkipWithError("Pop");
+		break;
+	 }
+	 offset += chunk;
+	 benchmark::DoNotOptimize(sink.data());
+  }
+  state.SetBytesProcessed(state.iterations() * chunk * 2);
+}
+
+// Push range(0) bytes then gather them with Writev, the publish path to websocket clients. The
+// writev callback copies out of the iovecs so only the stream cost is measured.
+template <typename StreamType>
+static void BM_StreamWritev (benchmark::State &state) {
+  BenchStream<StreamType> stream;
+  if (!stream.IsOpen()) {
+	 state.SkipWithError("MakeTemp");
+	 return;
+  }
+
+  const uint64_t chunk = state.range(0);
+  std::string src(chunk, 's');
+  std::vector<char> sink(chunk);
+  std::function<int(int, const struct iovec *, int)> writev = [&sink] (int, const struct iovec *iov, int count) {
+	 size_t copied = 0;
+	 for (int i = 0; i < count; ++i) {
+		const size_t x = std::min(sink.size() - copied, iov[i].iov_len);
+		::memcpy(sink.data() + copied, iov[i].iov_base, x);
+		copied += x;
+	 }
+	 return static_cast<int>(copied);
+  };
+
+  uint64_t offset = 0;
+  for (auto _ : state) {
+	 if (offset + chunk > BenchStream<StreamType>::MAX_SIZE) {
+		state.PauseTiming();
+		stream.Reset();
+		offset = 0;
+		state.ResumeTiming();
+	 }
+	 stream->Push(src.data(), chunk);
+	 int r = stream->Writev(offset, chunk, -1, writev);
+	 if (r <= 0) {
+		state.SkipWithError("Writev");
+		break;
+	 }
+	 offset += r;
+  }
+  state.SetBytesProcessed(state.iterations() * chunk);
+}
+
+BENCHMARK_TEMPLATE(BM_StreamPushPop, bench_stream_type)->Arg(64)->Arg(1000)->Arg(9000);
+BENCHMARK_TEMPLATE(BM_StreamPushPop, bench_window_type)->Arg(64)->Arg(1000)->Arg(9000);
+BENCHMARK_TEMPLATE(BM_StreamWritev, bench_stream_type)->Arg(64)->Arg(1000)->Arg(9000);
+BENCHMARK_TEMPLATE(BM_StreamWritev, bench_window_type)->Arg(64)->Arg(1000)->Arg(9000);
+
+// Cycles per 64 byte Push on 256k pages, range(0) pages kept ready by a SegmentAllocator or 0 to map
+// each page on the write path. The mean hides the page rolls, the percentiles are where they show.
+static void BM_StorePushLatency (benchmark::State &state) {
+  const uint64_t pageSize = 64 * MemManager::GetPageSize();
+  const uint64_t chunk = 64;
+  const uint32_t ahead = state.range(0);
+  std::string src(chunk, 's');
+  coypu::util::Histogram histogram;
+
+  char path[1024];
+  int fd = -1;
+  std::shared_ptr<SegmentAllocator> segments;
+  std::unique_ptr<bench_stream_type> stream;
+  auto closeStream = [&] () {
+	 stream.reset();
+	 segments.reset();
+	 if (fd > 0) {
+		FileUtil::Close(fd);
+		FileUtil::Remove(path);
+		fd = -1;
+	 }
+  };
+  auto openStream = [&] () {
+	 closeStream();
+	 fd = FileUtil::MakeTemp("coypubench", path, sizeof(path));
+	 if (fd < 0) return false;
+	 stream.reset(new bench_stream_type(pageSize, 0, fd, false));
+	 if (ahead) {
+		segments = std::make_shared<SegmentAllocator>(fd, pageSize, 0, ahead);
+		if (segments->Start() || !stream->SetSegmentAllocator(segments)) return false;
+	 }
+	 return true;
+  };
+
+  if (!openStream()) {
+	 state.SkipWithError("MakeTemp");
+	 closeStream();
+	 return;
+  }
+
+  uint64_t offset = 0;
+  unsigned int aux = 0;
+  for (auto _ : state) {
+	 if (offset + chunk > BenchStream<bench_stream_type>::MAX_SIZE) {
+		state.PauseTiming();
+		openStream();
+		offset = 0;
+		state.ResumeTiming();
+	 }
+	 const uint64_t start = __rdtscp(&aux);
+	 stream->Push(src.data(), chunk);
+	 histogram.Record(__rdtscp(&aux) - start);
+	 offset += chunk;
+  }
+  state.SetBytesProcessed(state.iterations() * chunk);
+  state.counters["p50"] = histogram.GetPercentile(50);
+  state.counters["p99"] = histogram.GetPercentile(99);
+  state.counters["p99.9"] = histogram.GetPercentile(99.9);
+  state.counters["p99.99"] = histogram.GetPercentile(99.99);
+  state.counters["max"] = histogram.GetMax();
+  closeStream();
+}
+
+BENCHMARK(BM_StorePushLatency)->Arg(0)->Arg(4)->Arg(16);
+
+// LRUCache before the hash index: linear walk of a deque, erase and push_front on a hit
+template<typename MMapProvider, int CachePages>
+class DequeLRUCache {
+public:
+  typedef LogReadPageBuf <MMapProvider> store_type;
+  typedef std::shared_ptr<store_type> page_type;
+  typedef std::pair<uint32_t, page_type> pair_type;
+  typedef std::shared_ptr<pair_type> read_cache_type;
+  typedef uint64_t offset_type;
+
+  DequeLRUCache (off64_t pageSize, off64_t maxSize, int fd) : _pageSize(pageSize), _maxSize(maxSize), _fd(fd) {
+  }
+
+  int FindPage (offset_type offset, read_cache_type &page) {
+	 uint32_t pageIndex = offset / _pageSize;
+	 for (auto b = _lruReadCache.begin(); b != _lruReadCache.end(); ++b) {
+		if ((*b)->first == pageIndex) {
+		  page = *b;
+		  if (b != _lruReadCache.begin()) {
+			 _lruReadCache.erase(b);
+			 _lruReadCache.push_front(page);
+		  }
+		  return 0;
+		}
+	 }
+
+	 if (_lruReadCache.size() == _maxSize) {
+		page = _lruReadCache.back();
+		page->first = pageIndex;
+		_lruReadCache.pop_back();
+	 } else {
+		page = std::make_shared<pair_type>(std::make_pair(pageIndex, std::make_shared<store_type>(_pageSize)));
+	 }
+	 if (page->second->Map(_fd, pageIndex * _pageSize) == 0) {
+		_lruReadCache.push_front(page);
+		return 0;
+	 }
+	 page = nullptr;
+	 return -1;
+  }
+
+private:
+  uint64_t _pageSize;
+  uint64_t _maxSize;
+  int _fd;
+  std::deque<read_cache_type> _lruReadCache;
+};
+
+// FindPage over a file of 256 pages. range(0) pages touched, range(1) the pattern: 0 rotation, which
+// hits at the least recent entry while range(0) fits the cache and misses (remaps) every lookup
+// once it does not, 1 the same page each time, 2 random pages as many subscribers at different
+// offsets of the publish log see it.
+template <template <typename, int> class CacheType, int CachePages>
+static void BM_LRUFindPage (benchmark::State &state) {
+  const uint64_t pageSize = MemManager::GetPageSize();
+  const uint64_t filePages = 256;
+  char path[1024];
+  int fd = FileUtil::MakeTemp("coypubench", path, sizeof(path));
+  if (fd < 0 || FileUtil::Truncate(fd, filePages * pageSize)) {
+	 state.SkipWithError("MakeTemp");
+	 return;
+  }
+
+  {
+	 typedef CacheType<MMapShared, CachePages> cache_type;
+	 cache_type cache(pageSize, CachePages, fd);
+	 typename cache_type::read_cache_type page;
+
+	 const uint64_t touched = std::min<uint64_t>(state.range(0), filePages);
+	 std::vector<uint32_t> pages(4096);
+	 uint32_t x = 12345;
+	 for (size_t i = 0; i < pages.size(); ++i) {
+		x = x * 1103515245 + 12345;
+		pages[i] = state.range(1) == 0 ? i % touched : state.range(1) == 1 ? 0 : (x >> 8) % touched;
+	 }
+
+	 size_t i = 0;
+	 for (auto _ : state) {
+		if (cache.FindPage(pages[i++ & (pages.size() - 1)] * pageSize, page)) {
+		  state.SkipWithError("FindPage");
+		  break;
+		}
+		benchmark::DoNotOptimize(page);
+	 }
+  }
+
+  FileUtil::Close(fd);
+  FileUtil::Remove(path);
+}
+
+BENCHMARK_TEMPLATE(BM_LRUFindPage, DequeLRUCache, 16)->Args({1, 1})->Args({16, 0})->Args({32, 0})->Args({16, 2});
+BENCHMARK_TEMPLATE(BM_LRUFindPage, LRUCache, 16)->Args({1, 1})->Args({16, 0})->Args({32, 0})->Args({16, 2});
+BENCHMARK_TEMPLATE(BM_LRUFindPage, DequeLRUCache, 128)->Args({1, 1})->Args({128, 0})->Args({256, 0})->Args({128, 2})->Args({160, 2});
+BENCHMARK_TEMPLATE(BM_LRUFindPage, LRUCache, 128)->Args({1, 1})->Args({128, 0})->Args({256, 0})->Args({128, 2})->Args({160, 2});
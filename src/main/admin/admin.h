@@ -1,11 +1,13 @@
 #ifndef __COYPU_ADMIN_H
 #define __COYPU_ADMIN_H
 
+#include <errno.h>
 #include <functional>
 #include <unordered_map>
 #include <memory>
 #include <iostream>
 #include "buf/buf.h"
+#include "mem/pool.h"
 #include "util/string-util.h"
 
 namespace coypu {
@@ -18,7 +20,7 @@ namespace coypu {
 
                 AdminManager (LogTrait logger, 
                                 write_cb_type set_write) noexcept : _logger(logger),
-                                _capacity(64*1024), _set_write(set_write)  {
+                                _capacity(64*1024), _set_write(set_write), _drain(false)  {
                     }
 
                 virtual ~AdminManager () {
@@ -28,7 +30,7 @@ namespace coypu {
                                 std::function<int(int,const struct iovec *,int)> &readv,
                                 std::function<int(int,const struct iovec *,int)> &writev
                 ) {
-                    auto sp = std::make_shared<con_type>(fd, _capacity, readv, writev); // 32k capacity
+                    auto sp = std::make_shared<con_type>(fd, _capacity, _pool, readv, writev); // 32k capacity
                     auto p = std::make_pair(fd, sp);
                     return _connections.insert(p).second;
                 }
@@ -55,37 +57,58 @@ namespace coypu {
                     std::shared_ptr<con_type> &con = (*x).second;
                     if (!con) return -2;
 
-                    int r = con->_readBuf->Readv(fd, con->_readv);
-                    uint64_t offset = 0;
-                    if (con->_readBuf->Find('\n', offset)) {
-                        char buf[1024*32];
-                        if (offset+1 > sizeof(buf)) return -1;
-                        if (con->_readBuf->Pop(buf, offset+1)) {
+                    int r = 0;
+                    do {
+                        r = con->_readBuf->Readv(fd, con->_readv);
+                        if (_drain && r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0; // drained
+
+                        uint64_t offset = 0;
+                        while (con->_readBuf->Find('\n', offset)) {
+                            char buf[1024*32];
+                            if (offset+1 > sizeof(buf)) return -1;
+                            if (!con->_readBuf->Pop(buf, offset+1)) break;
+
                             buf[offset] = 0;
                             std::string s(buf);
-									 coypu::util::StringUtil::Trim(s);
+                            coypu::util::StringUtil::Trim(s);
                             std::vector<std::string> tokens;
                             coypu::util::StringUtil::Split(s, ' ', tokens);
                             if (tokens.size() > 0) {
                                 auto b = _commands.find(tokens[0]);
                                 if (b != _commands.end()) {
-											 (*b).second(fd, tokens);
+                                    (*b).second(fd, tokens);
                                 } else {
-											 _logger->warn("Unknown command[{0}]", tokens[0]);
-										  }
+                                    _logger->warn("Unknown command[{0}]", tokens[0]);
+                                }
                             }
-                            // con->_writeBuf->Push('f');
-                            // con->_writeBuf->Push('o');
-                            // con->_writeBuf->Push('o');
-                            // con->_writeBuf->Push('\r');
-                            // con->_writeBuf->Push('\n');
-                            // _set_write(fd);
                         }
-                    }
+                    } while (_drain && r > 0);
 
                     return r;
                 }
 
+                // Queue a reply on the connection. -3 when the write buffer is full.
+                int WriteResponse (int fd, const std::string &response) {
+                    auto x = _connections.find(fd);
+                    if (x == _connections.end()) return -1;
+                    std::shared_ptr<con_type> &con = (*x).second;
+                    if (!con) return -2;
+
+                    if (!con->_writeBuf->Push(response.c_str(), response.length())) return -3;
+                    _set_write(fd);
+                    return 0;
+                }
+
+                // Required for fds registered edge triggered - Read loops until the socket would block.
+                void SetDrain (bool drain) {
+                    _drain = drain;
+                }
+
+                // Connection buffers come from the pool (returned on Unregister), else the heap
+                void SetBufferPool (const std::shared_ptr<coypu::mem::BufferPool> &pool) {
+                    _pool = pool;
+                }
+
                 int Write (int fd) {
                     auto x = _connections.find(fd);
                     if (x == _connections.end()) return -1;
@@ -114,21 +137,22 @@ namespace coypu {
                         std::function<int(int,const struct iovec *,int)> _writev;
                         char * _readData;
                         char * _writeData;
+                        coypu::mem::PoolBuffer _readMem;
+                        coypu::mem::PoolBuffer _writeMem;
 
                         WebSocketConnection (int fd, 
                                             int capacity,
+                                            const std::shared_ptr<coypu::mem::BufferPool> &pool,
                                             std::function<int(int,const struct iovec *,int)> readv,
                                             std::function<int(int,const struct iovec *,int)> writev ) :
-                            _fd(fd), _readv(readv), _writev(writev){ 
-                            _readData = new char[capacity];
-                            _writeData = new char[capacity];
+                            _fd(fd), _readv(readv), _writev(writev), _readMem(pool, capacity), _writeMem(pool, capacity) { 
+                            _readData = _readMem.Get();
+                            _writeData = _writeMem.Get();
                             _readBuf = std::make_shared<coypu::buf::BipBuf <char, uint64_t>>(_readData, capacity);
                             _writeBuf = std::make_shared<coypu::buf::BipBuf <char, uint64_t>>(_writeData, capacity);
                         }
 
                         virtual ~WebSocketConnection () {
-                            if (_readData) delete [] _readData;
-                            if (_writeData) delete [] _writeData;
                         }
                     } con_type;
 
@@ -138,6 +162,8 @@ namespace coypu {
                 LogTrait _logger;
                 uint64_t _capacity;
                 write_cb_type _set_write;
+                bool _drain;
+                std::shared_ptr<coypu::mem::BufferPool> _pool;
                 con_map_type _connections;
                 cmd_map_type _commands;
         };
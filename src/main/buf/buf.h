@@ -26,6 +26,10 @@ limitations under the License.
 #include <algorithm>
 #include <functional>
 
+#include "scan.h"
+#include "mask.h"
+#include "frame.h"
+
 // https://www.codeproject.com/Articles/3479/The-Bip-Buffer-The-Circular-Buffer-with-a-Twist
 namespace coypu {
     namespace buf {
@@ -81,30 +85,104 @@ namespace coypu {
                     return true;
                 }
 
-					 bool Unmask (CapacityType offset, CapacityType len, const char *mask, int maskLen) {
-						assert(false);
-						return false;
-					 }
+                // In place XOR of len bytes starting offset bytes past the tail, across the wrap
+                bool Unmask (CapacityType offset, CapacityType len, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Unmask is byte wise");
+                    if (!mask || maskLen <= 0) return false;
+                    if (offset > Available() || len > Available() - offset) return false;
+                    if (len == 0) return true;
+
+                    char *data = reinterpret_cast<char *>(_data);
+                    const CapacityType first = (_head > _tail ? _head : _capacity) - _tail;
+                    if (offset < first) {
+                        const CapacityType x = std::min(len, first - offset);
+                        mask::Xor(&data[_tail + offset], &data[_tail + offset], x, mask, maskLen, 0);
+                        if (x < len) {
+                            mask::Xor(&data[0], &data[0], len - x, mask, maskLen, x);
+                        }
+                    } else {
+                        char *start = &data[offset - first];
+                        mask::Xor(start, start, len, mask, maskLen, 0);
+                    }
+                    return true;
+                }
+
+                // In place view of len elements starting offset elements past the tail, two spans across the wrap
+                bool View (CapacityType offset, CapacityType len, FrameView<DataType> &view) const {
+                    view.Clear();
+                    if (offset > Available() || len > Available() - offset) return false;
+                    if (len == 0) return true;
+
+                    const CapacityType first = (_head > _tail ? _head : _capacity) - _tail;
+                    if (offset < first) {
+                        const CapacityType x = std::min(len, first - offset);
+                        view.Append(&_data[_tail + offset], x);
+                        view.Append(&_data[0], len - x);
+                    } else {
+                        view.Append(&_data[offset - first], len);
+                    }
+                    return true;
+                }
 
                 bool Find (DataType d, CapacityType &offset) const {
                     offset = 0;
                     if (IsEmpty()) return false;
 
-                    if (_head > _tail) {
-                        for (CapacityType x = _tail; x < _head; ++x, ++offset) {
-                            if (_data[x] == d) return true;
-                        }
-                    } else {
-                        for (CapacityType x = _tail; x < _capacity; ++x, ++offset) {
-                            if (_data[x] == d) return true;
-                        }
+                    // tail segment, then the wrapped head segment
+                    const CapacityType end = _head > _tail ? _head : _capacity;
+                    size_t x = scan::Find(&_data[_tail], end - _tail, d);
+                    if (x < end - _tail) {
+                        offset = x;
+                        return true;
+                    }
 
-                        for (CapacityType x = 0; x < _head; ++x, ++offset) {
-                            if (_data[x] == d) return true;
+                    if (_head <= _tail) {
+                        x = scan::Find(&_data[0], _head, d);
+                        if (x < _head) {
+                            offset = (end - _tail) + x;
+                            return true;
                         }
                     }
 
+                    return false;
+                }
+
+                // Offset of the first occurrence of pattern (e.g. \r\n\r\n), which may straddle the wrap
+                bool Find (const DataType *pattern, CapacityType patternLen, CapacityType &offset) const {
                     offset = 0;
+                    if (!pattern || patternLen == 0 || patternLen > Available()) return false;
+
+                    const CapacityType end = _head > _tail ? _head : _capacity;
+                    const CapacityType first = end - _tail;
+                    size_t x = scan::Find(&_data[_tail], first, pattern, patternLen);
+                    if (x < first) {
+                        offset = x;
+                        return true;
+                    }
+                    if (_head > _tail) return false;
+
+                    // starts in the tail segment and ends in the head segment
+                    const CapacityType straddle = std::min(patternLen - 1, first);
+                    for (CapacityType start = first - straddle; start < first; ++start) {
+                        if (start + patternLen > Available()) break;
+                        CapacityType i = 0;
+                        for (; i < patternLen; ++i) {
+                            const CapacityType pos = start + i;
+                            const DataType c = pos < first ? _data[_tail + pos] : _data[pos - first];
+                            if (c != pattern[i]) break;
+                        }
+                        if (i == patternLen) {
+                            offset = start;
+                            return true;
+                        }
+                    }
+
+                    x = scan::Find(&_data[0], _head, pattern, patternLen);
+                    if (x < _head) {
+                        offset = first + x;
+                        return true;
+                    }
+
                     return false;
                 }
 
@@ -147,6 +225,35 @@ namespace coypu {
                     return true;
                 }
 					 
+                // Push with each byte XORed against the mask, e.g. an outbound websocket payload
+                bool Push (const DataType * indata, CapacityType size, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Masked push is byte wise");
+                    if (!indata || !mask || maskLen <= 0 || size > (Capacity() - Available())) {
+                        return false;
+                    }
+                    if (size == 0 || _full) return false;
+
+                    const char *src = reinterpret_cast<const char *>(indata);
+                    char *data = reinterpret_cast<char *>(_data);
+                    CapacityType offset = 0;
+
+                    if (_head >= _tail && _head < _capacity) {
+                        offset = std::min(size, (_capacity - _head));
+                        mask::Xor(&data[_head], src, offset, mask, maskLen, 0);
+                        _head += offset;
+                        if (_head == _capacity) _head = 0;
+                    }
+
+                    if (offset < size) {
+                        mask::Xor(&data[_head], &src[offset], size - offset, mask, maskLen, offset);
+                        _head += size - offset;
+                    }
+
+                    _full = _head == _tail;
+
+                    return true;
+                }
+
 					 bool PushDirect (void ** indata, CapacityType *size) {
                     if (size == 0 || _full) return false;
 
@@ -325,7 +432,7 @@ namespace coypu {
                             }
                         } else {
                             v[0].iov_base = &_data[_tail];
-                            v[0].iov_len = _tail - _capacity;
+                            v[0].iov_len = _capacity - _tail;
                             ret = cb(fd, v, 1);
 
                             if (ret > 0) {
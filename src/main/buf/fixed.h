@@ -0,0 +1,357 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_FIXED_H
+#define __COYPU_FIXED_H
+
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "scan.h"
+#include "mask.h"
+#include "frame.h"
+
+namespace coypu {
+    namespace buf {
+        // BipBuf with the capacity fixed at compile time. N must be a power of two: head and tail are
+        // free running counts, an index is count & (N - 1), and the fill level is head - tail, so there
+        // is no full flag and no wrap compare on each access. Same interface as BipBuf, the capacity
+        // argument is only checked.
+        template <typename DataType, typename CapacityType, CapacityType N>
+        class FixedBipBuf {
+            static_assert(N > 0 && (N & (N - 1)) == 0, "FixedBipBuf capacity must be a power of two");
+
+            public:
+                static constexpr CapacityType CAPACITY = N;
+
+                FixedBipBuf (DataType * data, CapacityType capacity = N) : _head(0), _tail(0), _data(data) {
+                    assert(capacity == N);
+                }
+
+                virtual ~FixedBipBuf () {
+                }
+
+                inline CapacityType Head() const {
+                    return Index(_head);
+                }
+
+                inline CapacityType Tail() const {
+                    return Index(_tail);
+                }
+
+                inline CapacityType Available() const {
+                    return _head - _tail;
+                }
+
+                inline constexpr CapacityType Capacity() const {
+                    return N;
+                }
+
+                inline CapacityType Free() const {
+                    return N - Available();
+                }
+
+                inline bool IsEmpty () const {
+                    return _head == _tail;
+                }
+
+                bool Peak (CapacityType offset, DataType &d) const {
+                    if (offset >= Available()) return false;
+                    d = _data[Index(_tail + offset)];
+                    return true;
+                }
+
+                // In place XOR of len bytes starting offset bytes past the tail, across the wrap
+                bool Unmask (CapacityType offset, CapacityType len, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Unmask is byte wise");
+                    if (!mask || maskLen <= 0) return false;
+                    if (offset > Available() || len > Available() - offset) return false;
+                    if (len == 0) return true;
+
+                    char *data = reinterpret_cast<char *>(_data);
+                    const uint64_t start = Index(_tail + offset);
+                    const uint64_t x = std::min<uint64_t>(len, N - start);
+                    mask::Xor(&data[start], &data[start], x, mask, maskLen, 0);
+                    if (x < len) {
+                        mask::Xor(&data[0], &data[0], len - x, mask, maskLen, x);
+                    }
+                    return true;
+                }
+
+                bool View (CapacityType offset, CapacityType len, FrameView<DataType> &view) const {
+                    view.Clear();
+                    if (offset > Available() || len > Available() - offset) return false;
+                    if (len == 0) return true;
+
+                    const uint64_t start = Index(_tail + offset);
+                    const uint64_t x = std::min<uint64_t>(len, N - start);
+                    view.Append(&_data[start], x);
+                    view.Append(&_data[0], len - x);
+                    return true;
+                }
+
+                bool Find (DataType d, CapacityType &offset) const {
+                    offset = 0;
+                    if (IsEmpty()) return false;
+
+                    const uint64_t first = ReadSpan();
+                    size_t x = scan::Find(&_data[Index(_tail)], first, d);
+                    if (x < first) {
+                        offset = x;
+                        return true;
+                    }
+
+                    const uint64_t second = Available() - first;
+                    x = scan::Find(&_data[0], second, d);
+                    if (x < second) {
+                        offset = first + x;
+                        return true;
+                    }
+                    return false;
+                }
+
+                // Offset of the first occurrence of pattern, which may straddle the wrap
+                bool Find (const DataType *pattern, CapacityType patternLen, CapacityType &offset) const {
+                    offset = 0;
+                    if (!pattern || patternLen == 0 || patternLen > Available()) return false;
+
+                    const uint64_t first = ReadSpan();
+                    size_t x = scan::Find(&_data[Index(_tail)], first, pattern, patternLen);
+                    if (x < first) {
+                        offset = x;
+                        return true;
+                    }
+                    const uint64_t second = Available() - first;
+                    if (second == 0) return false;
+
+                    // starts in the tail segment and ends in the head segment
+                    const uint64_t straddle = std::min<uint64_t>(patternLen - 1, first);
+                    for (uint64_t start = first - straddle; start < first; ++start) {
+                        if (start + patternLen > Available()) break;
+                        CapacityType i = 0;
+                        for (; i < patternLen; ++i) {
+                            if (_data[Index(_tail + start + i)] != pattern[i]) break;
+                        }
+                        if (i == patternLen) {
+                            offset = start;
+                            return true;
+                        }
+                    }
+
+                    x = scan::Find(&_data[0], second, pattern, patternLen);
+                    if (x < second) {
+                        offset = first + x;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool Push (const DataType indata) {
+                    if (Available() == N) return false;
+                    _data[Index(_head++)] = indata;
+                    return true;
+                }
+
+                bool Push (const DataType * indata, CapacityType size) {
+                    if (!indata || size > Free()) return false;
+                    if (size == 0) return false;
+
+                    const uint64_t start = Index(_head);
+                    const uint64_t x = std::min<uint64_t>(size, N - start);
+                    ::memcpy(&_data[start], indata, sizeof(DataType) * x);
+                    if (x < size) {
+                        ::memcpy(&_data[0], &indata[x], sizeof(DataType) * (size - x));
+                    }
+                    _head += size;
+                    return true;
+                }
+
+                // Push with each byte XORed against the mask, e.g. an outbound websocket payload
+                bool Push (const DataType * indata, CapacityType size, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Masked push is byte wise");
+                    if (!indata || !mask || maskLen <= 0 || size > Free()) return false;
+                    if (size == 0) return false;
+
+                    const char *src = reinterpret_cast<const char *>(indata);
+                    char *data = reinterpret_cast<char *>(_data);
+                    const uint64_t start = Index(_head);
+                    const uint64_t x = std::min<uint64_t>(size, N - start);
+                    mask::Xor(&data[start], src, x, mask, maskLen, 0);
+                    if (x < size) {
+                        mask::Xor(&data[0], &src[x], size - x, mask, maskLen, x);
+                    }
+                    _head += size;
+                    return true;
+                }
+
+                // Hands out the contiguous free space at the head and commits it, BackupDirect returns
+                // what was not used
+                bool PushDirect (void ** indata, CapacityType *size) {
+                    if (!size || Available() == N) return false;
+
+                    *size = WriteSpan();
+                    *indata = &_data[Index(_head)];
+                    _head += *size;
+                    return true;
+                }
+
+                bool BackupDirect (CapacityType count) {
+                    if (count == 0) return true;
+                    if (count > Available()) return false;
+
+                    _head -= count;
+                    return true;
+                }
+
+                bool Pop (DataType *dest, CapacityType size, bool peak=false) {
+                    if (size > Available()) return false;
+                    if (size == 0) return false;
+
+                    const uint64_t start = Index(_tail);
+                    const uint64_t x = std::min<uint64_t>(size, N - start);
+                    ::memcpy(dest, &_data[start], sizeof(DataType) * x);
+                    if (x < size) {
+                        ::memcpy(&dest[x], &_data[0], sizeof(DataType) * (size - x));
+                    }
+
+                    if (!peak) _tail += size;
+                    return true;
+                }
+
+                bool PopAll (const std::function<bool(const DataType*, CapacityType)> &cb, CapacityType size) {
+                    if (size > Available()) return false;
+                    if (size == 0) return false;
+
+                    const uint64_t start = Index(_tail);
+                    const uint64_t x = std::min<uint64_t>(size, N - start);
+                    if (!cb(&_data[start], x)) return false;
+                    _tail += x;
+
+                    if (x < size) {
+                        if (!cb(&_data[0], size - x)) return false;
+                        _tail += size - x;
+                    }
+                    return true;
+                }
+
+                int Read (int fd, const std::function <int(int, void *, size_t)> &cb) {
+                    if (Available() == N) return -2;
+
+                    int ret = cb(fd, &_data[Index(_head)], WriteSpan());
+                    if (ret > 0) _head += ret;
+                    return ret;
+                }
+
+                int Write (int fd, const std::function <int(int, void *, size_t)> &cb) {
+                    if (IsEmpty()) return -2;
+
+                    int ret = cb(fd, &_data[Index(_tail)], ReadSpan());
+                    if (ret > 0) _tail += ret;
+                    return ret;
+                }
+
+                int Writev (int fd, const std::function <int(int, const struct iovec *, int)> &cb) {
+                    if (IsEmpty()) return -2;
+
+                    struct iovec v[2];
+                    const uint64_t first = ReadSpan();
+                    v[0].iov_base = &_data[Index(_tail)];
+                    v[0].iov_len = sizeof(DataType) * first;
+                    v[1].iov_base = &_data[0];
+                    v[1].iov_len = sizeof(DataType) * (Available() - first);
+
+                    int ret = cb(fd, v, first < Available() ? 2 : 1);
+                    if (ret > 0) _tail += ret;
+                    return ret;
+                }
+
+                int Readv (int fd, const std::function <int(int, const struct iovec *, int)> &cb) {
+                    if (Available() == N) return -2;
+
+                    struct iovec v[2];
+                    const uint64_t first = WriteSpan();
+                    v[0].iov_base = &_data[Index(_head)];
+                    v[0].iov_len = sizeof(DataType) * first;
+                    v[1].iov_base = &_data[0];
+                    v[1].iov_len = sizeof(DataType) * (Free() - first);
+
+                    int ret = cb(fd, v, first < Free() ? 2 : 1);
+                    if (ret > 0) _head += ret;
+                    return ret;
+                }
+
+                CapacityType CurrentOffset() const {
+                    return Index(_head);
+                }
+
+                // Un-pop count elements
+                bool Backup (CapacityType count) {
+                    if (count > Free()) return false;
+
+                    _tail -= count;
+                    return true;
+                }
+
+                // Hands out the contiguous readable data at the tail and consumes it
+                bool Direct (const void **out, CapacityType *len) {
+                    if (IsEmpty()) return false;
+
+                    *len = ReadSpan();
+                    *out = &_data[Index(_tail)];
+                    _tail += *len;
+                    return true;
+                }
+
+                bool Skip (CapacityType size) {
+                    if (size > Available()) return false;
+                    if (size == 0) return false;
+
+                    _tail += size;
+                    return true;
+                }
+
+            private:
+                FixedBipBuf (const FixedBipBuf &other);
+                FixedBipBuf &operator = (const FixedBipBuf &other);
+
+                static constexpr uint64_t MASK = N - 1;
+
+                static inline uint64_t Index (uint64_t count) {
+                    return count & MASK;
+                }
+
+                // readable elements before the wrap
+                inline uint64_t ReadSpan () const {
+                    return std::min<uint64_t>(Available(), N - Index(_tail));
+                }
+
+                // free elements before the wrap
+                inline uint64_t WriteSpan () const {
+                    return std::min<uint64_t>(Free(), N - Index(_head));
+                }
+
+                uint64_t _head; // elements ever pushed
+                uint64_t _tail; // elements ever consumed
+                DataType * _data;
+        };
+    }
+}
+#endif
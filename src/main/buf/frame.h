@@ -0,0 +1,98 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_FRAME_H
+#define __COYPU_FRAME_H
+
+#include <stddef.h>
+#include <string.h>
+
+namespace coypu {
+    namespace buf {
+        // In place view of a frame held in a ring or a paged log: one span, or two when the frame
+        // crosses the wrap (or a page boundary). Spans point into the owner's memory and are only valid
+        // until the owner is next written or consumed.
+        template <typename DataType>
+        class FrameView {
+            public:
+                static constexpr int MAX_SPANS = 2;
+
+                FrameView () : _count(0) {
+                    Clear();
+                }
+
+                inline void Clear () {
+                    _count = 0;
+                    _data[0] = _data[1] = nullptr;
+                    _len[0] = _len[1] = 0;
+                }
+
+                // false when the frame needs more than two spans
+                inline bool Append (const DataType *data, size_t len) {
+                    if (len == 0) return true;
+                    if (_count == MAX_SPANS) return false;
+                    _data[_count] = data;
+                    _len[_count] = len;
+                    ++_count;
+                    return true;
+                }
+
+                inline int Count () const {
+                    return _count;
+                }
+
+                inline const DataType *Data (int i) const {
+                    return _data[i];
+                }
+
+                inline size_t Length (int i) const {
+                    return _len[i];
+                }
+
+                inline size_t Size () const {
+                    return _len[0] + _len[1];
+                }
+
+                inline bool IsContiguous () const {
+                    return _count <= 1;
+                }
+
+                // Copies the whole frame, false if dest is too small
+                bool CopyTo (DataType *dest, size_t destLen) const {
+                    if (Size() > destLen) return false;
+                    ::memcpy(dest, _data[0], sizeof(DataType) * _len[0]);
+                    if (_count > 1) {
+                        ::memcpy(&dest[_len[0]], _data[1], sizeof(DataType) * _len[1]);
+                    }
+                    return true;
+                }
+
+                // Contiguous pointer to the frame: the first span when it does not wrap, otherwise a copy
+                // into scratch. nullptr when it wraps and scratch is too small.
+                const DataType *Linear (DataType *scratch, size_t scratchLen) const {
+                    if (IsContiguous()) return _data[0];
+                    return CopyTo(scratch, scratchLen) ? scratch : nullptr;
+                }
+
+            private:
+                const DataType *_data[MAX_SPANS];
+                size_t _len[MAX_SPANS];
+                int _count;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_MASK_H
+#define __COYPU_MASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <x86intrin.h>
+
+namespace coypu {
+    namespace buf {
+        namespace mask {
+            static constexpr size_t KEY_SIZE = 64;
+            static constexpr size_t MAX_VECTOR_MASK = 16; // must divide every register width
+
+            // dest[i] = src[i] ^ mask[(maskPos + i) % maskLen], dest may equal src (in place unmask).
+            // Websocket masks are 4 bytes, so the key is repeated across a 64 byte (AVX-512), 32 byte (AVX2)
+            // or 16 byte (SSE2) register. Masks that do not divide 16 XOR a byte at a time.
+            inline void Xor (char *dest, const char *src, size_t len, const char *mask, size_t maskLen, uint64_t maskPos) {
+                if (maskLen == 0) {
+                    if (dest != src) ::memmove(dest, src, len);
+                    return;
+                }
+
+                size_t i = 0;
+                if ((maskLen & (maskLen - 1)) == 0 && maskLen <= MAX_VECTOR_MASK && len >= 16) {
+                    char key[KEY_SIZE];
+                    for (size_t k = 0; k < KEY_SIZE; ++k) {
+                        key[k] = mask[(maskPos + k) & (maskLen - 1)];
+                    }
+#ifdef __AVX512BW__
+                    const __m512i k64 = _mm512_loadu_si512(key);
+                    for (; i + 64 <= len; i += 64) {
+                        const __m512i v = _mm512_loadu_si512(src + i);
+                        _mm512_storeu_si512(dest + i, _mm512_xor_si512(v, k64));
+                    }
+#endif
+#ifdef __AVX2__
+                    const __m256i k32 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(key));
+                    for (; i + 32 <= len; i += 32) {
+                        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), _mm256_xor_si256(v, k32));
+                    }
+#endif
+                    const __m128i k16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+                    for (; i + 16 <= len; i += 16) {
+                        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_xor_si128(v, k16));
+                    }
+                }
+
+                for (; i < len; ++i) {
+                    dest[i] = src[i] ^ mask[(maskPos + i) % maskLen];
+                }
+            }
+        }
+    }
+}
+
+#endif
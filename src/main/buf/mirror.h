@@ -0,0 +1,280 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_MIRROR_H
+#define __COYPU_MIRROR_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "scan.h"
+#include "mask.h"
+
+namespace coypu {
+    namespace buf {
+        // Ring buffer with the BipBuf interface over storage mapped twice back to back
+        // (MemManager::MapMirror), so data[i] and data[i + capacity] are the same memory. Every readable
+        // and writable region is one contiguous span: no wrap branches, one memcpy, one iovec, and
+        // frame headers can be parsed in place from Front().
+        template <typename DataType, typename CapacityType>
+        class MirrorBuf {
+            public:
+                // data must be a mirrored mapping of capacity elements (2 * capacity addressable)
+                MirrorBuf (DataType * data, CapacityType capacity) :
+                _head(0), _tail(0), _size(0), _data(data), _capacity(capacity) {
+                }
+
+                virtual ~MirrorBuf () {
+                }
+
+                inline CapacityType Head() const {
+                    return _head;
+                }
+
+                inline CapacityType Tail() const {
+                    return _tail;
+                }
+
+                inline CapacityType Available() const {
+                    return _size;
+                }
+
+                inline CapacityType Capacity() const {
+                    return _capacity;
+                }
+
+                inline CapacityType Free() const {
+                    return _capacity - _size;
+                }
+
+                inline bool IsEmpty () const {
+                    return _size == 0;
+                }
+
+                // Available() contiguous readable elements
+                inline const DataType *Front () const {
+                    return &_data[_tail];
+                }
+
+                // Free() contiguous writable elements
+                inline DataType *Back () {
+                    return &_data[_head];
+                }
+
+                bool Peak (CapacityType offset, DataType &d) const {
+                    if (offset >= _size) return false;
+                    d = _data[_tail + offset];
+                    return true;
+                }
+
+                bool Find (DataType d, CapacityType &offset) const {
+                    offset = 0;
+                    const size_t x = scan::Find(Front(), _size, d);
+                    if (x < _size) {
+                        offset = x;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool Find (const DataType *pattern, CapacityType patternLen, CapacityType &offset) const {
+                    offset = 0;
+                    if (!pattern || patternLen == 0 || patternLen > _size) return false;
+                    const size_t x = scan::Find(Front(), _size, pattern, patternLen);
+                    if (x < _size) {
+                        offset = x;
+                        return true;
+                    }
+                    return false;
+                }
+
+                // In place XOR of len bytes starting offset bytes past the tail
+                bool Unmask (CapacityType offset, CapacityType len, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Unmask is byte wise");
+                    if (!mask || maskLen <= 0) return false;
+                    if (offset > _size || len > _size - offset) return false;
+
+                    char *data = reinterpret_cast<char *>(&_data[_tail + offset]);
+                    mask::Xor(data, data, len, mask, maskLen, 0);
+                    return true;
+                }
+
+                bool Push (const DataType indata) {
+                    if (_size == _capacity) return false;
+
+                    _data[_head] = indata;
+                    Commit(1);
+                    return true;
+                }
+
+                bool Push (const DataType * indata, CapacityType size) {
+                    if (!indata || size > Free()) return false;
+                    if (size == 0) return false;
+
+                    ::memcpy(&_data[_head], indata, sizeof(DataType) * size);
+                    Commit(size);
+                    return true;
+                }
+
+                // Push with each byte XORed against the mask
+                bool Push (const DataType * indata, CapacityType size, const char *mask, int maskLen) {
+                    static_assert(sizeof(DataType) == 1, "Masked push is byte wise");
+                    if (!indata || !mask || maskLen <= 0 || size > Free()) return false;
+                    if (size == 0) return false;
+
+                    mask::Xor(reinterpret_cast<char *>(&_data[_head]), reinterpret_cast<const char *>(indata), size, mask, maskLen, 0);
+                    Commit(size);
+                    return true;
+                }
+
+                // Hands out all free space and commits it, BackupDirect returns what was not used
+                bool PushDirect (void ** indata, CapacityType *size) {
+                    if (!size || _size == _capacity) return false;
+
+                    *size = Free();
+                    *indata = &_data[_head];
+                    Commit(*size);
+                    return true;
+                }
+
+                bool BackupDirect (CapacityType count) {
+                    if (count == 0) return true;
+                    if (count > _size) return false;
+
+                    _head = _head >= count ? _head - count : _head + _capacity - count;
+                    _size -= count;
+                    return true;
+                }
+
+                bool Pop (DataType *dest, CapacityType size, bool peak=false) {
+                    if (size > _size) return false;
+                    if (size == 0) return false;
+
+                    ::memcpy(dest, &_data[_tail], sizeof(DataType) * size);
+                    if (!peak) Consume(size);
+                    return true;
+                }
+
+                bool PopAll (const std::function<bool(const DataType*, CapacityType)> &cb, CapacityType size) {
+                    if (size > _size) return false;
+                    if (size == 0) return false;
+
+                    if (!cb(&_data[_tail], size)) return false;
+                    Consume(size);
+                    return true;
+                }
+
+                int Read (int fd, const std::function <int(int, void *, size_t)> &cb) {
+                    if (_size == _capacity) return -2;
+
+                    int ret = cb(fd, &_data[_head], Free());
+                    if (ret > 0) Commit(ret);
+                    return ret;
+                }
+
+                int Write (int fd, const std::function <int(int, void *, size_t)> &cb) {
+                    if (_size == 0) return -2;
+
+                    int ret = cb(fd, &_data[_tail], _size);
+                    if (ret > 0) Consume(ret);
+                    return ret;
+                }
+
+                int Writev (int fd, const std::function <int(int, const struct iovec *, int)> &cb) {
+                    if (_size == 0) return -2;
+
+                    struct iovec v;
+                    v.iov_base = &_data[_tail];
+                    v.iov_len = _size * sizeof(DataType);
+
+                    int ret = cb(fd, &v, 1);
+                    if (ret > 0) Consume(ret);
+                    return ret;
+                }
+
+                int Readv (int fd, const std::function <int(int, const struct iovec *, int)> &cb) {
+                    if (_size == _capacity) return -2;
+
+                    struct iovec v;
+                    v.iov_base = &_data[_head];
+                    v.iov_len = Free() * sizeof(DataType);
+
+                    int ret = cb(fd, &v, 1);
+                    if (ret > 0) Commit(ret);
+                    return ret;
+                }
+
+                CapacityType CurrentOffset() const {
+                    return _head;
+                }
+
+                // Un-pop count elements
+                bool Backup (CapacityType count) {
+                    if (count > Free()) return false;
+
+                    _tail = _tail >= count ? _tail - count : _tail + _capacity - count;
+                    _size += count;
+                    return true;
+                }
+
+                // Hands out all readable data and consumes it
+                bool Direct (const void **out, CapacityType *len) {
+                    if (_size == 0) return false;
+
+                    *out = &_data[_tail];
+                    *len = _size;
+                    Consume(_size);
+                    return true;
+                }
+
+                bool Skip (CapacityType size) {
+                    if (size > _size) return false;
+                    if (size == 0) return false;
+
+                    Consume(size);
+                    return true;
+                }
+
+            private:
+                MirrorBuf (const MirrorBuf &other);
+                MirrorBuf &operator = (const MirrorBuf &other);
+
+                inline void Commit (CapacityType count) {
+                    _head += count;
+                    if (_head >= _capacity) _head -= _capacity;
+                    _size += count;
+                }
+
+                inline void Consume (CapacityType count) {
+                    _tail += count;
+                    if (_tail >= _capacity) _tail -= _capacity;
+                    _size -= count;
+                }
+
+                CapacityType _head;
+                CapacityType _tail;
+                CapacityType _size;
+
+                DataType * _data;
+                CapacityType _capacity;
+        };
+    }
+}
+#endif
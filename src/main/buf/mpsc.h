@@ -0,0 +1,104 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_MPSC_H
+#define __COYPU_MPSC_H
+
+#include <stdint.h>
+#include <atomic>
+#include <type_traits>
+
+#include "mem/mem.h"
+
+namespace coypu {
+    namespace buf {
+        // Bounded lock free multi producer single consumer ring. Each slot carries a sequence number
+        // (Vyukov) so producers claim with one CAS on the tail and publish with a release store; the
+        // consumer never writes shared state except the slot sequence. No allocation after construction.
+        template <typename DataType, uint32_t Capacity>
+        class MPSCRing {
+            static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+            static_assert(std::is_trivially_copyable<DataType>::value, "DataType must be trivially copyable");
+
+            public:
+                MPSCRing () : _tail(0), _head(0) {
+                    for (uint32_t i = 0; i < Capacity; ++i) {
+                        _slots[i]._seq.store(i, std::memory_order_relaxed);
+                    }
+                }
+
+                // any thread. false when full
+                bool Push (const DataType &data) {
+                    uint64_t pos = _tail.load(std::memory_order_relaxed);
+                    for (;;) {
+                        Slot &slot = _slots[pos & MASK];
+                        const uint64_t seq = slot._seq.load(std::memory_order_acquire);
+                        const int64_t diff = static_cast<int64_t>(seq - pos);
+                        if (diff == 0) {
+                            if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                                slot._data = data;
+                                slot._seq.store(pos + 1, std::memory_order_release);
+                                return true;
+                            }
+                        } else if (diff < 0) {
+                            return false; // consumer has not freed this slot
+                        } else {
+                            pos = _tail.load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+
+                // consumer thread only
+                bool Pop (DataType &data) {
+                    Slot &slot = _slots[_head & MASK];
+                    if (slot._seq.load(std::memory_order_acquire) != _head + 1) return false;
+
+                    data = slot._data;
+                    slot._seq.store(_head + Capacity, std::memory_order_release);
+                    ++_head;
+                    return true;
+                }
+
+                // consumer thread only
+                bool IsEmpty () const {
+                    return _slots[_head & MASK]._seq.load(std::memory_order_acquire) != _head + 1;
+                }
+
+                static constexpr uint32_t GetCapacity () {
+                    return Capacity;
+                }
+
+            private:
+                MPSCRing (const MPSCRing &other) = delete;
+                MPSCRing &operator = (const MPSCRing &other) = delete;
+
+                static constexpr uint64_t MASK = Capacity - 1;
+
+                typedef struct Slot {
+                    std::atomic<uint64_t> _seq;
+                    DataType _data;
+                } Slot;
+
+                coypu::mem::CacheLinePad<> _pad0;
+                std::atomic<uint64_t> _tail; // producers
+                coypu::mem::CacheLinePad<sizeof(std::atomic<uint64_t>)> _pad1;
+                uint64_t _head;              // consumer
+                coypu::mem::CacheLinePad<sizeof(uint64_t)> _pad2;
+                Slot _slots[Capacity];
+        };
+    }
+}
+#endif
@@ -0,0 +1,120 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_SCAN_H
+#define __COYPU_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <x86intrin.h>
+#include <algorithm>
+
+namespace coypu {
+    namespace buf {
+        // Delimiter search over one contiguous block. Each returns the index of the first match, or len
+        // when there is none. AVX2 when built with it (-march=native), SSE2 otherwise, scalar tails.
+        namespace scan {
+            template <typename DataType>
+            inline size_t Find (const DataType *data, size_t len, DataType d) {
+                for (size_t i = 0; i < len; ++i) {
+                    if (data[i] == d) return i;
+                }
+                return len;
+            }
+
+            inline size_t Find (const char *data, size_t len, char d) {
+                size_t i = 0;
+#ifdef __AVX2__
+                const __m256i v32 = _mm256_set1_epi8(d);
+                for (; i + 32 <= len; i += 32) {
+                    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                    const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v32));
+                    if (mask) return i + __builtin_ctz(mask);
+                }
+#endif
+                const __m128i v16 = _mm_set1_epi8(d);
+                for (; i + 16 <= len; i += 16) {
+                    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                    const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, v16));
+                    if (mask) return i + __builtin_ctz(mask);
+                }
+
+                for (; i < len; ++i) {
+                    if (data[i] == d) return i;
+                }
+                return len;
+            }
+
+            template <typename DataType>
+            inline size_t Find (const DataType *data, size_t len, const DataType *pattern, size_t patternLen) {
+                if (patternLen == 0 || patternLen > len) return len;
+
+                for (size_t i = 0; i + patternLen <= len; ++i) {
+                    if (std::equal(pattern, pattern + patternLen, &data[i])) return i;
+                }
+                return len;
+            }
+
+            // Compares the first and last pattern byte at every position at once, then verifies the
+            // middle of each candidate. Rarely more than one candidate per block for http delimiters.
+            inline size_t Find (const char *data, size_t len, const char *pattern, size_t patternLen) {
+                if (patternLen == 0 || patternLen > len) return len;
+                if (patternLen == 1) {
+                    return Find(data, len, pattern[0]);
+                }
+
+                const size_t last = patternLen - 1;
+                size_t i = 0;
+#ifdef __AVX2__
+                const __m256i first32 = _mm256_set1_epi8(pattern[0]);
+                const __m256i last32 = _mm256_set1_epi8(pattern[last]);
+                for (; i + last + 32 <= len; i += 32) {
+                    const __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                    const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + last));
+                    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first32),
+                                                                          _mm256_cmpeq_epi8(l, last32)));
+                    while (mask) {
+                        const size_t x = i + __builtin_ctz(mask);
+                        if (::memcmp(data + x + 1, pattern + 1, last - 1) == 0) return x;
+                        mask &= mask - 1;
+                    }
+                }
+#endif
+                const __m128i first16 = _mm_set1_epi8(pattern[0]);
+                const __m128i last16 = _mm_set1_epi8(pattern[last]);
+                for (; i + last + 16 <= len; i += 16) {
+                    const __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                    const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + last));
+                    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first16),
+                                                                    _mm_cmpeq_epi8(l, last16)));
+                    while (mask) {
+                        const size_t x = i + __builtin_ctz(mask);
+                        if (::memcmp(data + x + 1, pattern + 1, last - 1) == 0) return x;
+                        mask &= mask - 1;
+                    }
+                }
+
+                for (; i + patternLen <= len; ++i) {
+                    if (data[i] == pattern[0] && ::memcmp(data + i + 1, pattern + 1, last) == 0) return i;
+                }
+                return len;
+            }
+        }
+    }
+}
+
+#endif
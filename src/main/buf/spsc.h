@@ -0,0 +1,231 @@
+/*
+Copyright 2018 Aaron Wald
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COYPU_SPSC_H
+#define __COYPU_SPSC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include "scan.h"
+#include "mem/mem.h"
+
+namespace coypu {
+    namespace buf {
+        // Byte stream ring shared by one producer thread (e.g. the socket reader) and one consumer thread
+        // (the parser). Positions only grow, so there is no full flag to share. Each side owns one cache
+        // line: its published position, a private position, and a cached copy of the other side's
+        // position that is only reloaded (acquire) when it looks short. Producer writes are visible to
+        // the consumer after Publish (release), so a reader can batch several reads into one publish.
+        // Data is passed in as with BipBuf.
+        template <typename DataType, typename CapacityType>
+        class SPSCBipBuf {
+            public:
+                SPSCBipBuf (DataType * data, CapacityType capacity) : _data(data), _capacity(capacity),
+                _head(0), _writePos(0), _cachedTail(0), _tail(0), _cachedHead(0) {
+                }
+
+                virtual ~SPSCBipBuf () {
+                }
+
+                inline CapacityType Capacity() const {
+                    return _capacity;
+                }
+
+                // producer thread
+
+                CapacityType Free () {
+                    _cachedTail = _tail.load(std::memory_order_acquire);
+                    return _capacity - (_writePos - _cachedTail);
+                }
+
+                bool Push (const DataType * indata, CapacityType size, bool publish = true) {
+                    if (!indata || size == 0 || Writable(size) < size) return false;
+
+                    const CapacityType index = _writePos % _capacity;
+                    const CapacityType x = std::min(size, _capacity - index);
+                    ::memcpy(&_data[index], indata, sizeof(DataType) * x);
+                    if (x < size) {
+                        ::memcpy(&_data[0], &indata[x], sizeof(DataType) * (size - x));
+                    }
+                    _writePos += size;
+
+                    if (publish) Publish();
+                    return true;
+                }
+
+                // Read into the free space, at most two iovecs. -2 when full
+                int Readv (int fd, const std::function <int(int, const struct iovec *, int)> &cb, bool publish = true) {
+                    const CapacityType free = Free();
+                    if (free == 0) return -2;
+
+                    struct iovec v[2];
+                    const CapacityType index = _writePos % _capacity;
+                    const CapacityType x = std::min(free, _capacity - index);
+                    v[0].iov_base = &_data[index];
+                    v[0].iov_len = sizeof(DataType) * x;
+                    v[1].iov_base = &_data[0];
+                    v[1].iov_len = sizeof(DataType) * (free - x);
+
+                    int ret = cb(fd, v, free > x ? 2 : 1);
+                    if (ret > 0) {
+                        _writePos += ret;
+                        if (publish) Publish();
+                    }
+                    return ret;
+                }
+
+                // Make everything written so far visible to the consumer
+                inline void Publish () {
+                    _head.store(_writePos, std::memory_order_release);
+                }
+
+                // consumer thread
+
+                CapacityType Available () {
+                    _cachedHead = _head.load(std::memory_order_acquire);
+                    return _cachedHead - ReadPos();
+                }
+
+                bool IsEmpty () {
+                    return Available() == 0;
+                }
+
+                bool Peak (CapacityType offset, DataType &d) {
+                    if (offset >= Readable(offset + 1)) return false;
+                    d = _data[(ReadPos() + offset) % _capacity];
+                    return true;
+                }
+
+                bool Find (DataType d, CapacityType &offset) {
+                    offset = 0;
+                    const CapacityType avail = Available();
+                    if (avail == 0) return false;
+
+                    const CapacityType index = ReadPos() % _capacity;
+                    const CapacityType first = std::min(avail, _capacity - index);
+                    size_t x = scan::Find(&_data[index], first, d);
+                    if (x < first) {
+                        offset = x;
+                        return true;
+                    }
+                    x = scan::Find(&_data[0], avail - first, d);
+                    if (x < avail - first) {
+                        offset = first + x;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool Pop (DataType *dest, CapacityType size, bool peak = false) {
+                    if (size == 0 || Readable(size) < size) return false;
+
+                    const CapacityType index = ReadPos() % _capacity;
+                    const CapacityType x = std::min(size, _capacity - index);
+                    ::memcpy(dest, &_data[index], sizeof(DataType) * x);
+                    if (x < size) {
+                        ::memcpy(&dest[x], &_data[0], sizeof(DataType) * (size - x));
+                    }
+
+                    if (!peak) Release(size);
+                    return true;
+                }
+
+                // In place view of size elements, one or two callbacks
+                bool PopAll (const std::function<bool(const DataType*, CapacityType)> &cb, CapacityType size) {
+                    if (size == 0 || Readable(size) < size) return false;
+
+                    const CapacityType index = ReadPos() % _capacity;
+                    const CapacityType x = std::min(size, _capacity - index);
+                    if (!cb(&_data[index], x)) return false;
+                    if (x < size && !cb(&_data[0], size - x)) {
+                        Release(x);
+                        return false;
+                    }
+
+                    Release(size);
+                    return true;
+                }
+
+                bool Skip (CapacityType size) {
+                    if (size == 0 || Readable(size) < size) return false;
+                    Release(size);
+                    return true;
+                }
+
+                int Writev (int fd, const std::function <int(int, const struct iovec *, int)> &cb) {
+                    const CapacityType avail = Available();
+                    if (avail == 0) return -2;
+
+                    struct iovec v[2];
+                    const CapacityType index = ReadPos() % _capacity;
+                    const CapacityType x = std::min(avail, _capacity - index);
+                    v[0].iov_base = &_data[index];
+                    v[0].iov_len = sizeof(DataType) * x;
+                    v[1].iov_base = &_data[0];
+                    v[1].iov_len = sizeof(DataType) * (avail - x);
+
+                    int ret = cb(fd, v, avail > x ? 2 : 1);
+                    if (ret > 0) Release(ret);
+                    return ret;
+                }
+
+            private:
+                SPSCBipBuf (const SPSCBipBuf &other) = delete;
+                SPSCBipBuf &operator = (const SPSCBipBuf &other) = delete;
+
+                // Producer free space, only reloads the consumer position when the cached one is short
+                inline CapacityType Writable (CapacityType want) {
+                    const uint64_t free = _capacity - (_writePos - _cachedTail);
+                    return free >= want ? free : Free();
+                }
+
+                // Consumer readable count, only reloads the producer position when the cached one is short
+                inline CapacityType Readable (CapacityType want) {
+                    const uint64_t avail = _cachedHead - ReadPos();
+                    return avail >= want ? avail : Available();
+                }
+
+                // only the consumer stores _tail, so its own relaxed load is exact
+                inline uint64_t ReadPos () const {
+                    return _tail.load(std::memory_order_relaxed);
+                }
+
+                inline void Release (CapacityType count) {
+                    _tail.store(ReadPos() + count, std::memory_order_release);
+                }
+
+                coypu::mem::CacheLinePad<> _pad0;
+                DataType * const _data;
+                const CapacityType _capacity;
+                coypu::mem::CacheLinePad<sizeof(DataType *) + sizeof(CapacityType)> _pad1;
+
+                std::atomic<uint64_t> _head; // published by the producer
+                uint64_t _writePos;          // producer, ahead of _head until Publish
+                uint64_t _cachedTail;        // producer copy of _tail
+                coypu::mem::CacheLinePad<3 * sizeof(uint64_t)> _pad2;
+
+                std::atomic<uint64_t> _tail; // released by the consumer
+                uint64_t _cachedHead;        // consumer copy of _head
+                coypu::mem::CacheLinePad<2 * sizeof(uint64_t)> _pad3;
+        };
+    }
+}
+#endif
@@ -0,0 +1,761 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+
+#include "event_hlpr.h"
+#include "event_backend.h"
+
+using namespace coypu::event;
+
+// Poll user_data is gen << 32 | fd, recv the same under the recv bit. Anything else carries the
+// cancel tag: cancels are never reported, writes also carry the write bit over their index in the batch.
+static constexpr uint64_t IOURING_CANCEL_TAG = 1ULL << 63;
+static constexpr uint64_t IOURING_WRITE_TAG = 1ULL << 62;
+static constexpr uint64_t IOURING_RECV_TAG = 1ULL << 62;
+static constexpr uint32_t IOURING_GEN_MASK = 0x3FFFFFFF;
+static constexpr uint16_t IOURING_RECV_GROUP = 0;
+static constexpr uint32_t IOURING_MAX_BUFFERS = 32768;
+
+EPollBackend::EPollBackend () : _fd(-1) {
+}
+
+EPollBackend::~EPollBackend () {
+}
+
+int EPollBackend::Init () {
+    _fd = EPollHelper::Create();
+    return _fd < 0 ? -1 : 0;
+}
+
+int EPollBackend::Close () {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    return 0;
+}
+
+int EPollBackend::Add (int fd, uint32_t events, bool) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    return EPollHelper::Add(_fd, fd, &event);
+}
+
+int EPollBackend::Modify (int fd, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    return EPollHelper::Modify(_fd, fd, &event);
+}
+
+int EPollBackend::Delete (int fd) {
+    return EPollHelper::Delete(_fd, fd);
+}
+
+int EPollBackend::Wait (struct epoll_event *events, int maxEvents, int timeout) {
+    return ::epoll_wait(_fd, events, maxEvents, timeout);
+}
+
+IOUringBackend::IOUringBackend (uint32_t entries) : _entries(entries), _fd(-1),
+    _sqRing(MAP_FAILED), _sqRingSize(0), _cqRing(MAP_FAILED), _cqRingSize(0), _sqes(nullptr), _sqesSize(0),
+    _sqHead(nullptr), _sqTail(nullptr), _sqMask(nullptr), _sqArray(nullptr), _sqEntries(0), _sqLocalTail(0), _toSubmit(0),
+    _cqHead(nullptr), _cqTail(nullptr), _cqMask(nullptr), _cqes(nullptr), _enterCalls(0),
+    _writeIovMax(0), _writesPending(0), _deferredNext(0), _bufRing(nullptr), _bufRingSize(0), _bufs(nullptr),
+    _bufCount(0), _bufSize(0), _bufTail(0), _bufProvided(false), _recvNext(0), _recvHeld(0), _recvNoBufs(0) {
+}
+
+IOUringBackend::~IOUringBackend () {
+    Close();
+}
+
+int IOUringBackend::Init () {
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+
+    _fd = IOUringHelper::Setup(_entries, &params);
+    if (_fd < 0) return -1;
+
+    // timeout on io_uring_enter
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        Close();
+        errno = ENOSYS;
+        return -1;
+    }
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+    }
+
+    _sqRing = ::mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED) {
+        Close();
+        return -1;
+    }
+
+    if (single) {
+        _cqRing = _sqRing;
+    } else {
+        _cqRing = ::mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED) {
+            Close();
+            return -1;
+        }
+    }
+
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        Close();
+        return -1;
+    }
+    _sqes = reinterpret_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = reinterpret_cast<char *>(_sqRing);
+    _sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    _sqEntries = params.sq_entries;
+    _sqLocalTail = *_sqTail;
+
+    char *cq = reinterpret_cast<char *>(_cqRing);
+    _cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+int IOUringBackend::Close () {
+    if (_sqes) {
+        ::munmap(_sqes, _sqesSize);
+        _sqes = nullptr;
+    }
+    if (_cqRing != MAP_FAILED && _cqRing != _sqRing) {
+        ::munmap(_cqRing, _cqRingSize);
+    }
+    _cqRing = MAP_FAILED;
+    if (_sqRing != MAP_FAILED) {
+        ::munmap(_sqRing, _sqRingSize);
+        _sqRing = MAP_FAILED;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    // the ring is gone, so is the kernel's hold on the buffers
+    if (_bufRing) {
+        ::munmap(_bufRing, _bufRingSize);
+        _bufRing = nullptr;
+    }
+    if (_bufs) {
+        ::munmap(_bufs, static_cast<size_t>(_bufCount) * _bufSize);
+        _bufs = nullptr;
+    }
+    _bufCount = _bufSize = 0;
+    _bufTail = 0;
+    _bufProvided = false;
+    _recvBuffers.clear();
+    _recvReady.clear();
+    _recvNext = 0;
+    _recvReported.clear();
+    _recvStarved.clear();
+    _recvHeld = 0;
+    _state.clear();
+    _rearm.clear();
+    _toSubmit = 0;
+    _writeIov.clear();
+    _writes.clear();
+    _writesPending = 0;
+    _deferred.clear();
+    _deferredNext = 0;
+    return 0;
+}
+
+int IOUringBackend::Add (int fd, uint32_t events, bool recv) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (static_cast<size_t>(fd) >= _state.size()) {
+        _state.resize(fd + 1, fd_state_type());
+    }
+
+    fd_state_type &state = _state[fd];
+    if (state._registered) {
+        errno = EEXIST;
+        return -1;
+    }
+    state._registered = 1;
+    state._events = events;
+    state._rearm = 0;
+    state._recv = recv && _bufRing;
+    state._recvEnd = 0;
+    if (state._recv && ArmRecv(fd)) return -1;
+    return Arm(fd);
+}
+
+int IOUringBackend::Modify (int fd, uint32_t events) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _state.size() || !_state[fd]._registered) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    fd_state_type &state = _state[fd];
+    state._events = events;
+    if (!state._armed) {
+        // a recv fd polls for nothing without EPOLLOUT, so may not be waiting on a re-arm
+        if (state._recv && !state._rearm) return Arm(fd);
+        return 0; // single shot fired, re-armed with the new mask in Wait
+    }
+
+    if (Cancel(fd)) return -1;
+    return Arm(fd);
+}
+
+int IOUringBackend::Delete (int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _state.size() || !_state[fd]._registered) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // the owner may close fd next, a queued write must not go to whatever reuses it
+    if (_state[fd]._writing && FlushWrites()) return -1;
+
+    fd_state_type &state = _state[fd];
+    state._registered = 0;
+    if (state._recv) {
+        DropRecv(state);
+        if (state._recvArmed) {
+            if (CancelRecv(fd)) return -1;
+        } else {
+            state._recvGen = (state._recvGen + 1) & IOURING_GEN_MASK;
+        }
+        state._recv = 0;
+    }
+    if (state._armed) {
+        return Cancel(fd);
+    }
+    state._gen = (state._gen + 1) & IOURING_GEN_MASK;
+    return 0;
+}
+
+int IOUringBackend::Wait (struct epoll_event *events, int maxEvents, int timeout) {
+    for (const int fd : _rearm) {
+        fd_state_type &state = _state[fd];
+        state._rearm = 0;
+        if (state._registered && !state._armed) {
+            Arm(fd);
+        }
+        if (state._registered && state._recv && !state._recvArmed && !state._recvEnd) {
+            ArmRecv(fd);
+        }
+    }
+    _rearm.clear();
+
+    // level triggered, what the callbacks left is reported again
+    for (const int fd : _recvReported) {
+        fd_state_type &state = _state[fd];
+        state._recvReported = 0;
+        if (state._registered && state._recv && !state._recvQueued && (state._recvHead >= 0 || state._recvEnd)) {
+            state._recvQueued = 1;
+            _recvReady.push_back(fd);
+        }
+    }
+    _recvReported.clear();
+
+    // readiness FlushWrites took off the ring first
+    if (_deferredNext < _deferred.size()) {
+        if (_toSubmit && Submit(0, 0, nullptr, 0) < 0) return -1;
+        int count = 0;
+        for (; _deferredNext < _deferred.size() && count < maxEvents; ++_deferredNext, ++count) {
+            events[count] = _deferred[_deferredNext];
+        }
+        if (_deferredNext == _deferred.size()) {
+            _deferred.clear();
+            _deferredNext = 0;
+        }
+        return Ready(events, count, maxEvents);
+    }
+
+    // completions left over from a full batch - just push submissions
+    if (*_cqHead != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) {
+        if (_toSubmit && Submit(0, 0, nullptr, 0) < 0) return -1;
+        return Ready(events, Harvest(events, maxEvents), maxEvents);
+    }
+
+    // received data waiting to be read, do not block
+    if (_recvNext < _recvReady.size()) {
+        timeout = 0;
+    }
+
+    int r = 0;
+    if (timeout == 0) {
+        r = Submit(0, 0, nullptr, 0);
+    } else if (timeout < 0) {
+        r = Submit(1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } else {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+
+        struct io_uring_getevents_arg arg;
+        ::memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        r = Submit(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    if (r < 0 && errno != ETIME) {
+        if (errno != EINTR || *_cqHead == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) return -1;
+    }
+
+    return Ready(events, Harvest(events, maxEvents), maxEvents);
+}
+
+struct io_uring_sqe *IOUringBackend::GetSQE () {
+    if (_sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries) {
+        if (Submit(0, 0, nullptr, 0) < 0) return nullptr;
+        if (_sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries) {
+            errno = EBUSY;
+            return nullptr;
+        }
+    }
+
+    const unsigned index = _sqLocalTail & *_sqMask;
+    _sqArray[index] = index;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    ::memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    ++_sqLocalTail;
+    ++_toSubmit;
+    return sqe;
+}
+
+int IOUringBackend::Submit (unsigned minComplete, unsigned flags, const void *arg, size_t argSize) {
+    __atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+
+    ++_enterCalls;
+    int r = IOUringHelper::Enter(_fd, _toSubmit, minComplete, flags, arg, argSize);
+    if (r > 0) {
+        _toSubmit -= std::min(static_cast<unsigned>(r), _toSubmit);
+    }
+    return r;
+}
+
+int IOUringBackend::Arm (int fd) {
+    // the recv reports reads and hangups
+    fd_state_type &state = _state[fd];
+    const uint32_t events = state._recv ? state._events & (EPOLLOUT | EPOLLET) : state._events;
+    if (!(events & ~EPOLLET)) return 0;
+
+    struct io_uring_sqe *sqe = GetSQE();
+    if (!sqe) return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events & ~EPOLLET;
+    sqe->len = (events & EPOLLET) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = (static_cast<uint64_t>(state._gen) << 32) | static_cast<uint32_t>(fd);
+    state._armed = 1;
+    return 0;
+}
+
+int IOUringBackend::Cancel (int fd) {
+    struct io_uring_sqe *sqe = GetSQE();
+    if (!sqe) return -1;
+
+    fd_state_type &state = _state[fd];
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (static_cast<uint64_t>(state._gen) << 32) | static_cast<uint32_t>(fd);
+    sqe->user_data = IOURING_CANCEL_TAG;
+    state._armed = 0;
+    state._gen = (state._gen + 1) & IOURING_GEN_MASK;
+    return 0;
+}
+
+int IOUringBackend::Harvest (struct epoll_event *events, int maxEvents) {
+    int count = 0;
+    unsigned head = *_cqHead;
+    const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail && count < maxEvents; ++head) {
+        if (Reap(&_cqes[head & *_cqMask], events[count])) {
+            ++count;
+        }
+    }
+
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    ProvideDone();
+    return count;
+}
+
+// Takes everything off the ring, readiness is kept for the next Wait
+void IOUringBackend::ReapAll () {
+    unsigned head = *_cqHead;
+    const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    struct epoll_event event;
+    for (; head != tail; ++head) {
+        if (Reap(&_cqes[head & *_cqMask], event)) {
+            _deferred.push_back(event);
+        }
+    }
+
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    ProvideDone();
+}
+
+// true when cqe is readiness to report in event
+bool IOUringBackend::Reap (const struct io_uring_cqe *cqe, struct epoll_event &event) {
+    const uint64_t data = cqe->user_data;
+    if (data & IOURING_CANCEL_TAG) {
+        if (data & IOURING_WRITE_TAG) {
+            queued_write_type &write = _writes[data & 0xFFFFFFFF];
+            _state[write._fd]._writing = 0;
+            _completions.push_back({write._fd, write._queued, cqe->res});
+            --_writesPending;
+        }
+        return false;
+    }
+    if (data & IOURING_RECV_TAG) {
+        ReapRecv(cqe);
+        return false;
+    }
+
+    const int fd = static_cast<int>(data & 0xFFFFFFFF);
+    const uint32_t gen = static_cast<uint32_t>(data >> 32);
+    if (static_cast<size_t>(fd) >= _state.size()) return false;
+
+    fd_state_type &state = _state[fd];
+    if (!state._registered || state._gen != gen) return false; // stale
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        state._armed = 0;
+        if (!state._rearm) {
+            state._rearm = 1;
+            _rearm.push_back(fd);
+        }
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res == -ECANCELED) return false;
+        event.events = EPOLLERR;
+    } else {
+        event.events = static_cast<uint32_t>(cqe->res);
+    }
+    event.data.fd = fd;
+    return true;
+}
+
+int IOUringBackend::SetWriteBatch (uint32_t maxIov) {
+    if (maxIov > IOV_MAX || _writesPending) {
+        errno = EINVAL;
+        return -1;
+    }
+    _writeIovMax = maxIov;
+    _writeIov.clear();
+    _writeIov.shrink_to_fit();
+    _writeIov.reserve(maxIov);
+    _writes.reserve(maxIov);
+    return 0;
+}
+
+int IOUringBackend::Writev (int fd, const struct iovec *iov, int count) {
+    if (!_writeIovMax) return ::writev(fd, iov, count);
+    if (fd < 0 || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 0) return 0;
+    if (static_cast<size_t>(fd) >= _state.size()) {
+        _state.resize(fd + 1, fd_state_type());
+    }
+
+    count = std::min(count, static_cast<int>(_writeIovMax));
+    if (_state[fd]._writing || _writeIov.size() + count > _writeIovMax) {
+        if (FlushWrites()) return -1;
+    }
+
+    struct io_uring_sqe *sqe = GetSQE();
+    if (!sqe) return -1;
+
+    // the batch is flushed before the reserve is outgrown, so the array never moves under the kernel
+    struct iovec *queued = _writeIov.data() + _writeIov.size();
+    uint32_t len = 0;
+    for (int i = 0; i < count; ++i) {
+        _writeIov.push_back(iov[i]);
+        len += iov[i].iov_len;
+    }
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(queued);
+    sqe->len = count;
+    sqe->user_data = IOURING_CANCEL_TAG | IOURING_WRITE_TAG | _writes.size();
+    _writes.push_back({fd, len});
+    _state[fd]._writing = 1;
+    ++_writesPending;
+    return static_cast<int>(len);
+}
+
+// One io_uring_enter for the batch (and anything else queued), then whatever else it takes for the
+// kernel to finish the writes. 0 on success
+int IOUringBackend::FlushWrites () {
+    while (_writesPending) {
+        const int r = Submit(1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r < 0 && errno != EINTR && errno != EBUSY) return -1;
+        ReapAll();
+    }
+    _writeIov.clear();
+    _writes.clear();
+    return 0;
+}
+
+int IOUringBackend::SetRecvBuffers (uint32_t count, uint32_t size) {
+    if (_fd < 0 || _bufRing) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (!count) return 0;
+    if (count > IOURING_MAX_BUFFERS || (count & (count - 1)) || !size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    _bufRingSize = ((count * sizeof(struct io_uring_buf) + pageSize - 1) / pageSize) * pageSize;
+    void *ring = ::mmap(nullptr, _bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring == MAP_FAILED) return -1;
+    void *bufs = ::mmap(nullptr, static_cast<size_t>(count) * size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (bufs == MAP_FAILED) {
+        ::munmap(ring, _bufRingSize);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    ::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = count;
+    reg.bgid = IOURING_RECV_GROUP;
+    if (IOUringHelper::Register(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        ::munmap(bufs, static_cast<size_t>(count) * size);
+        ::munmap(ring, _bufRingSize);
+        return -1;
+    }
+
+    _bufRing = reinterpret_cast<struct io_uring_buf *>(ring);
+    _bufs = reinterpret_cast<char *>(bufs);
+    _bufCount = count;
+    _bufSize = size;
+    _bufTail = 0;
+    _recvBuffers.assign(count, recv_buffer_type());
+    for (uint32_t bid = 0; bid < count; ++bid) {
+        Provide(bid);
+    }
+    ProvideDone();
+    return 0;
+}
+
+int IOUringBackend::Readv (int fd, const struct iovec *iov, int count) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _state.size() || !_state[fd]._recv) {
+        return ::readv(fd, iov, count);
+    }
+
+    fd_state_type &state = _state[fd];
+    if (state._recvHead < 0) {
+        if (state._recvEnd > 0) return 0;
+        errno = state._recvEnd < 0 ? -state._recvEnd : EAGAIN;
+        return -1;
+    }
+
+    size_t read = 0;
+    for (int i = 0; i < count && state._recvHead >= 0; ++i) {
+        char *dest = reinterpret_cast<char *>(iov[i].iov_base);
+        size_t room = iov[i].iov_len;
+        while (room && state._recvHead >= 0) {
+            const int32_t bid = state._recvHead;
+            recv_buffer_type &buffer = _recvBuffers[bid];
+            const size_t x = std::min(room, static_cast<size_t>(buffer._len - buffer._offset));
+            ::memcpy(dest, _bufs + static_cast<size_t>(bid) * _bufSize + buffer._offset, x);
+            buffer._offset += x;
+            dest += x;
+            room -= x;
+            read += x;
+
+            if (buffer._offset == buffer._len) {
+                state._recvHead = buffer._next;
+                --_recvHeld;
+                Provide(bid);
+            }
+        }
+    }
+    if (state._recvHead < 0) {
+        state._recvTail = -1;
+    }
+    ProvideDone();
+    return static_cast<int>(read);
+}
+
+int IOUringBackend::ArmRecv (int fd) {
+    struct io_uring_sqe *sqe = GetSQE();
+    if (!sqe) return -1;
+
+    fd_state_type &state = _state[fd];
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IOURING_RECV_GROUP;
+    sqe->user_data = IOURING_RECV_TAG | (static_cast<uint64_t>(state._recvGen) << 32) | static_cast<uint32_t>(fd);
+    state._recvArmed = 1;
+    return 0;
+}
+
+int IOUringBackend::CancelRecv (int fd) {
+    struct io_uring_sqe *sqe = GetSQE();
+    if (!sqe) return -1;
+
+    fd_state_type &state = _state[fd];
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = IOURING_RECV_TAG | (static_cast<uint64_t>(state._recvGen) << 32) | static_cast<uint32_t>(fd);
+    sqe->user_data = IOURING_CANCEL_TAG;
+    state._recvArmed = 0;
+    state._recvGen = (state._recvGen + 1) & IOURING_GEN_MASK;
+    return 0;
+}
+
+// A buffer that is not kept goes straight back on the ring
+void IOUringBackend::ReapRecv (const struct io_uring_cqe *cqe) {
+    const uint64_t data = cqe->user_data;
+    const int fd = static_cast<int>(data & 0xFFFFFFFF);
+    const uint32_t gen = static_cast<uint32_t>(data >> 32) & IOURING_GEN_MASK;
+    const bool buffer = cqe->flags & IORING_CQE_F_BUFFER;
+    const uint32_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (static_cast<size_t>(fd) >= _state.size() || !_state[fd]._registered || !_state[fd]._recv ||
+        _state[fd]._recvGen != gen) {
+        if (buffer) Provide(bid);
+        return;
+    }
+
+    fd_state_type &state = _state[fd];
+    const bool more = cqe->flags & IORING_CQE_F_MORE;
+    if (!more) {
+        state._recvArmed = 0;
+    }
+
+    if (cqe->res > 0 && buffer) {
+        recv_buffer_type &b = _recvBuffers[bid];
+        b._len = cqe->res;
+        b._offset = 0;
+        b._next = -1;
+        if (state._recvTail >= 0) {
+            _recvBuffers[state._recvTail]._next = bid;
+        } else {
+            state._recvHead = bid;
+        }
+        state._recvTail = bid;
+        ++_recvHeld;
+    } else {
+        if (buffer) Provide(bid);
+        if (cqe->res == -ENOBUFS) {
+            ++_recvNoBufs;
+            // buffers read since are back on the ring, else wait for the next one given back
+            if (_recvHeld < _bufCount) {
+                if (!state._rearm) {
+                    state._rearm = 1;
+                    _rearm.push_back(fd);
+                }
+            } else {
+                _recvStarved.push_back(fd);
+            }
+            return;
+        }
+        if (cqe->res == -ECANCELED) return;
+        state._recvEnd = cqe->res == 0 ? 1 : cqe->res;
+    }
+
+    if (!more && !state._recvEnd && !state._rearm) {
+        state._rearm = 1;
+        _rearm.push_back(fd);
+    }
+    if (!state._recvQueued) {
+        state._recvQueued = 1;
+        _recvReady.push_back(fd);
+    }
+}
+
+// appends the fds with something to read, returns the new count
+int IOUringBackend::Ready (struct epoll_event *events, int count, int maxEvents) {
+    if (count < 0) return count;
+    for (; _recvNext < _recvReady.size() && count < maxEvents; ++_recvNext) {
+        const int fd = _recvReady[_recvNext];
+        fd_state_type &state = _state[fd];
+        state._recvQueued = 0;
+        if (!state._registered || !state._recv || (state._recvHead < 0 && !state._recvEnd)) continue;
+
+        events[count].events = EPOLLIN | (state._recvEnd > 0 ? static_cast<uint32_t>(EPOLLRDHUP) : 0u) |
+            (state._recvEnd < 0 ? static_cast<uint32_t>(EPOLLERR) : 0u);
+        events[count].data.fd = fd;
+        ++count;
+        if (!state._recvReported) {
+            state._recvReported = 1;
+            _recvReported.push_back(fd);
+        }
+    }
+    if (_recvNext == _recvReady.size()) {
+        _recvReady.clear();
+        _recvNext = 0;
+    }
+    return count;
+}
+
+void IOUringBackend::Provide (uint32_t bid) {
+    struct io_uring_buf &buf = _bufRing[_bufTail & (_bufCount - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(_bufs + static_cast<size_t>(bid) * _bufSize);
+    buf.len = _bufSize;
+    buf.bid = bid;
+    ++_bufTail;
+    _bufProvided = true;
+}
+
+// publishes the buffers given back, and the recvs that ran out get another go
+void IOUringBackend::ProvideDone () {
+    if (!_bufProvided) return;
+    _bufProvided = false;
+    __atomic_store_n(&_bufRing[0].resv, _bufTail, __ATOMIC_RELEASE);
+
+    for (const int fd : _recvStarved) {
+        fd_state_type &state = _state[fd];
+        if (!state._rearm) {
+            state._rearm = 1;
+            _rearm.push_back(fd);
+        }
+    }
+    _recvStarved.clear();
+}
+
+void IOUringBackend::DropRecv (fd_state_type &state) {
+    for (int32_t bid = state._recvHead; bid >= 0; bid = _recvBuffers[bid]._next) {
+        --_recvHeld;
+        Provide(bid);
+    }
+    state._recvHead = state._recvTail = -1;
+    state._recvEnd = 0;
+    ProvideDone();
+}
@@ -0,0 +1,240 @@
+#ifndef __COYPU_EVENT_BACKEND_H
+#define __COYPU_EVENT_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_buf;
+struct io_uring_cqe;
+
+namespace  coypu
+{
+    namespace event
+    {
+        // A batched write as the kernel finished it. res is the bytes written or -errno
+        typedef struct WriteCompletion {
+            int _fd;
+            uint32_t _queued;
+            int32_t _res;
+        } write_completion_type;
+
+        // Readiness backends for EventManager. Events are epoll masks (EPOLLIN etc.) and EPOLLET
+        // selects edge triggered. Wait fills epoll_event records with data.fd set.
+        class EPollBackend {
+            public:
+                EPollBackend ();
+                ~EPollBackend ();
+
+                int Init ();
+                int Close ();
+
+                // recv is for IOUringBackend, reads here are always the fd's own
+                int Add (int fd, uint32_t events, bool recv = false);
+                int Modify (int fd, uint32_t events);
+                int Delete (int fd);
+
+                int Wait (struct epoll_event *events, int maxEvents, int timeout);
+
+                // No provided buffers, Readv is readv
+                int SetRecvBuffers (uint32_t count, uint32_t) {
+                    return count ? -1 : 0;
+                }
+
+                int Readv (int fd, const struct iovec *iov, int count) {
+                    return ::readv(fd, iov, count);
+                }
+
+                uint64_t GetRecvNoBufs () const {
+                    return 0;
+                }
+
+                // No batching, Writev is writev
+                int SetWriteBatch (uint32_t maxIov) {
+                    return maxIov ? -1 : 0;
+                }
+
+                int Writev (int fd, const struct iovec *iov, int count) {
+                    return ::writev(fd, iov, count);
+                }
+
+                int FlushWrites () {
+                    return 0;
+                }
+
+                std::vector <write_completion_type> &GetWriteCompletions () {
+                    return _completions;
+                }
+
+            private:
+                EPollBackend (const EPollBackend &other) = delete;
+                EPollBackend &operator= (const EPollBackend &other) = delete;
+
+                int _fd;
+                std::vector <write_completion_type> _completions; // always empty
+        };
+
+        // io_uring poll backend. Level triggered fds use single shot poll requests re-armed at the start
+        // of the next Wait, edge triggered fds use multishot poll. Adds, re-arms, interest changes and the
+        // wait itself go to the kernel in one io_uring_enter.
+        //
+        // With a write batch set, Writev queues an IORING_OP_WRITEV and returns the bytes queued, and
+        // FlushWrites sends every write queued since in one io_uring_enter. On a nonblocking socket the
+        // kernel finishes each write (or fails it with EAGAIN) as it is submitted, so the flush does not
+        // wait on a peer. The iovecs are copied, the data they point at must stay put until the flush.
+        // An fd has one write in a batch, a second one flushes the batch first.
+        //
+        // With receive buffers set, an fd added with recv reads through a multishot IORING_OP_RECV that
+        // picks from one ring of provided buffers registered with the kernel. The data is there when
+        // the completion is, so the fd is reported readable (EPOLLIN, EPOLLRDHUP at end of stream) and
+        // Readv copies it out and gives the buffers back instead of calling readv. Its poll request
+        // only covers EPOLLOUT. Readiness is level triggered: an fd is reported again while it holds
+        // data. When the ring runs dry the recv ends and is re-armed once Readv returns a buffer.
+        class IOUringBackend {
+            public:
+                IOUringBackend (uint32_t entries = 256);
+                ~IOUringBackend ();
+
+                int Init ();
+                int Close ();
+
+                int Add (int fd, uint32_t events, bool recv = false);
+                int Modify (int fd, uint32_t events);
+                int Delete (int fd);
+
+                int Wait (struct epoll_event *events, int maxEvents, int timeout);
+
+                uint64_t GetEnterCalls () const {
+                    return _enterCalls;
+                }
+
+                // count (a power of 2, at most 32768) buffers of size bytes for the fds added with recv,
+                // once after Init. 0 on success
+                int SetRecvBuffers (uint32_t count, uint32_t size);
+                // readv, or what the recv of an fd added with recv got. -1 EAGAIN when it has nothing yet
+                int Readv (int fd, const struct iovec *iov, int count);
+
+                // recvs that ended because every buffer was held
+                uint64_t GetRecvNoBufs () const {
+                    return _recvNoBufs;
+                }
+
+                // iovecs a batch holds before it is flushed, 0 (default) for a plain writev
+                int SetWriteBatch (uint32_t maxIov);
+                int Writev (int fd, const struct iovec *iov, int count);
+                int FlushWrites ();
+
+                // writes finished since the caller last cleared it
+                std::vector <write_completion_type> &GetWriteCompletions () {
+                    return _completions;
+                }
+
+            private:
+                IOUringBackend (const IOUringBackend &other) = delete;
+                IOUringBackend &operator= (const IOUringBackend &other) = delete;
+
+                typedef struct FDState {
+                    uint32_t _events;
+                    uint32_t _gen;      // bumped on cancel, stale completions are dropped
+                    uint8_t _registered;
+                    uint8_t _armed;     // poll request outstanding in the kernel
+                    uint8_t _rearm;     // fd is on _rearm
+                    uint8_t _writing;   // write in the current batch
+                    uint8_t _recv;      // reads through a multishot recv
+                    uint8_t _recvArmed; // recv request outstanding in the kernel
+                    uint8_t _recvQueued;   // fd is on _recvReady
+                    uint8_t _recvReported; // fd is on _recvReported
+                    uint32_t _recvGen;  // as _gen, for the recv request
+                    int32_t _recvEnd;   // 1 end of stream, -errno the recv failed, else 0
+                    int32_t _recvHead;  // buffers received and not read, oldest first, -1 none
+                    int32_t _recvTail;
+
+                    FDState () : _events(0), _gen(0), _registered(0), _armed(0), _rearm(0), _writing(0),
+                        _recv(0), _recvArmed(0), _recvQueued(0), _recvReported(0), _recvGen(0), _recvEnd(0),
+                        _recvHead(-1), _recvTail(-1) {
+                    }
+                } fd_state_type;
+
+                typedef struct RecvBuffer {
+                    uint32_t _len;      // received
+                    uint32_t _offset;   // read
+                    int32_t _next;
+                } recv_buffer_type;
+
+                typedef struct QueuedWrite {
+                    int _fd;
+                    uint32_t _queued;
+                } queued_write_type;
+
+                struct io_uring_sqe *GetSQE ();
+                int Submit (unsigned minComplete, unsigned flags, const void *arg, size_t argSize);
+                int Arm (int fd);
+                int Cancel (int fd);
+                int Harvest (struct epoll_event *events, int maxEvents);
+                bool Reap (const struct io_uring_cqe *cqe, struct epoll_event &event);
+                void ReapAll ();
+                int ArmRecv (int fd);
+                int CancelRecv (int fd);
+                void ReapRecv (const struct io_uring_cqe *cqe);
+                int Ready (struct epoll_event *events, int count, int maxEvents);
+                void Provide (uint32_t bid);
+                void ProvideDone ();
+                void DropRecv (fd_state_type &state);
+
+                uint32_t _entries;
+                int _fd;
+
+                void *_sqRing;
+                size_t _sqRingSize;
+                void *_cqRing;
+                size_t _cqRingSize;
+                struct io_uring_sqe *_sqes;
+                size_t _sqesSize;
+
+                unsigned *_sqHead;
+                unsigned *_sqTail;
+                unsigned *_sqMask;
+                unsigned *_sqArray;
+                unsigned _sqEntries;
+                unsigned _sqLocalTail;
+                unsigned _toSubmit;
+
+                unsigned *_cqHead;
+                unsigned *_cqTail;
+                unsigned *_cqMask;
+                struct io_uring_cqe *_cqes;
+
+                std::vector <fd_state_type> _state;
+                std::vector <int> _rearm;
+                uint64_t _enterCalls;
+
+                uint32_t _writeIovMax;
+                std::vector <struct iovec> _writeIov;       // reserved, never moves under a queued write
+                std::vector <queued_write_type> _writes;     // this batch, indexed by user_data
+                uint32_t _writesPending;                     // queued and not completed
+                std::vector <write_completion_type> _completions;
+                std::vector <struct epoll_event> _deferred;  // readiness reaped by FlushWrites
+                size_t _deferredNext;
+
+                struct io_uring_buf *_bufRing; // io_uring_buf_ring as plain entries (its bufs sit 8 bytes off in C++), tail overlays [0].resv
+                size_t _bufRingSize;
+                char *_bufs;
+                uint32_t _bufCount;
+                uint32_t _bufSize;
+                uint16_t _bufTail;
+                bool _bufProvided;                           // ring tail not yet published
+                std::vector <recv_buffer_type> _recvBuffers; // by buffer id
+                std::vector <int> _recvReady;                // to report readable
+                size_t _recvNext;
+                std::vector <int> _recvReported;             // reported by the last Wait
+                std::vector <int> _recvStarved;              // recv ended with every buffer held
+                uint32_t _recvHeld;                          // buffers received and not yet read
+                uint64_t _recvNoBufs;
+        };
+    } // event
+} //  coypu
+
+#endif
@@ -3,6 +3,9 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
 #include <string.h>
 #include <iostream>
 
@@ -29,6 +32,18 @@ int EPollHelper::Delete (int efd, int fd) {
     return ::epoll_ctl(efd, EPOLL_CTL_DEL, fd, nullptr);
 }
 
+int IOUringHelper::Setup (unsigned entries, struct io_uring_params *params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IOUringHelper::Enter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+int IOUringHelper::Register (int fd, unsigned opcode, const void *arg, unsigned nrArgs) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
 int EventFDHelper::CreateNonBlockEventFD (int flags) {
     return ::eventfd(0, flags | EFD_NONBLOCK);
 }
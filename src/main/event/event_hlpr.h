@@ -7,6 +7,8 @@
 #include <sys/timerfd.h>
 #include <sys/signalfd.h>
 
+struct io_uring_params;
+
 namespace  coypu
 {
     namespace event 
@@ -21,6 +23,16 @@ namespace  coypu
                 EPollHelper() = delete;
         };
 
+        // Raw io_uring syscalls (no liburing)
+        class IOUringHelper {
+            public:
+                static int Setup (unsigned entries, struct io_uring_params *params);
+                static int Enter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize);
+                static int Register (int fd, unsigned opcode, const void *arg, unsigned nrArgs);
+            private:
+                IOUringHelper() = delete;
+        };
+
         class TimerFDHelper {
             public:
                 static int CreateRealtimeNonBlock (int flags = 0);
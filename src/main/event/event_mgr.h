@@ -3,6 +3,8 @@
 #include <iostream>
 #include <errno.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <vector>
@@ -10,38 +12,83 @@
 #include <functional>
 #include <sys/epoll.h>
 #include <deque>
-#include <set>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <time.h>
+#include <limits.h>
+#include <x86intrin.h>
+#include <ostream>
+#include <iomanip>
 
 #include "event_hlpr.h"
+#include "event_backend.h"
+#include "timer_wheel.h"
+#include "buf/mpsc.h"
+#include "util/histogram.h"
 
 namespace  coypu
 {
     namespace event 
     {
         typedef std::function <int (int)> callback_type;
-        template <typename LogTrait>
+
+        enum EventFlags {
+            EF_NONE           = 0x0,
+            // Edge triggered (EPOLLET). The read callback is only invoked when new data arrives, so it
+            // must drain the fd until EAGAIN (see the managers' SetDrain).
+            EF_EDGE_TRIGGERED = 0x1,
+            // Sockets only. Reads come from a multishot recv into the backend's buffers (IOUringBackend
+            // after SetRecvBuffers), so the read callback must take them with Readv rather than read
+            // the fd. Otherwise Readv is readv.
+            EF_RECV           = 0x2
+        };
+
+        // Why the event loop closed an fd, kept per fd until the fd is registered again
+        enum CloseReason {
+            CR_NONE,
+            CR_READ,  // read callback < 0
+            CR_WRITE, // write callback < 0
+            CR_HUP,
+            CR_ERR,
+            CR_RDHUP,
+            CR_MAX
+        };
+
+        // SetSpin: never block in the backend wait
+        constexpr uint32_t SPIN_FOREVER = UINT32_MAX;
+
+        // Raw dispatch entry. ctx is either a static handler object or the std::function side table entry.
+        typedef int (*dispatch_type)(void *ctx, int fd);
+
+        // BackendType is EPollBackend or IOUringBackend (event_backend.h)
+        template <typename LogTrait, typename BackendType = EPollBackend>
         class EventManager {
             public:
-			 EventManager (LogTrait logger) : _emptyCB(nullptr), _growSize(8),
-				_fdToCB(_growSize, _emptyCB),
-				_fdEvents(_growSize, 0),
-				_fd(0), _logger(logger),
-                _timeout(1000), _maxEvents(16), _outEvents(nullptr) {
+			 EventManager (LogTrait logger) : _growSize(8),
+				_fdToCB(nullptr), _fdCapacity(0),
+				_logger(logger),
+                _timeout(1000), _maxEvents(16), _maxEventsLimit(1024), _outEvents(nullptr),
+                _spin(0), _idleSpins(0), _wakeTSC(0), _instrument(false), _polls(0), _wakeups(0), _saturated(0),
+                _ctlCalls(0), _ctlSaved(0), _batchedWrites(0), _shortWrites(0), _timers(NowMs()) {
                     _outEvents = reinterpret_cast<struct epoll_event *>(malloc(sizeof(struct epoll_event) * _maxEvents));
                 }
 
                 virtual ~EventManager () {
                     if (_outEvents) {
-                        delete _outEvents;
+                        free(_outEvents);
                         _outEvents = nullptr;
                     }
+                    if (_fdToCB) {
+                        free(_fdToCB);
+                        _fdToCB = nullptr;
+                    }
                 }
 
                 int Init () {
-                    _fd = coypu::event::EPollHelper::Create();
-                    if (_fd < 0) {
+                    if (_backend.Init()) {
 							 if (_logger) {
-								_logger->perror(errno, "Failed to create epoll");
+								_logger->perror(errno, "Failed to create event backend");
 							 }
                         return -1;
                     }
@@ -49,133 +96,423 @@ namespace  coypu
                 }
 
                 int Close () {
-                    if (_fd > 0) {
-                        ::close(_fd);
-                    }
+                    return _backend.Close();
+                }
 
+                // Initial epoll_wait batch and the limit it may grow to when a Wait fills the batch.
+                int SetMaxEvents (int maxEvents, int maxEventsLimit) {
+                    if (maxEvents <= 0 || maxEventsLimit < maxEvents) return -1;
+                    if (!ResizeEvents(maxEvents)) return -2;
+                    _maxEventsLimit = maxEventsLimit;
                     return 0;
                 }
 
-                int Register (int fd, callback_type read_func, callback_type write_func, callback_type close_func) {
+                int GetMaxEvents () const {
+                    return _maxEvents;
+                }
+
+                void SetTimeout (int timeout) {
+                    _timeout = timeout;
+                }
+
+                // Busy poll. Wait polls with a zero timeout until spins consecutive polls come back empty,
+                // then blocks as usual; any event starts the spin again. 0 (default) always blocks and
+                // SPIN_FOREVER never does. Each Wait is still one poll so timers keep running.
+                void SetSpin (uint32_t spins) {
+                    _spin = spins;
+                    _idleSpins = 0;
+                }
+
+                uint32_t GetSpin () const {
+                    return _spin;
+                }
+
+                // TSC taken when the last non empty wait returned, for readiness to dispatch latency
+                uint64_t GetWakeTSC () const {
+                    return _wakeTSC;
+                }
+
+                // Callback cycles (rdtscp around each dispatch) and loop histograms. Event, byte and close
+                // counters are always kept.
+                void SetInstrument (bool instrument) {
+                    _instrument = instrument;
+                }
+
+                // Bytes are only known to the io callbacks, which report them here.
+                void AddBytes (int fd, uint64_t in, uint64_t out) {
+                    if (fd < 0 || static_cast<uint32_t>(fd) >= _fdCapacity) return;
+                    _fdStats[fd]._bytesIn += in;
+                    _fdStats[fd]._bytesOut += out;
+                }
+
+                uint64_t GetCloseCount (uint32_t reason) const {
+                    return reason < CR_MAX ? _closeReasons[reason] : 0;
+                }
+
+                uint32_t GetCloseReason (int fd) const {
+                    return (fd >= 0 && static_cast<uint32_t>(fd) < _fdCapacity) ? _fdStats[fd]._closeReason : static_cast<uint32_t>(CR_NONE);
+                }
+
+                // Text snapshot: loop and callback totals, then up to top fds by callback cycles (events
+                // when not instrumented). Closed fds stay listed with their close reason until reused.
+                void WriteStats (std::ostream &out, uint32_t top = 16) const {
+                    static const char *cbNames[CB_MAX] = { "read", "write", "close" };
+                    static const char *crNames[CR_MAX] = { "-", "read", "write", "hup", "err", "rdhup" };
+
+                    out << "loop polls[" << _polls << "] wakeups[" << _wakeups << "] saturated[" << _saturated
+                        << "] maxEvents[" << _maxEvents << "/" << _maxEventsLimit << "]\n";
+                    out << "batch " << _batchSize << "\n";
+                    out << "cycles " << _loopCycles << "\n";
+                    for (uint32_t i = 0; i < CB_MAX; ++i) {
+                        out << "cb " << cbNames[i] << " calls[" << _cbCalls[i] << "] cycles[" << _cbCycles[i] << "]\n";
+                    }
+                    out << "close";
+                    for (uint32_t i = CR_READ; i < CR_MAX; ++i) {
+                        out << " " << crNames[i] << "[" << _closeReasons[i] << "]";
+                    }
+                    out << "\n";
+                    out << "writes batched[" << _batchedWrites << "] short[" << _shortWrites << "] recv nobufs["
+                        << _backend.GetRecvNoBufs() << "]\n";
+
+                    std::vector<int> fds;
+                    for (uint32_t fd = 0; fd < _fdCapacity; ++fd) {
+                        if (_fdStats[fd]._events) fds.push_back(fd);
+                    }
+                    auto cost = [this] (int fd) {
+                        const fd_stats_type &st = _fdStats[fd];
+                        return _instrument ? st._readCycles + st._writeCycles : st._events;
+                    };
+                    const size_t n = std::min(fds.size(), static_cast<size_t>(top));
+                    std::partial_sort(fds.begin(), fds.begin() + n, fds.end(), [&cost] (int a, int b) { return cost(a) > cost(b); });
+
+                    out << "fd live events reads writes readCycles writeCycles bytesIn bytesOut close\n";
+                    for (size_t i = 0; i < n; ++i) {
+                        const int fd = fds[i];
+                        const fd_stats_type &st = _fdStats[fd];
+                        out << fd << " " << (_fdToCB[fd]._fd == fd ? 1 : 0) << " " << st._events << " " << st._reads << " "
+                            << st._writes << " " << st._readCycles << " " << st._writeCycles << " " << st._bytesIn << " "
+                            << st._bytesOut << " " << crNames[st._closeReason] << "\n";
+                    }
+                }
+
+                // std::function path. The functions live in a side table so the dispatch record stays one cache line.
+                int Register (int fd, callback_type read_func, callback_type write_func, callback_type close_func, uint32_t flags = EF_NONE) {
 						if (fd <=0) {
 						  assert(false);
 						  return -1;
 						}
-                    struct epoll_event event;
-                    event.events = EPOLLIN | EPOLLRDHUP | EPOLLPRI;// always | EPOLLERR | EPOLLHUP;
-
-                    auto cb = std::make_shared<event_cb_type>();
-                    cb->_cf = close_func;
-                    cb->_wf = write_func;
-                    cb->_rf = read_func;
-                    cb->_fd = fd;
-						  while (_fdToCB.size() < fd+1) {
-							 _fdToCB.resize(_fdToCB.size()+_growSize, _emptyCB);
-							 _fdEvents.resize(_fdEvents.size()+_growSize, 0);
-						  }
+						if (!Grow(fd)) return -1;
 
-                    assert(fd < _fdToCB.capacity());
-						  assert(_fdToCB[fd].get() == nullptr);
-                    _fdToCB[fd] = cb;
-						  _fdEvents[fd] = 0; // reset
+						function_cb_type &fcb = _fdToFunc[fd];
+						fcb._rf = read_func;
+						fcb._wf = write_func;
+						fcb._cf = close_func;
 
-                    event.data.fd = fd;
+						return Add(fd, &fcb,
+									  read_func ? &FunctionRead : nullptr,
+									  write_func ? &FunctionWrite : nullptr,
+									  close_func ? &FunctionClose : nullptr, flags);
+                }
 
-                    int r =  EPollHelper::Add(_fd, fd, &event);
-                    if (r != 0) {
-							 assert(false);
-                        Unregister(fd); // cleanup
-                    }
-                    return r;
+                // Static handler path. Dispatches straight to obj->*ReadFunc etc. No std::function, no refcount.
+                // obj must outlive the registration (until Unregister or the close callback fires).
+                template <typename T,
+                          int (T::*ReadFunc)(int),
+                          int (T::*WriteFunc)(int) = nullptr,
+                          int (T::*CloseFunc)(int) = nullptr>
+                int Register (int fd, T *obj, uint32_t flags = EF_NONE) {
+						if (fd <=0 || !obj) {
+						  assert(false);
+						  return -1;
+						}
+						if (!Grow(fd)) return -1;
+
+						return Add(fd, obj,
+									  MakeDispatch<T, ReadFunc>(),
+									  MakeDispatch<T, WriteFunc>(),
+									  MakeDispatch<T, CloseFunc>(), flags);
+                }
+
+                // Timers run on the event loop thread and bound the epoll_wait timeout. Delays are in ms,
+                // interval 0 is one shot. Returns 0 on failure.
+                uint64_t AddTimer (uint64_t delay, uint64_t interval, TimerWheel::timer_cb_type cb) {
+                    // wheel time only moves in Wait, so delay is from now rather than the last advance
+                    const uint64_t now = NowMs();
+                    return _timers.Add(delay + (now > _timers.Now() ? now - _timers.Now() : 0), interval, cb);
+                }
+
+                bool CancelTimer (uint64_t id) {
+                    return _timers.Cancel(id);
                 }
 
+                static uint64_t NowMs () {
+                    struct timespec ts;
+                    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+                    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+                }
+
+                // Write interest is tracked per fd and applied by FlushInterest, which Wait calls before
+                // epoll_wait and after dispatching. Repeated SetWrite/ClearWrite calls cost no syscalls.
                 int SetWrite (int fd) {
-                    struct epoll_event event;
-                    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLPRI; // always | EPOLLERR | EPOLLHUP;
-                    event.data.fd = fd;
-                    return EPollHelper::Modify(_fd, fd, &event);
+                    return SetInterest(fd, true);
                 }
 
                 int ClearWrite (int fd) {
-                    struct epoll_event event;
-                    event.events = EPOLLIN | EPOLLRDHUP | EPOLLPRI; // always | EPOLLERR | EPOLLHUP;
-                    event.data.fd = fd;
-                    return EPollHelper::Modify(_fd, fd, &event);
+                    return SetInterest(fd, false);
+                }
+
+                // One epoll_ctl per fd whose interest changed since the last flush.
+                void FlushInterest () {
+                    if (_dirty.empty()) return;
+
+                    for (const int fd : _dirty) {
+                        if (static_cast<uint32_t>(fd) >= _fdCapacity) continue;
+                        event_cb_type &cb = _fdToCB[fd];
+                        if (cb._fd != fd || !cb._queued) continue; // unregistered or already flushed
+                        cb._queued = 0;
+
+                        // edge triggered always re-arms so a MOD re-reports a writable socket
+                        if (cb._wantWrite == cb._armedWrite && !cb._epollFlags) {
+                            ++_ctlSaved;
+                            continue;
+                        }
+
+                        uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLPRI | cb._epollFlags; // always | EPOLLERR | EPOLLHUP;
+                        if (cb._wantWrite) events |= EPOLLOUT;
+
+                        ++_ctlCalls;
+                        if (_backend.Modify(fd, events) == 0) {
+                            cb._armedWrite = cb._wantWrite;
+                        } else if (_logger) {
+                            _logger->perror(errno, "epoll_ctl");
+                        }
+                    }
+                    _dirty.clear();
+                }
+
+                // Batched fan-out writes, IOUringBackend only. With maxIov set, Writev queues the write and
+                // returns the bytes queued, and the writes queued while Wait dispatches go to the kernel
+                // together once the callbacks have run. Bytes a write did not get out are passed to
+                // unsent, which rewinds its stream, and the fd gets write interest to try again. A failed
+                // write closes the fd. The data must stay where it is until the flush, so whatever maps it
+                // calls FlushWrites before it unmaps or remaps it. 0 turns it off. 0 on success
+                int SetWriteBatch (uint32_t maxIov, std::function<void(int, uint32_t)> unsent) {
+                    if (_backend.SetWriteBatch(maxIov)) return -1;
+                    _unsent = maxIov ? unsent : nullptr;
+                    return 0;
+                }
+
+                // Buffers for the fds registered EF_RECV, IOUringBackend only: count (a power of 2) of size
+                // bytes, held from the recv until Readv copies them out. Once, after Init. 0 on success
+                int SetRecvBuffers (uint32_t count, uint32_t size) {
+                    return _backend.SetRecvBuffers(count, size);
                 }
 
+                // readv, or what an EF_RECV fd has received
+                int Readv (int fd, const struct iovec *iov, int count) {
+                    return _backend.Readv(fd, iov, count);
+                }
+
+                // writev, or queued for the flush after the callbacks with a write batch set
+                int Writev (int fd, const struct iovec *iov, int count) {
+                    return _backend.Writev(fd, iov, count);
+                }
+
+                // Sends the writes the callbacks queued and settles what came back short. Wait calls it
+                // after the callbacks, and anything about to unmap data a queued write points into (see
+                // LRUCache::SetEvictCB) calls it first.
+                void FlushWrites () {
+                    if (_backend.FlushWrites() && _logger) {
+                        _logger->perror(errno, "FlushWrites");
+                    }
+
+                    std::vector <write_completion_type> &completions = _backend.GetWriteCompletions();
+                    if (completions.empty()) return;
+                    for (const write_completion_type &c : completions) {
+                        ++_batchedWrites;
+                        if (static_cast<uint32_t>(c._fd) >= _fdCapacity || _fdToCB[c._fd]._fd != c._fd) continue;
+
+                        const int32_t res = c._res == -EAGAIN ? 0 : c._res;
+                        if (res < 0) {
+                            MarkClose(c._fd, CR_WRITE);
+                        } else if (static_cast<uint32_t>(res) < c._queued) {
+                            ++_shortWrites;
+                            if (_unsent) _unsent(c._fd, c._queued - res);
+                            SetWrite(c._fd);
+                        }
+                    }
+                    completions.clear();
+                    FlushInterest();
+                }
+
+                // batched writes the kernel finished, and the ones of those passed to unsent
+                uint64_t GetBatchedWrites () const {
+                    return _batchedWrites;
+                }
+
+                uint64_t GetShortWrites () const {
+                    return _shortWrites;
+                }
+
+                // recvs that ran out of buffers, see SetRecvBuffers
+                uint64_t GetRecvNoBufs () const {
+                    return _backend.GetRecvNoBufs();
+                }
+
+                // epoll_ctl MOD calls issued and calls avoided by coalescing
+                uint64_t GetCtlCalls () const {
+                    return _ctlCalls;
+                }
+
+                uint64_t GetCtlSaved () const {
+                    return _ctlSaved;
+                }
+
+                // Owner keeps the fd. One already queued by a failed callback or hangup is still
+                // closed by Wait.
                 int Unregister (int fd) {
-                    int r = EPollHelper::Delete(_fd, fd);
-						  _fdToCB[fd].reset();
+                    int r = _backend.Delete(fd);
+						  if (fd >= 0 && static_cast<uint32_t>(fd) < _fdCapacity) {
+							 event_cb_type &cb = _fdToCB[fd];
+							 cb._rf = cb._wf = cb._cf = nullptr;
+							 cb._ctx = nullptr;
+							 cb._epollFlags = 0;
+							 cb._armedWrite = cb._wantWrite = cb._queued = 0;
+							 cb._fd = -1;
+
+							 function_cb_type &fcb = _fdToFunc[fd];
+							 fcb._rf = fcb._wf = fcb._cf = nullptr; // release captures
+						  }
 
                     return r;
                 }
 
 					 uint64_t GetEventCount (int fd) {
 						assert(fd >= 0);
-						assert(fd < _fdEvents.size());
-						return _fdEvents[fd];
+						assert(static_cast<uint32_t>(fd) < _fdCapacity);
+						return _fdToCB[fd]._events;
 					 }
 
                 int Wait () {
-                    int count = ::epoll_wait(_fd, _outEvents, _maxEvents, _timeout);
+                    int timeout = _timeout;
+                    if (_timers.Size()) {
+                        _timers.Advance(NowMs());
+                        timeout = static_cast<int>(_timers.NextTimeout(_timeout < 0 ? INT_MAX : _timeout));
+                    }
+
+                    FlushInterest(); // changes made outside Wait
+                    FlushWrites();
+
+                    const bool spin = _spin == SPIN_FOREVER || _idleSpins < _spin;
+                    int count = _backend.Wait(_outEvents, _maxEvents, spin ? 0 : timeout);
+                    ++_polls;
                     if (count > 0) {
-                        if (count == _maxEvents) {
-								  if (_logger) {
-                            _logger->warn("Hit epoll _maxEvents [{0}].", _maxEvents);
-								  }
-                        }
+                        _wakeTSC = __rdtsc();
+                        _idleSpins = 0;
+
                         for (int i = 0; i < count; ++i) {
-									 std::shared_ptr<event_cb_type> &cb = _fdToCB[_outEvents[i].data.fd];
-									 assert(cb);
-									 ++_fdEvents[_outEvents[i].data.fd];
-									 
-                            if (_outEvents[i].events & (EPOLLIN|EPOLLPRI)) {
-                                if (cb->_rf) {
-                                    // ret < 0 : close                                    
-                                    int ret = cb->_rf(cb->_fd);
+									 const int fd = _outEvents[i].data.fd;
+									 const uint32_t events = _outEvents[i].events;
+
+									 // Callbacks can register (grow the table) or unregister, so never hold a
+									 // reference to the record across a dispatch.
+									 if (_fdToCB[fd]._fd != fd) continue; // unregistered earlier in this batch
+									 ++_fdToCB[fd]._events;
+									 ++_fdStats[fd]._events;
+
+                            if (events & (EPOLLIN|EPOLLPRI)) {
+										  dispatch_type rf = _fdToCB[fd]._rf;
+                                if (rf) {
+                                    // ret < 0 : close
+                                    const uint64_t start = _instrument ? Cycles() : 0;
+                                    int ret = rf(_fdToCB[fd]._ctx, fd);
+                                    if (_instrument) {
+                                        const uint64_t cycles = Cycles() - start;
+                                        _fdStats[fd]._readCycles += cycles;
+                                        _cbCycles[CB_READ] += cycles;
+                                    }
+                                    ++_fdStats[fd]._reads;
+                                    ++_cbCalls[CB_READ];
                                     if (ret < 0) {
-                                        _closeSet.insert(cb->_fd);
+                                        MarkClose(fd, CR_READ);
                                     }
                                 }
-                            } 
+                            }
 
-                            if (_outEvents[i].events & EPOLLOUT) {
-                                if (cb->_wf) {
+                            if (events & EPOLLOUT) {
+										  dispatch_type wf = _fdToCB[fd]._wf;
+                                if (wf && _fdToCB[fd]._fd == fd && !_fdToCB[fd]._closing) {
                                     // ret < 0 : close
                                     // ret 0 : clear
                                     // ret > 0 : keep EPOLLOUT bit set
-											 int ret = cb->_wf(cb->_fd);
+											 const uint64_t start = _instrument ? Cycles() : 0;
+											 int ret = wf(_fdToCB[fd]._ctx, fd);
+											 if (_instrument) {
+												const uint64_t cycles = Cycles() - start;
+												_fdStats[fd]._writeCycles += cycles;
+												_cbCycles[CB_WRITE] += cycles;
+											 }
+											 ++_fdStats[fd]._writes;
+											 ++_cbCalls[CB_WRITE];
 											 if (ret < 0) {
-												_closeSet.insert(cb->_fd);
+												MarkClose(fd, CR_WRITE);
 											 }
 											 if (ret == 0) {
-												ClearWrite(cb->_fd);
+												ClearWrite(fd);
 											 }
                                 }
-                            }   
-                            
-                            if (_outEvents[i].events & (EPOLLHUP|EPOLLERR|EPOLLRDHUP)) {
-                                _closeSet.insert(cb->_fd);
-										  ::close(cb->_fd);
+                            }
+
+                            if (events & (EPOLLHUP|EPOLLERR|EPOLLRDHUP)) {
+                                MarkClose(fd, (events & EPOLLERR) ? CR_ERR : ((events & EPOLLHUP) ? CR_HUP : CR_RDHUP));
                             }
                         }
 
-								if (!_closeSet.empty()) {
-								  auto e = _closeSet.end();
-								  for (auto b = _closeSet.begin(); b != e; ++b) {
-                            std::shared_ptr<event_cb_type> &cb = _fdToCB[*b];
-                            assert(cb);
-
-									 if (cb->_cf) {
-										cb->_cf(cb->_fd);
-										cb->_cf = nullptr; // fire once
-									 }
-									 
-                            Unregister(*b);
-								  }
-								}
+                        FlushWrites();
+
+                        // Single close path: close callback, unregister, then the fd is closed here and
+                        // nowhere else. Entries are unique (the _closing flag), and the queue is reserved to
+                        // the table size in Grow so the hot loop never allocates.
+                        for (size_t i = 0; i < _closeQueue.size(); ++i) {
+                            const int fd = _closeQueue[i];
+                            if (!_fdToCB[fd]._closing) continue; // re-registered by its owner since
+                            _fdToCB[fd]._closing = 0;
+                            ++_closeReasons[_fdStats[fd]._closeReason];
+
+                            dispatch_type cf = _fdToCB[fd]._fd == fd ? _fdToCB[fd]._cf : nullptr;
+                            if (cf) {
+                                _fdToCB[fd]._cf = nullptr; // fire once
+                                const uint64_t start = _instrument ? Cycles() : 0;
+                                cf(_fdToCB[fd]._ctx, fd);
+                                if (_instrument) {
+                                    _cbCycles[CB_CLOSE] += Cycles() - start;
+                                }
+                                ++_cbCalls[CB_CLOSE];
+                            }
+
+                            Unregister(fd);
+                            ::close(fd);
+                        }
+                        _closeQueue.clear();
+                        FlushInterest();
+
+                        ++_wakeups;
+                        if (_instrument) {
+                            _loopCycles.Record(Cycles() - _wakeTSC);
+                            _batchSize.Record(count);
+                        }
 
-                        _closeSet.clear();
+                        // Saturated - grow so the next wakeup can take the whole ready set
+                        if (count == _maxEvents) {
+                            ++_saturated;
+								  if (_maxEvents < _maxEventsLimit) {
+									 ResizeEvents(std::min(_maxEvents * 2, _maxEventsLimit));
+								  } else if (_logger) {
+                            _logger->warn("Hit epoll _maxEvents [{0}].", _maxEvents);
+								  }
+                        }
+                    } else if (count == 0) {
+                        if (spin) ++_idleSpins;
                     } else if (count < 0) {
 							 if (errno == EINTR) {
 								if (_logger) {
@@ -188,6 +525,11 @@ namespace  coypu
 								}
 							 }
                     }
+
+                    if (_timers.Size()) {
+                        _timers.Advance(NowMs());
+                        FlushInterest(); // SetWrite from timer callbacks
+                    }
                     return count;
                 }
 
@@ -197,41 +539,222 @@ namespace  coypu
                 EventManager (const EventManager &&other) = delete;
                 EventManager &operator= (const EventManager &&other) = delete;
 
+                // Hot dispatch record - fd indexed, one cache line, no heap or refcount on the event path.
                 typedef struct EventCB {
+                    dispatch_type _rf;
+                    dispatch_type _wf;
+                    dispatch_type _cf;
+                    void *_ctx;
+                    uint64_t _events;
+                    uint32_t _epollFlags;
+                    int _fd;
+                    uint8_t _armedWrite; // EPOLLOUT as last set in the kernel
+                    uint8_t _wantWrite;  // EPOLLOUT as requested since
+                    uint8_t _queued;     // fd is on _dirty
+                    uint8_t _closing;    // fd is on _closeQueue, survives Unregister until closed
+                } __attribute__ ((aligned(64))) event_cb_type;
+
+                static_assert(sizeof(event_cb_type) == 64, "EventCB Size Check");
+
+                enum CallbackType {
+                    CB_READ,
+                    CB_WRITE,
+                    CB_CLOSE,
+                    CB_MAX
+                };
+
+                // Cold per fd counters, kept apart from the dispatch record
+                typedef struct FDStats {
+                    uint64_t _events;
+                    uint64_t _reads;
+                    uint64_t _writes;
+                    uint64_t _readCycles;
+                    uint64_t _writeCycles;
+                    uint64_t _bytesIn;
+                    uint64_t _bytesOut;
+                    uint32_t _closeReason;
+                } fd_stats_type;
+
+                static inline uint64_t Cycles () {
+                    unsigned int aux;
+                    return __rdtscp(&aux);
+                }
+
+                // first reason wins
+                void MarkClose (int fd, uint32_t reason) {
+                    if (_fdStats[fd]._closeReason == CR_NONE) {
+                        _fdStats[fd]._closeReason = reason;
+                    }
+                    if (!_fdToCB[fd]._closing) {
+                        _fdToCB[fd]._closing = 1;
+                        _closeQueue.push_back(fd); // reserved, never reallocates
+                    }
+                }
+
+                typedef struct FunctionCB {
                     callback_type _rf;
                     callback_type _wf;
                     callback_type _cf;
-                    int _fd;
-                } event_cb_type;
+                } function_cb_type;
+
+                static int FunctionRead (void *ctx, int fd) {
+                    return static_cast<function_cb_type *>(ctx)->_rf(fd);
+                }
+
+                static int FunctionWrite (void *ctx, int fd) {
+                    return static_cast<function_cb_type *>(ctx)->_wf(fd);
+                }
+
+                static int FunctionClose (void *ctx, int fd) {
+                    return static_cast<function_cb_type *>(ctx)->_cf(fd);
+                }
+
+                template <typename T, int (T::*Func)(int)>
+                static int StaticDispatch (void *ctx, int fd) {
+                    return (static_cast<T *>(ctx)->*Func)(fd);
+                }
+
+                template <typename T, int (T::*Func)(int)>
+                static constexpr dispatch_type MakeDispatch () {
+                    return Func ? &StaticDispatch<T, Func> : nullptr;
+                }
+
+                bool Grow (int fd) {
+                    if (static_cast<uint32_t>(fd) < _fdCapacity) return true;
+
+                    // doubles, so accepting fds in order copies the table O(log n) times
+                    const uint32_t newCapacity = std::max(static_cast<uint32_t>(fd)+1, std::max(2 * _fdCapacity, _growSize));
+
+                    void *mem = nullptr;
+                    if (::posix_memalign(&mem, 64, sizeof(event_cb_type) * newCapacity)) {
+                        if (_logger) {
+                            _logger->perror(errno, "posix_memalign");
+                        }
+                        return false;
+                    }
+                    event_cb_type *table = reinterpret_cast<event_cb_type *>(mem);
+                    if (_fdToCB) {
+                        ::memcpy(table, _fdToCB, sizeof(event_cb_type) * _fdCapacity);
+                        free(_fdToCB);
+                    }
+                    for (uint32_t i = _fdCapacity; i < newCapacity; ++i) {
+                        ::memset(&table[i], 0, sizeof(event_cb_type));
+                        table[i]._fd = -1;
+                    }
+
+                    _fdToCB = table;
+                    _fdCapacity = newCapacity;
+                    _fdToFunc.resize(newCapacity); // deque - existing entries do not move
+                    _fdStats.resize(newCapacity, fd_stats_type());
+                    _closeQueue.reserve(newCapacity);
+                    return true;
+                }
+
+                int SetInterest (int fd, bool write) {
+                    if (fd < 0 || static_cast<uint32_t>(fd) >= _fdCapacity || _fdToCB[fd]._fd != fd) return -1;
+
+                    event_cb_type &cb = _fdToCB[fd];
+                    cb._wantWrite = write;
+                    if (cb._queued) {
+                        ++_ctlSaved; // folded into the pending flush
+                    } else if (cb._wantWrite != cb._armedWrite || cb._epollFlags) {
+                        cb._queued = 1;
+                        _dirty.push_back(fd);
+                    } else {
+                        ++_ctlSaved;
+                    }
+                    return 0;
+                }
+
+                bool ResizeEvents (int maxEvents) {
+                    struct epoll_event *events = reinterpret_cast<struct epoll_event *>(realloc(_outEvents, sizeof(struct epoll_event) * maxEvents));
+                    if (!events) {
+                        if (_logger) {
+                            _logger->perror(errno, "realloc");
+                        }
+                        return false;
+                    }
+                    _outEvents = events;
+                    _maxEvents = maxEvents;
+                    return true;
+                }
+
+                int Add (int fd, void *ctx, dispatch_type rf, dispatch_type wf, dispatch_type cf, uint32_t flags) {
+						  assert(fd >= 0 && static_cast<uint32_t>(fd) < _fdCapacity);
+						  event_cb_type &cb = _fdToCB[fd];
+						  assert(cb._fd == -1);
+						  cb._rf = rf;
+						  cb._wf = wf;
+						  cb._cf = cf;
+						  cb._ctx = ctx;
+						  cb._fd = fd;
+						  cb._events = 0; // reset
+						  _fdStats[fd] = fd_stats_type();
+						  cb._epollFlags = (flags & EF_EDGE_TRIGGERED) ? static_cast<uint32_t>(EPOLLET) : 0u;
+						  cb._armedWrite = cb._wantWrite = cb._queued = cb._closing = 0;
+
+                    int r =  _backend.Add(fd, EPOLLIN | EPOLLRDHUP | EPOLLPRI | cb._epollFlags, flags & EF_RECV);// always | EPOLLERR | EPOLLHUP;
+                    if (r != 0) {
+							 assert(false);
+                        Unregister(fd); // cleanup
+                    }
+                    return r;
+                }
 
-					 std::shared_ptr<event_cb_type> _emptyCB;
 					 uint32_t _growSize;
-                std::vector <std::shared_ptr<event_cb_type>> _fdToCB;
-					 std::vector <uint64_t> _fdEvents;
+                event_cb_type *_fdToCB;
+                uint32_t _fdCapacity;
+                std::deque <function_cb_type> _fdToFunc;
 
-                int _fd;
+                BackendType _backend;
                 LogTrait _logger;
 
                 int _timeout;
                 int _maxEvents;
+                int _maxEventsLimit;
                 struct epoll_event * _outEvents;
-                std::set <int> _closeSet;
-
+                std::vector <int> _closeQueue; // deferred closes, one entry per fd
+                std::vector <int> _dirty;
+
+                uint32_t _spin;
+                uint32_t _idleSpins;
+                uint64_t _wakeTSC;
+
+                bool _instrument;
+                uint64_t _polls;     // backend waits
+                uint64_t _wakeups;   // waits that returned events
+                uint64_t _saturated; // waits that filled the batch
+                uint64_t _cbCalls[CB_MAX] = {};
+                uint64_t _cbCycles[CB_MAX] = {};
+                uint64_t _closeReasons[CR_MAX] = {};
+                std::vector <fd_stats_type> _fdStats;
+                coypu::util::Histogram _loopCycles; // wakeup to end of dispatch
+                coypu::util::Histogram _batchSize;  // events per wakeup
+
+                uint64_t _ctlCalls;
+                uint64_t _ctlSaved;
+
+                std::function<void(int, uint32_t)> _unsent;
+                uint64_t _batchedWrites; // completions of batched writes
+                uint64_t _shortWrites;   // of those, the ones rewound by unsent
+
+                TimerWheel _timers;
         };
 
-		  template <typename CBType>
+		  // Cross thread command queue for the event thread. Producers on any thread Queue a type and
+		  // payload; the callback registered for the type runs on the event thread as cb(payload).
+		  // The eventfd is only written when the consumer is not already signalled.
+		  template <typename CBType, typename PayloadType = uint64_t, uint32_t Capacity = 1024>
 			 class EventCBManager {
 		  public:
-			 typedef std::function<int(int)> write_cb_type;
-			 typedef std::deque<uint64_t> queue_type;
-
-			 // fd should be eventfd()
-		  EventCBManager(int fd, write_cb_type set_write) : _fd(fd), _set_write(set_write) {
+			 // fd should be eventfd(), registered for read on the event thread
+		  EventCBManager(int fd) : _fd(fd), _signalled(false), _dropped(0) {
 			 }
 
 			 virtual ~EventCBManager() {
 			 }
 
+			 // event thread, before producers start
 			 bool Register (uint64_t type, CBType &cb) {
 				return _cbMap.insert(std::make_pair(type, cb)).second;
 			 }
@@ -248,38 +771,29 @@ namespace  coypu
 			 int Read (int fd) {
 				uint64_t u = UINT64_MAX;
 				int r = ::read(_fd, &u, sizeof(uint64_t));
-				if (r > 0) {
-				  assert(r == sizeof(uint64_t));
-				  if (r < sizeof(uint64_t)) return -128;
-
-				  while (!_queue.empty()) {
-					 u = _queue.front(); // not thread safe
-					 _queue.pop_front();
-					 auto b = _cbMap.find(u);
-					 if (b != _cbMap.end()) {
-						(*b).second();
-					 } else {
-						assert(false);
-					 }
+				if (r < 0) {
+				  return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : r;
+				}
+				if (r != static_cast<int>(sizeof(uint64_t))) return -128;
+
+				// clear before draining so a producer racing the drain signals again
+				_signalled.exchange(false, std::memory_order_seq_cst);
+
+				command_type cmd;
+				uint32_t count = 0;
+				while (count < Capacity && _queue.Pop(cmd)) {
+				  ++count;
+				  auto b = _cbMap.find(cmd._type);
+				  if (b != _cbMap.end()) {
+					 (*b).second(cmd._payload);
+				  } else {
+					 assert(false);
 				  }
-				  return 0;
 				}
-				return r;
-			 }
 
-			 int Write (int fd) {
-				// write queue
-				uint64_t u = _queue.size();
-				int r = ::write(_fd, &u, sizeof(uint64_t));
-								
-				if (r > 0) {
-				  assert(r == sizeof(uint64_t));
-				  if (r < sizeof(uint64_t)) return -128;
-				  return 0;
-				}
-				assert(false);
-				
-				return -1;
+				// bounded drain, come back for the rest
+				if (!_queue.IsEmpty()) Signal();
+				return 0;
 			 }
 
 			 int Close (int fd) {
@@ -287,9 +801,21 @@ namespace  coypu
 				return -1;
 			 }
 
-			 void Queue (uint64_t u) {
-				_queue.push_back(u);
-				_set_write(_fd);
+			 // any thread. false when the ring is full
+			 bool Queue (uint64_t type, const PayloadType &payload = PayloadType()) {
+				command_type cmd;
+				cmd._type = type;
+				cmd._payload = payload;
+				if (!_queue.Push(cmd)) {
+				  _dropped.fetch_add(1, std::memory_order_relaxed);
+				  return false;
+				}
+				Signal();
+				return true;
+			 }
+
+			 uint64_t GetDropped () const {
+				return _dropped.load(std::memory_order_relaxed);
 			 }
 
 		  private:
@@ -298,13 +824,28 @@ namespace  coypu
 			 EventCBManager (const EventCBManager &&other) = delete;
 			 EventCBManager &operator= (const EventCBManager &&other) = delete;
 
-			 queue_type _queue;
+			 typedef struct Command {
+				uint64_t _type;
+				PayloadType _payload;
+			 } command_type;
+
+			 inline void Signal () {
+				if (!_signalled.exchange(true, std::memory_order_seq_cst)) {
+				  uint64_t u = 1;
+				  int r = ::write(_fd, &u, sizeof(uint64_t));
+				  assert(r == sizeof(uint64_t));
+				  (void)r;
+				}
+			 }
+
+			 coypu::buf::MPSCRing <command_type, Capacity> _queue;
 			 
 			 typedef std::unordered_map <uint64_t, CBType> cb_map_type;
 			 cb_map_type _cbMap;
 			 
 			 int _fd;
-			 write_cb_type _set_write;
+			 std::atomic<bool> _signalled;
+			 std::atomic<uint64_t> _dropped;
 		  };
     } // event
 } //  coypu
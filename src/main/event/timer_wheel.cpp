@@ -0,0 +1,201 @@
+#include <algorithm>
+
+#include "timer_wheel.h"
+
+using namespace coypu::event;
+
+constexpr uint32_t TimerWheel::LEVELS;
+constexpr uint32_t TimerWheel::SLOT_BITS;
+constexpr uint32_t TimerWheel::SLOTS;
+constexpr uint64_t TimerWheel::SLOT_MASK;
+constexpr uint32_t TimerWheel::NIL;
+
+TimerWheel::TimerWheel (uint64_t now) : _now(now), _size(0), _free(NIL), _firing(NIL) {
+    std::fill(_head, _head + LEVELS * SLOTS, NIL);
+    std::fill(_occupied, _occupied + LEVELS, 0);
+}
+
+TimerWheel::~TimerWheel () {
+}
+
+uint64_t TimerWheel::Add (uint64_t delay, uint64_t interval, timer_cb_type cb) {
+    if (!cb) return 0;
+
+    uint32_t index = _free;
+    if (index != NIL) {
+        _free = _nodes[index]._next;
+    } else {
+        index = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+        _nodes[index]._gen = 0;
+    }
+
+    timer_node_type &node = _nodes[index];
+    node._expires = _now + std::max<uint64_t>(delay, 1);
+    node._interval = interval;
+    node._active = true;
+    node._cb = cb;
+    Insert(index);
+    ++_size;
+
+    return MakeId(index, node._gen);
+}
+
+bool TimerWheel::Cancel (uint64_t id) {
+    const uint64_t index = (id & 0xFFFFFFFF) - 1;
+    if (!id || index >= _nodes.size()) return false;
+
+    timer_node_type &node = _nodes[index];
+    if (!node._active || node._gen != static_cast<uint32_t>(id >> 32)) return false;
+
+    Unlink(index);
+    node._active = false;
+    --_size;
+    if (index != _firing) {
+        Release(index);
+    }
+    return true;
+}
+
+uint32_t TimerWheel::Advance (uint64_t now) {
+    uint32_t fired = 0;
+
+    while (_now < now) {
+        uint64_t next = _now + 1;
+        if (next & SLOT_MASK) {
+            // skip to the next occupied level 0 slot, or to the wrap where the next cascade is due
+            const uint64_t bits = _occupied[0] & (~0ULL << (next & SLOT_MASK));
+            next = bits ? (_now & ~SLOT_MASK) + __builtin_ctzll(bits) : (_now | SLOT_MASK) + 1;
+            if (next > now) {
+                _now = now;
+                break;
+            }
+        }
+
+        _now = next;
+        if ((_now & SLOT_MASK) == 0) {
+            Cascade(1);
+        }
+
+        uint32_t &head = _head[_now & SLOT_MASK];
+        while (head != NIL) {
+            const uint32_t index = head;
+            Unlink(index);
+
+            timer_node_type &node = _nodes[index];
+            const uint64_t id = MakeId(index, node._gen);
+            if (node._interval) {
+                node._expires = _now + node._interval;
+                Insert(index);
+            } else {
+                node._active = false;
+                --_size;
+            }
+
+            _firing = index;
+            node._cb(id);
+            _firing = NIL;
+
+            if (!node._active) {
+                Release(index);
+            }
+            ++fired;
+        }
+    }
+
+    return fired;
+}
+
+uint64_t TimerWheel::NextTimeout (uint64_t max) const {
+    if (!_size) return max;
+
+    uint64_t best = max;
+    for (uint32_t level = 0; level < LEVELS; ++level) {
+        const uint64_t bits = _occupied[level];
+        if (!bits) continue;
+
+        const uint32_t shift = SLOT_BITS * level;
+        const uint64_t bucket = _now >> shift;
+        const uint32_t r = (bucket + 1) & SLOT_MASK;
+
+        // bit k is the slot k+1 buckets ahead
+        const uint64_t ahead = r ? ((bits >> r) | (bits << (SLOTS - r))) : bits;
+        const uint64_t when = ((bucket + __builtin_ctzll(ahead) + 1) << shift) - _now;
+        best = std::min(best, when);
+    }
+    return best;
+}
+
+void TimerWheel::Insert (uint32_t index) {
+    timer_node_type &node = _nodes[index];
+
+    uint64_t expires = node._expires;
+    const uint64_t delta = expires > _now ? expires - _now : 0;
+
+    uint32_t level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    if (delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+        expires = _now + (1ULL << (SLOT_BITS * LEVELS)) - 1; // park, cascades again before it is due
+    }
+
+    const uint32_t slot = (expires >> (SLOT_BITS * level)) & SLOT_MASK;
+    const uint32_t pos = level * SLOTS + slot;
+
+    node._slot = static_cast<uint16_t>(pos);
+    node._prev = NIL;
+    node._next = _head[pos];
+    if (node._next != NIL) {
+        _nodes[node._next]._prev = index;
+    }
+    _head[pos] = index;
+    _occupied[level] |= (1ULL << slot);
+}
+
+void TimerWheel::Unlink (uint32_t index) {
+    timer_node_type &node = _nodes[index];
+    const uint32_t pos = node._slot;
+
+    if (node._prev != NIL) {
+        _nodes[node._prev]._next = node._next;
+    } else {
+        _head[pos] = node._next;
+    }
+    if (node._next != NIL) {
+        _nodes[node._next]._prev = node._prev;
+    }
+    node._prev = node._next = NIL;
+
+    if (_head[pos] == NIL) {
+        _occupied[pos / SLOTS] &= ~(1ULL << (pos & SLOT_MASK));
+    }
+}
+
+void TimerWheel::Cascade (uint32_t level) {
+    if (level >= LEVELS) return;
+
+    const uint32_t slot = (_now >> (SLOT_BITS * level)) & SLOT_MASK;
+    if (slot == 0) {
+        Cascade(level + 1);
+    }
+
+    const uint32_t pos = level * SLOTS + slot;
+    uint32_t index = _head[pos];
+    _head[pos] = NIL;
+    _occupied[level] &= ~(1ULL << slot);
+
+    while (index != NIL) {
+        const uint32_t next = _nodes[index]._next;
+        Insert(index);
+        index = next;
+    }
+}
+
+void TimerWheel::Release (uint32_t index) {
+    timer_node_type &node = _nodes[index];
+    node._cb = nullptr;
+    ++node._gen;
+    node._next = _free;
+    _free = index;
+}
@@ -0,0 +1,81 @@
+#ifndef __COYPU_TIMER_WHEEL_H
+#define __COYPU_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+
+namespace  coypu
+{
+    namespace event
+    {
+        // Hierarchical timer wheel. 4 levels of 64 slots at 1 tick resolution (EventManager uses ms),
+        // so add, cancel and expiry are O(1) and the wheel spans 2^24 ticks. Longer delays are parked in
+        // the top level and cascade again. Timer ids are never 0 and stay unique across reuse.
+        class TimerWheel {
+            public:
+                typedef std::function <void(uint64_t)> timer_cb_type;
+
+                TimerWheel (uint64_t now);
+                ~TimerWheel ();
+
+                // interval 0 is one shot
+                uint64_t Add (uint64_t delay, uint64_t interval, timer_cb_type cb);
+                bool Cancel (uint64_t id);
+
+                // Fire everything expired up to now. Returns timers fired.
+                uint32_t Advance (uint64_t now);
+
+                // Ticks until the wheel next needs Advance (expiry or cascade), capped at max.
+                uint64_t NextTimeout (uint64_t max) const;
+
+                uint32_t Size () const {
+                    return _size;
+                }
+
+                uint64_t Now () const {
+                    return _now;
+                }
+
+            private:
+                TimerWheel (const TimerWheel &other) = delete;
+                TimerWheel &operator= (const TimerWheel &other) = delete;
+
+                static constexpr uint32_t LEVELS = 4;
+                static constexpr uint32_t SLOT_BITS = 6;
+                static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+                static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+                static constexpr uint32_t NIL = UINT32_MAX;
+
+                typedef struct TimerNode {
+                    uint64_t _expires;
+                    uint64_t _interval;
+                    uint32_t _prev;
+                    uint32_t _next;
+                    uint32_t _gen;
+                    uint16_t _slot;    // level * SLOTS + slot, for unlink
+                    bool _active;
+                    timer_cb_type _cb;
+                } timer_node_type;
+
+                void Insert (uint32_t index);
+                void Unlink (uint32_t index);
+                void Cascade (uint32_t level);
+                void Release (uint32_t index);
+
+                static inline uint64_t MakeId (uint32_t index, uint32_t gen) {
+                    return (static_cast<uint64_t>(gen) << 32) | (index + 1);
+                }
+
+                uint64_t _now;
+                uint32_t _size;
+                uint32_t _free;    // free list through _next
+                uint32_t _firing;  // released after its callback returns
+                std::deque <timer_node_type> _nodes; // stable while a callback runs
+                uint32_t _head[LEVELS * SLOTS];
+                uint64_t _occupied[LEVELS]; // bit per non empty slot
+        };
+    } // event
+} //  coypu
+
+#endif
@@ -7,6 +7,8 @@
 #include <sys/mman.h>
 #include <linux/limits.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include "file.h"
@@ -55,6 +57,11 @@ int FileUtil::Truncate (int fd, off64_t size) {
   return ::ftruncate64(fd, size);
 }
 
+int FileUtil::Allocate (int fd, off64_t offset, off64_t len) {
+  if (::fallocate64(fd, 0, offset, len) == 0) return 0;
+  return errno == EOPNOTSUPP ? Truncate(fd, offset + len) : -1;
+}
+
 ssize_t FileUtil::Write (int fd, const char *buf, size_t count) {
   return ::write(fd, buf, count);
 }
@@ -144,3 +151,58 @@ int MMapAnon::GetSize (int fd, off64_t &offset) {
   }
   return i;
 }
+
+MMapWindow::MMapWindow (int fd, size_t reserve, size_t extent) : _fd(fd), _reserve(reserve),
+  _extent(extent), _base(nullptr), _mapped(0) {
+}
+
+MMapWindow::~MMapWindow () {
+  if (_base) {
+    ::munmap(_base, _reserve);
+  }
+}
+
+int MMapWindow::Init () {
+  if (_base || _extent == 0 || _reserve < _extent) return -1;
+  _reserve = (_reserve / _extent) * _extent;
+
+  void *base = ::mmap(nullptr, _reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) return -2;
+  _base = reinterpret_cast<char *>(base);
+
+  off64_t size = 0;
+  if (_fd >= 0 && FileUtil::GetSize(_fd, size)) return -3;
+  return Ensure(size);
+}
+
+int MMapWindow::Ensure (off64_t end) {
+  if (!_base) return -2;
+  if (end <= _mapped) return 0;
+  if (end > static_cast<off64_t>(_reserve)) return -1;
+
+  const off64_t target = std::min<off64_t>(_reserve, ((end + _extent - 1) / _extent) * _extent);
+  const size_t len = target - _mapped;
+  if (_fd >= 0) {
+    if (FileUtil::Allocate(_fd, _mapped, len)) {
+      return -3;
+    }
+  }
+  if (MapExtent(_mapped, len)) return -4;
+  _mapped = target;
+  return 0;
+}
+
+int MMapWindow::Trim (off64_t size) {
+  if (_fd < 0) return 0;
+  return FileUtil::Truncate(_fd, size);
+}
+
+int MMapWindow::MapExtent (off64_t offset, size_t len) {
+  void *p = nullptr;
+  if (_fd >= 0) {
+    p = ::mmap(_base + offset, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, _fd, offset);
+  } else {
+    p = ::mmap(_base + offset, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  }
+  return p == MAP_FAILED ? -1 : 0;
+}
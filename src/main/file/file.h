@@ -20,6 +20,9 @@ namespace coypu {
       static int Open (const char *pathname, int flags, mode_t mode);
       static int Close (int fd);
       static int Truncate (int fd, off64_t offset);
+      // Grows the file to cover [offset, offset+len) with the blocks reserved, or only sized where
+      // the filesystem has no fallocate (tmpfs and friends). 0 on success
+      static int Allocate (int fd, off64_t offset, off64_t len);
       static int GetSize (int fd, off64_t &offset);
       static int Remove(const char *pathname);
       static int Exists(const char *file, bool &b);
@@ -65,6 +68,49 @@ namespace coypu {
 		static int GetSize (int fd, off64_t &offset);
 	 };
 
+
+	 // One reservation of address space for a whole log. The file grows with fallocate an extent at
+	 // a time and each extent is mapped MAP_FIXED at its own offset in the reservation, so Base never
+	 // moves and a byte mapped once is never remapped. Readers on other threads may use anything
+	 // below an offset the writer has published. fd -1 maps anonymous memory.
+	 class MMapWindow {
+	 public:
+		MMapWindow (int fd, size_t reserve, size_t extent);
+		~MMapWindow ();
+
+		// Reserves the range and maps the existing file. 0 on success
+		int Init ();
+
+		// Maps at least [0, end), growing the file. 0 on success, -1 past the reservation
+		int Ensure (off64_t end);
+
+		// Cuts the file back to size, e.g. the written length on close. The mapping is kept.
+		int Trim (off64_t size);
+
+		inline char *Base () const {
+		  return _base;
+		}
+
+		inline off64_t Mapped () const {
+		  return _mapped;
+		}
+
+		inline size_t Reserved () const {
+		  return _reserve;
+		}
+
+	 private:
+		MMapWindow (const MMapWindow &other) = delete;
+		MMapWindow &operator= (const MMapWindow &other) = delete;
+
+		int MapExtent (off64_t offset, size_t len);
+
+		int _fd;
+		size_t _reserve;
+		size_t _extent;
+		char *_base;
+		off64_t _mapped;
+	 };
   }
 }
 
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018 Aaron Wald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COYPU_BACKPRESSURE_H
+#define __COYPU_BACKPRESSURE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <ostream>
+
+#include "buf/mask.h"
+#include "mem/pool.h"
+
+namespace coypu {
+  namespace http {
+	 enum BackpressurePolicy {
+		BP_DROP_OLDEST, // drop queued frames, oldest first, until under the low watermark
+		BP_DISCONNECT,  // close the connection
+		BP_CONFLATE     // a keyed frame replaces the queued frame with the same key, else drop oldest
+	 };
+
+	 // Per connection limits. Pending is the write buffer plus the overflow queue.
+	 struct BackpressureConfig {
+		uint64_t _highWater;        // bytes pending before the policy applies
+		uint64_t _lowWater;         // congestion clears at or below this
+		uint32_t _maxChunks;        // overflow growth in pooled chunks, 0 for none
+		bool _spill;                // overflow past the chunks goes to an anonymous log stream
+		BackpressurePolicy _policy;
+
+		BackpressureConfig () : _highWater(64*1024), _lowWater(32*1024), _maxChunks(0), _spill(false),
+		  _policy(BP_DROP_OLDEST) {
+		}
+	 };
+
+	 struct BackpressureStats {
+		uint64_t _frames;      // queued
+		uint64_t _dropped;     // new frames that did not fit, or oldest dropped by the policy
+		uint64_t _conflated;   // queued frames replaced by a newer one with the same key
+		uint64_t _spilled;     // frames that went to the spill stream
+		uint64_t _congested;   // times the high watermark was crossed
+		uint64_t _disconnects;
+
+		BackpressureStats () : _frames(0), _dropped(0), _conflated(0), _spilled(0), _congested(0), _disconnects(0) {
+		}
+	 };
+
+	 inline std::ostream &operator<< (std::ostream &out, const BackpressureStats &stats) {
+		out << "backpressure frames[" << stats._frames << "] dropped[" << stats._dropped
+			 << "] conflated[" << stats._conflated << "] spilled[" << stats._spilled
+			 << "] congested[" << stats._congested << "] disconnects[" << stats._disconnects << "]";
+		return out;
+	 }
+
+	 // Frames that did not fit a connection's write buffer, in order. Bytes go to pooled chunks while
+	 // fewer than maxChunks are held, then to the spill stream (created on first use, released once it
+	 // drains). Once anything is spilled later frames spill too until it drains, so order holds.
+	 // Frames dropped behind a live one stay in place and are skipped when moved out.
+	 template <typename SpillType>
+	 class OverflowQueue {
+	 public:
+		OverflowQueue (const std::shared_ptr<coypu::mem::BufferPool> &pool, uint64_t chunkSize,
+							uint32_t maxChunks, bool spill) : _pool(pool), _chunkSize(chunkSize), _maxChunks(maxChunks),
+		  _spill(spill), _chunkHead(0), _chunkTail(0), _spillRead(0), _spillBytes(0), _live(0) {
+		}
+
+		virtual ~OverflowQueue () {
+		}
+
+		inline bool IsEmpty () const {
+		  return _frames.empty();
+		}
+
+		// Bytes of frames not dropped
+		inline uint64_t Live () const {
+		  return _live;
+		}
+
+		inline uint32_t Chunks () const {
+		  return _chunks.size();
+		}
+
+		inline bool IsSpilling () const {
+		  return _spillBytes > 0;
+		}
+
+		// Copies a frame made of up to two parts, the second XORed with mask when maskLen > 0.
+		// false when neither the chunks nor the spill stream can hold it.
+		bool Push (const char *hdr, uint64_t hdrLen, const char *data, uint64_t len,
+					  const char *mask, int maskLen, uint64_t key) {
+		  Frame frame;
+		  frame._size = hdrLen + len;
+		  frame._key = key;
+		  frame._dropped = false;
+		  frame._spill = _spillBytes > 0 || ChunkRoom() < frame._size;
+		  if (frame._spill) {
+			 if (!_spill) return false;
+			 if (!_spillStream) {
+				_spillStream = std::make_shared<SpillType>(static_cast<uint64_t>(SPILL_PAGE_SIZE), 0, -1, true);
+				_spillRead = 0;
+			 }
+		  }
+
+		  Append(frame._spill, hdr, hdrLen);
+		  if (maskLen > 0) {
+			 char masked[MASK_BLOCK];
+			 for (uint64_t i = 0; i < len; i += MASK_BLOCK) {
+				const uint64_t n = std::min(len - i, static_cast<uint64_t>(MASK_BLOCK));
+				coypu::buf::mask::Xor(masked, &data[i], n, mask, maskLen, i);
+				Append(frame._spill, masked, n);
+			 }
+		  } else {
+			 Append(frame._spill, data, len);
+		  }
+
+		  if (frame._spill) _spillBytes += frame._size;
+		  _live += frame._size;
+		  _frames.push_back(frame);
+		  return true;
+		}
+
+		// Marks the oldest live frame dropped
+		bool DropOldest () {
+		  for (Frame &frame : _frames) {
+			 if (!frame._dropped) {
+				Drop(frame);
+				return true;
+			 }
+		  }
+		  return false;
+		}
+
+		// Marks the live frame with this key dropped
+		bool Conflate (uint64_t key) {
+		  if (key == 0) return false;
+		  for (auto b = _frames.rbegin(); b != _frames.rend(); ++b) {
+			 if (!(*b)._dropped && (*b)._key == key) {
+				Drop(*b);
+				return true;
+			 }
+		  }
+		  return false;
+		}
+
+		// Moves whole frames into buf while they fit, skipping dropped ones. buf needs Free and Push.
+		template <typename BufType>
+		void MoveTo (BufType &buf) {
+		  while (!_frames.empty()) {
+			 const Frame frame = _frames.front();
+			 if (!frame._dropped && frame._size > buf->Free()) return;
+
+			 Consume(frame._spill, frame._size, [&buf, &frame] (const char *data, uint64_t len) {
+				  if (!frame._dropped) buf->Push(data, len);
+				});
+			 if (!frame._dropped) _live -= frame._size;
+			 _frames.pop_front();
+		  }
+		}
+
+	 private:
+		OverflowQueue (const OverflowQueue &other) = delete;
+		OverflowQueue &operator= (const OverflowQueue &other) = delete;
+
+		static constexpr uint64_t SPILL_PAGE_SIZE = 1024*1024;
+		static constexpr int MASK_BLOCK = 4096;
+
+		typedef struct Frame {
+		  uint64_t _size;
+		  uint64_t _key;
+		  bool _spill;
+		  bool _dropped;
+		} Frame;
+
+		// Dropped frames at the front give their space back straight away
+		inline void Drop (Frame &frame) {
+		  frame._dropped = true;
+		  _live -= frame._size;
+		  while (!_frames.empty() && _frames.front()._dropped) {
+			 Consume(_frames.front()._spill, _frames.front()._size, [] (const char *, uint64_t) { });
+			 _frames.pop_front();
+		  }
+		}
+
+		uint64_t ChunkRoom () const {
+		  uint64_t room = (_maxChunks - std::min<uint64_t>(_maxChunks, _chunks.size())) * _chunkSize;
+		  if (!_chunks.empty()) room += _chunkSize - _chunkTail;
+		  return room;
+		}
+
+		void Append (bool spill, const char *data, uint64_t len) {
+		  if (len == 0) return;
+		  if (spill) {
+			 _spillStream->Push(data, len);
+			 return;
+		  }
+
+		  uint64_t offset = 0;
+		  while (offset < len) {
+			 if (_chunks.empty() || _chunkTail == _chunkSize) {
+				_chunks.push_back(std::unique_ptr<coypu::mem::PoolBuffer>(new coypu::mem::PoolBuffer(_pool, _chunkSize)));
+				_chunkTail = 0;
+			 }
+			 const uint64_t n = std::min(len - offset, _chunkSize - _chunkTail);
+			 ::memcpy(&_chunks.back()->Get()[_chunkTail], &data[offset], n);
+			 _chunkTail += n;
+			 offset += n;
+		  }
+		}
+
+		// Hands len bytes from the front of the chunks or the spill stream to cb, releasing chunks as
+		// they empty and the spill stream once it drains
+		template <typename CB>
+		void Consume (bool spill, uint64_t len, const CB &cb) {
+		  if (spill) {
+			 char data[MASK_BLOCK];
+			 for (uint64_t i = 0; i < len; ) {
+				const uint64_t n = std::min(len - i, static_cast<uint64_t>(MASK_BLOCK));
+				_spillStream->Pop(_spillRead, data, n);
+				cb(data, n);
+				_spillRead += n;
+				i += n;
+			 }
+			 _spillBytes -= len;
+			 if (_spillBytes == 0) _spillStream.reset();
+			 return;
+		  }
+
+		  while (len) {
+			 const uint64_t end = _chunks.size() == 1 ? _chunkTail : _chunkSize;
+			 const uint64_t n = std::min(len, end - _chunkHead);
+			 cb(&_chunks.front()->Get()[_chunkHead], n);
+			 _chunkHead += n;
+			 len -= n;
+			 if (_chunkHead == end) {
+				_chunks.pop_front();
+				_chunkHead = 0;
+				if (_chunks.empty()) _chunkTail = 0;
+			 }
+		  }
+		}
+
+		std::shared_ptr<coypu::mem::BufferPool> _pool;
+		uint64_t _chunkSize;
+		uint32_t _maxChunks;
+		bool _spill;
+
+		std::deque<std::unique_ptr<coypu::mem::PoolBuffer>> _chunks;
+		uint64_t _chunkHead; // read offset in the front chunk
+		uint64_t _chunkTail; // write offset in the back chunk
+
+		std::shared_ptr<SpillType> _spillStream;
+		uint64_t _spillRead;
+		uint64_t _spillBytes;
+
+		std::deque<Frame> _frames;
+		uint64_t _live;
+	 };
+  }
+}
+
+#endif
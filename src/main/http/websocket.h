@@ -36,7 +36,11 @@
 #include <unordered_map>
 #include <memory>
 #include "buf/buf.h"
+#include "mem/pool.h"
+#include "file/file.h"
+#include "store/store.h"
 #include "util/string-util.h"
+#include "http/backpressure.h"
 
 namespace coypu
 {
@@ -68,10 +72,14 @@ namespace coypu
 		static constexpr char CR = 0xD;
 		static constexpr char LF = 0xA;
 		static constexpr int MAX_HEADER_SIZE = 8*1024;
+		static constexpr int MAX_HEADERS_SIZE = 16*1024; // the whole block, buffered until it ends
+		static constexpr const char *HEADER_END = "\r\n\r\n";
+		static constexpr uint64_t HEADER_END_LEN = 4;
 
 		static constexpr int WS_PAYLOAD_16       = 126; // network byte order following - error if less than 126
 		static constexpr int WS_PAYLOAD_64       = 127; // network byte order following - error if less than 2^16-1
 		static constexpr int WS_MASK_LEN         = 4;
+		static constexpr int WS_MAX_FRAME_HEADER = 14; // 2 + 64 bit length + mask
 		static constexpr const char * WS_VERSION = "13";
             
 		static constexpr int WS_SEC_KEY_LEN      = 16;
@@ -121,14 +129,18 @@ namespace coypu
 		};
 
 		// ProviderType to read from underlying connection which could be regular socket (writev/readv) or SSL (SSL_Read/SSL_Write)
-		template <typename LogTrait, typename StreamTrait, typename PublishTrait>
+		// BufTrait is the connection http and write buffer, BipBuf or a FixedBipBuf of the manager capacity
+		template <typename LogTrait, typename StreamTrait, typename PublishTrait,
+					 typename BufTrait = coypu::buf::BipBuf <char, uint64_t>>
 		  class WebSocketManager {
 		public:
 		  typedef std::function<int(int)> write_cb_type;
 
+		  static constexpr uint64_t BUFFER_CAPACITY = 64*1024; // per connection buffer
+
 		  WebSocketManager (LogTrait logger, 
 								  write_cb_type set_write) : _logger(logger),
-			 _capacity(64*1024), _set_write(set_write)  {
+			 _capacity(BUFFER_CAPACITY), _set_write(set_write), _drain(false)  {
 		  }
 
 		  virtual ~WebSocketManager () {
@@ -142,7 +154,7 @@ namespace coypu
 										  std::function <void(uint64_t, uint64_t)> onText,
 										  const std::shared_ptr<StreamTrait> stream,
 										  const std::shared_ptr<PublishTrait> publish) {
-			 auto sp = std::make_shared<con_type>(fd, _capacity, !serverCon, serverCon, readv, writev, onOpen, onText, stream, publish);
+			 auto sp = std::make_shared<con_type>(fd, _capacity, _pool, _backpressure, !serverCon, serverCon, readv, writev, onOpen, onText, stream, publish);
 			 auto p = std::make_pair(fd, sp);
 			 sp->_state = WS_CS_CONNECTING;
 
@@ -174,9 +186,11 @@ namespace coypu
 			 if (x == _connections.end()) return -1;
 			 std::shared_ptr<con_type> &con = (*x).second;
 			 if (!con) return -2;
+			 if (con->_disconnect) return -1; // BP_DISCONNECT
 
 			 // check if stream buf has data.... then send over writeBuf? probably we should have
 			 // a state here but we set to open once we upgrad eon server side.
+			 con->_overflow->MoveTo(con->_writeBuf);
 			 if (!con->_writeBuf->IsEmpty()) {
 				int ret = con->_writeBuf->Writev(fd, con->_writev); 
 
@@ -186,13 +200,18 @@ namespace coypu
 
 				if (ret < 0) return ret; // error
 
+				con->_overflow->MoveTo(con->_writeBuf);
+				if (con->_congested && Pending(con) <= _backpressure._lowWater) {
+				  con->_congested = false;
+				}
+
 				// We could have EAGAIN/EWOULDBLOCK so we want to maintain write if data available
 				// 0 will clear write bit
 				// Can improve branching here if we just return is empty directly on the stack without another call
 				return con->_writeBuf->IsEmpty() ? 0 : 1;
 			 } else if (con->_publish) {
 				// could limit size of write
-				int ret = con->_publish->Writev(con->_publish->Available(fd), fd, con->_writev);
+				int ret = con->_publish->Writev(con->_publish->Available(fd), fd, _publishWritev ? _publishWritev : con->_writev);
 									 
 				if (ret < 0) {
 				  _logger->error("Publish error fd[{0}] err[{1}]", fd, ret);
@@ -212,30 +231,77 @@ namespace coypu
 
                         
 			 int r = 0;
-			 if (con->_stream && (con->_state == WS_CS_OPEN || con->_state == WS_CS_OPEN_DATA)) {
-				r = con->_stream->Readv(fd, con->_readv);
-			 } else {
-				r = con->_httpBuf->Readv(fd, con->_readv);
-			 }
-
-			 if (con->_server) {
-				_logger->info("Read fd[{0}] bytes[{1}]", fd, r);
-			 }
+			 do {
+				if (con->_stream && (con->_state == WS_CS_OPEN || con->_state == WS_CS_OPEN_DATA)) {
+				  r = con->_stream->Readv(fd, con->_readv);
+				} else {
+				  r = con->_httpBuf->Readv(fd, con->_readv);
+				}
 
+				if (con->_server) {
+				  _logger->info("Read fd[{0}] bytes[{1}]", fd, r);
+				}
 
-			 if (r < 0) return -3;
+				if (r < 0) {
+				  if (_drain && r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break; // drained
+				  return -3;
+				}
                         
-			 if (con->_state == WS_CS_CONNECTING) {
-				int r = HandleHTTP(con);
-				if (r < 0) return r;
-			 }
+				if (con->_state == WS_CS_CONNECTING) {
+				  int r = HandleHTTP(con);
+				  if (r < 0) return r;
+				}
 								
-			 while (ProcessState(con)) {
-			 }
+				while (ProcessState(con)) {
+				}
+			 } while (_drain && r > 0);
 
 			 return 0;
 		  }
 
+		  // Required for fds registered edge triggered - Read loops until the socket would block.
+		  void SetDrain (bool drain) {
+			 _drain = drain;
+		  }
+
+		  // Connection buffers come from the pool (returned on Unregister), else the heap
+		  void SetBufferPool (const std::shared_ptr<coypu::mem::BufferPool> &pool) {
+			 _pool = pool;
+		  }
+
+		  // Applies to connections registered after the call
+		  void SetBackpressure (const BackpressureConfig &config) {
+			 _backpressure = config;
+		  }
+
+		  // Publish log writes go through writev rather than each connection's own, e.g. the event
+		  // manager's batched Writev. The log stays put, unlike the write buffer, so a batched write
+		  // can be rewound with Unsent.
+		  void SetPublishWritev (const std::function<int(int,const struct iovec *,int)> &writev) {
+			 _publishWritev = writev;
+		  }
+
+		  // bytes a publish write queued and did not get out, sent again on the next Write
+		  int Unsent (int fd, uint32_t bytes) {
+			 auto x = _connections.find(fd);
+			 if (x == _connections.end()) return -1;
+			 std::shared_ptr<con_type> &con = (*x).second;
+			 if (!con || !con->_publish) return -2;
+			 return con->_publish->Rewind(fd, bytes) ? 0 : -3;
+		  }
+
+		  // Totals over every connection, open or closed
+		  const BackpressureStats &GetBackpressureStats () const {
+			 return _backpressureStats;
+		  }
+
+		  bool GetBackpressureStats (int fd, BackpressureStats &stats) const {
+			 auto x = _connections.find(fd);
+			 if (x == _connections.end() || !(*x).second) return false;
+			 stats = (*x).second->_backpressureStats;
+			 return true;
+		  }
+
 		  // TODO This is natural entry place for the store to make sure we place the streamed data into a store for a given uri.
 		  // should assign a stream token here?
 		  bool Stream (int fd, 
@@ -315,8 +381,31 @@ namespace coypu
 			 return true;
 		  }
 
-		  // Queue data
-		  bool Queue (int fd, WSOPCode code, const char *data, uint64_t len) {
+		  // Frame header, returns its length (no mask)
+		  static int EncodeHeader (char *hdr, WSOPCode code, bool masked, uint64_t len) {
+			 hdr[0] = 0x80 | (0x0F & code);
+			 if (len <= 125) {
+				hdr[1] = 0x7F & len;
+				if (masked) hdr[1] |= 0x80;
+				return 2;
+			 } else if (len < UINT16_MAX) {
+				hdr[1] = 0x7F & WS_PAYLOAD_16;
+				if (masked) hdr[1] |= 0x80;
+				uint16_t outlen = htons((uint16_t)len);
+				::memcpy(&hdr[2], &outlen, sizeof(uint16_t));
+				return 4;
+			 }
+			 hdr[1] = 0x7F & WS_PAYLOAD_64;
+			 if (masked) hdr[1] |= 0x80;
+			 uint64_t outlen = htobe64(len);
+			 ::memcpy(&hdr[2], &outlen, sizeof(uint64_t));
+			 return 10;
+		  }
+
+		  // Queue data. Frames that do not fit the write buffer, or arrive while others wait in the
+		  // overflow, are queued in the overflow (see BackpressureConfig). Past the high watermark the
+		  // policy applies; a non zero key lets BP_CONFLATE replace a waiting frame with the same key.
+		  bool Queue (int fd, WSOPCode code, const char *data, uint64_t len, uint64_t key = 0) {
 			 auto x = _connections.find(fd);
 			 if (x == _connections.end()) return false;
 
@@ -324,16 +413,36 @@ namespace coypu
 
 			 if (con && (con->_state == WS_CS_OPEN || 
 							 con->_state == WS_CS_OPEN_DATA )) {
-				if(!WriteFrame(con->_writeBuf, code, con->_masked, len)) return false;
-
+				char hdr[WS_MAX_FRAME_HEADER];
+				int hdrLen = EncodeHeader(hdr, code, con->_masked, len);
 				if (con->_masked) {
-				  /// write mask 
-				  con->_writeBuf->Push(reinterpret_cast<char *>(con->_mask), WS_MASK_LEN);
-				  PushMask(con, data, len);
+				  ::memcpy(&hdr[hdrLen], con->_mask, WS_MASK_LEN);
+				  hdrLen += WS_MASK_LEN;
+				}
+
+				const uint64_t size = hdrLen + len;
+				if (size > con->_writeBuf->Capacity()) {
+				  Count(con, &BackpressureStats::_dropped); // would never fit the write buffer
+				  return false;
+				}
+				if (Pending(con) + size > _backpressure._highWater && !Admit(con, size, key)) return false;
+
+				if (con->_overflow->IsEmpty() && size <= con->_writeBuf->Free()) {
+				  con->_writeBuf->Push(hdr, hdrLen);
+				  if (con->_masked) {
+					 PushMask(con, data, len);
+				  } else {
+					 con->_writeBuf->Push(data, len);
+				  }
+				} else if (con->_overflow->Push(hdr, hdrLen, data, len, reinterpret_cast<const char *>(con->_mask),
+														  con->_masked ? WS_MASK_LEN : 0, key)) {
+				  if (con->_overflow->IsSpilling()) Count(con, &BackpressureStats::_spilled);
 				} else {
-				  con->_writeBuf->Push(data, len);
+				  Count(con, &BackpressureStats::_dropped);
+				  return false;
 				}
 
+				Count(con, &BackpressureStats::_frames);
 				_set_write(fd);
 				return true;
 			 }
@@ -358,10 +467,13 @@ namespace coypu
 			 uint64_t _len;    // can be up to unsigned 64 bit in length;
 		  } WebSocketFrame;
 
+		  typedef coypu::store::LogRWStream<coypu::file::MMapAnon, coypu::store::OneShotCache, 16> spill_type;
+		  typedef OverflowQueue<spill_type> overflow_type;
+
 		  typedef struct WebSocketConnection {
 			 int _fd;
-			 std::shared_ptr<coypu::buf::BipBuf <char, uint64_t>> _httpBuf;
-			 std::shared_ptr<coypu::buf::BipBuf <char, uint64_t>> _writeBuf;
+			 std::shared_ptr<BufTrait> _httpBuf;
+			 std::shared_ptr<BufTrait> _writeBuf;
 			 std::shared_ptr<StreamTrait> _stream;
 			 std::shared_ptr<PublishTrait> _publish;
 			 std::unordered_map <std::string, std::string> _headers;
@@ -382,8 +494,16 @@ namespace coypu
 			 std::function <void(int)> _onOpen;
 			 std::function <void(uint64_t, uint64_t)> _onText;
 			 unsigned char _key[WS_SEC_KEY_SIZE] = {};
-
-			 WebSocketConnection (int fd, uint64_t capacity, bool masked, bool server,
+			 coypu::mem::PoolBuffer _readMem;
+			 coypu::mem::PoolBuffer _writeMem;
+			 std::unique_ptr<overflow_type> _overflow; // frames waiting behind _writeBuf
+			 BackpressureStats _backpressureStats;
+			 bool _congested;
+			 bool _disconnect;
+
+			 WebSocketConnection (int fd, uint64_t capacity, const std::shared_ptr<coypu::mem::BufferPool> &pool,
+										 const BackpressureConfig &backpressure,
+										 bool masked, bool server,
 										 std::function<int(int,const struct iovec *,int)> readv,
 										 std::function<int(int,const struct iovec *,int)> writev,
 										 std::function <void(int)> onOpen,
@@ -392,17 +512,17 @@ namespace coypu
 										 std::shared_ptr<PublishTrait> publish) :
 			 _fd(fd), _stream(stream), _publish(publish), _readData(nullptr), _writeData(nullptr), 
 				_state(WS_CS_UNKNOWN), _frame({}), _masked(masked), _server(server), _readv(readv), _writev(writev),
-				_onOpen(onOpen), _onText(onText) { 
-				_readData = new char[capacity];
-				_writeData = new char[capacity];
-				_httpBuf = std::make_shared<coypu::buf::BipBuf <char, uint64_t>>(_readData, capacity);
-				_writeBuf = std::make_shared<coypu::buf::BipBuf <char, uint64_t>>(_writeData, capacity);
+				_onOpen(onOpen), _onText(onText), _readMem(pool, capacity), _writeMem(pool, capacity),
+				_overflow(new overflow_type(pool, capacity, backpressure._maxChunks, backpressure._spill)),
+				_congested(false), _disconnect(false) { 
+				_readData = _readMem.Get();
+				_writeData = _writeMem.Get();
+				_httpBuf = std::make_shared<BufTrait>(_readData, capacity);
+				_writeBuf = std::make_shared<BufTrait>(_writeData, capacity);
 				_mask[0] = _mask[1] = _mask[2] = _mask[3] = 0;
 			 }
 
 			 virtual ~WebSocketConnection () {
-				if (_readData) delete [] _readData;
-				if (_writeData) delete [] _writeData;
 			 }
 
 			 bool HasHeader (const std::string &hdr) const {
@@ -426,15 +546,59 @@ namespace coypu
 		  LogTrait _logger;
 		  uint64_t _capacity;
 		  write_cb_type _set_write;
+		  bool _drain;
+		  std::shared_ptr<coypu::mem::BufferPool> _pool;
+		  BackpressureConfig _backpressure;
+		  BackpressureStats _backpressureStats;
+		  std::function<int(int,const struct iovec *,int)> _publishWritev;
+
+		  inline void Count (std::shared_ptr<con_type> &con, uint64_t BackpressureStats::*counter) {
+			 ++(con->_backpressureStats.*counter);
+			 ++(_backpressureStats.*counter);
+		  }
+
+		  static inline uint64_t Pending (const std::shared_ptr<con_type> &con) {
+			 return con->_writeBuf->Available() + con->_overflow->Live();
+		  }
+
+		  // Past the high watermark, false when the frame should not be queued
+		  bool Admit (std::shared_ptr<con_type> &con, uint64_t size, uint64_t key) {
+			 if (!con->_congested) {
+				con->_congested = true;
+				Count(con, &BackpressureStats::_congested);
+				_logger->warn("Backpressure fd[{0}] pending[{1}]", con->_fd, Pending(con));
+			 }
+
+			 switch (_backpressure._policy) {
+			 case BP_DISCONNECT:
+				if (!con->_disconnect) {
+				  con->_disconnect = true;
+				  Count(con, &BackpressureStats::_disconnects);
+				  _set_write(con->_fd); // Write fails and the event loop closes it
+				}
+				return false;
+			 case BP_CONFLATE:
+				if (con->_overflow->Conflate(key)) {
+				  Count(con, &BackpressureStats::_conflated);
+				  return true;
+				}
+				// falls through, no queued frame with the key
+			 case BP_DROP_OLDEST:
+				while (Pending(con) + size > _backpressure._lowWater && con->_overflow->DropOldest()) {
+				  Count(con, &BackpressureStats::_dropped);
+				}
+				return true;
+			 }
+			 return true;
+		  }
 
 		  static inline void Unmask (const WebSocketFrame &frame, char *data, size_t len) {
-			 for (size_t i = 0; i < len; ++i) data[i] ^= frame._mask[i%WS_MASK_LEN];
+			 coypu::buf::mask::Xor(data, data, len, frame._mask, WS_MASK_LEN, 0);
 		  }
 						  
-		  static inline void PushMask (std::shared_ptr<con_type> &con , const char *data, size_t len) {
-			 for (size_t i = 0; i < len; ++i) {
-				con->_writeBuf->Push(data[i] ^ con->_mask[i%WS_MASK_LEN]);
-			 }
+		  static inline bool PushMask (std::shared_ptr<con_type> &con , const char *data, size_t len) {
+			 if (len == 0) return true;
+			 return con->_writeBuf->Push(data, len, reinterpret_cast<const char *>(con->_mask), WS_MASK_LEN);
 		  }
 
 		  // TODO Clean up bounds checks
@@ -497,8 +661,9 @@ namespace coypu
 				  }
 										
 				  buf->Pop(data, offset, con->_frame._len); // copy
-				  bool b = Queue(con->_fd, WS_OP_PONG, data, con->_frame._len);
-				  assert(b);
+				  if (!Queue(con->_fd, WS_OP_PONG, data, con->_frame._len)) {
+					 _logger->error("Pong not queued fd[{0}]", con->_fd);
+				  }
 				} else if (con->_frame._opcode == WS_OP_PONG) {
 				  _logger->debug("Pong");
 				} else if (con->_frame._opcode == WS_OP_CLOSE) {
@@ -744,13 +909,19 @@ namespace coypu
 			 return false;
 		  }
 
+		  // Waits for the blank line ending the headers, so a request or response split across reads
+		  // is parsed in one go with the start line first
 		  int HandleHTTP (std::shared_ptr<con_type> &con) {
 			 char header[MAX_HEADER_SIZE]; // max header
 			 uint64_t offset = 0;
 
+			 if (!con->_httpBuf->Find(HEADER_END, HEADER_END_LEN, offset)) {
+				return con->_httpBuf->Available() >= MAX_HEADERS_SIZE ? -3 : 0;
+			 }
+
 			 bool is_uri = true;
 			 bool done = false;
-			 while (con->_httpBuf->Find(LF, offset) && !done) {
+			 while (!done && con->_httpBuf->Find(LF, offset)) {
 				if (offset == 1) {
 				  con->_httpBuf->Pop(header, offset+1);
 				  done = true;
@@ -14,6 +14,7 @@
 #include <iostream>
 #include <unordered_map>
 #include <thread>
+#include <atomic>
 #include <iomanip>
 #include <sstream>
 
@@ -35,14 +36,18 @@
 #include "net/ssl/openssl_mgr.h"
 #include "http/websocket.h"
 #include "mem/mem.h"
+#include "mem/pool.h"
 #include "file/file.h"
 #include "store/store.h"
 #include "store/storeutil.h"
+#include "store/segmented.h"
 #include "buf/buf.h"
+#include "buf/fixed.h"
 #include "cache/seqcache.h"
 #include "cache/tagcache.h"
 #include "book/level.h"
 #include "util/backtrace.h"
+#include "util/histogram.h"
 #include "admin/admin.h"
 #include "protobuf/protomgr.h"
 #include "protobuf/streams.h"
@@ -84,7 +89,11 @@ enum CoypuEvents {
   CE_BOOK_CLEAR_GDAX,
   CE_BOOK_CLEAR_KRAKEN,
   CE_WS_CONNECT_GDAX,
-  CE_WS_CONNECT_KRAKEN
+  CE_WS_CONNECT_KRAKEN,
+  CE_REACTOR_ACCEPT,   // payload is the accepted client fd
+  CE_REACTOR_PUBLISH,
+  CE_REACTOR_STATS,    // payload is the reactor's slot in the StatsRequest
+  CE_STATS_DONE        // every reactor has written its part of the StatsRequest
 };
 
 struct CoinLevel
@@ -141,23 +150,53 @@ struct CoinCache {
 
 // BEGIN Coypu Types
 typedef std::shared_ptr<SPDLogger> LogType;
+#ifdef COYPU_IO_URING
+typedef coypu::event::EventManager<LogType, coypu::event::IOUringBackend> EventManagerType;
+#else
 typedef coypu::event::EventManager<LogType> EventManagerType;
+#endif
+#ifdef COYPU_MMAP_WINDOW
+// 64GB of address space per log, file grown 64MB at a time
+typedef coypu::store::LogWindowStream<1ULL << 36, 64*1024*1024> RWBufType;
+typedef coypu::store::LogWindowReadStream<1ULL << 36, 64*1024*1024> ReadBufType;
+#else
 typedef coypu::store::LogRWStream<MMapShared, coypu::store::LRUCache, 128> RWBufType;
+typedef coypu::store::LogReadStream<MMapShared, coypu::store::LRUCache, 128> ReadBufType;
+#endif
 typedef coypu::store::PositionedStream <RWBufType> StreamType;
+#ifdef COYPU_FIXED_BUFFERS
+// capacity must match the managers' BUFFER_CAPACITY
+typedef coypu::buf::FixedBipBuf <char, uint64_t, 64*1024> WSBufType;
+typedef coypu::buf::FixedBipBuf <char, int, 64*1024> ProtoBufType;
+#else
+typedef coypu::buf::BipBuf <char, uint64_t> WSBufType;
+typedef coypu::buf::BipBuf <char, int> ProtoBufType;
+#endif
 typedef coypu::store::LogRWStream<MMapAnon, coypu::store::OneShotCache, 128> AnonRWBufType;
 typedef coypu::store::PositionedStream <AnonRWBufType> AnonStreamType;
-typedef coypu::store::MultiPositionedStreamLog <RWBufType> PublishStreamType;
-typedef coypu::http::websocket::WebSocketManager <LogType, StreamType, PublishStreamType> WebSocketManagerType;
-typedef coypu::http::websocket::WebSocketManager <LogType, AnonStreamType, PublishStreamType> AnonWebSocketManagerType;
+#ifdef COYPU_MMAP_WINDOW
+typedef RWBufType PublishLogType;
+typedef ReadBufType ReactorPublishLogType;
+#else
+// publish log split into segments with retention, offsets run on across them
+typedef coypu::store::SegmentedLog<RWBufType> PublishLogType;
+typedef coypu::store::SegmentedReadLog<ReadBufType, RWBufType> ReactorPublishLogType;
+#endif
+typedef coypu::store::MultiPositionedStreamLog <PublishLogType> PublishStreamType;
+typedef coypu::store::MultiPositionedStreamLog <RWBufType> CacheStreamType;
+typedef coypu::http::websocket::WebSocketManager <LogType, StreamType, PublishStreamType, WSBufType> WebSocketManagerType;
+typedef coypu::http::websocket::WebSocketManager <LogType, AnonStreamType, PublishStreamType, WSBufType> AnonWebSocketManagerType;
+typedef coypu::store::MultiPositionedStreamLog <ReactorPublishLogType> ReactorPublishStreamType;
+typedef coypu::http::websocket::WebSocketManager <LogType, AnonStreamType, ReactorPublishStreamType, WSBufType> ReactorWebSocketManagerType;
 typedef coypu::http2::HTTP2GRPCManager <LogType, AnonStreamType, PublishStreamType, coypu::msg::CoypuRequest, coypu::msg::CoypuMessage> HTTP2GRPCManagerType;
 typedef LogWriteBuf<MMapShared> StoreType;
-typedef SequenceCache<CoinCache, 128, PublishStreamType, void> CacheType;
+typedef SequenceCache<CoinCache, 128, CacheStreamType, void> CacheType;
 typedef CBook <CoinLevel, 4096*16>  BookType;
 typedef std::unordered_map <std::string, std::shared_ptr<BookType> > BookMapType;
 typedef AdminManager<LogType> AdminManagerType;
-typedef ProtoManager<LogType, coypu::msg::CoypuRequest, coypu::msg::CoypuMessage> ProtoManagerType;
+typedef ProtoManager<LogType, coypu::msg::CoypuRequest, coypu::msg::CoypuMessage, ProtoBufType> ProtoManagerType;
 typedef OpenSSLManager <LogType> SSLType;
-typedef std::function<void(void)> CBType;
+typedef std::function<void(uint64_t)> CBType; // payload from EventCBManager::Queue
 typedef std::unordered_map <int, std::shared_ptr<AnonStreamType>> TxtBufMapType;
 typedef TagStream<Tag> TagStreamType;
 // END Coypu Types
@@ -167,13 +206,75 @@ const std::string COYPU_CACHE_PATH = "stream/cache/data";
 const std::string COYPU_DEFAULT_ADMIN_PORT = "9999";
 const std::string COYPU_DEFAULT_PROTO_PORT = "8088";
 const std::string COYPU_DEFAULT_GRPC_PORT = "8089";
+const int COYPU_DEFAULT_MAX_EVENTS = 16;
+const int COYPU_DEFAULT_MAX_EVENTS_LIMIT = 1024;
+const size_t COYPU_CONNECTION_BUFFER_SIZE = 64*1024; // manager read/write buffer capacity
 
 const std::string COYPU_ADMIN_STOP = "stop";
 const std::string COYPU_ADMIN_QUEUE = "queue";
+const std::string COYPU_ADMIN_STATS = "stats";
+const uint32_t FEED_LATENCY_WINDOW_SECONDS = 60; // feed readiness histogram is logged and reset this often
+
+// Admin stats across loops. The feed handler writes its part when the command arrives, each reactor
+// writes its own slot on its own loop and the last one queues CE_STATS_DONE back to send the reply.
+typedef struct StatsRequestS {
+  StatsRequestS (int fd, uint32_t top, uint32_t reactors) : _fd(fd), _top(top), _reactors(reactors),
+																				_pending(reactors) {
+  }
+  StatsRequestS(const StatsRequestS &other) = delete;
+  StatsRequestS &operator=(const StatsRequestS &other) = delete;
+
+  int _fd;
+  uint32_t _top;
+  std::string _main;
+  std::vector<std::string> _reactors;
+  std::atomic<uint32_t> _pending;
+} StatsRequest;
+
+// Websocket fan-out reactor. Runs its own event loop on its own thread and owns the client fds handed
+// to it, reading the publish log through a private view that the feed handler publishes into.
+typedef struct CoypuReactorS {
+  typedef ReactorWebSocketManagerType ws_manager_type;
+
+  CoypuReactorS (LogType &logger, const std::string &cpus, uint32_t index, uint32_t clientEventFlags) :
+	 _logger(logger), _cpus(cpus), _index(index), _clientEventFlags(clientEventFlags), _notify(false),
+	 _useBufferPool(false)
+  {
+	 _txtBufs = std::make_shared<TxtBufMapType>();
+	 _eventMgr = std::make_shared<EventManagerType>(logger);
+	 _set_write_ws = std::bind(&EventManagerType::SetWrite, _eventMgr, std::placeholders::_1);
+	 _wsAnonManager = std::make_shared<ws_manager_type>(logger, _set_write_ws);
+  }
+  CoypuReactorS(const CoypuReactorS &other) = delete;
+  CoypuReactorS &operator=(const CoypuReactorS &other) = delete;
+
+  LogType _logger;
+  std::string _cpus;
+  uint32_t _index;
+  uint32_t _clientEventFlags;
+  std::atomic<bool> _notify; // CE_REACTOR_PUBLISH queued and not yet run
+
+  std::shared_ptr <TxtBufMapType> _txtBufs;
+  std::shared_ptr <EventManagerType> _eventMgr;
+  std::function<int(int)> _set_write_ws;
+  std::shared_ptr <ws_manager_type> _wsAnonManager;
+  std::shared_ptr <ReactorPublishLogType> _publishBuf;
+  std::shared_ptr <ReactorPublishStreamType> _publishStreamSP;
+  std::shared_ptr <EventCBManager<CBType>> _cbManager;
+  std::shared_ptr <EventCBManager<CBType>> _ownerCBManager; // feed handler's, for CE_STATS_DONE
+  std::shared_ptr <StatsRequest> _statsRequest; // std::atomic_store/exchange, set before CE_REACTOR_STATS
+  std::shared_ptr <BufferPool> _bufferPool;
+  bool _useBufferPool;
+  std::thread _thread;
+} CoypuReactor;
 
 typedef struct CoypuContextS {
+  typedef AnonWebSocketManagerType ws_manager_type;
+
   CoypuContextS (LogType &consoleLogger, LogType &wsLogger, LogType&httpLogger,
-					  const std::string &grpcPath) : _consoleLogger(consoleLogger), _krakenFD(-1), _coinbaseFD(-1)
+					  const std::string &grpcPath) : _consoleLogger(consoleLogger), _krakenFD(-1), _coinbaseFD(-1),
+															  _clientEventFlags(EF_NONE), _busyPollUsec(0), _feedLatencyStart(::time(nullptr)),
+															  _nextReactor(0)
   {
 	 _txtBufs = std::make_shared<TxtBufMapType>();
 	 _eventMgr = std::make_shared<EventManagerType>(consoleLogger);
@@ -196,6 +297,10 @@ typedef struct CoypuContextS {
   LogType _consoleLogger;
   int _krakenFD;
   int _coinbaseFD;
+  uint32_t _clientEventFlags; // EventManager flags for accepted client fds
+  int _busyPollUsec;          // SO_BUSY_POLL for feed sockets, 0 off
+  coypu::util::Histogram _feedLatency; // rdtsc cycles from feed readiness to onText
+  time_t _feedLatencyStart;            // last _feedLatency reset
 
   std::vector<std::shared_ptr <BookMapType>> _bookSourceMap;
   std::shared_ptr <TxtBufMapType> _txtBufs;
@@ -210,18 +315,40 @@ typedef struct CoypuContextS {
 
   std::shared_ptr <PublishStreamType> _publishStreamSP;
 
-  std::shared_ptr <PublishStreamType> _cacheStreamSP;
+  std::shared_ptr <CacheStreamType> _cacheStreamSP;
   std::shared_ptr <CacheType> _coinCache;
   std::shared_ptr <StreamType> _gdaxStreamSP;
   std::shared_ptr <StreamType> _krakenStreamSP;
   std::shared_ptr <EventCBManager<CBType>> _cbManager;
   std::shared_ptr <TagStreamType> _tagManager;
   std::shared_ptr <TagStore> _tagStore;
+  std::shared_ptr <BufferPool> _bufferPool; // connection buffers for this thread's managers
 
   std::unordered_map<int, std::pair<std::string, std::string>> _krakenChannelToPairType;
+
+  // websocket clients are sharded round robin across these when any are configured
+  std::vector<std::shared_ptr <CoypuReactor>> _reactors;
+  uint32_t _nextReactor;
+  std::shared_ptr <StatsRequest> _statsRequest; // admin stats waiting on reactors, feed handler thread only
 } CoypuContext;
 
-void EventMgrWait (std::shared_ptr<CoypuContext> &context, bool &done) {
+// feed handler thread, sends the admin stats reply once no reactor still owes its part
+void WriteStatsResponse (std::shared_ptr<CoypuContext> &context) {
+  std::shared_ptr<StatsRequest> request = context->_statsRequest;
+  if (!request || request->_pending.load(std::memory_order_acquire)) return;
+  context->_statsRequest.reset();
+
+  std::string out = request->_main;
+  for (const std::string &s : request->_reactors) {
+	 out += s;
+  }
+  int r = context->_adminManager->WriteResponse(request->_fd, out);
+  if (r != 0) {
+	 context->_consoleLogger->error("Admin '{0}' response failed [{1}]", COYPU_ADMIN_STATS, r);
+  }
+}
+
+void EventMgrWait (std::shared_ptr<CoypuContext> &context, std::atomic<bool> &done) {
   CPUManager::SetName("coypu_epoll");
 
   while (!done) {
@@ -231,6 +358,64 @@ void EventMgrWait (std::shared_ptr<CoypuContext> &context, bool &done) {
   }
 }
 
+void ReactorWait (std::shared_ptr<CoypuReactor> reactor, std::atomic<bool> &done) {
+  CPUManager::SetName("coypu_ws" + std::to_string(reactor->_index));
+  if (!reactor->_cpus.empty() && CPUManager::SetCPUs(reactor->_cpus)) {
+	 reactor->_logger->error("Reactor [{0}] failed to set cpus [{1}]", reactor->_index, reactor->_cpus);
+  }
+
+  // after pinning, so the pool is on this reactor's node
+  if (reactor->_useBufferPool) {
+	 reactor->_bufferPool = std::make_shared<BufferPool>(COYPU_CONNECTION_BUFFER_SIZE, MemManager::GetCurrentNode());
+	 reactor->_wsAnonManager->SetBufferPool(reactor->_bufferPool);
+  }
+
+  // wait times out so done is seen without a wakeup
+  while (!done) {
+	 if(reactor->_eventMgr->Wait() < 0) {
+		reactor->_logger->error("Reactor [{0}] wait failed", reactor->_index);
+		break;
+	 }
+  }
+
+  if (reactor->_bufferPool) {
+	 std::stringstream ss;
+	 ss << *reactor->_bufferPool;
+	 reactor->_logger->info("Reactor [{0}] {1}", reactor->_index, ss.str());
+  }
+}
+
+// Wraps readv/writev style io so the event manager can report bytes per fd
+std::function<int(int,const struct iovec *,int)> CountBytes (const std::shared_ptr<EventManagerType> &eventMgr,
+																				 std::function<int(int,const struct iovec *,int)> io, bool in) {
+  EventManagerType *mgr = eventMgr.get(); // outlives the fds registered on it
+  return [mgr, io, in] (int fd, const struct iovec *iov, int count) -> int {
+	 int r = io(fd, iov, count);
+	 if (r > 0) {
+		mgr->AddBytes(fd, in ? r : 0, in ? 0 : r);
+	 }
+	 return r;
+  };
+}
+
+// Call once a publish record is complete (coded streams destroyed). Wakes local websocket clients and
+// hands the new log length to each fan-out reactor, queueing at most one wakeup per reactor.
+void PublishAll (std::shared_ptr<CoypuContext> &context) {
+#ifndef COYPU_MMAP_WINDOW
+  context->_publishStreamSP->GetStream()->Checkpoint(); // segments start on a record
+#endif
+  context->_wsAnonManager->SetWriteAll();
+  if (context->_reactors.empty()) return;
+
+  const uint64_t available = context->_publishStreamSP->Available();
+  for (auto &reactor : context->_reactors) {
+	 reactor->_publishBuf->Publish(available);
+	 if (!reactor->_notify.exchange(true) && !reactor->_cbManager->Queue(CE_REACTOR_PUBLISH)) {
+		reactor->_notify.store(false); // full, retry on the next publish
+	 }
+  }
+}
+
 void EventClearBooks (uint32_t source, std::weak_ptr<CoypuContext> wContext) {
   auto consoleLogger = spdlog::get("console");
   assert(consoleLogger);
@@ -249,6 +434,17 @@ void EventClearBooks (uint32_t source, std::weak_ptr<CoypuContext> wContext) {
   }
 }
 
+// Text frame for the json parser: in place when it sits in one log page, otherwise copied into scratch.
+// nullptr when it does not fit.
+template <typename StreamType>
+const char *FrameText (StreamType &stream, uint64_t offset, uint64_t len, char *scratch, size_t scratchLen) {
+  coypu::buf::FrameView<char> frame;
+  if (stream->View(offset, len, frame)) {
+	 return frame.Linear(scratch, scratchLen);
+  }
+  return (len <= scratchLen && stream->Pop(scratch, offset, len)) ? scratch : nullptr;
+}
+
 template <typename RecordType>
 int RestoreStore (const std::string &name, const std::function<void(const char *, ssize_t)> &restore_record_cb) {
   uint32_t index = 0;
@@ -359,19 +555,27 @@ std::shared_ptr<EventCBManager<T>> CreateCBManager (std::shared_ptr<CoypuContext
   int fd = EventFDHelper::CreateNonBlockEventFD(0);
   if (fd < 0) return nullptr;
 
-  std::shared_ptr <event_type> sp = std::make_shared<event_type>(fd, contextSP->_set_write_ws);
+  std::shared_ptr <event_type> sp = std::make_shared<event_type>(fd);
 
   std::weak_ptr<CoypuContext> wContext = contextSP;
-  std::function<void(void)> cb = [wContext] () -> void { EventClearBooks(SOURCE_GDAX, wContext); }; 
+  CBType cb = [wContext] (uint64_t) -> void { EventClearBooks(SOURCE_GDAX, wContext); }; 
   sp->Register(CE_BOOK_CLEAR_GDAX, cb);
   
-  cb = [wContext] () -> void { EventClearBooks(SOURCE_KRAKEN, wContext); }; 
+  cb = [wContext] (uint64_t) -> void { EventClearBooks(SOURCE_KRAKEN, wContext); }; 
   sp->Register(CE_BOOK_CLEAR_KRAKEN, cb);
+
+  cb = [wContext] (uint64_t) -> void {
+	 auto context = wContext.lock();
+	 if (context) {
+		WriteStatsResponse(context);
+	 }
+  };
+  sp->Register(CE_STATS_DONE, cb);
   
+  // producers write the eventfd directly, no write interest needed
   std::function<int(int)> readCB = std::bind(&event_type::Read, sp, std::placeholders::_1);
-  std::function<int(int)> writeCB = std::bind(&event_type::Write, sp, std::placeholders::_1);
   std::function<int(int)> closeCB = std::bind(&event_type::Close, sp, std::placeholders::_1);
-  if (contextSP->_eventMgr->Register(fd, readCB, writeCB, closeCB) != 0) {
+  if (contextSP->_eventMgr->Register(fd, readCB, nullptr, closeCB) != 0) {
 	 std::cerr << "Failed to register queue" << std::endl;
 	 assert(false);
 	 return nullptr;
@@ -417,16 +621,8 @@ void SetupSimpleServer (std::string &interface,
 		std::function<int(int,const struct iovec *,int)> wv = [] (int fd, const struct iovec *iov, int count) -> int { return ::writev(fd, iov, count); };
 		manager->Register(clientfd, rv, wv);	
 		
-		std::function<int(int)> readCB = std::bind(&T::Read, manager, std::placeholders::_1);
-		std::function<int(int)> writeCB = std::bind(&T::Write, manager, std::placeholders::_1);
-		std::function<int(int)> closeCB = [wManager] (int fd) {
-		  auto manager = wManager.lock();
-		  if (manager) {
-			 manager->Unregister(fd);
-		  }
-		  return 0;
-		};
-		eventMgr->Register(clientfd, readCB, writeCB, closeCB);
+		// static dispatch - manager is owned by the context for the life of the event loop
+		eventMgr->Register<T, &T::Read, &T::Write, &T::Unregister>(clientfd, manager.get());
 	 }
 	 
 	 return 0;
@@ -444,14 +640,94 @@ void SetupSimpleServer (std::string &interface,
 }
 
 
+// Keeps pages of a store mapped ahead of its writer on a SegmentAllocator thread. The window streams
+// map whole extents and have no per page roll to take off the write path.
+void PrefaultStore(std::shared_ptr<CoypuContext> &contextSP, const std::shared_ptr<RWBufType> &bufSP, uint32_t pages) {
+#ifndef COYPU_MMAP_WINDOW
+  if (!bufSP || pages == 0) return;
+  std::shared_ptr<coypu::store::SegmentAllocator> segments =
+	 std::make_shared<coypu::store::SegmentAllocator>(bufSP->GetFD(), bufSP->GetPageSize(), bufSP->Available(), pages);
+  if (segments->Start() || !bufSP->SetSegmentAllocator(segments)) {
+	 contextSP->_consoleLogger->error("Failed to start segment allocator fd[{0}]", bufSP->GetFD());
+  }
+#endif
+}
+
+// Makes a store durable on a StoreFlusher thread, see FlushConfig
+void FlushStore(std::shared_ptr<CoypuContext> &contextSP, const std::shared_ptr<RWBufType> &bufSP,
+					 const coypu::store::FlushConfig &flush) {
+  if (!bufSP || flush._policy == coypu::store::FLUSH_NONE) return;
+  std::shared_ptr<coypu::store::StoreFlusher> flusher =
+	 std::make_shared<coypu::store::StoreFlusher>(bufSP->GetFD(), bufSP->GetPageSize(), bufSP->Available(), flush);
+  if (flusher->Start()) {
+	 contextSP->_consoleLogger->error("Failed to start store flusher fd[{0}]", bufSP->GetFD());
+	 return;
+  }
+  bufSP->SetFlusher(flusher);
+}
+
 void CreateStores(std::shared_ptr<CoypuConfig> &config, std::shared_ptr<CoypuContext> &contextSP) {
+  int prefaultPages = 0;
+  config->GetValue("store-prefault-pages", prefaultPages);
+
+  coypu::store::FlushConfig flush;
+  std::string flushPolicy;
+  int flushBytes = flush._bytes, flushIntervalMs = flush._intervalMs;
+  config->GetValue("store-flush-policy", flushPolicy);
+  config->GetValue("store-flush-bytes", flushBytes);
+  config->GetValue("store-flush-interval-ms", flushIntervalMs);
+  flush._bytes = flushBytes;
+  flush._intervalMs = flushIntervalMs;
+  if (flushPolicy == "bytes") {
+	 flush._policy = coypu::store::FLUSH_BYTES;
+  } else if (flushPolicy == "interval") {
+	 flush._policy = coypu::store::FLUSH_INTERVAL;
+  } else if (flushPolicy == "roll") {
+	 flush._policy = coypu::store::FLUSH_ROLL;
+  } else if (!flushPolicy.empty() && flushPolicy != "none") {
+	 contextSP->_consoleLogger->error("Unknown store-flush-policy [{0}], using none", flushPolicy);
+  }
+
   std::string publish_path;
   config->GetValue("coypu-publish-path", publish_path, COYPU_PUBLISH_PATH);
+#ifdef COYPU_MMAP_WINDOW
   contextSP->_publishStreamSP = coypu::store::StoreUtil::CreateRollingStore<PublishStreamType, RWBufType>(publish_path); 
+  if (contextSP->_publishStreamSP) {
+	 PrefaultStore(contextSP, contextSP->_publishStreamSP->GetStream(), prefaultPages);
+	 FlushStore(contextSP, contextSP->_publishStreamSP->GetStream(), flush);
+  }
+#else
+  coypu::store::SegmentConfig segments;
+  int segmentMB = segments._segmentBytes / (1024*1024), segmentSeconds = 0, retainMB = 0, retainSeconds = 0;
+  config->GetValue("publish-segment-mb", segmentMB);
+  config->GetValue("publish-segment-seconds", segmentSeconds);
+  config->GetValue("publish-retain-mb", retainMB);
+  config->GetValue("publish-retain-seconds", retainSeconds);
+  segments._segmentBytes = static_cast<uint64_t>(std::max(segmentMB, 1)) * 1024 * 1024;
+  segments._segmentSeconds = std::max(segmentSeconds, 0);
+  segments._retainBytes = static_cast<uint64_t>(std::max(retainMB, 0)) * 1024 * 1024;
+  segments._retainSeconds = std::max(retainSeconds, 0);
+
+  std::shared_ptr<PublishLogType> publishLog =
+	 std::make_shared<PublishLogType>(publish_path, 64 * coypu::mem::MemManager::GetPageSize(), segments);
+  publishLog->SetPrefaultPages(prefaultPages);
+  publishLog->SetFlushConfig(flush);
+  if (publishLog->Open()) {
+	 contextSP->_consoleLogger->perror(errno, "Open publish log");
+  } else {
+	 contextSP->_publishStreamSP = std::make_shared<PublishStreamType>(publishLog);
+	 contextSP->_consoleLogger->info("Publish log segments[{0}] first[{1}] available[{2}]", publishLog->Segments(),
+												publishLog->First(), publishLog->Available());
+  }
+#endif
 
   std::string cache_path;
   config->GetValue("coypu-cache-path", cache_path, COYPU_CACHE_PATH);
-  contextSP->_cacheStreamSP = coypu::store::StoreUtil::CreateRollingStore<PublishStreamType, RWBufType>(cache_path); 
+  contextSP->_cacheStreamSP = coypu::store::StoreUtil::CreateRollingStore<CacheStreamType, RWBufType>(cache_path); 
+  if (contextSP->_cacheStreamSP) {
+	 PrefaultStore(contextSP, contextSP->_cacheStreamSP->GetStream(), prefaultPages);
+	 FlushStore(contextSP, contextSP->_cacheStreamSP->GetStream(), flush);
+  }
 
   contextSP->_coinCache = std::make_shared<CacheType>(contextSP->_cacheStreamSP);
 
@@ -483,6 +759,8 @@ void CreateStores(std::shared_ptr<CoypuConfig> &config, std::shared_ptr<CoypuCon
 	 contextSP->_consoleLogger->info("Current size [{0}]", curSize);
 	  
 	 std::shared_ptr<RWBufType> bufSP = std::make_shared<RWBufType>(pageSize, curSize, fd, false);
+	 PrefaultStore(contextSP, bufSP, prefaultPages);
+	 FlushStore(contextSP, bufSP, flush);
 	 contextSP->_gdaxStreamSP = std::make_shared<StreamType>(bufSP);
   } else {
 	 contextSP->_consoleLogger->perror(errno, "Open");
@@ -500,6 +778,8 @@ void CreateStores(std::shared_ptr<CoypuConfig> &config, std::shared_ptr<CoypuCon
 	 contextSP->_consoleLogger->info("Current size [{0}]", curSize);
 	  
 	 std::shared_ptr<RWBufType> bufSP = std::make_shared<RWBufType>(pageSize, curSize, fd, false);
+	 PrefaultStore(contextSP, bufSP, prefaultPages);
+	 FlushStore(contextSP, bufSP, flush);
 	 contextSP->_krakenStreamSP = std::make_shared<StreamType>(bufSP);
   } else {
 	 contextSP->_consoleLogger->perror(errno, "Open");
@@ -507,23 +787,13 @@ void CreateStores(std::shared_ptr<CoypuConfig> &config, std::shared_ptr<CoypuCon
 
 }
 
-void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogType &logger, int fd) {
-  std::weak_ptr <CoypuContext> wContextSP = context;
-  struct sockaddr_in client_addr= {0};
-  socklen_t addrlen= sizeof(sockaddr_in);
-  
-  // using IP V4
-  int clientfd = TCPHelper::AcceptNonBlock(fd, reinterpret_cast<struct sockaddr *>(&client_addr), &addrlen);
-  if (TCPHelper::SetNoDelay(clientfd)) {
-  }
+// Registers an accepted websocket client with its owner, either the context or the fan-out reactor the
+// fd was handed to. Must run on the owner's event loop thread.
+template <typename OwnerType>
+void RegisterWebsocketClient (std::shared_ptr<OwnerType> &context, const LogType &logger, int clientfd) {
+  typedef typename OwnerType::ws_manager_type ws_manager_type;
+  std::weak_ptr <OwnerType> wContextSP = context;
 
-  int fastopen = 0;
-  TCPHelper::GetTCPFastOpen(clientfd, fastopen);
-  int send = 0, recv = 0;
-  TCPHelper::GetSendRecvSize(clientfd, send, recv);
-  
-  logger->info("accept ws fd[{0}] fastopen[{1}] send[{2}] recv[{3}]", clientfd, fastopen, send, recv);
-  
   if (context) {
 	 std::shared_ptr<AnonStreamType> txtBuf = coypu::store::StoreUtil::CreateAnonStore<AnonStreamType, AnonRWBufType>();
 	 context->_txtBufs->insert(std::make_pair(clientfd, txtBuf));
@@ -531,8 +801,8 @@ void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogTyp
 	 uint64_t init_offset = UINT64_MAX;
 	 context->_publishStreamSP->Register(clientfd, init_offset);
 	 
-	 std::function<int(int)> readCB = std::bind(&AnonWebSocketManagerType::Read, context->_wsAnonManager, std::placeholders::_1);
-	 std::function<int(int)> writeCB = std::bind(&AnonWebSocketManagerType::Write, context->_wsAnonManager, std::placeholders::_1);
+	 std::function<int(int)> readCB = std::bind(&ws_manager_type::Read, context->_wsAnonManager, std::placeholders::_1);
+	 std::function<int(int)> writeCB = std::bind(&ws_manager_type::Write, context->_wsAnonManager, std::placeholders::_1);
 	 std::function<int(int)> closeCB = [wContextSP] (int fd) {
 		auto context = wContextSP.lock();
 		if (context) {
@@ -549,15 +819,14 @@ void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogTyp
 
 	 std::function <void(uint64_t, uint64_t)> onText = [clientfd, txtBuf, wContextSP, logger] (uint64_t offset, off64_t len) {
 		// could do something with a request from client here. json sub msg? with mark
-		char jsonDoc[1024*1024] = {};
-		if (len < sizeof(jsonDoc)) {
-		  // sad copying but nice json library
-		  if(txtBuf->Pop(jsonDoc, offset, len)) {
-			 jsonDoc[len] = 0;
-			 logger->debug("{0} doc {1}", clientfd, jsonDoc);
+		char scratch[1024*1024]; // only written when the frame crosses a page
+		if (len < sizeof(scratch)) {
+		  const char *jsonDoc = FrameText(txtBuf, offset, len, scratch, sizeof(scratch));
+		  if(jsonDoc) {
+			 logger->debug("{0} doc {1}", clientfd, std::string(jsonDoc, len));
 					
 			 Document jd;
-			 if (!jd.Parse(jsonDoc).HasParseError()) {
+			 if (!jd.Parse(jsonDoc, len).HasParseError()) {
 				if (jd.HasMember("cmd")) {
 				  const char *cmd = jd["cmd"].GetString();
 				  if (!strncmp(cmd, "mark", 4)) {
@@ -600,11 +869,13 @@ void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogTyp
 		return;
 	 };
 	 
-	 std::function <int(int,const struct iovec*, int)> readvCB = [] (int fd, const struct iovec *iovec, int c) -> int { return ::readv(fd, iovec, c); };
-	 std::function <int(int,const struct iovec*, int)> writevCB = [] (int fd, const struct iovec *iovec, int c) -> int { return ::writev(fd, iovec, c); };
+	 // EF_RECV clients are read from the multishot recv's buffers, others fall through to readv
+	 EventManagerType *mgr = context->_eventMgr.get();
+	 std::function <int(int,const struct iovec*, int)> readvCB = CountBytes(context->_eventMgr, [mgr] (int fd, const struct iovec *iovec, int c) -> int { return mgr->Readv(fd, iovec, c); }, true);
+	 std::function <int(int,const struct iovec*, int)> writevCB = CountBytes(context->_eventMgr, [] (int fd, const struct iovec *iovec, int c) -> int { return ::writev(fd, iovec, c); }, false);
 	 bool b = context->_wsAnonManager->RegisterConnection(clientfd, true, readvCB, writevCB, nullptr, onText, txtBuf, context->_publishStreamSP);
 	 assert(b);
-	 int r = context->_eventMgr->Register(clientfd, readCB, writeCB, closeCB);
+	 int r = context->_eventMgr->Register(clientfd, readCB, writeCB, closeCB, context->_clientEventFlags);
 	 assert(r == 0);
 
 
@@ -638,6 +909,117 @@ void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogTyp
   }
 }
 
+void AcceptWebsocketClient (std::shared_ptr<CoypuContext> &context, const LogType &logger, int fd) {
+  struct sockaddr_in client_addr= {0};
+  socklen_t addrlen= sizeof(sockaddr_in);
+  
+  // using IP V4
+  int clientfd = TCPHelper::AcceptNonBlock(fd, reinterpret_cast<struct sockaddr *>(&client_addr), &addrlen);
+  if (clientfd < 0) {
+	 logger->perror(errno, "AcceptNonBlock");
+	 return;
+  }
+  if (TCPHelper::SetNoDelay(clientfd)) {
+  }
+
+  int fastopen = 0;
+  TCPHelper::GetTCPFastOpen(clientfd, fastopen);
+  int send = 0, recv = 0;
+  TCPHelper::GetSendRecvSize(clientfd, send, recv);
+  
+  logger->info("accept ws fd[{0}] fastopen[{1}] send[{2}] recv[{3}]", clientfd, fastopen, send, recv);
+
+  if (context) {
+	 if (context->_reactors.empty()) {
+		RegisterWebsocketClient(context, logger, clientfd);
+	 } else {
+		// round robin handoff, the reactor registers the fd on its own thread
+		auto &reactor = context->_reactors[context->_nextReactor++ % context->_reactors.size()];
+		if (!reactor->_cbManager->Queue(CE_REACTOR_ACCEPT, clientfd)) {
+		  logger->error("Reactor [{0}] queue full, close fd[{1}]", reactor->_index, clientfd);
+		  ::close(clientfd);
+		}
+	 }
+  }
+}
+
+std::shared_ptr<CoypuReactor> CreateReactor (std::shared_ptr<CoypuContext> &contextSP, LogType &logger,
+														  const std::string &cpus, uint32_t index, int maxEvents, int maxEventsLimit) {
+  auto reactor = std::make_shared<CoypuReactor>(logger, cpus, index, contextSP->_clientEventFlags);
+  if (reactor->_eventMgr->Init()) {
+	 logger->perror(errno, "Init");
+	 return nullptr;
+  }
+  reactor->_eventMgr->SetMaxEvents(maxEvents, maxEventsLimit);
+  if (reactor->_clientEventFlags & EF_EDGE_TRIGGERED) {
+	 reactor->_wsAnonManager->SetDrain(true);
+  }
+
+  const std::shared_ptr<PublishLogType> &publish = contextSP->_publishStreamSP->GetStream();
+#ifdef COYPU_MMAP_WINDOW
+  // read view sharing the writer's mapping of the publish log
+  reactor->_publishBuf = std::make_shared<ReadBufType>(*publish);
+#else
+  // private read view of the publish log segments, pages are mapped by this reactor only
+  reactor->_publishBuf = std::make_shared<ReactorPublishLogType>(*publish);
+#endif
+  reactor->_publishStreamSP = std::make_shared<ReactorPublishStreamType>(reactor->_publishBuf);
+
+  int fd = EventFDHelper::CreateNonBlockEventFD(0);
+  if (fd < 0) return nullptr;
+  reactor->_cbManager = std::make_shared<EventCBManager<CBType>>(fd);
+
+  std::weak_ptr<CoypuReactor> wReactor = reactor;
+  CBType cb = [wReactor] (uint64_t clientfd) -> void {
+	 auto reactor = wReactor.lock();
+	 if (reactor) {
+		RegisterWebsocketClient(reactor, reactor->_logger, static_cast<int>(clientfd));
+	 }
+  };
+  reactor->_cbManager->Register(CE_REACTOR_ACCEPT, cb);
+
+  cb = [wReactor] (uint64_t) -> void {
+	 auto reactor = wReactor.lock();
+	 if (reactor) {
+		reactor->_notify.store(false); // clear first so a publish racing this is not lost
+		reactor->_wsAnonManager->SetWriteAll();
+	 }
+  };
+  reactor->_cbManager->Register(CE_REACTOR_PUBLISH, cb);
+
+  cb = [wReactor] (uint64_t slot) -> void {
+	 auto reactor = wReactor.lock();
+	 if (reactor) {
+		std::shared_ptr<StatsRequest> request = std::atomic_exchange(&reactor->_statsRequest, std::shared_ptr<StatsRequest>());
+		if (!request) return;
+
+		std::stringstream ss;
+		ss << "reactor " << reactor->_index << " loop, counters since start\n";
+		reactor->_eventMgr->WriteStats(ss, request->_top);
+		if (reactor->_bufferPool) {
+		  ss << *reactor->_bufferPool << "\n";
+		}
+		ss << "ws " << reactor->_wsAnonManager->GetBackpressureStats() << "\n";
+		request->_reactors[slot] = ss.str();
+		if (request->_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		  reactor->_ownerCBManager->Queue(CE_STATS_DONE);
+		}
+	 }
+  };
+  reactor->_cbManager->Register(CE_REACTOR_STATS, cb);
+  reactor->_ownerCBManager = contextSP->_cbManager;
+
+  typedef EventCBManager<CBType> event_type;
+  std::function<int(int)> readCB = std::bind(&event_type::Read, reactor->_cbManager, std::placeholders::_1);
+  std::function<int(int)> closeCB = std::bind(&event_type::Close, reactor->_cbManager, std::placeholders::_1);
+  if (reactor->_eventMgr->Register(fd, readCB, nullptr, closeCB) != 0) {
+	 logger->perror(errno, "Register");
+	 return nullptr;
+  }
+
+  return reactor;
+}
+
 void AcceptHTTP2Client (std::shared_ptr<CoypuContext> &context, const LogType &logger, int fd) {
   std::weak_ptr <CoypuContext> wContextSP = context;
   struct sockaddr_in client_addr= {0};
@@ -700,14 +1082,17 @@ void StreamGDAX (std::shared_ptr<CoypuContext> contextSP, const std::string &hos
   assert(r == 0);
   r= TCPHelper::SetNoDelay(contextSP->_coinbaseFD);
   assert(r == 0);
+  if (contextSP->_busyPollUsec > 0 && TCPHelper::SetBusyPoll(contextSP->_coinbaseFD, contextSP->_busyPollUsec)) {
+	 contextSP->_consoleLogger->perror(errno, "SetBusyPoll");
+  }
 
   r = contextSP->_openSSLMgr->Register(contextSP->_coinbaseFD);
   assert(r == 0);
 
-  std::function <int(int,const struct iovec*,int)> sslReadCB =
-	 std::bind(&SSLType::ReadvNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3);
-  std::function <int(int,const struct iovec *,int)> sslWriteCB =
-	 std::bind(&SSLType::WritevNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3);
+  std::function <int(int,const struct iovec*,int)> sslReadCB = CountBytes(contextSP->_eventMgr,
+	 std::bind(&SSLType::ReadvNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3), true);
+  std::function <int(int,const struct iovec *,int)> sslWriteCB = CountBytes(contextSP->_eventMgr,
+	 std::bind(&SSLType::WritevNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3), false);
   
   std::function <void(int)> onOpen = [wContextSP, symbolList, channelList] (int fd) {
 	 auto context = wContextSP.lock();
@@ -741,21 +1126,21 @@ void StreamGDAX (std::shared_ptr<CoypuContext> contextSP, const std::string &hos
   std::function <void(uint64_t, uint64_t)> onText = [wContextSP] (uint64_t offset, off64_t len) {
 	 auto context = wContextSP.lock();
 	 if (context) {
+		context->_feedLatency.Record(__rdtsc() - context->_eventMgr->GetWakeTSC());
 		std::shared_ptr<BookMapType> &bookMap = context->_bookSourceMap[SOURCE_GDAX];
 
-		char jsonDoc[1024*1024] = {};
-		if (len < sizeof(jsonDoc)) {
-		  // sad copying but nice json library
-		  if(context->_gdaxStreamSP->Pop(jsonDoc, offset, len)) {
-			 jsonDoc[len] = 0;
+		char scratch[1024*1024]; // only written when the frame crosses a page
+		if (len < sizeof(scratch)) {
+		  const char *jsonDoc = FrameText(context->_gdaxStreamSP, offset, len, scratch, sizeof(scratch));
+		  if(jsonDoc) {
 			 Document jd;
 
 			 uint64_t start = 0, end = 0;
 			 unsigned int junk= 0;
 			 start = __rdtscp(&junk);
-			 jd.Parse(jsonDoc);
+			 jd.Parse(jsonDoc, len);
 			 if (jd.HasParseError()) {
-				context->_consoleLogger->error(jsonDoc);
+				context->_consoleLogger->error("{0}", std::string(jsonDoc, len));
 				context->_consoleLogger->error("JSON Error [{0}]",
 														 GetParseError_En(jd.GetParseError()));
 			 }
@@ -839,10 +1224,13 @@ void StreamGDAX (std::shared_ptr<CoypuContext> contextSP, const std::string &hos
 				  tick->set_ask_qty(ask.qty);
 				  tick->set_ask_px(ask.px);
 
-				  WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
- 				  LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
-				  google::protobuf::io::CodedOutputStream coded_output(&zOutput);
-				  cMsg.SerializeToCodedStream(&coded_output);
+				  {
+				    WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
+				    LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
+				    google::protobuf::io::CodedOutputStream coded_output(&zOutput);
+				    cMsg.SerializeToCodedStream(&coded_output);
+				    // force coded to destruct before publish
+				  }
 
 				  /*
 					 char pub[1024];
@@ -851,10 +1239,10 @@ void StreamGDAX (std::shared_ptr<CoypuContext> contextSP, const std::string &hos
 					 WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_TEXT_FRAME, false, len);
 					 context->_publishStreamSP->Push(pub, len);
 				  */
-				  context->_wsAnonManager->SetWriteAll();
+				  PublishAll(context);
 				}
 			 } else if (!strcmp(type, "error")) {
-				context->_consoleLogger->error("{0}", jsonDoc);
+				context->_consoleLogger->error("{0}", std::string(jsonDoc, len));
 			 } else if (!strcmp(type, "ticker")) {
 				const char *product = jd["product_id"].GetString();
 				const char *vol24 = jd["volume_24h"].GetString();
@@ -990,14 +1378,14 @@ void StreamGDAX (std::shared_ptr<CoypuContext> contextSP, const std::string &hos
 				  WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_TEXT_FRAME, false, len);
 				  context->_publishStreamSP->Push(pub, len);
 				  */
-				  context->_wsAnonManager->SetWriteAll();
+				  PublishAll(context);
 				}
 			 } else if (!strcmp(type, "subscriptions")) {
 				// skip
 			 } else if (!strcmp(type, "heartbeat")) {
 				// skip
 			 } else {
-				context->_consoleLogger->warn("{0} {1}", type, jsonDoc); // spdlog does not do streams
+				context->_consoleLogger->warn("{0} {1}", type, std::string(jsonDoc, len)); // spdlog does not do streams
 			 }
 		  } else {
 			 assert(false);
@@ -1041,13 +1429,16 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
   assert(r == 0);
   r= TCPHelper::SetNoDelay(contextSP->_krakenFD);
   assert(r == 0);
+  if (contextSP->_busyPollUsec > 0 && TCPHelper::SetBusyPoll(contextSP->_krakenFD, contextSP->_busyPollUsec)) {
+	 contextSP->_consoleLogger->perror(errno, "SetBusyPoll");
+  }
 
   contextSP->_openSSLMgr->Register(contextSP->_krakenFD);
 
-  std::function <int(int,const struct iovec*,int)> sslReadCB =
-	 std::bind(&SSLType::ReadvNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3);
-  std::function <int(int,const struct iovec *,int)> sslWriteCB =
-	 std::bind(&SSLType::WritevNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3);
+  std::function <int(int,const struct iovec*,int)> sslReadCB = CountBytes(contextSP->_eventMgr,
+	 std::bind(&SSLType::ReadvNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3), true);
+  std::function <int(int,const struct iovec *,int)> sslWriteCB = CountBytes(contextSP->_eventMgr,
+	 std::bind(&SSLType::WritevNonBlock, contextSP->_openSSLMgr, std::placeholders::_1,  std::placeholders::_2,  std::placeholders::_3), false);
 
   
   std::function <void(int)> onOpen = [wContextSP, symbolList] (int fd) {
@@ -1091,19 +1482,19 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
   std::function <void(uint64_t, uint64_t)> onText = [wContextSP] (uint64_t offset, off64_t len) {
 	 auto context = wContextSP.lock();
 	 if (context) {
+		context->_feedLatency.Record(__rdtsc() - context->_eventMgr->GetWakeTSC());
 		std::shared_ptr<BookMapType> &bookMap = context->_bookSourceMap[SOURCE_KRAKEN];
 
-		char jsonDoc[1024*1024] = {};
-		if (len < sizeof(jsonDoc)) {
-		  // sad copying but nice json library
-		  if(context->_krakenStreamSP->Pop(jsonDoc, offset, len)) {
-			 jsonDoc[len] = 0;
+		char scratch[1024*1024]; // only written when the frame crosses a page
+		if (len < sizeof(scratch)) {
+		  const char *jsonDoc = FrameText(context->_krakenStreamSP, offset, len, scratch, sizeof(scratch));
+		  if(jsonDoc) {
 			 Document jd;
 
 			 uint64_t start = 0, end = 0;
 			 unsigned int junk= 0;
 			 start = __rdtscp(&junk);
-			 jd.Parse(jsonDoc);
+			 jd.Parse(jsonDoc, len);
 			 end = __rdtscp(&junk);
 			 //printf("%zu\n", (end-start));
 			 //			 std::cerr << jsonDoc << std::endl;
@@ -1131,17 +1522,17 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
 						bookMap->insert(std::make_pair(pair, std::make_shared<BookType>(SOURCE_KRAKEN))); 
 					 }
 				  } else if (status == "error") {
-					 context->_consoleLogger->error("{0}", jsonDoc);
+					 context->_consoleLogger->error("{0}", std::string(jsonDoc, len));
 				  } else {
-					 context->_consoleLogger->error("{0}", jsonDoc);
+					 context->_consoleLogger->error("{0}", std::string(jsonDoc, len));
 					 assert(false);
 				  }
 				} else if (eventType == "heartbeat") {
 				  //{"event":"heartbeat"}
 				} else if (jd.HasMember("Error")) {
-				  context->_consoleLogger->error("{0}", jsonDoc);
+				  context->_consoleLogger->error("{0}", std::string(jsonDoc, len));
 				} else {
-				  std::cerr << jsonDoc << std::endl;
+				  std::cerr << std::string(jsonDoc, len) << std::endl;
 				  assert(false);
 				}
 			 } else {
@@ -1170,10 +1561,13 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
 					 trade->set_last_px(atof(px));
 					 trade->set_last_size(atof(qty));
 
-					 WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
-					 LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
-					 google::protobuf::io::CodedOutputStream coded_output(&zOutput);
-					 cMsg.SerializeToCodedStream(&coded_output);
+					 {
+					   WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
+					   LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
+					   google::protobuf::io::CodedOutputStream coded_output(&zOutput);
+					   cMsg.SerializeToCodedStream(&coded_output);
+					   // force coded to destruct before publish
+					 }
 
 					 /*
 						char pub[1024];
@@ -1181,7 +1575,7 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
 						WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_TEXT_FRAME, false, len);
 						context->_publishStreamSP->Push(pub, len);
 					 */
-					 context->_wsAnonManager->SetWriteAll();
+					 PublishAll(context);
 				  }
 				} else if (type == "ticker") {
 				  // nop
@@ -1294,10 +1688,13 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
 				  tick->set_ask_qty(ask.qty);
 				  tick->set_ask_px(ask.px);
 
-				  WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
-				  LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
-				  google::protobuf::io::CodedOutputStream coded_output(&zOutput);
-				  cMsg.SerializeToCodedStream(&coded_output);
+				  {
+				    WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_BINARY_FRAME, false, cMsg.ByteSize());
+				    LogZeroCopyOutputStream<std::shared_ptr <PublishStreamType>> zOutput(context->_publishStreamSP);
+				    google::protobuf::io::CodedOutputStream coded_output(&zOutput);
+				    cMsg.SerializeToCodedStream(&coded_output);
+				    // force coded to destruct before publish
+				  }
 
 				  /*
 					 char pub[1024];
@@ -1306,7 +1703,7 @@ void StreamKraken (std::shared_ptr<CoypuContext> contextSP, const std::string &h
 					 WebSocketManagerType::WriteFrame(context->_publishStreamSP, coypu::http::websocket::WS_OP_TEXT_FRAME, false, len);
 					 context->_publishStreamSP->Push(pub, len);
 				  */
-				  context->_wsAnonManager->SetWriteAll();
+				  PublishAll(context);
 				} else {
 				  std::cerr << "unsupported " << type << std::endl;
 				  assert(false);
@@ -1417,6 +1814,7 @@ int main(int argc, char **argv)
 
   // Config BEGIN
   std::string wsStoreFile;
+  std::vector<std::string> reactorCPUs; // one websocket fan-out reactor per entry
   LogType wsLogger;
   {
 	 auto cfg = config->GetConfig("coypu");
@@ -1429,6 +1827,7 @@ int main(int argc, char **argv)
 		  cfg->GetValue("logger", logger);
 		  cfg->GetValue("cpu", cpuStr);
 		  cfg->GetValue("store-file", wsStoreFile);
+		  cfg->GetSeqValues("reactor-cpus", reactorCPUs);
 		}
 	 }
 
@@ -1457,6 +1856,73 @@ int main(int argc, char **argv)
   auto contextSP = std::make_shared<CoypuContext>(consoleLogger, wsLogger, wsLogger, grpcPath);
   contextSP->_eventMgr->Init(); // needs to happens before cb manager so we can register the queue.
 
+  int maxEvents = COYPU_DEFAULT_MAX_EVENTS, maxEventsLimit = COYPU_DEFAULT_MAX_EVENTS_LIMIT;
+  config->GetValue("epoll-max-events", maxEvents);
+  config->GetValue("epoll-max-events-limit", maxEventsLimit);
+  if (contextSP->_eventMgr->SetMaxEvents(maxEvents, maxEventsLimit)) {
+	 consoleLogger->error("Invalid epoll-max-events [{0}] epoll-max-events-limit [{1}]", maxEvents, maxEventsLimit);
+  }
+
+  // feed handler loop trades cpu for wakeup latency: spin N empty polls before blocking, -1 never blocks
+  int spin = 0;
+  config->GetValue("epoll-spin", spin);
+  contextSP->_eventMgr->SetSpin(spin < 0 ? SPIN_FOREVER : static_cast<uint32_t>(spin));
+  config->GetValue("feed-busy-poll-usec", contextSP->_busyPollUsec);
+
+  // callback cycles and loop histograms for the admin 'stats' command
+  bool eventStats = false;
+  config->GetValue("event-stats", eventStats);
+  contextSP->_eventMgr->SetInstrument(eventStats);
+
+  // connection buffers from 2MB huge page slabs on this thread's (and each reactor's) numa node
+  bool bufferPool = false;
+  config->GetValue("connection-buffer-pool", bufferPool);
+  if (bufferPool) {
+	 contextSP->_bufferPool = std::make_shared<BufferPool>(COYPU_CONNECTION_BUFFER_SIZE, MemManager::GetCurrentNode());
+	 contextSP->_wsAnonManager->SetBufferPool(contextSP->_bufferPool);
+	 contextSP->_adminManager->SetBufferPool(contextSP->_bufferPool);
+	 contextSP->_protoManager->SetBufferPool(contextSP->_bufferPool);
+  }
+
+  // websocket client queues past the write buffer, see BackpressureConfig
+  coypu::http::BackpressureConfig backpressure;
+  int highWater = backpressure._highWater, lowWater = backpressure._lowWater, overflowChunks = 0;
+  std::string policy;
+  config->GetValue("ws-high-water", highWater);
+  config->GetValue("ws-low-water", lowWater);
+  config->GetValue("ws-overflow-chunks", overflowChunks);
+  config->GetValue("ws-overflow-spill", backpressure._spill);
+  config->GetValue("ws-backpressure-policy", policy);
+  backpressure._highWater = highWater;
+  backpressure._lowWater = lowWater;
+  backpressure._maxChunks = overflowChunks;
+  if (policy == "disconnect") {
+	 backpressure._policy = coypu::http::BP_DISCONNECT;
+  } else if (policy == "conflate") {
+	 backpressure._policy = coypu::http::BP_CONFLATE;
+  } else if (!policy.empty() && policy != "drop-oldest") {
+	 consoleLogger->error("Unknown ws-backpressure-policy [{0}], using drop-oldest", policy);
+  }
+  contextSP->_wsAnonManager->SetBackpressure(backpressure);
+
+  // reactor publish writes of one loop pass submitted together (io_uring backend only)
+  int writeBatch = 0;
+  config->GetValue("reactor-write-batch", writeBatch);
+
+  // reactor clients read by a multishot recv into buffers provided to the ring (io_uring backend only)
+  int recvBuffers = 0;
+  int recvBufferSize = 4096;
+  config->GetValue("reactor-recv-buffers", recvBuffers);
+  config->GetValue("reactor-recv-buffer-size", recvBufferSize);
+
+  // edge triggered websocket clients - manager must drain reads until EAGAIN
+  bool edgeTriggered = false;
+  config->GetValue("epoll-edge-triggered", edgeTriggered);
+  if (edgeTriggered) {
+	 contextSP->_clientEventFlags = EF_EDGE_TRIGGERED;
+	 contextSP->_wsAnonManager->SetDrain(true);
+  }
+
   contextSP->_cbManager = CreateCBManager<CBType, EventManagerType>(contextSP);
   contextSP->_tagManager = CreateTagManager(contextSP);
   contextSP->_tagStore = std::make_shared<TagStore>("tag/tags.store");
@@ -1466,6 +1932,53 @@ int main(int argc, char **argv)
 
   CreateStores(config, contextSP);
 
+  // BEGIN Websocket reactors
+  for (uint32_t i = 0; i < reactorCPUs.size(); ++i) {
+	 // console logger is thread safe, file loggers are not
+	 auto reactor = CreateReactor(contextSP, consoleLogger, reactorCPUs[i], i, maxEvents, maxEventsLimit);
+	 if (reactor) {
+		reactor->_useBufferPool = bufferPool; // created on the reactor thread
+		reactor->_wsAnonManager->SetBackpressure(backpressure);
+		if (writeBatch > 0) {
+		  std::weak_ptr<CoypuReactor::ws_manager_type> wManager = reactor->_wsAnonManager;
+		  std::function<void(int, uint32_t)> unsent = [wManager] (int fd, uint32_t bytes) -> void {
+			 auto manager = wManager.lock();
+			 if (manager) {
+				manager->Unsent(fd, bytes);
+			 }
+		  };
+		  if (reactor->_eventMgr->SetWriteBatch(writeBatch, unsent)) {
+			 consoleLogger->error("Reactor [{0}] can not batch writes of [{1}], needs the io_uring backend", i, writeBatch);
+		  } else {
+			 reactor->_wsAnonManager->SetPublishWritev(std::bind(&EventManagerType::Writev, reactor->_eventMgr,
+																				  std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+#ifndef COYPU_MMAP_WINDOW
+			 // queued writes point into the read cache, they go out before it remaps a page
+			 std::weak_ptr<EventManagerType> wEventMgr = reactor->_eventMgr;
+			 reactor->_publishBuf->SetEvictCB([wEventMgr] () -> void {
+				  auto eventMgr = wEventMgr.lock();
+				  if (eventMgr) {
+					 eventMgr->FlushWrites();
+				  }
+				});
+#endif
+		  }
+		}
+		if (recvBuffers > 0) {
+		  if (reactor->_eventMgr->SetRecvBuffers(static_cast<uint32_t>(recvBuffers), static_cast<uint32_t>(recvBufferSize))) {
+			 consoleLogger->error("Reactor [{0}] can not provide [{1}] recv buffers, needs the io_uring backend", i, recvBuffers);
+		  } else {
+			 reactor->_clientEventFlags |= EF_RECV;
+		  }
+		}
+		contextSP->_reactors.push_back(reactor);
+	 } else {
+		consoleLogger->error("Failed to create reactor [{0}]", i);
+	 }
+  }
+  consoleLogger->info("Websocket reactors [{0}]", contextSP->_reactors.size());
+  // END Websocket reactors
+
   // Init event manager
 
   // BEGIN Signal
@@ -1479,7 +1992,7 @@ int main(int argc, char **argv)
 	 consoleLogger->perror(errno, "CreateNonBlockSignalFD");
   }
 
-  bool done = false;
+  std::atomic<bool> done(false);
   coypu::event::callback_type readCB = [&done](int fd) {
 	 struct signalfd_siginfo signal;
 	 int count = ::read(fd, &signal, sizeof(signal));  
@@ -1552,7 +2065,7 @@ int main(int argc, char **argv)
 	 config->GetSeqValues("gdax-symbols", symbolList);
 	 config->GetSeqValues("gdax-channels", channelList);
   
-	 std::function<void(void)> cb = [wContext, symbolList, channelList] () -> void {
+	 CBType cb = [wContext, symbolList, channelList] (uint64_t) -> void {
 		auto contextSP = wContext.lock();
 		if (contextSP) {
 		  std::string gdax_hostname = "ws-feed.pro.coinbase.com";
@@ -1581,7 +2094,7 @@ int main(int argc, char **argv)
 	 config->GetValue("kraken-host", kraken_hostname);
 	 assert(!kraken_hostname.empty());
   
-	 std::function<void(void)> cb = [wContext, symbolList, kraken_hostname] () -> void {
+	 CBType cb = [wContext, symbolList, kraken_hostname] (uint64_t) -> void {
 		auto contextSP = wContext.lock();
 		if (contextSP) {
 		  uint32_t kraken_port = 443;
@@ -1642,6 +2155,62 @@ int main(int argc, char **argv)
 		return;
 	 });
   
+  // stats [top] - event loop snapshot of the feed handler loop and of each reactor loop, the
+  // reactors write theirs on their own threads and the reply goes out once all of them have
+  contextSP->_adminManager->RegisterCommand(COYPU_ADMIN_STATS, [wContext] (int fd, const std::vector<std::string> &cmd) -> void {
+		auto context = wContext.lock();
+		if (context) {
+		  uint32_t top = cmd.size() == 2 ? atoi(cmd[1].c_str()) : 16;
+		  std::stringstream ss;
+		  ss << "feed handler loop, counters since start\n";
+		  context->_eventMgr->WriteStats(ss, top);
+		  ss << "feed window[" << (::time(nullptr) - context->_feedLatencyStart) << "s since reset, reset every "
+			  << FEED_LATENCY_WINDOW_SECONDS << "s] " << context->_feedLatency << "\n";
+		  if (context->_bufferPool) {
+			 ss << *context->_bufferPool << "\n";
+		  }
+		  ss << "ws " << context->_wsAnonManager->GetBackpressureStats() << "\n";
+		  // replay clients can rely on the publish log up to its durable offset after a crash
+#ifdef COYPU_MMAP_WINDOW
+		  if (context->_publishStreamSP && context->_publishStreamSP->GetStream()->GetFlusher()) {
+			 ss << "publish " << *context->_publishStreamSP->GetStream()->GetFlusher() << "\n";
+		  }
+#else
+		  if (context->_publishStreamSP) {
+			 const std::shared_ptr<PublishLogType> &publish = context->_publishStreamSP->GetStream();
+			 ss << "publish segments[" << publish->Segments() << "] first[" << publish->First()
+				 << "] available[" << publish->Available() << "] written[" << publish->Written()
+				 << "] durable[" << publish->Durable() << "] errors[" << publish->Errors() << "]\n";
+		  }
+#endif
+		  if (context->_reactors.empty() || context->_statsRequest) {
+			 if (context->_statsRequest) {
+				ss << "reactors busy with an earlier stats request\n";
+			 }
+			 int r = context->_adminManager->WriteResponse(fd, ss.str());
+			 if (r != 0) {
+				context->_consoleLogger->error("Admin '{0}' response failed [{1}]", cmd[0], r);
+			 }
+			 return;
+		  }
+
+		  auto request = std::make_shared<StatsRequest>(fd, top, context->_reactors.size());
+		  request->_main = ss.str();
+		  context->_statsRequest = request;
+		  for (uint32_t i = 0; i < context->_reactors.size(); ++i) {
+			 std::shared_ptr<CoypuReactor> &reactor = context->_reactors[i];
+			 std::atomic_store(&reactor->_statsRequest, request);
+			 if (!reactor->_cbManager->Queue(CE_REACTOR_STATS, i)) {
+				std::atomic_store(&reactor->_statsRequest, std::shared_ptr<StatsRequest>());
+				request->_reactors[i] = "reactor " + std::to_string(reactor->_index) + " queue full\n";
+				request->_pending.fetch_sub(1, std::memory_order_acq_rel);
+			 }
+		  }
+		  WriteStatsResponse(context); // every queue was full
+		}
+		return;
+	 });
+
   std::string protoPort;
   config->GetValue("proto-port", protoPort, COYPU_DEFAULT_PROTO_PORT);
   SetupSimpleServer<ProtoManagerType>(interface, contextSP->_protoManager, contextSP->_eventMgr, atoi(protoPort.c_str()));
@@ -1738,23 +2307,43 @@ int main(int argc, char **argv)
   contextSP->_protoManager->SetCallback(coypuRequestCB);
 
   // Simple Connection Manager
-  int timerFD = TimerFDHelper::CreateMonotonicNonBlock();
-  TimerFDHelper::SetRelativeRepeating(timerFD, 5, 0);
-  std::function<int(int)> readTimerCB = [wContext] (int fd) { 
+  const uint32_t timerSeconds = 5;
+  std::function<void(uint64_t)> checkTimerCB = [wContext, timerSeconds] (uint64_t) { 
 	 static uint32_t checks = 0;
+	 static uint64_t lastCtlCalls = 0, lastCtlSaved = 0;
 	 static std::vector<std::pair<uint32_t, uint64_t>> _marks(16, std::pair<uint32_t,uint64_t>(0,0));
 
-	 // clear timer
-	 uint64_t x = UINT64_MAX;
-	 if (read(fd, &x, sizeof(uint64_t)) != sizeof(uint64_t)) {
-		// TODO some error
-		assert(false);
-	 }
-
 	 ++checks;
 	 auto context = wContext.lock();
 	 if (context) {
 		auto consoleLogger = spdlog::get("console");
+
+#ifndef COYPU_MMAP_WINDOW
+		// publish segment rolls by age and retention
+		if (context->_publishStreamSP) {
+		  context->_publishStreamSP->GetStream()->Tick(::time(nullptr));
+		}
+#endif
+
+		// epoll_ctl coalescing
+		const uint32_t statChecks = FEED_LATENCY_WINDOW_SECONDS / timerSeconds;
+		if (checks % statChecks == 0) {
+		  uint64_t ctlCalls = context->_eventMgr->GetCtlCalls();
+		  uint64_t ctlSaved = context->_eventMgr->GetCtlSaved();
+		  const uint64_t secs = statChecks * timerSeconds;
+		  consoleLogger->debug("EPoll ctl/s [{0}] saved/s [{1}]", (ctlCalls - lastCtlCalls) / secs, (ctlSaved - lastCtlSaved) / secs);
+		  lastCtlCalls = ctlCalls;
+		  lastCtlSaved = ctlSaved;
+
+		  if (context->_feedLatency.GetCount()) {
+			 std::stringstream ss;
+			 ss << context->_feedLatency;
+			 consoleLogger->info("Feed readiness to onText cycles spin[{0}] {1}", context->_eventMgr->GetSpin(), ss.str());
+			 context->_feedLatency.Reset();
+			 context->_feedLatencyStart = ::time(nullptr);
+		  }
+		}
+
 		while(_marks.size() < context->_krakenFD+1 ||
 				_marks.size() < context->_coinbaseFD+1) {
 		  _marks.resize(_marks.size()+16, std::pair<uint32_t, uint64_t>(0,0));
@@ -1778,19 +2367,26 @@ int main(int argc, char **argv)
 		  }
 		}
 	 }
-	 
-	 return 0;
   };
-  contextSP->_eventMgr->Register(timerFD, readTimerCB, nullptr, nullptr);
+  contextSP->_eventMgr->AddTimer(timerSeconds * 1000, timerSeconds * 1000, checkTimerCB);
   // END Simple Connection Manager
 
   //  std::thread t1(EventMgrWait, contextSP, std::ref(done));
   //t1.join();
 
-  // single thread
-  EventMgrWait(contextSP, std::ref(done));
+  for (auto &reactor : contextSP->_reactors) {
+	 reactor->_thread = std::thread(ReactorWait, reactor, std::ref(done));
+  }
+
+  // feed handlers, admin, proto and grpc stay on this thread with the books
+  EventMgrWait(contextSP, done);
   contextSP->_eventMgr->Close();
 
+  for (auto &reactor : contextSP->_reactors) {
+	 reactor->_thread.join();
+	 reactor->_eventMgr->Close();
+  }
+
   // cleanup protobuf
   google::protobuf::ShutdownProtobufLibrary();
   
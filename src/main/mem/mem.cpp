@@ -5,6 +5,7 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <numaif.h>
+#include <sys/mman.h>
 
 #include "mem.h"
 
@@ -26,6 +27,12 @@ int MemManager::GetMaxNumaNode()
     return ::numa_max_node();
 }
 
+int MemManager::GetCurrentNode() 
+{
+    int cpu = ::sched_getcpu();
+    return cpu < 0 ? -1 : ::numa_node_of_cpu(cpu);
+}
+
 int CPUManager::RunOnNode(int node) {
     return ::numa_run_on_node(node);
 }
@@ -92,3 +99,36 @@ bool CPUManager::ParseCPUs (const std::string &cpuStr, cpu_set_t &set) {
 void MemManager::ToNode (void *mem, size_t size, int node) {
     numa_tonode_memory(mem, size, node);
 }
+
+void *MemManager::MapMirror (size_t size) {
+    if (size == 0 || size % GetPageSize()) return nullptr;
+
+    int fd = ::memfd_create("coypu-mirror", MFD_CLOEXEC);
+    if (fd < 0) return nullptr;
+
+    if (::ftruncate(fd, size)) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // reserve both halves, then map the same pages over each
+    char *base = static_cast<char *>(::mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    if (::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        ::munmap(base, size * 2);
+        ::close(fd);
+        return nullptr;
+    }
+
+    ::close(fd); // the mappings hold the memory
+    return base;
+}
+
+int MemManager::UnmapMirror (void *mem, size_t size) {
+    return ::munmap(mem, size * 2);
+}
@@ -2,6 +2,7 @@
 #define __COYPU_MEM_H
 
 #include <sched.h>
+#include <stddef.h>
 #include <string>
 namespace coypu {
     namespace mem {
@@ -21,9 +22,21 @@ namespace coypu {
             private:
                 CPUManager() = delete;
         };
+        // Keeps fields written by different threads on cache lines of their own, Used being the bytes
+        // of the line already taken by the fields before it. Padding rather than alignas, so heap
+        // allocation of the owner does not need aligned new.
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        template <size_t Used = 0>
+        struct CacheLinePad {
+            static_assert(Used < CACHE_LINE_SIZE, "fields span more than a cache line");
+            char _pad[CACHE_LINE_SIZE - Used];
+        };
+
         class MemManager {
         public:
             static int GetMaxNumaNode();
+            static int GetCurrentNode(); // node of the cpu this thread is running on
             static int GetCPUCount ();
             static long GetPageSize();
             static int SetPolicyBind (int node);
@@ -31,6 +44,10 @@ namespace coypu {
             static void *AllocOnNode (int node, size_t size);
             static void ToNode (void *mem, size_t size, int node);
 
+            // size bytes (a page multiple) mapped twice back to back, for MirrorBuf. nullptr on error.
+            static void *MapMirror (size_t size);
+            static int UnmapMirror (void *mem, size_t size);
+
         private:
             MemManager() = delete;
         };
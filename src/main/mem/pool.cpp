@@ -0,0 +1,92 @@
+#include <sys/mman.h>
+#include <assert.h>
+
+#include "pool.h"
+#include "mem.h"
+
+using namespace coypu::mem;
+
+BufferPool::BufferPool (size_t blockSize, int node) : _node(node), _blocks(0), _highWater(0), _hugeChunks(0) {
+    _blockSize = blockSize ? ((blockSize + 63) & ~static_cast<size_t>(63)) : 64; // cache line multiple
+    _chunkSize = ((_blockSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+}
+
+BufferPool::~BufferPool () {
+    assert(GetInUse() == 0);
+    for (void *chunk : _chunks) {
+        ::munmap(chunk, _chunkSize);
+    }
+}
+
+bool BufferPool::Grow () {
+    bool huge = true;
+    void *chunk = ::mmap(nullptr, _chunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (chunk == MAP_FAILED) {
+        // no hugetlb pages reserved, ask for transparent huge pages instead
+        huge = false;
+        chunk = ::mmap(nullptr, _chunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) return false;
+        ::madvise(chunk, _chunkSize, MADV_HUGEPAGE);
+    }
+
+    // before first touch so the pages fault in on the node
+    if (_node >= 0 && _node <= MemManager::GetMaxNumaNode()) {
+        MemManager::ToNode(chunk, _chunkSize, _node);
+    }
+
+    _chunks.push_back(chunk);
+    if (huge) ++_hugeChunks;
+
+    // pushed in reverse so blocks are handed out in address order
+    const size_t count = _chunkSize / _blockSize;
+    char *base = static_cast<char *>(chunk);
+    for (size_t i = count; i > 0; --i) {
+        _free.push_back(base + (i - 1) * _blockSize);
+    }
+    _blocks += count;
+    return true;
+}
+
+void *BufferPool::Allocate () {
+    if (_free.empty() && !Grow()) return nullptr;
+
+    void *block = _free.back();
+    _free.pop_back();
+    if (GetInUse() > _highWater) _highWater = GetInUse();
+    return block;
+}
+
+void BufferPool::Free (void *block) {
+    if (block) {
+        _free.push_back(block);
+    }
+}
+
+namespace coypu {
+    namespace mem {
+        std::ostream & operator << (std::ostream &out, const BufferPool &pool) {
+            out << "pool block[" << pool.GetBlockSize() << "] node[" << pool.GetNode() << "] in use[" << pool.GetInUse()
+                << "/" << pool.GetBlocks() << "] high[" << pool.GetHighWater() << "] chunks[" << pool.GetChunks()
+                << "] huge[" << pool.GetHugeChunks() << "]";
+            return out;
+        }
+    }
+}
+
+PoolBuffer::PoolBuffer (const std::shared_ptr<BufferPool> &pool, size_t size) : _data(nullptr) {
+    if (pool && size <= pool->GetBlockSize()) {
+        _data = static_cast<char *>(pool->Allocate());
+        if (_data) _pool = pool;
+    }
+    if (!_data) {
+        _data = new char[size];
+    }
+}
+
+PoolBuffer::~PoolBuffer () {
+    if (_pool) {
+        _pool->Free(_data);
+    } else {
+        delete [] _data;
+    }
+}
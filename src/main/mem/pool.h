@@ -0,0 +1,98 @@
+#ifndef __COYPU_POOL_H
+#define __COYPU_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+#include <ostream>
+
+namespace coypu {
+    namespace mem {
+        // Fixed size blocks for connection buffers, carved from 2MB chunks that are huge pages (hugetlb,
+        // else transparent huge pages) bound to a NUMA node. Freed blocks are recycled LIFO so a reused
+        // block is likely still in cache. Not thread safe - one pool per event loop thread.
+        class BufferPool {
+            public:
+                static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+                // node < 0 leaves placement to the default policy (first touch)
+                BufferPool (size_t blockSize, int node = -1);
+                ~BufferPool ();
+
+                // nullptr when a new chunk cannot be mapped
+                void *Allocate ();
+                void Free (void *block);
+
+                size_t GetBlockSize () const {
+                    return _blockSize;
+                }
+
+                int GetNode () const {
+                    return _node;
+                }
+
+                size_t GetBlocks () const {
+                    return _blocks;
+                }
+
+                size_t GetInUse () const {
+                    return _blocks - _free.size();
+                }
+
+                size_t GetHighWater () const {
+                    return _highWater;
+                }
+
+                size_t GetChunks () const {
+                    return _chunks.size();
+                }
+
+                size_t GetHugeChunks () const {
+                    return _hugeChunks;
+                }
+
+                friend std::ostream & operator << (std::ostream &out, const BufferPool &pool);
+
+            private:
+                BufferPool (const BufferPool &other) = delete;
+                BufferPool &operator= (const BufferPool &other) = delete;
+
+                bool Grow ();
+
+                size_t _blockSize;
+                size_t _chunkSize;
+                int _node;
+                size_t _blocks;
+                size_t _highWater;
+                size_t _hugeChunks;
+                std::vector <void *> _chunks;
+                std::vector <void *> _free;
+        };
+
+        // A block from the pool, or the heap when there is no pool, the block is too small or the pool
+        // cannot grow. Returns it where it came from.
+        class PoolBuffer {
+            public:
+                PoolBuffer (const std::shared_ptr<BufferPool> &pool, size_t size);
+                ~PoolBuffer ();
+
+                char *Get () const {
+                    return _data;
+                }
+
+                bool IsPooled () const {
+                    return _pool != nullptr;
+                }
+
+            private:
+                PoolBuffer (const PoolBuffer &other) = delete;
+                PoolBuffer &operator= (const PoolBuffer &other) = delete;
+
+                std::shared_ptr<BufferPool> _pool; // held so the pool outlives its blocks
+                char *_data;
+        };
+    }
+}
+
+#endif
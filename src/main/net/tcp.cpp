@@ -75,11 +75,20 @@ int TCPHelper::SetRecvSize (int fd, int recvSize) {
     return ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recvSize, optlen);
 }
 
+int TCPHelper::SetBusyPoll (int fd, int usec) {
+    return ::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+}
+
 int TCPHelper::SetNoDelay (int fd) {
     int one = 1;
     return ::setsockopt(fd, SOL_TCP, TCP_NODELAY, &one, sizeof(one));
 }
 
+int TCPHelper::SetCork (int fd, bool cork) {
+    int v = cork ? 1 : 0;
+    return ::setsockopt(fd, SOL_TCP, TCP_CORK, &v, sizeof(v));
+}
+
 int TCPHelper::SetReuseAddr (int fd) {
     int one = 1;
     return ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
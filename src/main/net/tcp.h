@@ -23,6 +23,7 @@ namespace coypu {
                 static int CreateIPV4NonBlockSocket ();
                 static int CreateIPV6NonBlockSocket ();
                 static int SetNoDelay (int fd);
+                static int SetCork (int fd, bool cork); // TCP_CORK, clearing it pushes out a partial frame
                 static int SetReuseAddr (int fd);
                 static int SetReusePort(int fd);
 
@@ -34,6 +35,7 @@ namespace coypu {
 					 static int GetTCPFastOpen (int fd, int &fastopen);
                 static int SetSendSize (int fd, int sendSize);
                 static int SetRecvSize (int fd, int recvSize);
+                static int SetBusyPoll (int fd, int usec); // SO_BUSY_POLL, spin in the driver on blocking reads
 
                 static int Listen (int sockfd, int listen);
                 static int AcceptNonBlock (int sockfd, struct sockaddr *addr, socklen_t *addrlen);
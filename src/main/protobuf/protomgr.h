@@ -1,14 +1,21 @@
 #ifndef __COYPU_PROTOMGR_H
 #define __COYPU_PROTOMGR_H
 
+#include <errno.h>
+#include <limits.h>
 #include <functional>
 #include <unordered_map>
 #include <memory>
+#include <deque>
+#include <string>
+#include <vector>
 #include <iostream>
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/io/coded_stream.h>
 
 #include "buf/buf.h"
+#include "mem/pool.h"
+#include "net/tcp.h"
 #include "util/string-util.h"
 
 namespace coypu {
@@ -86,16 +93,20 @@ namespace coypu {
 	 };
 
 
-	 template <typename LogTrait, typename RequestTrait, typename ResponseTrait>
+	 // BufTrait is the connection read and write buffer, BipBuf or a FixedBipBuf of the manager capacity
+	 template <typename LogTrait, typename RequestTrait, typename ResponseTrait,
+				  typename BufTrait = coypu::buf::BipBuf <char, int>>
 		class ProtoManager {
 	 public:
 		typedef std::function<void(int, RequestTrait &)> callback_type;
 		
 		typedef std::function<int(int)> write_cb_type;
 
+		static constexpr uint64_t BUFFER_CAPACITY = 64*1024; // per connection buffer
+
 		ProtoManager (LogTrait logger, 
 						  write_cb_type set_write) noexcept : _logger(logger),
-		  _capacity(64*1024), _set_write(set_write)  {
+		  _capacity(BUFFER_CAPACITY), _set_write(set_write), _drain(false)  {
 		}
 
 		virtual ~ProtoManager () {
@@ -105,7 +116,7 @@ namespace coypu {
 						  std::function<int(int,const struct iovec *,int)> &readv,
 						  std::function<int(int,const struct iovec *,int)> &writev
 						  ) {
-		  auto sp = std::make_shared<con_type>(fd, _capacity, readv, writev); // 32k capacity
+		  auto sp = std::make_shared<con_type>(fd, _capacity, _pool, readv, writev); // 32k capacity
 		  auto p = std::make_pair(fd, sp);
 		  return _connections.insert(p).second;
 		}
@@ -124,77 +135,165 @@ namespace coypu {
 		  std::shared_ptr<con_type> &con = (*x).second;
 		  if (!con) return -2;
 
-		  int r = con->_readBuf->Readv(fd, con->_readv);
-		  int minBytes = 4; // compressed byte + length
-		  if (con->_readBuf->Available() >= minBytes) {
+		  int r = 0;
+		  do {
+			 r = con->_readBuf->Readv(fd, con->_readv);
+			 if (_drain && r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0; // drained
 
-			 if (con->_gSize == 0) {
-				char isCompressed = 0;
-				con->_readBuf->Pop(&isCompressed, 1);
-				assert(isCompressed == 0); // Only support uncompressed 
-				con->_readBuf->Pop(reinterpret_cast<char *>(&con->_gSize), sizeof(con->_gSize));
-				con->_gSize = ntohl(con->_gSize);
+			 while (ReadMessage(con)) {
 			 }
+		  } while (_drain && r > 0);
 
-			 if (con->_gSize > 0 && con->_readBuf->Available() >= con->_gSize) {
+		  return r;
+		}
 
-				proto_in_type gIn(con->_readBuf);
-				google::protobuf::io::CodedInputStream gInStream(&gIn);
-				
-				google::protobuf::io::CodedInputStream::Limit limit =
-				  gInStream.PushLimit(con->_gSize);
+		// Required for fds registered edge triggered - Read loops until the socket would block.
+		void SetDrain (bool drain) {
+		  _drain = drain;
+		}
 
-				bool b = _request.MergeFromCodedStream(&gInStream);
-				assert(b);
-				assert(gInStream.ConsumedEntireMessage());
+		// Connection buffers come from the pool (returned on Unregister), else the heap
+		void SetBufferPool (const std::shared_ptr<coypu::mem::BufferPool> &pool) {
+		  _pool = pool;
+		}
 
-				if (_cb) {
-				  _cb(con->_fd, _request);
-				}
-				
-				gInStream.PopLimit(limit);
-				con->_gSize = 0;
-			 }
+		// Small responses are serialized straight into the write buffer. Once a response does not fit,
+		// it and everything after it is queued as a segment until the queue drains, so order holds.
+		int WriteResponse (int fd, const ResponseTrait &t) {
+		  auto x = _connections.find(fd);
+		  if (x == _connections.end()) return -1;
+		  std::shared_ptr<con_type> &con = (*x).second;
+		  if (!con) return -2;
+
+		  const int byteSize = t.ByteSize();
+		  if (!con->_segments.empty() || HEADER_SIZE + byteSize > con->_writeBuf->Free()) {
+			 segment_type segment = MakeSegment(t, byteSize);
+			 if (!segment) return -2;
+			 con->_segments.push_back(segment);
+		  } else {
+			 uint32_t size = htonl(byteSize);
+			 char compressed = 0;
+			 bool b =con->_writeBuf->Push(&compressed, 1);
+			 b = con->_writeBuf->Push(reinterpret_cast<char *>(&size), sizeof(uint32_t));
+			 if (!b) return -1;
+
+			 proto_out_type gOut(con->_writeBuf);
+			 google::protobuf::io::CodedOutputStream gOutStream(&gOut);
+			 b = t.SerializeToCodedStream(&gOutStream);
+			 if (!b) return -2;
 		  }
+		  if (!con->_burst) _set_write(fd);
 
-		  return r;
+		  return 0;
 		}
 
-		int WriteResponse (int fd, const ResponseTrait &t) {
+		// Serializes once and queues the same segment on every connection (bulk snapshot).
+		// Returns the number of connections queued.
+		int WriteResponse (const std::vector<int> &fds, const ResponseTrait &t) {
+		  segment_type segment = MakeSegment(t, t.ByteSize());
+		  if (!segment) return -2;
+
+		  int count = 0;
+		  for (int fd : fds) {
+			 auto x = _connections.find(fd);
+			 if (x == _connections.end() || !(*x).second) continue;
+			 std::shared_ptr<con_type> &con = (*x).second;
+			 con->_segments.push_back(segment);
+			 if (!con->_burst) _set_write(fd);
+			 ++count;
+		  }
+		  return count;
+		}
+
+		// Responses written until EndBurst are only queued. EndBurst flushes them in one gathered
+		// writev; with cork the kernel holds partial segments until then (TCP_CORK).
+		int BeginBurst (int fd, bool cork) {
 		  auto x = _connections.find(fd);
 		  if (x == _connections.end()) return -1;
 		  std::shared_ptr<con_type> &con = (*x).second;
 		  if (!con) return -2;
 
-		  uint32_t size = htonl(t.ByteSize());
-		  char compressed = 0;
-		  bool b =con->_writeBuf->Push(&compressed, 1);
-		  b = con->_writeBuf->Push(reinterpret_cast<char *>(&size), sizeof(uint32_t));
-		  if (!b) return -1;
-		  
-		  proto_out_type gOut(con->_writeBuf);
-		  google::protobuf::io::CodedOutputStream gOutStream(&gOut);
-		  b = t.SerializeToCodedStream(&gOutStream);
-		  if (!b) return -2;
-		  _set_write(fd);
-
+		  con->_burst = true;
+		  con->_corked = cork && coypu::tcp::TCPHelper::SetCork(fd, true) == 0;
 		  return 0;
 		}
-		  
 
+		int EndBurst (int fd) {
+		  auto x = _connections.find(fd);
+		  if (x == _connections.end()) return -1;
+		  std::shared_ptr<con_type> &con = (*x).second;
+		  if (!con) return -2;
+
+		  con->_burst = false;
+		  int r = Write(fd);
+		  if (con->_corked) {
+			 coypu::tcp::TCPHelper::SetCork(fd, false);
+			 con->_corked = false;
+		  }
+		  if (r > 0) _set_write(fd); // rest goes when the socket is writable
+		  return r < 0 ? r : 0;
+		}
+
+		// Bytes waiting to be written
+		int64_t Pending (int fd) const {
+		  auto x = _connections.find(fd);
+		  if (x == _connections.end() || !(*x).second) return -1;
+		  const std::shared_ptr<con_type> &con = (*x).second;
+
+		  int64_t pending = con->_writeBuf->Available();
+		  for (const segment_type &segment : con->_segments) {
+			 pending += segment->size();
+		  }
+		  return pending - con->_segmentOffset;
+		}
+
+		// One writev over the write buffer and up to MAX_IOV queued segments
 		int Write (int fd) {
 		  auto x = _connections.find(fd);
 		  if (x == _connections.end()) return -1;
 		  std::shared_ptr<con_type> &con = (*x).second;
 		  if (!con) return -2;
-                    
-		  int ret = con->_writeBuf->Writev(fd, con->_writev);
-		  if (ret < 0) return ret; // error
 
-		  // We could have EAGAIN/EWOULDBLOCK so we want to maintain write if data available
+		  struct iovec iov[MAX_IOV];
+		  int count = 0;
+		  coypu::buf::FrameView<char> view;
+		  con->_writeBuf->View(0, con->_writeBuf->Available(), view);
+		  for (int i = 0; i < view.Count(); ++i, ++count) {
+			 iov[count].iov_base = const_cast<char *>(view.Data(i));
+			 iov[count].iov_len = view.Length(i);
+		  }
+
+		  size_t offset = con->_segmentOffset;
+		  for (auto b = con->_segments.begin(); b != con->_segments.end() && count < MAX_IOV; ++b, ++count) {
+			 iov[count].iov_base = const_cast<char *>((*b)->data() + offset);
+			 iov[count].iov_len = (*b)->size() - offset;
+			 offset = 0;
+		  }
+		  if (count == 0) return 0;
+
+		  int ret = con->_writev(fd, iov, count);
+		  if (ret < 0) {
+			 // We could have EAGAIN/EWOULDBLOCK so we want to maintain write if data available
+			 return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : ret;
+		  }
+
+		  size_t written = ret;
+		  const size_t buffered = std::min(written, static_cast<size_t>(con->_writeBuf->Available()));
+		  if (buffered) con->_writeBuf->Skip(buffered);
+		  written -= buffered;
+		  while (written) {
+			 const size_t left = con->_segments.front()->size() - con->_segmentOffset;
+			 if (written < left) {
+				con->_segmentOffset += written;
+				break;
+			 }
+			 written -= left;
+			 con->_segments.pop_front();
+			 con->_segmentOffset = 0;
+		  }
+
 		  // 0 will clear write bit
-		  // Can improve branching here if we just return is empty directly on the stack without another call
-		  return con->_writeBuf->IsEmpty() ? 0 : 1;
+		  return con->_writeBuf->IsEmpty() && con->_segments.empty() ? 0 : 1;
 		}
 
 		void SetCallback (callback_type &cb) {
@@ -206,10 +305,14 @@ namespace coypu {
 		ProtoManager (const ProtoManager &other);
 		ProtoManager &operator= (const ProtoManager &other);
 
-		typedef coypu::buf::BipBuf <char, int> buf_type;
+		typedef BufTrait buf_type;
 		typedef std::shared_ptr<buf_type> buf_sp_type;
 		typedef BufZeroCopyInputStream<buf_sp_type> proto_in_type;
 		typedef BufZeroCopyOutputStream<buf_sp_type> proto_out_type;
+		typedef std::shared_ptr<const std::string> segment_type;
+
+		static constexpr int HEADER_SIZE = 5; // compressed byte + length
+		static constexpr int MAX_IOV = IOV_MAX;
 		
 		typedef struct ClientConnection {
 		  int _fd;
@@ -222,29 +325,80 @@ namespace coypu {
 		  char * _readData;
 		  char * _writeData;
 		  uint32_t _gSize;
+		  coypu::mem::PoolBuffer _readMem;
+		  coypu::mem::PoolBuffer _writeMem;
+		  std::deque<segment_type> _segments; // after everything in _writeBuf
+		  size_t _segmentOffset;              // written from the front segment
+		  bool _burst;
+		  bool _corked;
 
 		  ClientConnection (int fd, 
 									  int capacity,
+									  const std::shared_ptr<coypu::mem::BufferPool> &pool,
 									  std::function<int(int,const struct iovec *,int)> readv,
 									  std::function<int(int,const struct iovec *,int)> writev ) :
-		  _fd(fd), _readv(readv), _writev(writev), _gSize(0) { 
-			 _readData = new char[capacity];
-			 _writeData = new char[capacity];
+		  _fd(fd), _readv(readv), _writev(writev), _gSize(0), _readMem(pool, capacity), _writeMem(pool, capacity),
+		  _segmentOffset(0), _burst(false), _corked(false) { 
+			 _readData = _readMem.Get();
+			 _writeData = _writeMem.Get();
 			 _readBuf = std::make_shared<buf_type>(_readData, capacity);
 			 _writeBuf = std::make_shared<buf_type>(_writeData, capacity);
 		  }
 
 		  virtual ~ClientConnection () {
-			 if (_readData) delete [] _readData;
-			 if (_writeData) delete [] _writeData;
 		  }
 		} con_type;
 
 		typedef std::unordered_map<int, std::shared_ptr<con_type>> con_map_type;
 
+		static segment_type MakeSegment (const ResponseTrait &t, int byteSize) {
+		  std::shared_ptr<std::string> segment = std::make_shared<std::string>(HEADER_SIZE, 0);
+		  const uint32_t size = htonl(byteSize);
+		  ::memcpy(&(*segment)[1], &size, sizeof(uint32_t));
+		  if (!t.AppendToString(segment.get())) return nullptr;
+		  return segment;
+		}
+
+		// true if a complete message was consumed
+		bool ReadMessage (std::shared_ptr<con_type> &con) {
+		  int minBytes = 5; // compressed byte + length
+		  if (con->_gSize == 0 && con->_readBuf->Available() >= minBytes) {
+			 char isCompressed = 0;
+			 con->_readBuf->Pop(&isCompressed, 1);
+			 assert(isCompressed == 0); // Only support uncompressed 
+			 con->_readBuf->Pop(reinterpret_cast<char *>(&con->_gSize), sizeof(con->_gSize));
+			 con->_gSize = ntohl(con->_gSize);
+		  }
+
+		  // the header may have come in an earlier read, so only the body is waited for here
+		  if (con->_gSize > 0 && con->_readBuf->Available() >= con->_gSize) {
+
+			 proto_in_type gIn(con->_readBuf);
+			 google::protobuf::io::CodedInputStream gInStream(&gIn);
+			 
+			 google::protobuf::io::CodedInputStream::Limit limit =
+			   gInStream.PushLimit(con->_gSize);
+
+			 bool b = _request.MergeFromCodedStream(&gInStream);
+			 assert(b);
+			 assert(gInStream.ConsumedEntireMessage());
+
+			 if (_cb) {
+			   _cb(con->_fd, _request);
+			 }
+			 
+			 gInStream.PopLimit(limit);
+			 con->_gSize = 0;
+			 return true;
+		  }
+		  return false;
+		}
+
 		LogTrait _logger;
 		uint64_t _capacity;
 		write_cb_type _set_write;
+		bool _drain;
+		std::shared_ptr<coypu::mem::BufferPool> _pool;
 		con_map_type _connections;
 
 		RequestTrait _request;
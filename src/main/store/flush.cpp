@@ -0,0 +1,116 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include "flush.h"
+#include "mem/mem.h"
+
+using namespace coypu::store;
+
+StoreFlusher::StoreFlusher (int fd, off64_t pageSize, off64_t offset, const FlushConfig &config, uint32_t pollUsec) :
+  _fd(fd), _pageSize(pageSize), _config(config), _pollUsec(pollUsec), _written(offset), _durable(offset),
+  _flushes(0), _errors(0), _started(offset), _running(false) {
+}
+
+StoreFlusher::~StoreFlusher () {
+  Stop();
+}
+
+int StoreFlusher::Start () {
+  if (_config._policy == FLUSH_NONE || _fd < 0 || _pageSize <= 0 || _thread.joinable()) return -1;
+  _running.store(true, std::memory_order_release);
+  _thread = std::thread(&StoreFlusher::Run, this);
+  return 0;
+}
+
+void StoreFlusher::Stop () {
+  _running.store(false, std::memory_order_release);
+  if (_thread.joinable()) {
+	 _thread.join();
+
+	 const uint64_t written = _written.load(std::memory_order_acquire);
+	 if (written > Durable() && Flush(written)) {
+		_errors.fetch_add(1, std::memory_order_relaxed);
+	 }
+  }
+}
+
+void StoreFlusher::Run () {
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+  while (_running.load(std::memory_order_acquire)) {
+	 const uint64_t written = _written.load(std::memory_order_acquire);
+	 const uint64_t durable = Durable();
+
+	 uint64_t end = 0;
+	 switch (_config._policy) {
+	 case FLUSH_BYTES:
+		if (written - durable >= _config._bytes) end = written;
+		break;
+	 case FLUSH_INTERVAL:
+		if (written > durable && std::chrono::steady_clock::now() - last >= std::chrono::milliseconds(_config._intervalMs)) {
+		  end = written;
+		}
+		break;
+	 case FLUSH_ROLL:
+		if ((written / _pageSize) * _pageSize > durable) end = (written / _pageSize) * _pageSize;
+		break;
+	 default:
+		break;
+	 }
+
+	 if (end) {
+		if (Flush(end)) {
+		  // ENOSPC, EIO and the like do not clear straight away, retry at a slower pace
+		  _errors.fetch_add(1, std::memory_order_relaxed);
+		  std::this_thread::sleep_for(std::chrono::microseconds(_pollUsec * FAILED_BACKOFF));
+		}
+		last = std::chrono::steady_clock::now();
+	 } else if (!Writeback(written)) {
+		std::this_thread::sleep_for(std::chrono::microseconds(_pollUsec));
+	 }
+  }
+}
+
+// Starts writeback of the whole pages behind the writer once enough have built up, so a flush
+// has less to wait for and the dirty pages do not pile up between flushes. Does not wait.
+bool StoreFlusher::Writeback (uint64_t written) {
+  if (_config._writebackBytes == 0) return false;
+  const uint64_t end = written - written % coypu::mem::MemManager::GetPageSize();
+  if (end < _started + _config._writebackBytes) return false;
+
+  if (::sync_file_range(_fd, _started, end - _started, SYNC_FILE_RANGE_WRITE)) {
+	 _errors.fetch_add(1, std::memory_order_relaxed);
+  }
+  _started = end;
+  return true;
+}
+
+// sync_file_range does not write the block allocation (a page of an ftruncated or fallocated file
+// is new metadata when first written), so the watermark only moves after fdatasync
+int StoreFlusher::Flush (uint64_t end) {
+  const uint64_t durable = Durable();
+  if (end > _started && ::sync_file_range(_fd, _started, end - _started, SYNC_FILE_RANGE_WRITE)) {
+	 return -1;
+  }
+  _started = std::max(_started, end);
+  if (::fdatasync(_fd)) {
+	 return -2;
+  }
+  if (end > durable) {
+	 _durable.store(end, std::memory_order_release);
+  }
+  _flushes.fetch_add(1, std::memory_order_relaxed);
+  return 0;
+}
+
+namespace coypu {
+  namespace store {
+	 std::ostream &operator<< (std::ostream &out, const StoreFlusher &flusher) {
+		static const char *policies[] = { "none", "bytes", "interval", "roll" };
+		out << "flush policy[" << policies[flusher.GetConfig()._policy] << "] written[" << flusher.GetWritten()
+			 << "] durable[" << flusher.Durable() << "] flushes[" << flusher.Flushes()
+			 << "] errors[" << flusher.Errors() << "]";
+		return out;
+	 }
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <ostream>
+#include <thread>
+
+#include "mem/mem.h"
+
+namespace coypu {
+  namespace store {
+	 enum FlushPolicy {
+		FLUSH_NONE,     // kernel writeback only
+		FLUSH_BYTES,    // once _bytes are written past the durable watermark
+		FLUSH_INTERVAL, // every _intervalMs while anything is written past it
+		FLUSH_ROLL      // each page the writer has finished
+	 };
+
+	 struct FlushConfig {
+		FlushPolicy _policy;
+		uint64_t _bytes;
+		uint32_t _intervalMs;
+		uint64_t _writebackBytes; // started on in the background between flushes, 0 for none
+
+		FlushConfig () : _policy(FLUSH_NONE), _bytes(1024*1024), _intervalMs(100), _writebackBytes(1024*1024) {
+		}
+	 };
+
+	 // Makes a file backed log durable on a thread of its own. The writer publishes how far it has
+	 // written (one release store), the flusher starts writeback of whole pages behind it with
+	 // sync_file_range as they fill and, when the policy says so, waits for the data and the block
+	 // allocation with fdatasync before moving the durable watermark. Everything below Durable
+	 // survives a crash. What was in the file at open counts as durable, and Stop flushes the rest.
+	 class StoreFlusher {
+	 public:
+		// offset is the length already in the file
+		StoreFlusher (int fd, off64_t pageSize, off64_t offset, const FlushConfig &config, uint32_t pollUsec = 100);
+		virtual ~StoreFlusher ();
+
+		// 0 on success, -1 for FLUSH_NONE as there is nothing to run
+		int Start ();
+		void Stop ();
+
+		// writer thread, bytes written from the start of the file
+		inline void Written (uint64_t offset) {
+		  _written.store(offset, std::memory_order_release);
+		}
+
+		inline uint64_t Durable () const {
+		  return _durable.load(std::memory_order_acquire);
+		}
+
+		inline uint64_t GetWritten () const {
+		  return _written.load(std::memory_order_acquire);
+		}
+
+		inline const FlushConfig &GetConfig () const {
+		  return _config;
+		}
+
+		inline uint64_t Flushes () const {
+		  return _flushes.load(std::memory_order_relaxed);
+		}
+
+		inline uint64_t Errors () const {
+		  return _errors.load(std::memory_order_relaxed);
+		}
+
+	 private:
+		StoreFlusher (const StoreFlusher &other) = delete;
+		StoreFlusher &operator= (const StoreFlusher &other) = delete;
+
+		static constexpr uint32_t FAILED_BACKOFF = 100; // poll intervals after a failed flush
+
+		void Run ();
+		bool Writeback (uint64_t written);
+		int Flush (uint64_t end);
+
+		const int _fd;
+		const off64_t _pageSize;
+		const FlushConfig _config;
+		const uint32_t _pollUsec;
+
+		coypu::mem::CacheLinePad<> _pad0;
+		std::atomic<uint64_t> _written; // published by the writer
+		coypu::mem::CacheLinePad<sizeof(uint64_t)> _pad1;
+
+		std::atomic<uint64_t> _durable;
+		std::atomic<uint64_t> _flushes;
+		std::atomic<uint64_t> _errors;
+		uint64_t _started; // flusher, writeback started below this
+
+		std::atomic<bool> _running;
+		std::thread _thread;
+	 };
+
+	 std::ostream &operator<< (std::ostream &out, const StoreFlusher &flusher);
+  }
+}
@@ -0,0 +1,169 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <chrono>
+#include "segment.h"
+#include "file/file.h"
+#include "mem/mem.h"
+
+using namespace coypu::store;
+using namespace coypu::file;
+
+SegmentAllocator::SegmentAllocator (int fd, off64_t pageSize, off64_t offset, uint32_t ahead, uint32_t pollUsec) :
+  _fd(fd), _pageSize(pageSize), _ahead(ahead ? ahead : 1), _pollUsec(pollUsec), _ready(_ahead), _retired(_ahead),
+  _readyHead(0), _retireTail(0), _next(offset), _readyTail(0), _retireHead(0), _taken(offset), _hits(0), _misses(0),
+  _running(false), _errors(0) {
+}
+
+SegmentAllocator::~SegmentAllocator () {
+  Stop();
+
+  Drain();
+  for (uint64_t i = _readyTail.load(std::memory_order_relaxed); i < _readyHead.load(std::memory_order_relaxed); ++i) {
+	 Unmap(_ready[i % _ahead]._data);
+  }
+
+  // pages mapped ahead and never written do not stay on the end of the log
+  off64_t size = 0;
+  const off64_t taken = _taken.load(std::memory_order_relaxed);
+  if (FileUtil::GetSize(_fd, size) == 0 && size > taken) {
+	 FileUtil::Truncate(_fd, taken);
+  }
+}
+
+int SegmentAllocator::Start () {
+  if (_fd < 0 || _pageSize <= 0 || _thread.joinable()) return -1;
+  _running.store(true, std::memory_order_release);
+  _thread = std::thread(&SegmentAllocator::Run, this);
+  return 0;
+}
+
+void SegmentAllocator::Stop () {
+  _running.store(false, std::memory_order_release);
+  if (_thread.joinable()) {
+	 _thread.join();
+  }
+}
+
+bool SegmentAllocator::Take (off64_t offset, char *&page) {
+  const uint64_t head = _readyHead.load(std::memory_order_acquire);
+  uint64_t tail = _readyTail.load(std::memory_order_relaxed);
+
+  while (tail < head && _ready[tail % _ahead]._offset < offset) {
+	 if (!Retire(_ready[tail % _ahead]._data)) {
+		Unmap(_ready[tail % _ahead]._data);
+	 }
+	 ++tail;
+  }
+
+  bool hit = tail < head && _ready[tail % _ahead]._offset == offset;
+  if (hit) {
+	 page = _ready[tail % _ahead]._data;
+	 ++tail;
+	 Advance(offset + _pageSize);
+	 ++_hits;
+  } else {
+	 ++_misses;
+  }
+  _readyTail.store(tail, std::memory_order_release);
+  return hit;
+}
+
+bool SegmentAllocator::Retire (char *page) {
+  const uint64_t head = _retireHead.load(std::memory_order_relaxed);
+  if (head - _retireTail.load(std::memory_order_acquire) == _ahead) return false;
+
+  _retired[head % _ahead] = page;
+  _retireHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+int SegmentAllocator::Extend (off64_t end) {
+  Advance(end);
+  return Grow(end);
+}
+
+void SegmentAllocator::Advance (off64_t end) {
+  if (static_cast<uint64_t>(end) > _taken.load(std::memory_order_relaxed)) {
+	 _taken.store(end, std::memory_order_release);
+  }
+}
+
+void SegmentAllocator::Run () {
+  while (_running.load(std::memory_order_acquire)) {
+	 bool work = Drain();
+	 work |= Fill();
+	 if (!work) {
+		std::this_thread::sleep_for(std::chrono::microseconds(_pollUsec));
+	 }
+  }
+}
+
+bool SegmentAllocator::Fill () {
+  bool work = false;
+  uint64_t head = _readyHead.load(std::memory_order_relaxed);
+
+  // after a miss the writer maps pages itself, so skip to where it is rather than prepare pages
+  // it has passed and would only retire
+  _next = std::max<off64_t>(_next, _taken.load(std::memory_order_acquire));
+  while (head - _readyTail.load(std::memory_order_acquire) < _ahead) {
+	 char *page = Prepare(_next);
+	 if (!page) {
+		_errors.fetch_add(1, std::memory_order_relaxed);
+		break;
+	 }
+
+	 _ready[head % _ahead]._data = page;
+	 _ready[head % _ahead]._offset = _next;
+	 _readyHead.store(++head, std::memory_order_release);
+	 _next += _pageSize;
+	 work = true;
+  }
+  return work;
+}
+
+bool SegmentAllocator::Drain () {
+  const uint64_t head = _retireHead.load(std::memory_order_acquire);
+  uint64_t tail = _retireTail.load(std::memory_order_relaxed);
+  if (tail == head) return false;
+
+  for (; tail < head; ++tail) {
+	 Unmap(_retired[tail % _ahead]);
+  }
+  _retireTail.store(tail, std::memory_order_release);
+  return true;
+}
+
+char *SegmentAllocator::Prepare (off64_t offset) {
+  if (Grow(offset + _pageSize)) return nullptr;
+
+  void *p = ::mmap(nullptr, _pageSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, offset);
+  if (p == MAP_FAILED) return nullptr;
+
+  // MAP_POPULATE only read faults a shared mapping. A compare and swap of a byte with itself is a
+  // write that cannot lose one of the writer's, should it have got ahead of us into this page.
+  char *page = reinterpret_cast<char *>(p);
+  const off64_t step = coypu::mem::MemManager::GetPageSize();
+  for (off64_t i = 0; i < _pageSize; i += step) {
+	 char c = __atomic_load_n(&page[i], __ATOMIC_RELAXED);
+	 __atomic_compare_exchange_n(&page[i], &c, c, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  }
+  return page;
+}
+
+int SegmentAllocator::Grow (off64_t end) {
+  // the truncate fallback must not race the other thread's size check
+  std::lock_guard<std::mutex> lock(_grow);
+  off64_t size = 0;
+  if (FileUtil::GetSize(_fd, size)) return -1;
+  if (size >= end) return 0;
+
+  return FileUtil::Allocate(_fd, size, end - size) ? -2 : 0;
+}
+
+void SegmentAllocator::Unmap (char *page) {
+  ::munmap(page, _pageSize);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mem/mem.h"
+
+namespace coypu {
+  namespace store {
+	 // Maps the pages of a file backed log ahead of its writer on a thread of its own. Each page past
+	 // the writer is fallocated, mapped MAP_POPULATE and touched, so the first write to it takes no
+	 // fault, and handed over through a single producer single consumer ring. Pages the writer is done
+	 // with go back through a second ring to be unmapped off the write path. Take and Retire are the
+	 // writer's side and never block. The only system call left to the writer is the munmap of a page
+	 // when the retire ring is full, the allocator thread having fallen that far behind.
+	 class SegmentAllocator {
+	 public:
+		// offset is the writer's next page, ahead the number of pages kept ready
+		SegmentAllocator (int fd, off64_t pageSize, off64_t offset, uint32_t ahead, uint32_t pollUsec = 100);
+		virtual ~SegmentAllocator ();
+
+		// 0 on success
+		int Start ();
+		void Stop ();
+
+		// writer thread
+
+		// The ready page at offset. Ready pages before offset (the writer moved past them) are
+		// retired, or unmapped here when the retire ring is full. false when the allocator has not
+		// got there yet.
+		bool Take (off64_t offset, char *&page);
+
+		// Hands a page back to be unmapped. false when the ring is full and the caller unmaps.
+		bool Retire (char *page);
+
+		// Grows the file to at least end for a page the writer maps itself. Never shrinks the file
+		// under the pages mapped ahead, and may wait on the allocator thread. 0 on success
+		int Extend (off64_t end);
+
+		inline uint64_t Hits () const {
+		  return _hits;
+		}
+
+		inline uint64_t Misses () const {
+		  return _misses;
+		}
+
+		inline uint64_t Errors () const {
+		  return _errors.load(std::memory_order_relaxed);
+		}
+
+	 private:
+		SegmentAllocator (const SegmentAllocator &other) = delete;
+		SegmentAllocator &operator= (const SegmentAllocator &other) = delete;
+
+		typedef struct Segment {
+		  char *_data;
+		  off64_t _offset;
+		} Segment;
+
+		void Run ();
+		char *Prepare (off64_t offset);
+		int Grow (off64_t end);
+		void Advance (off64_t end);
+		void Unmap (char *page);
+
+		// allocator thread
+		bool Fill ();
+		bool Drain ();
+
+		const int _fd;
+		const off64_t _pageSize;
+		const uint32_t _ahead;
+		const uint32_t _pollUsec;
+
+		std::vector<Segment> _ready;
+		std::vector<char *> _retired;
+
+		coypu::mem::CacheLinePad<> _pad0;
+		std::atomic<uint64_t> _readyHead;  // published by the allocator
+		std::atomic<uint64_t> _retireTail; // released by the allocator
+		off64_t _next;                     // allocator, offset of the next page to prepare
+		coypu::mem::CacheLinePad<2 * sizeof(uint64_t) + sizeof(off64_t)> _pad1;
+
+		std::atomic<uint64_t> _readyTail;  // released by the writer
+		std::atomic<uint64_t> _retireHead; // published by the writer
+		std::atomic<uint64_t> _taken;      // published by the writer, end of the last page it took or extended to
+		uint64_t _hits;
+		uint64_t _misses;
+		coypu::mem::CacheLinePad<5 * sizeof(uint64_t)> _pad2;
+
+		std::mutex _grow;
+		std::atomic<bool> _running;
+		std::atomic<uint64_t> _errors;
+		std::thread _thread;
+	 };
+  }
+}
@@ -0,0 +1,249 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+#include <chrono>
+#include "segmented.h"
+#include "file/file.h"
+
+using namespace coypu::store;
+using namespace coypu::file;
+
+LogSegment::LogSegment (uint32_t number, uint64_t base, int fd, int64_t created) : _number(number), _base(base),
+  _fd(fd), _created(created), _end(UINT64_MAX) {
+}
+
+LogSegment::~LogSegment () {
+  if (_fd >= 0) {
+	 FileUtil::Close(_fd);
+  }
+}
+
+SegmentIndex::SegmentIndex (const std::string &path) : _path(path), _fd(-1) {
+}
+
+SegmentIndex::~SegmentIndex () {
+  if (_fd >= 0) {
+	 FileUtil::Close(_fd);
+  }
+}
+
+std::string SegmentIndex::SegmentPath (const std::string &path, uint32_t number) {
+  char storeFile[PATH_MAX];
+  ::snprintf(storeFile, PATH_MAX, "%s.%09d.store", path.c_str(), number);
+  return storeFile;
+}
+
+int SegmentIndex::Open (std::vector<Entry> &entries) {
+  if (_fd >= 0) return -1;
+  entries.clear();
+
+  const std::string indexFile = _path + ".index";
+  bool exists = false;
+  FileUtil::Exists(indexFile.c_str(), exists);
+
+  _fd = FileUtil::Open(indexFile.c_str(), O_CREAT|O_RDWR|O_APPEND, 0600);
+  if (_fd < 0) return -2;
+
+  if (exists) {
+	 Entry entry;
+	 while (FileUtil::Read(_fd, &entry, sizeof(entry)) == sizeof(entry)) {
+		entries.push_back(entry);
+	 }
+
+	 // drop a record cut short so the next one lands on a boundary
+	 if (FileUtil::Truncate(_fd, entries.size() * sizeof(Entry))) return -3;
+	 return 0;
+  }
+
+  // files from CreateRollingStore, each one started where the last ended
+  uint64_t base = 0;
+  for (uint32_t number = 0; number < UINT32_MAX; ++number) {
+	 const std::string segmentPath = SegmentPath(_path, number);
+	 struct stat s = {};
+	 if (::stat(segmentPath.c_str(), &s)) break;
+
+	 Entry entry;
+	 ::memset(&entry, 0, sizeof(entry));
+	 entry._base = base;
+	 entry._created = s.st_mtime;
+	 entry._number = number;
+	 if (Append(entry)) return -4;
+
+	 entries.push_back(entry);
+	 base += s.st_size;
+  }
+  return 0;
+}
+
+// a restart needs these to carry on the offsets, so each one is synced
+int SegmentIndex::Append (const Entry &entry) {
+  if (_fd < 0) return -1;
+  if (FileUtil::Write(_fd, reinterpret_cast<const char *>(&entry), sizeof(entry)) != sizeof(entry)) return -2;
+  if (::fdatasync(_fd)) return -3;
+  return 0;
+}
+
+SegmentRoller::SegmentRoller (const std::string &path, SegmentIndex &index, off64_t pageSize, uint32_t prefaultPages,
+										const FlushConfig &flush, uint32_t pollUsec) : _path(path), _index(index),
+  _pageSize(pageSize), _prefaultPages(prefaultPages), _flush(flush), _pollUsec(pollUsec), _next(0),
+  _preparing(false), _misses(0), _released(0), _errors(0), _running(false) {
+  _ready._number = 0;
+  _ready._fd = -1;
+}
+
+SegmentRoller::~SegmentRoller () {
+  Stop();
+}
+
+int SegmentRoller::Start (uint32_t number) {
+  if (_thread.joinable()) return -1;
+  _next = number;
+  _running.store(true, std::memory_order_release);
+  _thread = std::thread(&SegmentRoller::Run, this);
+  return 0;
+}
+
+void SegmentRoller::Stop () {
+  _running.store(false, std::memory_order_release);
+  if (_thread.joinable()) {
+	 _thread.join();
+  }
+
+  Work();
+  if (_ready._fd >= 0) {
+	 Close(_ready);
+	 FileUtil::Remove(SegmentIndex::SegmentPath(_path, _ready._number).c_str());
+	 _ready._fd = -1;
+  }
+}
+
+int SegmentRoller::Take (Head &head) {
+  uint32_t number = 0;
+  for (;;) {
+	 {
+		std::lock_guard<std::mutex> guard(_lock);
+		if (_ready._fd >= 0) {
+		  head = _ready;
+		  _ready = Head();
+		  _ready._fd = -1;
+		  return 0;
+		}
+		if (!_preparing) {
+		  number = _next++;
+		  break;
+		}
+	 }
+	 std::this_thread::yield(); // the thread is part way through it
+  }
+
+  ++_misses;
+  return Prepare(number, head);
+}
+
+void SegmentRoller::Release (const std::shared_ptr<LogSegment> &segment, const std::shared_ptr<SegmentAllocator> &segments,
+									  const std::shared_ptr<StoreFlusher> &flusher, const SegmentIndex::Entry &entry) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _retired.push_back({segment, segments, flusher, entry});
+}
+
+void SegmentRoller::Remove (uint32_t number) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _removed.push_back(number);
+}
+
+void SegmentRoller::Run () {
+  while (_running.load(std::memory_order_acquire)) {
+	 bool idle = !Work();
+
+	 uint32_t number = 0;
+	 bool prepare = false;
+	 {
+		std::lock_guard<std::mutex> guard(_lock);
+		if (_ready._fd < 0 && !_preparing) {
+		  number = _next++;
+		  _preparing = prepare = true;
+		}
+	 }
+
+	 if (prepare) {
+		Head head;
+		const int r = Prepare(number, head);
+		std::lock_guard<std::mutex> guard(_lock);
+		_preparing = false;
+		if (r == 0) {
+		  _ready = head;
+		  idle = false;
+		}
+	 }
+
+	 if (idle) {
+		std::this_thread::sleep_for(std::chrono::microseconds(_pollUsec));
+	 }
+  }
+}
+
+// number is in no index record yet, so anything left at that path is not part of the log
+int SegmentRoller::Prepare (uint32_t number, Head &head) {
+  const std::string segmentPath = SegmentIndex::SegmentPath(_path, number);
+  // the store is only ever mapped, so no O_DIRECT
+  head._number = number;
+  head._fd = FileUtil::Open(segmentPath.c_str(), O_CREAT|O_TRUNC|O_LARGEFILE|O_RDWR, 0600);
+  head._segments.reset();
+  head._flusher.reset();
+  if (head._fd < 0) {
+	 _errors.fetch_add(1, std::memory_order_relaxed);
+	 return -1;
+  }
+
+  if (_prefaultPages) {
+	 head._segments = std::make_shared<SegmentAllocator>(head._fd, _pageSize, 0, _prefaultPages);
+	 if (head._segments->Start()) head._segments.reset();
+  }
+  if (_flush._policy != FLUSH_NONE) {
+	 head._flusher = std::make_shared<StoreFlusher>(head._fd, _pageSize, 0, _flush);
+	 if (head._flusher->Start()) head._flusher.reset();
+  }
+  return 0;
+}
+
+// In Release order: the old head's last flush before the next head's record, so the record is
+// only there once everything before its base is durable. false when there was nothing to do.
+bool SegmentRoller::Work () {
+  std::vector<Retired> retired;
+  std::vector<uint32_t> removed;
+  {
+	 std::lock_guard<std::mutex> guard(_lock);
+	 retired.swap(_retired);
+	 removed.swap(_removed);
+  }
+
+  for (Retired &r : retired) {
+	 if (r._flusher) {
+		r._flusher->Stop();
+		_errors.fetch_add(r._flusher->Errors(), std::memory_order_relaxed);
+		r._flusher.reset();
+	 }
+	 // unmaps what it mapped ahead and trims the file back
+	 r._segments.reset();
+	 if (_index.Append(r._entry)) {
+		_errors.fetch_add(1, std::memory_order_relaxed);
+	 }
+	 r._segment.reset();
+	 _released.fetch_add(1, std::memory_order_release);
+  }
+
+  for (uint32_t number : removed) {
+	 FileUtil::Remove(SegmentIndex::SegmentPath(_path, number).c_str());
+  }
+  return !retired.empty() || !removed.empty();
+}
+
+void SegmentRoller::Close (Head &head) {
+  head._flusher.reset();
+  head._segments.reset();
+  FileUtil::Close(head._fd);
+}
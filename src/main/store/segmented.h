@@ -0,0 +1,734 @@
+#pragma once
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "store/store.h"
+
+namespace coypu {
+  namespace store {
+	 struct SegmentConfig {
+		uint64_t _segmentBytes;   // the head rolls once it holds this much
+		uint32_t _segmentSeconds; // or is this old, 0 for no limit
+		uint64_t _retainBytes;    // oldest segments are deleted past this total, 0 keeps everything
+		uint32_t _retainSeconds;  // or once everything in them is this old, 0 for no limit
+
+		SegmentConfig () : _segmentBytes(1024ULL*1024*1024), _segmentSeconds(0), _retainBytes(0), _retainSeconds(0) {
+		}
+	 };
+
+	 // One file of a SegmentedLog, holding offsets [Base, End). Shared by the writer and the readers on
+	 // other threads, the file is closed when the last of them lets go, so a reader can finish a
+	 // segment retention has already deleted.
+	 class LogSegment {
+	 public:
+		LogSegment (uint32_t number, uint64_t base, int fd, int64_t created);
+		virtual ~LogSegment ();
+
+		inline uint32_t Number () const {
+		  return _number;
+		}
+
+		inline uint64_t Base () const {
+		  return _base;
+		}
+
+		inline int GetFD () const {
+		  return _fd;
+		}
+
+		inline int64_t Created () const {
+		  return _created;
+		}
+
+		// UINT64_MAX while it is the head
+		inline uint64_t End () const {
+		  return _end.load(std::memory_order_acquire);
+		}
+
+		inline void Finish (uint64_t end) {
+		  _end.store(end, std::memory_order_release);
+		}
+
+	 private:
+		LogSegment (const LogSegment &other) = delete;
+		LogSegment &operator= (const LogSegment &other) = delete;
+
+		const uint32_t _number;
+		const uint64_t _base;
+		const int _fd;
+		const int64_t _created;
+		std::atomic<uint64_t> _end;
+	 };
+
+	 typedef std::vector<std::shared_ptr<LogSegment>> segment_list_type;
+
+	 // The segments the writer has published for readers, swapped whole with std::atomic_store
+	 struct SegmentTable {
+		std::shared_ptr<const segment_list_type> _segments;
+	 };
+
+	 // path.index, a sparse offset to segment index: one record per segment with the offset it starts
+	 // at, so a restart carries on the offsets and a read finds its segment without opening the others.
+	 // A log written before there was an index gets one built from its store files in order.
+	 class SegmentIndex {
+	 public:
+		typedef struct Entry {
+		  uint64_t _base;
+		  int64_t _created;
+		  uint32_t _number;
+		  uint32_t _pad;
+		} Entry;
+
+		SegmentIndex (const std::string &path);
+		virtual ~SegmentIndex ();
+
+		// 0 on success. A record cut short by a crash is ignored.
+		int Open (std::vector<Entry> &entries);
+		int Append (const Entry &entry);
+
+		// path.NNNNNNNNN.store, as StoreUtil::CreateRollingStore names them
+		static std::string SegmentPath (const std::string &path, uint32_t number);
+
+	 private:
+		SegmentIndex (const SegmentIndex &other) = delete;
+		SegmentIndex &operator= (const SegmentIndex &other) = delete;
+
+		std::string _path;
+		int _fd;
+	 };
+
+	 // Keeps the next head of a SegmentedLog ready and finishes with the old ones on a thread of its
+	 // own, so a roll on the writer's thread makes no system call. The next head's file is created
+	 // empty with its allocator and flusher running. An old head's flusher and allocator are stopped
+	 // here (the last flush, the munmaps and the trim of pages mapped ahead), then the new head's index
+	 // record is appended and synced, its offset being known only at the roll. Retention's unlinks
+	 // come here too.
+	 class SegmentRoller {
+	 public:
+		typedef struct Head {
+		  uint32_t _number;
+		  int _fd;
+		  std::shared_ptr<SegmentAllocator> _segments;
+		  std::shared_ptr<StoreFlusher> _flusher;
+		} Head;
+
+		SegmentRoller (const std::string &path, SegmentIndex &index, off64_t pageSize, uint32_t prefaultPages,
+							const FlushConfig &flush, uint32_t pollUsec = 1000);
+		virtual ~SegmentRoller ();
+
+		// number is the next head's. 0 on success
+		int Start (uint32_t number);
+		// Finishes the queued work and removes a head made ready and not taken
+		void Stop ();
+
+		// writer thread
+
+		// The next head, made ready here when the thread has not got to it. 0 on success
+		int Take (Head &head);
+
+		// The old head's allocator and flusher to stop, then the new head's index record. The
+		// segment is held until then so its file stays open.
+		void Release (const std::shared_ptr<LogSegment> &segment, const std::shared_ptr<SegmentAllocator> &segments,
+						  const std::shared_ptr<StoreFlusher> &flusher, const SegmentIndex::Entry &entry);
+
+		// unlinks segment number
+		void Remove (uint32_t number);
+
+		// Release calls done with, in the order made
+		inline uint64_t Released () const {
+		  return _released.load(std::memory_order_acquire);
+		}
+
+		// failed flushes of released heads, index records and head files
+		inline uint64_t Errors () const {
+		  return _errors.load(std::memory_order_relaxed);
+		}
+
+		// heads made ready on the writer's thread
+		inline uint64_t Misses () const {
+		  return _misses;
+		}
+
+	 private:
+		SegmentRoller (const SegmentRoller &other) = delete;
+		SegmentRoller &operator= (const SegmentRoller &other) = delete;
+
+		typedef struct Retired {
+		  std::shared_ptr<LogSegment> _segment;
+		  std::shared_ptr<SegmentAllocator> _segments;
+		  std::shared_ptr<StoreFlusher> _flusher;
+		  SegmentIndex::Entry _entry;
+		} Retired;
+
+		void Run ();
+		int Prepare (uint32_t number, Head &head);
+		bool Work ();
+		void Close (Head &head);
+
+		const std::string _path;
+		SegmentIndex &_index;
+		const off64_t _pageSize;
+		const uint32_t _prefaultPages;
+		const FlushConfig _flush;
+		const uint32_t _pollUsec;
+
+		std::mutex _lock; // held for swaps only, never across a system call
+		Head _ready;      // _fd < 0 while there is none
+		uint32_t _next;   // number of the next head to make ready
+		bool _preparing;  // the thread took _next and is making it ready
+		std::vector<Retired> _retired;
+		std::vector<uint32_t> _removed;
+
+		uint64_t _misses;
+		std::atomic<uint64_t> _released;
+		std::atomic<uint64_t> _errors;
+		std::atomic<bool> _running;
+		std::thread _thread;
+	 };
+
+	 // Reads by absolute offset across the segments in _open. Derived supplies Readable(i), how much
+	 // of _open[i] may be read counting from its base, and Refresh, called when a read gets to the end
+	 // of the last segment it holds.
+	 template <typename Derived, typename StreamType>
+	 class SegmentedRead {
+	 public:
+		typedef uint64_t offset_type;
+		typedef char value_type;
+
+		// lowest offset still held, retention moves it forward
+		offset_type First () const {
+		  return _open.empty() ? 0 : _open.front()._segment->Base();
+		}
+
+		bool Peak (offset_type offset, char &d) {
+		  const int i = Find(offset);
+		  if (i < 0) return false;
+		  const uint64_t rel = offset - _open[i]._segment->Base();
+		  if (rel >= Self().Readable(i)) return false;
+		  return _open[i]._stream->Peak(rel, d);
+		}
+
+		bool Pop (offset_type offset, char *dest, uint64_t size) {
+		  while (size) {
+			 const int i = Find(offset);
+			 if (i < 0) return false;
+			 const uint64_t rel = offset - _open[i]._segment->Base();
+			 const uint64_t readable = Self().Readable(i);
+			 if (rel >= readable) return false;
+
+			 const uint64_t x = std::min(size, readable - rel);
+			 if (!_open[i]._stream->Pop(rel, dest, x)) return false;
+			 dest += x;
+			 offset += x;
+			 size -= x;
+		  }
+		  return true;
+		}
+
+		// Gathers from up to two segments so a client is not left short at a roll. -4 when offset
+		// is below First.
+		int Writev (offset_type offset, offset_type size, int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+		  int i = Find(offset);
+		  if (i < 0) return -4;
+
+		  struct iovec iov[MAX_IOV];
+		  int count = 0;
+		  std::function <int(int, const struct iovec *, int)> collect = [&iov, &count] (int, const struct iovec *v, int n) {
+			 int len = 0;
+			 for (int j = 0; j < n && count < MAX_IOV; ++j, ++count) {
+				iov[count] = v[j];
+				len += v[j].iov_len;
+			 }
+			 return len;
+		  };
+
+		  offset_type queued = 0;
+		  for (int s = 0; s < 2 && i < static_cast<int>(_open.size()) && queued < size; ++s, ++i) {
+			 const uint64_t rel = offset + queued - _open[i]._segment->Base();
+			 const uint64_t readable = Self().Readable(i);
+			 if (rel >= readable) break;
+
+			 int r = _open[i]._stream->Writev(rel, std::min(size - queued, readable - rel), fd, collect);
+			 if (r < 0) return r;
+			 queued += r;
+			 if (rel + r < readable) break; // capped by the segment's cache
+		  }
+		  return cb(fd, iov, count);
+		}
+
+		inline uint32_t Segments () const {
+		  return _open.size();
+		}
+
+	 protected:
+		static constexpr int MAX_IOV = 256;
+
+		typedef struct OpenSegment {
+		  std::shared_ptr<LogSegment> _segment;
+		  std::shared_ptr<StreamType> _stream; // destroyed first
+		} OpenSegment;
+
+		inline Derived &Self () {
+		  return static_cast<Derived &>(*this);
+		}
+
+		// index in _open of the segment holding offset, -1 below the first
+		int Find (offset_type offset) {
+		  if (_open.empty() || offset >= _open.back()._segment->End()) {
+			 Self().Refresh();
+		  }
+		  if (_open.empty() || offset < _open.front()._segment->Base()) return -1;
+		  if (offset >= _open.back()._segment->Base()) return _open.size() - 1; // usually the head
+
+		  auto b = std::upper_bound(_open.begin(), _open.end(), offset, [] (offset_type o, const OpenSegment &s) {
+				return o < s._segment->Base();
+			 });
+		  return static_cast<int>(b - _open.begin()) - 1;
+		}
+
+		std::deque<OpenSegment> _open;
+	 };
+
+	 // Publish log split across files path.NNNNNNNNN.store. Offsets run on over every segment and
+	 // across restarts (each run starts a new segment), so a client can Mark any offset still held
+	 // and read on through later segments. Same write interface as BufType, a LogRWStream per
+	 // segment. Call Checkpoint between records so segments start on a record, Tick from a timer for
+	 // the time limits. A SegmentRoller makes heads ready and releases old ones off the writer's
+	 // thread. Readers on other threads use SegmentedReadLog. After a crash the tail of the last page
+	 // of the head reads as zeros.
+	 template <typename BufType>
+	 class SegmentedLog : public SegmentedRead<SegmentedLog<BufType>, BufType> {
+		typedef SegmentedRead<SegmentedLog<BufType>, BufType> base_type;
+		friend base_type;
+
+	 public:
+		typedef uint64_t offset_type;
+		typedef char value_type;
+		typedef typename BufType::template store_iterator<SegmentedLog<BufType>> iterator;
+
+		SegmentedLog (const std::string &path, off64_t pageSize, const SegmentConfig &config) : _path(path),
+		  _pageSize(pageSize), _config(config), _index(path), _table(std::make_shared<SegmentTable>()),
+		  _prefaultPages(0), _rollDue(false), _releases(0) {
+		}
+
+		// the head file is cut back to the written length, so the next run carries on from there
+		virtual ~SegmentedLog () {
+		  if (_roller) _roller->Stop();
+		  if (this->_open.empty()) return;
+		  std::shared_ptr<LogSegment> head = this->_open.back()._segment;
+		  const uint64_t len = HeadBytes();
+		  _headSegments.reset();
+		  this->_open.clear();
+		  coypu::file::FileUtil::Truncate(head->GetFD(), len);
+		}
+
+		// before Open, applied to each head segment
+		void SetPrefaultPages (uint32_t pages) {
+		  _prefaultPages = pages;
+		}
+
+		void SetFlushConfig (const FlushConfig &flush) {
+		  _flush = flush;
+		}
+
+		// Opens the segments in the index and starts a new head after them. 0 on success
+		int Open () {
+		  if (!this->_open.empty()) return -1;
+		  coypu::file::FileUtil::Mkdir(_path.c_str(), 0777, true);
+
+		  std::vector<SegmentIndex::Entry> entries;
+		  if (_index.Open(entries)) return -2;
+
+		  uint64_t base = entries.empty() ? 0 : entries.back()._base;
+		  for (size_t i = 0; i < entries.size(); ++i) {
+			 const std::string segmentPath = SegmentIndex::SegmentPath(_path, entries[i]._number);
+			 bool exists = false;
+			 coypu::file::FileUtil::Exists(segmentPath.c_str(), exists);
+			 if (!exists) continue; // retained away
+
+			 int fd = coypu::file::FileUtil::Open(segmentPath.c_str(), O_LARGEFILE|O_RDWR, 0600);
+			 if (fd < 0) return -3;
+			 off64_t size = 0;
+			 coypu::file::FileUtil::GetSize(fd, size);
+			 if (size == 0) {
+				// a head nothing was written to
+				coypu::file::FileUtil::Close(fd);
+				coypu::file::FileUtil::Remove(segmentPath.c_str());
+				continue;
+			 }
+
+			 std::shared_ptr<LogSegment> segment = std::make_shared<LogSegment>(entries[i]._number, entries[i]._base,
+																									  fd, entries[i]._created);
+			 segment->Finish(i + 1 < entries.size() ? entries[i+1]._base : entries[i]._base + size);
+			 base = std::max(base, segment->End());
+
+			 // never written again, but the stream positions its write page on a page boundary
+			 const off64_t pages = ((size + _pageSize - 1) / _pageSize) * _pageSize;
+			 this->_open.push_back({segment, std::make_shared<BufType>(_pageSize, pages, fd, false)});
+		  }
+
+		  const uint32_t number = entries.empty() ? 0 : entries.back()._number + 1;
+		  int r = AddSegment(base, number, ::time(nullptr));
+		  if (r) return r;
+
+		  _roller = std::make_shared<SegmentRoller>(_path, _index, _pageSize, _prefaultPages, _flush);
+		  return _roller->Start(number + 1) ? -4 : 0;
+		}
+
+		offset_type Available () const {
+		  return this->_open.empty() ? 0 : this->_open.back()._segment->Base() + this->_open.back()._stream->Available();
+		}
+
+		bool IsEmpty () const {
+		  return Available() == 0;
+		}
+
+		inline offset_type Free () const {
+		  return Capacity() - Available();
+		}
+
+		offset_type Capacity () const {
+		  return UINT64_MAX;
+		}
+
+		int Push (const char *data, offset_type len) {
+		  if (this->_open.empty()) return -1;
+		  return this->_open.back()._stream->Push(data, len);
+		}
+
+		int ZeroCopyWriteNext (void **data, int *len) {
+		  if (this->_open.empty()) return -1;
+		  return this->_open.back()._stream->ZeroCopyWriteNext(data, len);
+		}
+
+		void ZeroCopyWriteBackup (int len) {
+		  this->_open.back()._stream->ZeroCopyWriteBackup(len);
+		}
+
+		iterator begin (offset_type offset) {
+		  return iterator(this, offset);
+		}
+
+		iterator end (offset_type end) {
+		  return iterator(this, end);
+		}
+
+		// Between records: rolls once the head is full, or Tick found it old enough. true on a roll
+		bool Checkpoint () {
+		  if (!_rollDue && HeadBytes() < _config._segmentBytes) return false;
+		  return Roll() == 0 && !_rollDue;
+		}
+
+		// From a timer on the writer's thread, now in seconds. Due rolls happen at the next
+		// Checkpoint, retention by age straight away.
+		void Tick (int64_t now) {
+		  if (!this->_open.empty() && _config._segmentSeconds && HeadBytes() &&
+				now - this->_open.back()._segment->Created() >= _config._segmentSeconds) {
+			 _rollDue = true;
+		  }
+		  Retain(now);
+		  Prune();
+		}
+
+		// Starts a new head segment at Available, the one the roller made ready. The old head's
+		// allocator and flusher go to the roller. Nothing to do while the head is empty. 0 on success
+		int Roll () {
+		  if (this->_open.empty() || !_roller) return -1;
+		  _rollDue = false;
+		  if (HeadBytes() == 0) return 0;
+
+		  SegmentRoller::Head next;
+		  if (_roller->Take(next)) return -2;
+
+		  const uint64_t base = Available();
+		  const int64_t now = ::time(nullptr);
+		  SegmentIndex::Entry entry;
+		  ::memset(&entry, 0, sizeof(entry));
+		  entry._base = base;
+		  entry._created = now;
+		  entry._number = next._number;
+
+		  // the old head is read only from here
+		  OpenSegment &head = this->_open.back();
+		  head._segment->Finish(base);
+		  std::shared_ptr<StoreFlusher> flusher = head._stream->GetFlusher();
+		  head._stream->SetSegmentAllocator(nullptr);
+		  head._stream->SetFlusher(nullptr);
+		  if (flusher) {
+			 _retiring.push_back({_releases, head._segment->Base(), flusher});
+		  }
+		  _roller->Release(head._segment, _headSegments, flusher, entry);
+		  ++_releases;
+
+		  std::shared_ptr<LogSegment> segment = std::make_shared<LogSegment>(next._number, base, next._fd, now);
+		  std::shared_ptr<BufType> stream = std::make_shared<BufType>(_pageSize, 0, next._fd, false);
+		  if (next._segments) stream->SetSegmentAllocator(next._segments);
+		  if (next._flusher) stream->SetFlusher(next._flusher);
+		  _headSegments = next._segments;
+		  this->_open.push_back({segment, stream});
+
+		  Retain(now);
+		  Publish();
+		  Prune();
+		  return 0;
+		}
+
+		// for SegmentedReadLog
+		const std::shared_ptr<SegmentTable> &GetTable () const {
+		  return _table;
+		}
+
+		uint64_t GetPageSize () const {
+		  return _pageSize;
+		}
+
+		// Everything below this offset survives a crash: where the flusher of the oldest head the
+		// roller has not finished with has got to, or the current head's once it has (the last flush
+		// and the head's index record are behind that). 0 without a flush policy
+		offset_type Durable () const {
+		  const std::shared_ptr<StoreFlusher> &flusher = HeadFlusher();
+		  if (!flusher) return 0;
+		  const uint64_t released = _roller ? _roller->Released() : 0;
+		  for (const Retiring &r : _retiring) {
+			 if (r._release >= released) return r._base + r._flusher->Durable();
+		  }
+		  return this->_open.back()._segment->Base() + flusher->Durable();
+		}
+
+		// what the head's flusher has been told is written. 0 without a flush policy
+		offset_type Written () const {
+		  const std::shared_ptr<StoreFlusher> &flusher = HeadFlusher();
+		  return flusher ? this->_open.back()._segment->Base() + flusher->GetWritten() : 0;
+		}
+
+		// failed flushes across every segment, and failures of the roller's index records and files
+		uint64_t Errors () const {
+		  const std::shared_ptr<StoreFlusher> &flusher = HeadFlusher();
+		  return (_roller ? _roller->Errors() : 0) + (flusher ? flusher->Errors() : 0);
+		}
+
+	 private:
+		SegmentedLog (const SegmentedLog &other) = delete;
+		SegmentedLog &operator= (const SegmentedLog &other) = delete;
+
+		// readable length of _open[i]: what its stream holds, up to where the next segment starts
+		inline uint64_t Readable (size_t i) {
+		  const OpenSegment &o = this->_open[i];
+		  return std::min<uint64_t>(o._stream->Available(), o._segment->End() - o._segment->Base());
+		}
+
+		// the writer's own list is always current
+		inline void Refresh () {
+		}
+
+		inline uint64_t HeadBytes () const {
+		  return this->_open.empty() ? 0 : this->_open.back()._stream->Available();
+		}
+
+		inline const std::shared_ptr<StoreFlusher> &HeadFlusher () const {
+		  static const std::shared_ptr<StoreFlusher> none;
+		  return this->_open.empty() ? none : this->_open.back()._stream->GetFlusher();
+		}
+
+		// the first head of a run, on Open. number is past the last index record, so a file there is
+		// from a run that crashed before the record was made and is not part of the log
+		int AddSegment (uint64_t base, uint32_t number, int64_t now) {
+		  const std::string segmentPath = SegmentIndex::SegmentPath(_path, number);
+		  // the store is only ever mapped, so no O_DIRECT
+		  int fd = coypu::file::FileUtil::Open(segmentPath.c_str(), O_CREAT|O_TRUNC|O_LARGEFILE|O_RDWR, 0600);
+		  if (fd < 0) return -1;
+
+		  SegmentIndex::Entry entry;
+		  ::memset(&entry, 0, sizeof(entry));
+		  entry._base = base;
+		  entry._created = now;
+		  entry._number = number;
+		  if (_index.Append(entry)) {
+			 coypu::file::FileUtil::Close(fd);
+			 return -2;
+		  }
+
+		  std::shared_ptr<LogSegment> segment = std::make_shared<LogSegment>(number, base, fd, now);
+		  std::shared_ptr<BufType> stream = std::make_shared<BufType>(_pageSize, 0, fd, false);
+		  if (_prefaultPages) {
+			 std::shared_ptr<SegmentAllocator> segments = std::make_shared<SegmentAllocator>(fd, _pageSize, 0, _prefaultPages);
+			 if (segments->Start() == 0 && stream->SetSegmentAllocator(segments)) _headSegments = segments;
+		  }
+		  if (_flush._policy != FLUSH_NONE) {
+			 std::shared_ptr<StoreFlusher> flusher = std::make_shared<StoreFlusher>(fd, _pageSize, 0, _flush);
+			 if (flusher->Start() == 0) stream->SetFlusher(flusher);
+		  }
+		  this->_open.push_back({segment, stream});
+
+		  Retain(now);
+		  Publish();
+		  return 0;
+		}
+
+		// Deletes the oldest segments, never the head, while the total is over _retainBytes or
+		// everything in them is older than _retainSeconds (the next segment started long enough ago)
+		void Retain (int64_t now) {
+		  bool removed = false;
+		  while (this->_open.size() > 1) {
+			 const bool size = _config._retainBytes && Available() - this->First() > _config._retainBytes;
+			 const bool age = _config._retainSeconds &&
+				now - this->_open[1]._segment->Created() >= static_cast<int64_t>(_config._retainSeconds);
+			 if (!size && !age) break;
+
+			 if (_roller) {
+				_roller->Remove(this->_open.front()._segment->Number());
+			 } else {
+				coypu::file::FileUtil::Remove(SegmentIndex::SegmentPath(_path, this->_open.front()._segment->Number()).c_str());
+			 }
+			 this->_open.pop_front();
+			 removed = true;
+		  }
+		  if (removed) Publish();
+		}
+
+		// heads the roller has finished with no longer hold Durable back
+		void Prune () {
+		  const uint64_t released = _roller ? _roller->Released() : 0;
+		  while (!_retiring.empty() && _retiring.front()._release < released) {
+			 _retiring.pop_front();
+		  }
+		}
+
+		// Readers see a segment end (Finish) before the table holding the one after it
+		void Publish () {
+		  std::shared_ptr<segment_list_type> list = std::make_shared<segment_list_type>();
+		  for (const OpenSegment &o : this->_open) {
+			 list->push_back(o._segment);
+		  }
+		  std::atomic_store(&_table->_segments, std::shared_ptr<const segment_list_type>(list));
+		}
+
+		typedef typename base_type::OpenSegment OpenSegment;
+
+		// an old head whose flusher the roller has yet to stop
+		typedef struct Retiring {
+		  uint64_t _release; // its Release call, counting from 0
+		  uint64_t _base;
+		  std::shared_ptr<StoreFlusher> _flusher;
+		} Retiring;
+
+		std::string _path;
+		off64_t _pageSize;
+		SegmentConfig _config;
+		SegmentIndex _index;
+		std::shared_ptr<SegmentTable> _table;
+		uint32_t _prefaultPages;
+		FlushConfig _flush;
+		bool _rollDue;
+		std::shared_ptr<SegmentAllocator> _headSegments; // the head's, handed to the roller with it
+		std::deque<Retiring> _retiring;
+		uint64_t _releases;
+		std::shared_ptr<SegmentRoller> _roller; // after _index, which it appends to
+	 };
+
+	 // Reader thread view of a SegmentedLog, as LogReadStream is for LogRWStream. Each segment is
+	 // mapped through its own ReadBufType. Segments the writer adds, or retention removes, are picked
+	 // up from its table when a read gets to the end of the last segment held.
+	 template <typename ReadBufType, typename BufType>
+	 class SegmentedReadLog : public SegmentedRead<SegmentedReadLog<ReadBufType, BufType>, ReadBufType> {
+		typedef SegmentedRead<SegmentedReadLog<ReadBufType, BufType>, ReadBufType> base_type;
+		friend base_type;
+
+	 public:
+		typedef uint64_t offset_type;
+		typedef char value_type;
+		typedef typename BufType::template store_iterator<SegmentedReadLog<ReadBufType, BufType>> iterator;
+
+		SegmentedReadLog (const SegmentedLog<BufType> &log) : _table(log.GetTable()), _pageSize(log.GetPageSize()),
+		  _available(log.Available()) {
+		  Refresh();
+		}
+
+		// writer thread, after a record is complete
+		void Publish (offset_type offset) {
+		  _available.store(offset, std::memory_order_release);
+		}
+
+		offset_type Available () const {
+		  return _available.load(std::memory_order_acquire);
+		}
+
+		bool IsEmpty () const {
+		  return Available() == 0;
+		}
+
+		iterator begin (offset_type offset) {
+		  return iterator(this, offset);
+		}
+
+		iterator end (offset_type end) {
+		  return iterator(this, end);
+		}
+
+		// Called before any page a read handed out is unmapped: a segment's cache evicting one, or
+		// the stream of a segment retention removed being dropped. See LRUCache::SetEvictCB
+		void SetEvictCB (const std::function<void()> &evict_cb) {
+		  _evictCB = evict_cb;
+		  for (OpenSegment &o : this->_open) {
+			 o._stream->SetEvictCB(evict_cb);
+		  }
+		}
+
+	 private:
+		SegmentedReadLog (const SegmentedReadLog &other) = delete;
+		SegmentedReadLog &operator= (const SegmentedReadLog &other) = delete;
+
+		typedef typename base_type::OpenSegment OpenSegment;
+
+		inline uint64_t Readable (size_t i) {
+		  const OpenSegment &o = this->_open[i];
+		  const uint64_t end = std::min(o._segment->End(), Available());
+		  const uint64_t readable = end > o._segment->Base() ? end - o._segment->Base() : 0;
+		  o._stream->Publish(readable);
+		  return readable;
+		}
+
+		void Refresh () {
+		  std::shared_ptr<const segment_list_type> list = std::atomic_load(&_table->_segments);
+		  if (!list || list == _list) return;
+
+		  // both in segment order, streams are kept for the segments still there
+		  std::deque<OpenSegment> open;
+		  size_t kept = 0;
+		  auto b = this->_open.begin();
+		  for (const std::shared_ptr<LogSegment> &segment : *list) {
+			 while (b != this->_open.end() && (*b)._segment->Number() < segment->Number()) ++b;
+			 if (b != this->_open.end() && (*b)._segment == segment) {
+				open.push_back(*b);
+				++kept;
+			 } else {
+				open.push_back({segment, std::make_shared<ReadBufType>(_pageSize, 0, segment->GetFD())});
+				open.back()._stream->SetEvictCB(_evictCB);
+			 }
+		  }
+		  if (kept < this->_open.size() && _evictCB) _evictCB();
+		  this->_open.swap(open);
+		  _list = list;
+		}
+
+		std::shared_ptr<SegmentTable> _table;
+		std::shared_ptr<const segment_list_type> _list;
+		uint64_t _pageSize;
+		std::atomic<uint64_t> _available;
+		std::function<void()> _evictCB;
+	 };
+  }
+}
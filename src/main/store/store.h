@@ -10,8 +10,16 @@
 #include <deque>
 #include <memory>
 #include <streambuf>
+#include <atomic>
 #include <type_traits>
 
+#include "buf/scan.h"
+#include "buf/mask.h"
+#include "buf/frame.h"
+#include "file/file.h"
+#include "store/segment.h"
+#include "store/flush.h"
+
 namespace coypu {
   namespace store {
     // Simpler to make this a rolling buffer 
@@ -76,6 +84,14 @@ namespace coypu {
 			 _allocate_cb = allocate_cb;
 		  }
 
+		  // Takes new pages from segments, mapped ahead on its thread, falling back to mapping them
+		  // here when it has not got there yet. File backed only.
+		  bool SetSegmentAllocator (const std::shared_ptr<SegmentAllocator> &segments) {
+			 if (_anonymous) return false;
+			 _segments = segments;
+			 return true;
+		  }
+
 		  // For use with google buf
 		  int ZeroCopyNext (void **data, int *len) {
 			 if (_readOnly) return -1;
@@ -115,7 +131,11 @@ namespace coypu {
 				  return -4;
 				}
 				
-				if (size == _offset) {
+				if (_segments) {
+				  if (_segments->Extend(_offset+_pageSize)) {
+					 return -1;
+				  }
+				} else if (size == _offset) {
 				  if (MMapProvider::Truncate(_fd, _offset+_pageSize)) {
 					 return -1;
 				  }
@@ -146,21 +166,31 @@ namespace coypu {
 		  }
 
         int AllocatePage () {
-			 if (!_anonymous) {
-				if (MMapProvider::Truncate(_fd, _offset+_pageSize)) {
-				  return -1;
-				}
-				
-				if (MMapProvider::LSeekSet(_fd, _offset) != _offset) {
-				  return -2;
+			 char *page = nullptr;
+			 if (_segments && _segments->Take(_offset, page)) {
+				// already faulted in, and the old page is unmapped on the allocator thread
+				if (_dataPage.first && !_segments->Retire(_dataPage.first)) {
+				  MMapProvider::MUnmap(_dataPage.first, _pageSize);
 				}
+				_dataPage.first = page;
+			 } else {
+				if (!_anonymous) {
+				  // the allocator may have grown the file past this page, so never cut it back
+				  if (_segments ? _segments->Extend(_offset+_pageSize) : MMapProvider::Truncate(_fd, _offset+_pageSize)) {
+					 return -1;
+				  }
 
-				if (_dataPage.first) {
-				  MMapProvider::MUnmap(_dataPage.first, _pageSize);
+				  if (MMapProvider::LSeekSet(_fd, _offset) != _offset) {
+					 return -2;
+				  }
+
+				  if (_dataPage.first) {
+					 MMapProvider::MUnmap(_dataPage.first, _pageSize);
+				  }
 				}
-			 }
 
-			 _dataPage.first = reinterpret_cast<char *>(MMapProvider::MMapWrite(_fd, _offset, _pageSize));
+				_dataPage.first = reinterpret_cast<char *>(MMapProvider::MMapWrite(_fd, _offset, _pageSize));
+			 }
 
 			 if (_allocate_cb) {
 				_allocate_cb(_dataPage.first, _offset);
@@ -181,6 +211,7 @@ namespace coypu {
         std::pair<char *, off64_t> _dataPage;
 		  bool _anonymous;
 		  std::function<void(char *, off64_t)> _allocate_cb;
+		  std::shared_ptr<SegmentAllocator> _segments;
     };
 
 	 
@@ -229,7 +260,7 @@ namespace coypu {
         }
 
         int Map (int fd, uint64_t offset) {
-          if (_dataPage.second != offset) {
+          if (_dataPage.second != offset || !_dataPage.first) {
             MMapProvider::MUnmap(_dataPage.first, _pageSize);
 
             _dataPage.second = offset;
@@ -270,11 +301,13 @@ namespace coypu {
         
         // Absolute offset
         bool Find (uint64_t start, char d, uint64_t &offset) const {
-          for (uint64_t i = start; i < (_dataPage.second+_pageSize); ++ i) {
-            if (_dataPage.first[i-_dataPage.second] == d) {
-              offset = i;
-              return true;
-            }
+          if (start < _dataPage.second || start >= (_dataPage.second+_pageSize)) return false;
+
+          const uint64_t pos = start-_dataPage.second;
+          const size_t x = coypu::buf::scan::Find(&_dataPage.first[pos], _pageSize-pos, d);
+          if (x < _pageSize-pos) {
+            offset = start + x;
+            return true;
           }
           return false;
         }
@@ -292,6 +325,18 @@ namespace coypu {
           return true;
         }
 		  
+        // Absolute offset - in place, up to the end of the page
+        bool View (uint64_t start, uint64_t size, coypu::buf::FrameView<char> &view, uint64_t &outSize) const {
+          if (!_dataPage.first) {
+            return false;
+          }
+
+          if (start < _dataPage.second || start >= (_dataPage.second+ _pageSize)) return false;
+
+          outSize = std::min(size, _pageSize - (start-_dataPage.second));
+          return view.Append(&_dataPage.first[start-_dataPage.second], outSize);
+        }
+
 		  bool Unmask (uint64_t start, uint64_t &maskPos, const char *mask, const int maskLen, uint64_t size, uint64_t &outSize) {
           if (!_dataPage.first) {
             return false;
@@ -301,11 +346,9 @@ namespace coypu {
 
           outSize = std::min(size, _pageSize - (start-_dataPage.second));
 
-			 //::memcpy(dest, &_dataPage.first[start-_dataPage.second], outSize);
-			 for (uint64_t i = start-_dataPage.second; i < (start-_dataPage.second)+outSize; ++i) {
-				_dataPage.first[i] ^= mask[maskPos%maskLen];
-				++maskPos;
-			 }				
+			 char *data = &_dataPage.first[start-_dataPage.second];
+			 coypu::buf::mask::Xor(data, data, outSize, mask, maskLen, maskPos);
+			 maskPos += outSize;
 			 
           return true;
         }
@@ -424,6 +467,11 @@ namespace coypu {
 		  std::deque<read_cache_type> _pages;
 	 };
 		  
+    // Read page cache, least recently used page is remapped on a miss. Pages are indexed by an
+    // intrusive chained hash over a fixed slot array and ordered by an intrusive doubly linked list
+    // of slot indices, so a lookup is O(1) and a hit only relinks two slots (no allocation). Slots
+    // are allocated on first use, up to maxSize. An evicted slot keeps its pair and page objects
+    // and is remapped in place, as before.
     template<typename MMapProvider, int CachePages>
     class LRUCache {
       public:
@@ -435,8 +483,13 @@ namespace coypu {
         typedef uint64_t offset_type;
 
         LRUCache (off64_t pageSize, off64_t maxSize, int fd) : 
-            _pageSize(pageSize), _maxSize(maxSize), _fd(fd) {
-
+            _pageSize(pageSize), _maxSize(std::max<off64_t>(maxSize, 1)), _fd(fd),
+            _hashShift(0), _head(NIL), _tail(NIL), _free(NIL) {
+          uint32_t buckets = 2;
+          while (buckets < 2 * _maxSize) buckets <<= 1;
+          _hashShift = 32 - __builtin_ctz(buckets);
+          _buckets.assign(buckets, static_cast<uint32_t>(NIL));
+          _slots.reserve(_maxSize);
         }
 
         virtual ~LRUCache () {
@@ -447,38 +500,53 @@ namespace coypu {
 		  }
 
         int FindPage (offset_type offset, read_cache_type &page) {
-          page_offset_type pageIndex = offset / _pageSize;
+          const page_offset_type pageIndex = offset / _pageSize;
 
-          typename std::deque<read_cache_type>::iterator b = _lruReadCache.begin();
-          typename std::deque<read_cache_type>::iterator e = _lruReadCache.end();
-
-          for (;b != e; ++b) {
-            if ((*b)->first == pageIndex) {
-              page = *b;
-
-              if (b != _lruReadCache.begin()) {
-                _lruReadCache.erase(b);         // erase
-                _lruReadCache.push_front(page); // add to front - TODO optimize with bpf
-              }
+          // sequential readers stay on the front page
+          if (_head != NIL && _slots[_head]._page->first == pageIndex) {
+            page = _slots[_head]._page;
+            return 0;
+          }
 
+          const uint32_t bucket = Bucket(pageIndex);
+          for (uint32_t i = _buckets[bucket]; i != NIL; i = _slots[i]._hashNext) {
+            if (_slots[i]._page->first == pageIndex) {
+              Unlink(i);
+              PushFront(i);
+              page = _slots[i]._page;
               return 0;
             }
           }
 
-          if (_lruReadCache.size() == _maxSize) {
-            page = _lruReadCache.back();                       // re-use object
-            page->first = pageIndex;
-            _lruReadCache.erase(--e);                          // erase
-          } else {
+          uint32_t i = NIL;
+          if (_free != NIL) {
+            i = _free;
+            _free = _slots[i]._next;
+          } else if (_slots.size() < _maxSize) {
+            i = _slots.size();
+            Slot slot;
             page_type psp = std::make_shared<store_type>(_pageSize);
-            page = std::make_shared<pair_type>(std::make_pair(pageIndex, psp)); // allocate new page
+            slot._page = std::make_shared<pair_type>(std::make_pair(pageIndex, psp)); // allocate new page
+            _slots.push_back(slot);
+          } else {
+            if (_evictCB) _evictCB();               // before the tail page is unmapped
+            i = _tail;                              // re-use object
+            Unlink(i);
+            Unhash(i);
           }
-			 
-          if(page->second->Map(_fd, pageIndex * _pageSize) == 0) {
-            _lruReadCache.push_front(page); // add to front
+
+          Slot &slot = _slots[i];
+          slot._page->first = pageIndex;
+          if (slot._page->second->Map(_fd, static_cast<offset_type>(pageIndex) * _pageSize) == 0) {
+            slot._hashNext = _buckets[bucket];
+            _buckets[bucket] = i;
+            PushFront(i);
+            page = slot._page;
             return 0;
           }
 
+          slot._next = _free; // unmapped, first to be reused
+          _free = i;
           page = nullptr; // just in case
 
           return -1;
@@ -488,18 +556,129 @@ namespace coypu {
 			 // nop
 		  }
 
+		  // called before a page is remapped, anything still pointing into the cache (e.g. writes
+		  // queued with EventManager::Writev) has to be done with it
+		  void SetEvictCB (const std::function<void()> &evict_cb) {
+			 _evictCB = evict_cb;
+		  }
+
       private:
         LRUCache (const LRUCache &other);
         LRUCache &operator= (const LRUCache &other);
         static constexpr int iov_size = CachePages;
+        static constexpr uint32_t NIL = UINT32_MAX;
+
+        typedef struct Slot {
+          read_cache_type _page;
+          uint32_t _prev;     // toward most recent
+          uint32_t _next;     // toward least recent, or next free slot
+          uint32_t _hashNext; // bucket chain
+
+          Slot () : _prev(NIL), _next(NIL), _hashNext(NIL) {
+          }
+        } Slot;
+
+        // fibonacci hash, consecutive pages spread across buckets
+        inline uint32_t Bucket (page_offset_type pageIndex) const {
+          return static_cast<uint32_t>(pageIndex * 2654435769u) >> _hashShift;
+        }
+
+        inline void Unlink (uint32_t i) {
+          Slot &slot = _slots[i];
+          if (slot._prev != NIL) _slots[slot._prev]._next = slot._next;
+          else _head = slot._next;
+          if (slot._next != NIL) _slots[slot._next]._prev = slot._prev;
+          else _tail = slot._prev;
+          slot._prev = slot._next = NIL;
+        }
+
+        inline void PushFront (uint32_t i) {
+          Slot &slot = _slots[i];
+          slot._prev = NIL;
+          slot._next = _head;
+          if (_head != NIL) _slots[_head]._prev = i;
+          _head = i;
+          if (_tail == NIL) _tail = i;
+        }
+
+        void Unhash (uint32_t i) {
+          uint32_t *link = &_buckets[Bucket(_slots[i]._page->first)];
+          while (*link != i) link = &_slots[*link]._hashNext;
+          *link = _slots[i]._hashNext;
+          _slots[i]._hashNext = NIL;
+        }
 
-        uint16_t _cachePages;
         uint64_t _pageSize;
         uint64_t _maxSize; 
         int _fd;
 
-        // page index, page
-        std::deque<read_cache_type> _lruReadCache;
+        uint32_t _hashShift;
+        uint32_t _head; // most recent
+        uint32_t _tail; // least recent
+        uint32_t _free; // slots whose map failed
+
+        std::vector<Slot> _slots;
+        std::vector<uint32_t> _buckets;
+        std::function<void()> _evictCB;
+    };
+
+    // Page walks over a read cache shared by the file backed streams, each bounded by the length
+    // the caller may read.
+    class ReadPages {
+      public:
+        // In place, one span per page touched, so false when the range covers more than two pages.
+        // Spans stay valid while their pages are cached.
+        template <typename CacheType>
+        static bool View (CacheType &cache, uint64_t pageSize, uint64_t available,
+                          uint64_t start_offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          view.Clear();
+          if (start_offset > available || size > available - start_offset) return false;
+
+          typename CacheType::read_cache_type page;
+          uint64_t read = 0, out_size = 0;
+          while (read < size) {
+            const uint64_t pos = start_offset + read;
+            if (cache.PeakPage((pos / pageSize) * pageSize, page) != 0 || !page || !page->second) return false;
+            if (!page->second->View(pos, size-read, view, out_size)) return false;
+            read += out_size;
+          }
+          return true;
+        }
+
+        // Hands up to CacheSize pages from start_offset to cb in one call, so a large size comes
+        // back short. -2 when a page cannot be mapped.
+        template <int CacheSize, typename CacheType>
+        static int Writev (CacheType &cache, uint64_t pageSize, uint64_t available,
+                           uint64_t start_offset, uint64_t size,
+                           int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+          if (start_offset >= available) return 0;
+          size = std::min(size, available - start_offset);
+          size = std::min(size, (CacheSize * pageSize));
+          struct iovec iov[CacheSize];
+
+          typename CacheType::read_cache_type page;
+          uint32_t startPage = start_offset / pageSize;
+          uint32_t maxPage = available / pageSize;
+
+          uint64_t queued = 0;
+          int iov_i = 0;
+          for (uint32_t i = startPage; queued < size && i <= maxPage && iov_i < CacheSize; ++i, ++iov_i) {
+            uint64_t pageStart = i * pageSize;
+            uint64_t page_offset = (start_offset+queued) % pageSize;
+
+            if (cache.FindPage(pageStart, page) == 0) {
+              iov[iov_i].iov_len = std::min((size-queued), pageSize - page_offset);
+              iov[iov_i].iov_base = page->second->GetBase(page_offset);
+              queued += iov[iov_i].iov_len;
+            } else {
+              return -2;
+            }
+          }
+          return cb(fd, iov, iov_i);
+        }
+
+      private:
+        ReadPages () = delete;
     };
 
     template <typename MMapProvider, template <typename, int> class ReadCache, int CacheSize>
@@ -619,11 +798,13 @@ namespace coypu {
 		  void ZeroCopyWriteBackup (int len) {
 			 _writeBuf.Backup(len);
 			 _available -= len;
+			 if (_flusher) _flusher->Written(_available);
 		  }
 
         int Push (const char *data, offset_type len) {
           int r = _writeBuf.Push(data,len);
           if (r == 0) _available += len;
+          if (_flusher) _flusher->Written(_available);
           return r;
         }
 
@@ -631,6 +812,7 @@ namespace coypu {
           int r = _writeBuf.Readv(fd, cb);
 			 // LRU will ignore, 
           if (r > 0) _available += r;
+          if (_flusher) _flusher->Written(_available);
           return r;
         }
 
@@ -722,33 +904,15 @@ namespace coypu {
           return false;
         }
 
-        // direct without a copy up to n bytes starting at start_offset
-        // maps up to CacheSize pages which means this could fail if n is significantly large.
+        // see ReadPages::View
+        bool View (offset_type start_offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          return ReadPages::View(_readCache, _pageSize, Available(), start_offset, size, view);
+        }
+
+        // direct without a copy up to n bytes starting at start_offset, see ReadPages::Writev
         int Writev (offset_type start_offset, offset_type size,
                     int fd, std::function <int(int, const struct iovec *, int)> &cb) {
-          size = std::min(size, (CacheSize * _pageSize));
-          struct iovec iov[CacheSize];
-
-          typename read_cache_type::read_cache_type page;
-          page_offset_type startPage = start_offset / _pageSize;
-          page_offset_type maxPage = _available / _pageSize;
-
-          // how to make sure pages are locked
-          offset_type queued = 0;
-          int iov_i = 0;
-          for (page_offset_type i = startPage; queued < size && i <= maxPage && iov_i < CacheSize; ++i, ++iov_i) {
-            offset_type pageStart = i * _pageSize;
-            offset_type page_offset = (start_offset+queued) % _pageSize;
-
-            if (_readCache.FindPage(pageStart, page) == 0) {
-              iov[iov_i].iov_len = std::min((size-queued), _pageSize - page_offset);
-              iov[iov_i].iov_base = page->second->GetBase(page_offset);
-              queued += iov[iov_i].iov_len;
-            } else {
-              return -2;
-            }
-          }
-          return cb(fd, iov, iov_i);
+          return ReadPages::Writev<CacheSize>(_readCache, _pageSize, _available, start_offset, size, fd, cb);
         }
 
 		  bool SetPosition (off64_t offset) {
@@ -763,6 +927,28 @@ namespace coypu {
 			 // nop - should be enable_if
 			 return true;
 		  }
+
+		  int GetFD () const {
+			 return _fd;
+		  }
+
+		  uint64_t GetPageSize () const {
+			 return _pageSize;
+		  }
+
+		  bool SetSegmentAllocator (const std::shared_ptr<SegmentAllocator> &segments) {
+			 return _writeBuf.SetSegmentAllocator(segments);
+		  }
+
+		  // Told the written length after each write. ZeroCopyWriteNext hands out space before it is
+		  // written, so that is only passed on at the next write or ZeroCopyWriteBackup.
+		  void SetFlusher (const std::shared_ptr<StoreFlusher> &flusher) {
+			 _flusher = flusher;
+		  }
+
+		  const std::shared_ptr<StoreFlusher> &GetFlusher () const {
+			 return _flusher;
+		  }
 		  
       private:
         LogRWStream (const LogRWStream &other);
@@ -777,9 +963,420 @@ namespace coypu {
         uint64_t _available;
         int      _fd;            // file descriptor
         uint64_t _maxSize;       // max size, defaults unbound
+        std::shared_ptr<StoreFlusher> _flusher;
+    };
+
+    // Read only view of a file backed log that is written on another thread. Each reader thread owns
+    // one and maps pages through its own cache (must be file backed, e.g. LRUCache), so the only state
+    // shared with the writer is the published length.
+    template <typename MMapProvider, template <typename, int> class ReadCache, int CacheSize>
+    class LogReadStream {
+      public:
+        typedef uint32_t page_offset_type;
+        typedef uint64_t offset_type;
+        typedef char value_type;
+
+        LogReadStream (off64_t pageSize, offset_type offset, int fd) :
+          _readCache(pageSize, CacheSize, fd),
+          _pageSize(pageSize),
+          _available(offset),
+          _fd(fd) {
+          assert(_fd > 0);
+        }
+
+        virtual ~LogReadStream () {
+        }
+
+        // writer thread. bytes before offset must be complete.
+        void Publish (offset_type offset) {
+          _available.store(offset, std::memory_order_release);
+        }
+
+        offset_type Available () const {
+          return _available.load(std::memory_order_acquire);
+        }
+
+        bool IsEmpty () const {
+          return Available() == 0;
+        }
+
+        typedef typename LogRWStream<MMapProvider, ReadCache, CacheSize>::template store_iterator<LogReadStream> iterator;
+
+        iterator begin(offset_type offset) {
+          return iterator(this, offset);
+        }
+
+        iterator end(offset_type end) {
+          return iterator(this, end);
+        }
+
+        bool Peak (offset_type offset, char &d) {
+          if (offset >= Available()) return false;
+          typename read_cache_type::read_cache_type page;
+          if (_readCache.PeakPage(offset, page)) return false;
+          return page ? page->second->Peak(offset, d) : false;
+        }
+
+        // copy
+        bool Pop (offset_type start_offset, char *dest, uint64_t size) {
+          const offset_type available = Available();
+          if (start_offset + size > available) return false;
+
+          page_offset_type startPage = start_offset / _pageSize;
+          page_offset_type maxPage = available / _pageSize;
+          typename read_cache_type::read_cache_type page;
+
+          uint64_t read = 0, out_size = 0;
+          for (page_offset_type i = startPage; i <= maxPage; ++i) {
+            offset_type pageStart = i * _pageSize;
+
+            if (_readCache.FindPage(pageStart, page) == 0) {
+              offset_type start_pos = std::max(start_offset, pageStart);
+
+              if (page->second && page->second->Pop (start_pos, &dest[read], size-read, out_size)) {
+                read += out_size;
+                if (read == size) return true;
+              } else {
+                return false;
+              }
+            }
+          }
+          return false;
+        }
+
+        // see ReadPages::View
+        bool View (offset_type start_offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          return ReadPages::View(_readCache, _pageSize, Available(), start_offset, size, view);
+        }
+
+        // same contract as LogRWStream::Writev, bounded by the published length
+        int Writev (offset_type start_offset, offset_type size,
+                    int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+          return ReadPages::Writev<CacheSize>(_readCache, _pageSize, Available(), start_offset, size, fd, cb);
+        }
+
+        // see LRUCache::SetEvictCB
+        void SetEvictCB (const std::function<void()> &evict_cb) {
+          _readCache.SetEvictCB(evict_cb);
+        }
+
+      private:
+        LogReadStream (const LogReadStream &other);
+        LogReadStream &operator= (const LogReadStream &other);
+
+        typedef ReadCache<MMapProvider, CacheSize>  read_cache_type;
+        read_cache_type _readCache;
+
+        uint64_t _pageSize;
+        std::atomic<uint64_t> _available;
+        int      _fd;
     };
 
 
+    // Log in one persistent mapping (file::MMapWindow) instead of a page at a time. The writer
+    // never remaps, reads are plain memory and Writev is one iovec. Same interface as LogRWStream,
+    // capacity is the reservation. The file grows by ExtentSize and is cut back to the written
+    // length (rounded up to pageSize, as LogWriteBuf leaves it) on destruction, so a restart
+    // appends where it would have. After a crash the tail of the last extent reads as zeros.
+    template <uint64_t ReserveSize, uint64_t ExtentSize>
+    class LogWindowStream {
+      public:
+        typedef uint64_t offset_type;
+        typedef char value_type;
+        typedef char * iterator;
+
+        LogWindowStream (off64_t pageSize, offset_type offset, int fd, bool anonymous, offset_type maxSize = UINT64_MAX) :
+          _window(std::make_shared<coypu::file::MMapWindow>(anonymous ? -1 : fd, ReserveSize, ExtentSize)),
+          _pageSize(pageSize),
+          _available(offset),
+          _fd(fd),
+          _trim(!anonymous),
+          _maxSize(std::min<offset_type>(maxSize, ReserveSize)) {
+          static_assert(ReserveSize % ExtentSize == 0, "Reserve whole extents");
+          if (!anonymous) {
+            assert(_fd > 0);
+          }
+          if (_window->Init() || _window->Ensure(_available)) {
+            _available = 0; // nothing readable, writes fail, file left alone
+            _trim = false;
+          }
+        }
+
+        virtual ~LogWindowStream () {
+          if (_trim) {
+            _window->Trim(((_available + _pageSize - 1) / _pageSize) * _pageSize);
+          }
+        }
+
+        // for LogWindowReadStream
+        const std::shared_ptr<coypu::file::MMapWindow> &GetWindow () const {
+          return _window;
+        }
+
+        iterator begin(offset_type offset) {
+          return _window->Base() + offset;
+        }
+
+        iterator end(offset_type end) {
+          return _window->Base() + end;
+        }
+
+        offset_type Available () const {
+          return _available;
+        }
+
+        bool IsEmpty () const {
+          return _available == 0;
+        }
+
+        inline offset_type Free() const {
+          return Capacity() - Available();
+        }
+
+        offset_type Capacity() const {
+          return _maxSize;
+        }
+
+        // rest of the current page, assumed all used
+		  int ZeroCopyWriteNext (void **data, int *len) {
+			 const offset_type x = _pageSize - (_available % _pageSize);
+			 if (_available + x > _maxSize || _window->Ensure(_available + x)) return -1;
+			 *data = _window->Base() + _available;
+			 *len = x;
+			 _available += x;
+			 return 0;
+		  }
+
+		  void ZeroCopyWriteBackup (int len) {
+			 _available -= len;
+			 if (_flusher) _flusher->Written(_available);
+		  }
+
+        int Push (const char *data, offset_type len) {
+          if (len > Free()) return -1;
+          if (_window->Ensure(_available + len)) return -2;
+          ::memcpy(_window->Base() + _available, data, len);
+          _available += len;
+          if (_flusher) _flusher->Written(_available);
+          return 0;
+        }
+
+        // reads up to the end of the current page
+        int Readv (int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+          struct iovec iov;
+          iov.iov_len = std::min<offset_type>(_pageSize - (_available % _pageSize), Free());
+          if (iov.iov_len == 0) return -1;
+          if (_window->Ensure(_available + iov.iov_len)) return -2;
+          iov.iov_base = _window->Base() + _available;
+
+          int r = cb(fd, &iov, 1);
+          if (r > 0) _available += r;
+          if (_flusher) _flusher->Written(_available);
+          return r;
+        }
+
+        bool Peak (offset_type offset, char &d) {
+          if (offset >= _available) return false;
+          d = _window->Base()[offset];
+          return true;
+        }
+
+		  bool ZeroCopyReadNext (offset_type offset, const void **data, int *len) {
+          if (offset >= _available) return false;
+          *data = _window->Base() + offset;
+          *len = std::min<offset_type>(_available - offset, _pageSize);
+          return true;
+        }
+
+		  bool Unmask (offset_type start_offset, offset_type len, const char *mask, int maskLen) {
+			 if (start_offset > _available || len > _available - start_offset) return false;
+			 char *data = _window->Base() + start_offset;
+			 coypu::buf::mask::Xor(data, data, len, mask, maskLen, 0);
+			 return true;
+		  }
+
+        bool Find (offset_type start_offset, char d, offset_type &offset) {
+          offset = UINT64_MAX;
+          if (start_offset >= _available) return false;
+          const size_t x = coypu::buf::scan::Find(_window->Base() + start_offset, _available - start_offset, d);
+          if (x < _available - start_offset) {
+            offset = start_offset + x;
+            return true;
+          }
+          return false;
+        }
+
+        // copy
+        bool Pop (offset_type start_offset, char *dest, uint64_t size) {
+          if (start_offset > _available || size > _available - start_offset) return false;
+          ::memcpy(dest, _window->Base() + start_offset, size);
+          return true;
+        }
+
+        // always one span
+        bool View (offset_type start_offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          view.Clear();
+          if (start_offset > _available || size > _available - start_offset) return false;
+          return view.Append(_window->Base() + start_offset, size);
+        }
+
+        int Writev (offset_type start_offset, offset_type size,
+                    int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+          if (start_offset >= _available) return 0;
+          struct iovec iov;
+          iov.iov_base = _window->Base() + start_offset;
+          iov.iov_len = std::min(size, _available - start_offset);
+          return cb(fd, &iov, 1);
+        }
+
+		  bool SetPosition (off64_t offset) {
+			 if (static_cast<offset_type>(offset) > _maxSize || _window->Ensure(offset)) return false;
+			 _available = offset;
+			 return true;
+		  }
+
+		  bool Backup (int count) {
+			 return true;
+		  }
+
+		  bool Skip (int count) {
+			 return true;
+		  }
+
+		  int GetFD () const {
+			 return _fd;
+		  }
+
+		  uint64_t GetPageSize () const {
+			 return _pageSize;
+		  }
+
+		  // as LogRWStream, destroyed after the file is trimmed
+		  void SetFlusher (const std::shared_ptr<StoreFlusher> &flusher) {
+			 _flusher = flusher;
+		  }
+
+		  const std::shared_ptr<StoreFlusher> &GetFlusher () const {
+			 return _flusher;
+		  }
+
+      private:
+        LogWindowStream (const LogWindowStream &other);
+        LogWindowStream &operator= (const LogWindowStream &other);
+
+        std::shared_ptr<coypu::file::MMapWindow> _window;
+        uint64_t _pageSize;
+        uint64_t _available;
+        int      _fd;
+        bool     _trim;
+        uint64_t _maxSize;
+        std::shared_ptr<StoreFlusher> _flusher;
+    };
+
+    // Reader thread view of a LogWindowStream, as LogReadStream is for LogRWStream. Shares the
+    // writer's mapping, so nothing is mapped per reader. Bytes below the published length are
+    // mapped before they are published.
+    template <uint64_t ReserveSize, uint64_t ExtentSize>
+    class LogWindowReadStream {
+      public:
+        typedef uint64_t offset_type;
+        typedef char value_type;
+        typedef const char * iterator;
+
+        LogWindowReadStream (const LogWindowStream<ReserveSize, ExtentSize> &writer) :
+          _window(writer.GetWindow()),
+          _base(writer.GetWindow()->Base()),
+          _pageSize(writer.GetPageSize()),
+          _available(writer.Available()),
+          _fd(writer.GetFD()) {
+        }
+
+        virtual ~LogWindowReadStream () {
+        }
+
+        // writer thread. bytes before offset must be complete.
+        void Publish (offset_type offset) {
+          _available.store(offset, std::memory_order_release);
+        }
+
+        offset_type Available () const {
+          return _available.load(std::memory_order_acquire);
+        }
+
+        bool IsEmpty () const {
+          return Available() == 0;
+        }
+
+        iterator begin(offset_type offset) {
+          return _base + offset;
+        }
+
+        iterator end(offset_type end) {
+          return _base + end;
+        }
+
+        bool Peak (offset_type offset, char &d) {
+          if (offset >= Available()) return false;
+          d = _base[offset];
+          return true;
+        }
+
+        bool Find (offset_type start_offset, char d, offset_type &offset) {
+          offset = UINT64_MAX;
+          const offset_type available = Available();
+          if (start_offset >= available) return false;
+          const size_t x = coypu::buf::scan::Find(_base + start_offset, available - start_offset, d);
+          if (x < available - start_offset) {
+            offset = start_offset + x;
+            return true;
+          }
+          return false;
+        }
+
+        // copy
+        bool Pop (offset_type start_offset, char *dest, uint64_t size) {
+          const offset_type available = Available();
+          if (start_offset > available || size > available - start_offset) return false;
+          ::memcpy(dest, _base + start_offset, size);
+          return true;
+        }
+
+        bool View (offset_type start_offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          view.Clear();
+          const offset_type available = Available();
+          if (start_offset > available || size > available - start_offset) return false;
+          return view.Append(_base + start_offset, size);
+        }
+
+        int Writev (offset_type start_offset, offset_type size,
+                    int fd, std::function <int(int, const struct iovec *, int)> &cb) {
+          const offset_type available = Available();
+          if (start_offset >= available) return 0;
+          struct iovec iov;
+          iov.iov_base = const_cast<char *>(_base + start_offset);
+          iov.iov_len = std::min(size, available - start_offset);
+          return cb(fd, &iov, 1);
+        }
+
+		  int GetFD () const {
+			 return _fd;
+		  }
+
+		  uint64_t GetPageSize () const {
+			 return _pageSize;
+		  }
+
+      private:
+        LogWindowReadStream (const LogWindowReadStream &other);
+        LogWindowReadStream &operator= (const LogWindowReadStream &other);
+
+        std::shared_ptr<coypu::file::MMapWindow> _window; // keeps the mapping alive
+        const char *_base;
+        uint64_t _pageSize;
+        std::atomic<uint64_t> _available;
+        int      _fd;
+    };
+
     // Keeps track of current read position in stream
     template <typename S>
     class PositionedStream {
@@ -828,6 +1425,11 @@ namespace coypu {
           return false;
         }
 
+        // Absolute offset, see FrameView
+        bool View (typename S::offset_type offset, uint64_t size, coypu::buf::FrameView<char> &view) {
+          return _stream->View(offset, size, view);
+        }
+
         int Readv (int fd, std::function <int(int, const struct iovec *, int)> &cb) {
           return _stream->Readv(fd, cb);
         }
@@ -942,6 +1544,13 @@ namespace coypu {
             return 0;
         }
 
+		  // bytes Writev counted as written that did not go out
+		  bool Rewind (int fd, typename S::offset_type bytes) {
+			 if (fd >= _curOffsets.size() || _curOffsets[fd] == UINT64_MAX || _curOffsets[fd] < bytes) return false;
+			 _curOffsets[fd] -= bytes;
+			 return true;
+		  }
+
         int Writev (typename S::offset_type  size,
                     int fd, std::function <int(int, const struct iovec *, int)> &cb) {
           if (fd >= _curOffsets.size()) return -3;
@@ -998,6 +1607,10 @@ namespace coypu {
           return _stream->end(end);
         }
 
+        const std::shared_ptr<S> &GetStream () const {
+          return _stream;
+        }
+
       private:
         MultiPositionedStreamLog (const MultiPositionedStreamLog &other);
         MultiPositionedStreamLog &operator=(const MultiPositionedStreamLog &other);
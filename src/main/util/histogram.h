@@ -0,0 +1,94 @@
+#ifndef __COYPU_HISTOGRAM_H
+#define __COYPU_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <ostream>
+
+namespace coypu {
+  namespace util {
+	 // Power of two bucketed histogram for latencies (rdtsc cycles or ns). Bucket b holds values in
+	 // [2^(b-1), 2^b), bucket 0 holds 0. Record is a clz and an increment, no allocation.
+	 class Histogram {
+	 public:
+		static constexpr uint32_t BUCKETS = 65;
+
+		Histogram () {
+		  Reset();
+		}
+
+		void Reset () {
+		  ::memset(_buckets, 0, sizeof(_buckets));
+		  _count = 0;
+		  _sum = 0;
+		  _min = UINT64_MAX;
+		  _max = 0;
+		}
+
+		inline void Record (uint64_t value) {
+		  ++_buckets[Bucket(value)];
+		  ++_count;
+		  _sum += value;
+		  if (value < _min) _min = value;
+		  if (value > _max) _max = value;
+		}
+
+		static inline uint32_t Bucket (uint64_t value) {
+		  return value ? 64 - __builtin_clzll(value) : 0;
+		}
+
+		uint64_t GetCount () const {
+		  return _count;
+		}
+
+		uint64_t GetBucket (uint32_t bucket) const {
+		  return bucket < BUCKETS ? _buckets[bucket] : 0;
+		}
+
+		uint64_t GetMin () const {
+		  return _count ? _min : 0;
+		}
+
+		uint64_t GetMax () const {
+		  return _max;
+		}
+
+		uint64_t GetMean () const {
+		  return _count ? _sum / _count : 0;
+		}
+
+		// Upper bound of the bucket holding the p'th percentile (0 < p <= 100), capped at max
+		uint64_t GetPercentile (double p) const {
+		  if (!_count) return 0;
+		  uint64_t rank = static_cast<uint64_t>(p * _count / 100.0 + 0.5);
+		  if (rank == 0) rank = 1;
+
+		  uint64_t seen = 0;
+		  for (uint32_t b = 0; b < BUCKETS; ++b) {
+			 seen += _buckets[b];
+			 if (seen >= rank) {
+				const uint64_t upper = b == 0 ? 0 : (b == 64 ? UINT64_MAX : (1ULL << b) - 1);
+				return upper < _max ? upper : _max;
+			 }
+		  }
+		  return _max;
+		}
+
+		friend std::ostream & operator << (std::ostream &out, const Histogram &h) {
+		  out << "count[" << h.GetCount() << "] min[" << h.GetMin() << "] mean[" << h.GetMean()
+				<< "] p50[" << h.GetPercentile(50) << "] p99[" << h.GetPercentile(99)
+				<< "] p99.9[" << h.GetPercentile(99.9) << "] max[" << h.GetMax() << "]";
+		  return out;
+		}
+
+	 private:
+		uint64_t _buckets[BUCKETS];
+		uint64_t _count;
+		uint64_t _sum;
+		uint64_t _min;
+		uint64_t _max;
+	 };
+  }
+}
+
+#endif
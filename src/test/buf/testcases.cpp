@@ -20,11 +20,19 @@
 #include <unistd.h>
 #include "gtest/gtest.h"
 #include "buf/buf.h" 
+#include "buf/fixed.h"
+#include "buf/mpsc.h"
+#include "buf/mirror.h"
+#include "buf/spsc.h"
+#include "mem/mem.h"
 
 #include <string>
 #include <sys/uio.h>
+#include <thread>
+#include <vector>
 
 using namespace coypu::buf;
+using namespace coypu::mem;
 
 TEST(BufTest, Test1) 
 {
@@ -762,3 +770,560 @@ TEST(BufTest, Backup6)
 	 ASSERT_TRUE(buf.IsEmpty());
 	 ASSERT_EQ(buf.Available(), 0);
 }
+
+TEST(BufTest, MPSCTest1)
+{
+	 MPSCRing<uint64_t, 4> ring;
+	 uint64_t x = 0;
+	 ASSERT_TRUE(ring.IsEmpty());
+	 ASSERT_FALSE(ring.Pop(x));
+
+	 for (uint64_t i = 0; i < 4; ++i) {
+		ASSERT_TRUE(ring.Push(i));
+	 }
+	 ASSERT_FALSE(ring.Push(99)); // full
+
+	 // wrap several times
+	 for (uint64_t i = 4; i < 20; ++i) {
+		ASSERT_TRUE(ring.Pop(x));
+		ASSERT_EQ(x, i - 4);
+		ASSERT_TRUE(ring.Push(i));
+	 }
+	 for (uint64_t i = 16; i < 20; ++i) {
+		ASSERT_TRUE(ring.Pop(x));
+		ASSERT_EQ(x, i);
+	 }
+	 ASSERT_TRUE(ring.IsEmpty());
+}
+
+TEST(BufTest, MPSCTest2)
+{
+	 struct Msg {
+		uint32_t _producer;
+		uint32_t _seq;
+	 };
+	 typedef MPSCRing<Msg, 256> ring_type;
+	 std::unique_ptr<ring_type> ring(new ring_type());
+
+	 const uint32_t producers = 4;
+	 const uint32_t count = 100000;
+	 std::vector<std::thread> threads;
+	 for (uint32_t p = 0; p < producers; ++p) {
+		threads.emplace_back([&ring, p, count] () {
+			 for (uint32_t i = 0; i < count; ++i) {
+				Msg m = { p, i };
+				while (!ring->Push(m)) {
+				  std::this_thread::yield();
+				}
+			 }
+		  });
+	 }
+
+	 // per producer order is preserved, nothing lost or duplicated
+	 std::vector<uint32_t> next(producers, 0);
+	 uint64_t total = 0;
+	 Msg m;
+	 while (total < producers * count) {
+		if (ring->Pop(m)) {
+		  ASSERT_LT(m._producer, producers);
+		  ASSERT_EQ(m._seq, next[m._producer]);
+		  ++next[m._producer];
+		  ++total;
+		} else {
+		  std::this_thread::yield();
+		}
+	 }
+	 for (auto &t : threads) t.join();
+	 ASSERT_TRUE(ring->IsEmpty());
+}
+
+TEST(BufTest, ScanFind)
+{
+    // every length and match position around the 16 and 32 byte block edges
+    char data[100];
+    for (size_t len = 0; len <= sizeof(data); ++len) {
+        ::memset(data, 'x', sizeof(data));
+        ASSERT_EQ(scan::Find(data, len, '\n'), len);
+        ASSERT_EQ(scan::Find(data, len, "\r\n\r\n", 4), len);
+
+        for (size_t pos = 0; pos < len; ++pos) {
+            ::memset(data, 'x', sizeof(data));
+            data[pos] = '\n';
+            ASSERT_EQ(scan::Find(data, len, '\n'), pos);
+
+            if (pos + 4 <= len) {
+                // partial matches before the real one
+                if (pos >= 4) ::memcpy(&data[pos - 4], "\r\n\r", 3);
+                ::memcpy(&data[pos], "\r\n\r\n", 4);
+                ASSERT_EQ(scan::Find(data, len, "\r\n\r\n", 4), pos) << len << " " << pos;
+            }
+        }
+    }
+
+    ::memcpy(data, "ab\r\r\nab\r\n", 9);
+    ASSERT_EQ(scan::Find(data, 9, "\r\n", 2), 3);
+    ASSERT_EQ(scan::Find(data, 9, "\r\r\n", 3), 2);
+    ASSERT_EQ(scan::Find(data, 9, "\r\n\r\n", 4), 9);
+}
+
+TEST(BufTest, FindPatternWrap)
+{
+    const char *delim = "\r\n\r\n";
+    char data[64];
+    char msg[48];
+    ::memset(msg, 'h', sizeof(msg));
+    ::memcpy(&msg[40], delim, 4);
+
+    // move the tail so the delimiter lands on every side of the wrap
+    for (uint32_t shift = 0; shift < sizeof(data); ++shift) {
+        BipBuf <char, uint32_t> buf(data, sizeof(data));
+        char scratch[64] = {};
+        if (shift) {
+            ASSERT_TRUE(buf.Push(scratch, shift));
+            ASSERT_TRUE(buf.Skip(shift));
+        }
+        ASSERT_TRUE(buf.Push(msg, sizeof(msg)));
+
+        uint32_t offset = 0;
+        ASSERT_TRUE(buf.Find(delim, 4, offset)) << shift;
+        ASSERT_EQ(offset, 40) << shift;
+        ASSERT_TRUE(buf.Find('\n', offset));
+        ASSERT_EQ(offset, 41) << shift;
+        ASSERT_FALSE(buf.Find("\r\n\r\r", 4, offset));
+
+        // delimiter not complete yet
+        ASSERT_TRUE(buf.Pop(scratch, 42));
+        ASSERT_FALSE(buf.Find(delim, 4, offset));
+        ASSERT_TRUE(buf.Find("\r\n", 2, offset));
+        ASSERT_EQ(offset, 0);
+    }
+}
+
+TEST(BufTest, MaskXor)
+{
+    const char mask[4] = {'\x12', '\x34', '\x56', '\x78'};
+    char src[200], dest[200];
+    for (size_t i = 0; i < sizeof(src); ++i) src[i] = static_cast<char>(i * 7);
+
+    // every length around the register widths, every mask phase
+    for (size_t len = 0; len <= sizeof(src); ++len) {
+        for (uint64_t pos = 0; pos < 4; ++pos) {
+            mask::Xor(dest, src, len, mask, 4, pos);
+            for (size_t i = 0; i < len; ++i) {
+                ASSERT_EQ(dest[i], src[i] ^ mask[(pos + i) % 4]) << len << " " << pos;
+            }
+
+            ::memcpy(dest, src, len);
+            mask::Xor(dest, dest, len, mask, 4, pos);
+            mask::Xor(dest, dest, len, mask, 4, pos);
+            ASSERT_EQ(::memcmp(dest, src, len), 0);
+        }
+    }
+
+    // not a power of two
+    mask::Xor(dest, src, 100, mask, 3, 1);
+    for (size_t i = 0; i < 100; ++i) {
+        ASSERT_EQ(dest[i], src[i] ^ mask[(1 + i) % 3]);
+    }
+}
+
+TEST(BufTest, UnmaskWrap)
+{
+    const char mask[4] = {'a', 'b', 'c', 'd'};
+    char data[64];
+    char msg[48];
+    for (size_t i = 0; i < sizeof(msg); ++i) msg[i] = static_cast<char>('A' + i);
+
+    for (uint32_t shift = 0; shift < sizeof(data); ++shift) {
+        BipBuf <char, uint32_t> buf(data, sizeof(data));
+        char scratch[64] = {};
+        if (shift) {
+            ASSERT_TRUE(buf.Push(scratch, shift));
+            ASSERT_TRUE(buf.Skip(shift));
+        }
+
+        // masked push then unmask past a 5 byte header returns the payload
+        ASSERT_TRUE(buf.Push(msg, 5));
+        ASSERT_TRUE(buf.Push(msg, 40, mask, 4));
+        ASSERT_EQ(buf.Available(), 45);
+        ASSERT_FALSE(buf.Unmask(6, 40, mask, 4));
+        ASSERT_TRUE(buf.Unmask(5, 40, mask, 4));
+
+        ASSERT_TRUE(buf.Pop(scratch, 45));
+        ASSERT_EQ(::memcmp(scratch, msg, 5), 0) << shift;
+        ASSERT_EQ(::memcmp(&scratch[5], msg, 40), 0) << shift;
+    }
+
+    BipBuf <char, uint32_t> buf(data, 8);
+    ASSERT_TRUE(buf.Push(msg, 6));
+    ASSERT_FALSE(buf.Push(msg, 3, mask, 4)); // no room
+    ASSERT_TRUE(buf.Push(msg, 2, mask, 4));
+    char out[8];
+    ASSERT_TRUE(buf.Pop(out, 6));
+    ASSERT_TRUE(buf.Pop(out, 2));
+    ASSERT_EQ(out[0], msg[0] ^ 'a');
+    ASSERT_EQ(out[1], msg[1] ^ 'b');
+}
+
+TEST(BufTest, FrameView)
+{
+    char data[64];
+    char msg[48];
+    for (size_t i = 0; i < sizeof(msg); ++i) msg[i] = static_cast<char>('A' + i);
+
+    for (uint32_t shift = 0; shift < sizeof(data); ++shift) {
+        BipBuf <char, uint32_t> buf(data, sizeof(data));
+        char scratch[64] = {};
+        if (shift) {
+            ASSERT_TRUE(buf.Push(scratch, shift));
+            ASSERT_TRUE(buf.Skip(shift));
+        }
+        ASSERT_TRUE(buf.Push(msg, sizeof(msg)));
+
+        // 40 bytes past a 5 byte header, two spans only when they cross the end of data
+        coypu::buf::FrameView<char> view;
+        ASSERT_FALSE(buf.View(9, 40, view));
+        ASSERT_TRUE(buf.View(5, 40, view));
+        ASSERT_EQ(view.Size(), 40);
+        const uint32_t start = (shift + 5) % sizeof(data);
+        ASSERT_EQ(view.IsContiguous(), start + 40 <= sizeof(data)) << shift;
+        if (view.IsContiguous()) {
+            ASSERT_EQ(view.Data(0), &data[start]);
+        }
+
+        char out[40] = {};
+        ASSERT_FALSE(view.CopyTo(out, 39));
+        ASSERT_TRUE(view.CopyTo(out, sizeof(out)));
+        ASSERT_EQ(::memcmp(out, &msg[5], 40), 0) << shift;
+
+        const char *linear = view.Linear(scratch, sizeof(scratch));
+        ASSERT_NE(linear, nullptr);
+        ASSERT_EQ(::memcmp(linear, &msg[5], 40), 0) << shift;
+        if (view.IsContiguous()) {
+            ASSERT_EQ(linear, view.Data(0)); // no copy
+        } else {
+            ASSERT_EQ(linear, scratch);
+            ASSERT_EQ(view.Linear(scratch, 39), nullptr);
+        }
+
+        ASSERT_TRUE(buf.View(0, 0, view));
+        ASSERT_EQ(view.Size(), 0);
+    }
+}
+
+TEST(BufTest, MirrorWrap)
+{
+    const uint64_t size = MemManager::GetPageSize();
+    char *data = static_cast<char *>(MemManager::MapMirror(size));
+    ASSERT_NE(data, nullptr);
+    {
+        MirrorBuf <char, uint64_t> buf(data, size);
+        ASSERT_TRUE(buf.IsEmpty());
+        ASSERT_EQ(buf.Free(), size);
+
+        std::string fill(size - 8, 'x');
+        ASSERT_TRUE(buf.Push(fill.c_str(), fill.size()));
+        ASSERT_TRUE(buf.Skip(fill.size()));
+
+        // straddles the end of the mapping but reads back as one span
+        const char *msg = "GET / HTTP/1.1\r\n\r\n";
+        const uint64_t len = ::strlen(msg);
+        ASSERT_TRUE(buf.Push(msg, len));
+        ASSERT_EQ(buf.Available(), len);
+        ASSERT_EQ(::memcmp(buf.Front(), msg, len), 0);
+        ASSERT_EQ(buf.Head(), len - 8);
+
+        uint64_t offset = 0;
+        ASSERT_TRUE(buf.Find("\r\n\r\n", 4, offset));
+        ASSERT_EQ(offset, len - 4);
+        ASSERT_TRUE(buf.Find('/', offset));
+        ASSERT_EQ(offset, 4);
+        char c = 0;
+        ASSERT_TRUE(buf.Peak(9, c));
+        ASSERT_EQ(c, 'P');
+        ASSERT_FALSE(buf.Peak(len, c));
+
+        const char mask[4] = {'a', 'b', 'c', 'd'};
+        ASSERT_TRUE(buf.Unmask(4, 10, mask, 4));
+        ASSERT_TRUE(buf.Unmask(4, 10, mask, 4));
+        ASSERT_FALSE(buf.Unmask(4, len, mask, 4));
+
+        char out[64] = {};
+        ASSERT_TRUE(buf.Pop(out, len, true));
+        ASSERT_EQ(::memcmp(out, msg, len), 0);
+        ASSERT_TRUE(buf.Pop(out, 4));
+        ASSERT_TRUE(buf.Backup(4));
+        ASSERT_EQ(buf.Available(), len);
+
+        // masked push across the end
+        ASSERT_TRUE(buf.Skip(len));
+        ASSERT_TRUE(buf.Push(fill.c_str(), size - 12));
+        ASSERT_TRUE(buf.Skip(size - 12));
+        ASSERT_TRUE(buf.Push(msg, len, mask, 4));
+        ASSERT_TRUE(buf.Unmask(0, len, mask, 4));
+        ASSERT_EQ(::memcmp(buf.Front(), msg, len), 0);
+    }
+    ASSERT_EQ(MemManager::UnmapMirror(data, size), 0);
+}
+
+TEST(BufTest, MirrorReadvWritev)
+{
+    const uint64_t size = MemManager::GetPageSize();
+    char *data = static_cast<char *>(MemManager::MapMirror(size));
+    ASSERT_NE(data, nullptr);
+    {
+        MirrorBuf <char, uint64_t> buf(data, size);
+        int fds[2];
+        ASSERT_EQ(::pipe(fds), 0);
+
+        // place the free space across the end of the mapping
+        std::string fill(size - 100, 'x');
+        ASSERT_TRUE(buf.Push(fill.c_str(), fill.size()));
+        ASSERT_TRUE(buf.Skip(fill.size()));
+
+        std::string msg(300, 'm');
+        for (size_t i = 0; i < msg.size(); ++i) msg[i] = static_cast<char>('a' + i % 26);
+        ASSERT_EQ(::write(fds[1], msg.c_str(), msg.size()), static_cast<ssize_t>(msg.size()));
+
+        int iovs = 0;
+        std::function<int(int, const struct iovec *, int)> readv = [&iovs] (int fd, const struct iovec *iov, int count) {
+            iovs = count;
+            return ::readv(fd, iov, count);
+        };
+        std::function<int(int, const struct iovec *, int)> writev = [&iovs] (int fd, const struct iovec *iov, int count) {
+            iovs = count;
+            return ::writev(fd, iov, count);
+        };
+
+        ASSERT_EQ(buf.Readv(fds[0], readv), 300);
+        ASSERT_EQ(iovs, 1);
+        ASSERT_EQ(buf.Available(), 300);
+        ASSERT_EQ(::memcmp(buf.Front(), msg.c_str(), msg.size()), 0);
+
+        ASSERT_EQ(buf.Writev(fds[1], writev), 300);
+        ASSERT_EQ(iovs, 1);
+        ASSERT_TRUE(buf.IsEmpty());
+        ASSERT_EQ(buf.Writev(fds[1], writev), -2);
+
+        char out[300];
+        ASSERT_EQ(::read(fds[0], out, sizeof(out)), 300);
+        ASSERT_EQ(::memcmp(out, msg.c_str(), msg.size()), 0);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+    ASSERT_EQ(MemManager::UnmapMirror(data, size), 0);
+}
+
+TEST(BufTest, SPSCBasic)
+{
+    char data[8];
+    SPSCBipBuf <char, uint32_t> buf(data, sizeof(data));
+    ASSERT_TRUE(buf.IsEmpty());
+    ASSERT_EQ(buf.Free(), 8);
+
+    // batched writes are invisible until published
+    ASSERT_TRUE(buf.Push("abc", 3, false));
+    ASSERT_TRUE(buf.Push("def", 3, false));
+    ASSERT_EQ(buf.Available(), 0);
+    buf.Publish();
+    ASSERT_EQ(buf.Available(), 6);
+    ASSERT_FALSE(buf.Push("xyz", 3));
+
+    char out[8] = {};
+    ASSERT_TRUE(buf.Pop(out, 4));
+    ASSERT_EQ(::memcmp(out, "abcd", 4), 0);
+
+    // wraps
+    ASSERT_TRUE(buf.Push("ghijkl", 6));
+    ASSERT_FALSE(buf.Push("m", 1));
+    ASSERT_EQ(buf.Available(), 8);
+
+    uint32_t offset = 0;
+    ASSERT_TRUE(buf.Find('j', offset));
+    ASSERT_EQ(offset, 5);
+    char c = 0;
+    ASSERT_TRUE(buf.Peak(7, c));
+    ASSERT_EQ(c, 'l');
+    ASSERT_FALSE(buf.Peak(8, c));
+
+    std::string seen;
+    ASSERT_TRUE(buf.PopAll([&seen] (const char *d, uint32_t len) { seen.append(d, len); return true; }, 8));
+    ASSERT_EQ(seen, "efghijkl");
+    ASSERT_TRUE(buf.IsEmpty());
+    ASSERT_FALSE(buf.Skip(1));
+}
+
+TEST(BufTest, SPSCReadvWritev)
+{
+    char data[64];
+    SPSCBipBuf <char, uint32_t> buf(data, sizeof(data));
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+
+    std::function<int(int, const struct iovec *, int)> readv = [] (int fd, const struct iovec *iov, int count) {
+        return ::readv(fd, iov, count);
+    };
+    std::function<int(int, const struct iovec *, int)> writev = [] (int fd, const struct iovec *iov, int count) {
+        return ::writev(fd, iov, count);
+    };
+
+    // free space straddles the end
+    char scratch[64] = {};
+    ASSERT_TRUE(buf.Push(scratch, 50));
+    ASSERT_TRUE(buf.Skip(50));
+
+    std::string msg = "0123456789abcdefghijklmnopqrstuvwxyz";
+    ASSERT_EQ(::write(fds[1], msg.c_str(), msg.size()), static_cast<ssize_t>(msg.size()));
+    ASSERT_EQ(buf.Readv(fds[0], readv), static_cast<int>(msg.size()));
+    ASSERT_EQ(buf.Available(), msg.size());
+    ASSERT_EQ(buf.Writev(fds[1], writev), static_cast<int>(msg.size()));
+    ASSERT_TRUE(buf.IsEmpty());
+
+    char out[64] = {};
+    ASSERT_EQ(::read(fds[0], out, sizeof(out)), static_cast<ssize_t>(msg.size()));
+    ASSERT_EQ(std::string(out, msg.size()), msg);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(BufTest, SPSCThreads)
+{
+    // producer writes a counting byte stream in odd sized chunks, consumer checks every byte
+    const uint64_t total = 1024 * 1024;
+    std::vector<char> data(1000);
+    auto buf = std::make_shared<SPSCBipBuf <char, uint32_t>>(data.data(), data.size());
+
+    std::thread producer([&buf, total] () {
+        char chunk[97];
+        uint64_t sent = 0;
+        while (sent < total) {
+            const uint32_t len = static_cast<uint32_t>(std::min<uint64_t>(1 + sent % sizeof(chunk), total - sent));
+            for (uint32_t i = 0; i < len; ++i) chunk[i] = static_cast<char>((sent + i) & 0x7F);
+            while (!buf->Push(chunk, len)) {
+                std::this_thread::yield();
+            }
+            sent += len;
+        }
+    });
+
+    uint64_t received = 0;
+    bool ok = true;
+    char out[128];
+    while (received < total && ok) {
+        uint32_t avail = buf->Available();
+        if (avail == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        avail = std::min<uint32_t>(avail, sizeof(out));
+        ASSERT_TRUE(buf->Pop(out, avail));
+        for (uint32_t i = 0; i < avail; ++i) {
+            if (out[i] != static_cast<char>((received + i) & 0x7F)) ok = false;
+        }
+        received += avail;
+    }
+    producer.join();
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(received, total);
+    ASSERT_TRUE(buf->IsEmpty());
+}
+
+TEST(BufTest, FixedMatchesBipBuf)
+{
+    // same operations on both, odd sizes so the ring wraps constantly
+    const uint64_t capacity = 256;
+    char data1[capacity], data2[capacity];
+    BipBuf <char, uint64_t> buf(data1, capacity);
+    FixedBipBuf <char, uint64_t, capacity> fixed(data2);
+    ASSERT_EQ(fixed.Capacity(), buf.Capacity());
+
+    const char mask[4] = {'a', 'b', 'c', 'd'};
+    char in[capacity], out1[capacity], out2[capacity];
+    for (uint64_t i = 0; i < capacity; ++i) in[i] = static_cast<char>('A' + i % 26);
+
+    uint64_t pushed = 0;
+    for (int step = 0; step < 2000; ++step) {
+        const uint64_t len = 1 + (step * 37) % 97;
+        const bool masked = step % 5 == 0;
+        const bool ok = masked ? buf.Push(in, len, mask, 4) : buf.Push(in, len);
+        ASSERT_EQ(masked ? fixed.Push(in, len, mask, 4) : fixed.Push(in, len), ok);
+        if (ok) ++pushed;
+        if (ok && masked) {
+            ASSERT_TRUE(buf.Unmask(buf.Available() - len, len, mask, 4));
+            ASSERT_TRUE(fixed.Unmask(fixed.Available() - len, len, mask, 4));
+        }
+        ASSERT_EQ(fixed.Available(), buf.Available());
+        ASSERT_EQ(fixed.Free(), buf.Free());
+        ASSERT_EQ(fixed.Head(), buf.Head());
+        ASSERT_EQ(fixed.Tail(), buf.Tail());
+
+        uint64_t offset1 = 0, offset2 = 0;
+        ASSERT_EQ(fixed.Find('Z', offset2), buf.Find('Z', offset1));
+        ASSERT_EQ(offset2, offset1);
+        ASSERT_EQ(fixed.Find("YZA", 3, offset2), buf.Find("YZA", 3, offset1));
+        ASSERT_EQ(offset2, offset1);
+
+        FrameView<char> view1, view2;
+        const uint64_t avail = buf.Available();
+        ASSERT_EQ(fixed.View(avail / 3, avail / 2, view2), buf.View(avail / 3, avail / 2, view1));
+        ASSERT_EQ(view2.Count(), view1.Count());
+        ASSERT_EQ(view2.Size(), view1.Size());
+        ASSERT_TRUE(view1.CopyTo(out1, sizeof(out1)));
+        ASSERT_TRUE(view2.CopyTo(out2, sizeof(out2)));
+        ASSERT_EQ(::memcmp(out1, out2, view1.Size()), 0);
+
+        const uint64_t pop = std::min<uint64_t>(buf.Available(), 1 + (step * 53) % 113);
+        if (pop == 0) continue;
+        if (step % 3 == 0) {
+            ASSERT_TRUE(buf.Pop(out1, pop));
+            ASSERT_TRUE(fixed.Pop(out2, pop));
+            ASSERT_EQ(::memcmp(out1, out2, pop), 0);
+        } else {
+            std::string all1, all2;
+            ASSERT_TRUE(buf.PopAll([&all1] (const char *d, uint64_t n) { all1.append(d, n); return true; }, pop));
+            ASSERT_TRUE(fixed.PopAll([&all2] (const char *d, uint64_t n) { all2.append(d, n); return true; }, pop));
+            ASSERT_EQ(all2, all1);
+        }
+    }
+    ASSERT_GT(pushed, 100u);
+}
+
+TEST(BufTest, FixedReadvWritev)
+{
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+
+    char data[64];
+    FixedBipBuf <char, uint64_t, 64> buf(data);
+    std::function<int(int, const struct iovec *, int)> readv = ::readv;
+    std::function<int(int, const struct iovec *, int)> writev = ::writev;
+
+    // tail near the end so the read lands in two iovecs
+    char scratch[64] = {};
+    ASSERT_TRUE(buf.Push(scratch, 50));
+    ASSERT_TRUE(buf.Skip(50));
+
+    std::string msg = "0123456789abcdefghijklmnopqrstuvwxyz";
+    ASSERT_EQ(::write(fds[1], msg.c_str(), msg.size()), static_cast<ssize_t>(msg.size()));
+    ASSERT_EQ(buf.Readv(fds[0], readv), static_cast<int>(msg.size()));
+    ASSERT_EQ(buf.Available(), msg.size());
+    ASSERT_EQ(buf.Head(), msg.size() - 14);
+    ASSERT_EQ(buf.Writev(fds[1], writev), static_cast<int>(msg.size()));
+    ASSERT_TRUE(buf.IsEmpty());
+
+    char out[64] = {};
+    ASSERT_EQ(::read(fds[0], out, sizeof(out)), static_cast<ssize_t>(msg.size()));
+    ASSERT_EQ(std::string(out, msg.size()), msg);
+
+    // full
+    ASSERT_TRUE(buf.Push(scratch, 64));
+    ASSERT_FALSE(buf.Push('x'));
+    ASSERT_EQ(buf.Readv(fds[0], readv), -2);
+    ASSERT_TRUE(buf.Skip(64));
+    ASSERT_EQ(buf.Writev(fds[1], writev), -2);
+
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,815 @@
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "event/event_hlpr.h"
+#include "event/event_mgr.h"
+#include "event/timer_wheel.h"
+#include "store/store.h"
+#include "file/file.h"
+#include "mem/mem.h"
+
+using namespace coypu::event;
+
+struct EventDummyLog {
+  void perror (int, const char *) { }
+  template <typename... Args> const void warn(const char *msg, Args... args) { }
+};
+
+static uint64_t event_mgr_now () {
+  return EventManager<EventDummyLog *>::NowMs();
+}
+
+template <typename BackendType>
+class EventTest : public ::testing::Test {
+};
+
+typedef ::testing::Types<EPollBackend, IOUringBackend> backend_types;
+TYPED_TEST_CASE(EventTest, backend_types);
+
+class EventCounter {
+public:
+  EventCounter () : _reads(0), _writes(0), _closes(0) { }
+
+  int Read (int fd) {
+	 uint64_t x = 0;
+	 if (::read(fd, &x, sizeof(x)) != sizeof(x)) return -1;
+	 ++_reads;
+	 return 0;
+  }
+
+  int Write (int fd) {
+	 ++_writes;
+	 return 0;
+  }
+
+  int Close (int fd) {
+	 ++_closes;
+	 return 0;
+  }
+
+  int _reads;
+  int _writes;
+  int _closes;
+};
+
+TYPED_TEST(EventTest, FunctionDispatch)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+
+  int efd = EventFDHelper::CreateNonBlockEventFD(0);
+  ASSERT_TRUE(efd > 0);
+
+  EventCounter counter;
+  std::function<int(int)> readCB = std::bind(&EventCounter::Read, &counter, std::placeholders::_1);
+  std::function<int(int)> closeCB = std::bind(&EventCounter::Close, &counter, std::placeholders::_1);
+  ASSERT_EQ(eventMgr.Register(efd, readCB, nullptr, closeCB), 0);
+
+  uint64_t x = 1;
+  ASSERT_EQ(::write(efd, &x, sizeof(x)), sizeof(x));
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._reads, 1);
+  ASSERT_EQ(eventMgr.GetEventCount(efd), 1);
+
+  ASSERT_EQ(eventMgr.Unregister(efd), 0);
+  ASSERT_EQ(::write(efd, &x, sizeof(x)), sizeof(x));
+  ASSERT_EQ(counter._closes, 0);
+
+  eventMgr.Close();
+  ::close(efd);
+}
+
+TYPED_TEST(EventTest, StaticDispatch)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+
+  EventCounter counter;
+  int efd = EventFDHelper::CreateNonBlockEventFD(0);
+  ASSERT_TRUE(efd > 0);
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read, &EventCounter::Write, &EventCounter::Close>(efd, &counter)), 0);
+
+  // eventfd is always writable - one write dispatch then clear
+  ASSERT_EQ(eventMgr.SetWrite(efd), 0);
+  uint64_t x = 1;
+  ASSERT_EQ(::write(efd, &x, sizeof(x)), sizeof(x));
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._reads, 1);
+  ASSERT_EQ(counter._writes, 1);
+
+  // writable with nothing to read: only the write dispatches, nothing closes
+  eventMgr.SetWrite(efd);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._writes, 2);
+  ASSERT_EQ(counter._closes, 0);
+
+  ASSERT_EQ(::write(efd, &x, sizeof(x)), sizeof(x));
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._reads, 2);
+  ASSERT_EQ(::read(efd, &x, sizeof(x)), -1); // drained
+
+  eventMgr.Close();
+  ::close(efd);
+}
+
+TYPED_TEST(EventTest, StaticClose)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+
+  EventCounter counter;
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read, nullptr, &EventCounter::Close>(fds[0], &counter)), 0);
+
+  // short read on a pipe returns -1 so the fd is closed and unregistered
+  ASSERT_EQ(::write(fds[1], "a", 1), 1);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._reads, 0);
+  ASSERT_EQ(counter._closes, 1);
+
+  // close path unregistered and closed the fd, so its number can be registered again
+  ASSERT_EQ(eventMgr.Unregister(fds[0]), -1);
+  ASSERT_EQ(::fcntl(fds[0], F_GETFD), -1);
+  int reuse[2];
+  ASSERT_EQ(pipe(reuse), 0);
+  ASSERT_EQ(reuse[0], fds[0]);
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read>(reuse[0], &counter)), 0);
+
+  eventMgr.Close();
+  ::close(reuse[0]);
+  ::close(reuse[1]);
+  ::close(fds[1]);
+}
+
+TYPED_TEST(EventTest, BatchGrowth)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  ASSERT_EQ(eventMgr.SetMaxEvents(0, 8), -1);
+  ASSERT_EQ(eventMgr.SetMaxEvents(4, 2), -1);
+  ASSERT_EQ(eventMgr.SetMaxEvents(2, 8), 0);
+  ASSERT_EQ(eventMgr.GetMaxEvents(), 2);
+
+  EventCounter counter;
+  const int count = 8;
+  int efd[count];
+  uint64_t x = 1;
+  for (int i = 0; i < count; ++i) {
+	 efd[i] = EventFDHelper::CreateNonBlockEventFD(0);
+	 ASSERT_TRUE(efd[i] > 0);
+	 ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read>(efd[i], &counter)), 0);
+	 ASSERT_EQ(::write(efd[i], &x, sizeof(x)), sizeof(x));
+  }
+
+  // each saturated wait doubles the batch until the limit
+  ASSERT_EQ(eventMgr.Wait(), 2);
+  ASSERT_EQ(eventMgr.GetMaxEvents(), 4);
+  ASSERT_EQ(eventMgr.Wait(), 4);
+  ASSERT_EQ(eventMgr.GetMaxEvents(), 8);
+  ASSERT_EQ(eventMgr.Wait(), 2);
+  ASSERT_EQ(eventMgr.GetMaxEvents(), 8);
+  ASSERT_EQ(counter._reads, count);
+
+  eventMgr.Close();
+  for (int i = 0; i < count; ++i) {
+	 ::close(efd[i]);
+  }
+}
+
+TYPED_TEST(EventTest, EdgeTriggered)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(0);
+
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+
+  // read callback does not drain
+  int reads = 0;
+  std::function<int(int)> readCB = [&reads] (int) { ++reads; return 0; };
+  ASSERT_EQ(eventMgr.Register(fds[0], readCB, nullptr, nullptr, EF_EDGE_TRIGGERED), 0);
+
+  ASSERT_EQ(::write(fds[1], "ab", 2), 2);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(reads, 1);
+
+  // no new data, no new edge - level triggered would fire again
+  ASSERT_EQ(eventMgr.Wait(), 0);
+  ASSERT_EQ(reads, 1);
+
+  // write interest keeps the edge flag
+  ASSERT_EQ(eventMgr.ClearWrite(fds[0]), 0);
+  ASSERT_EQ(::write(fds[1], "c", 1), 1);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(eventMgr.Wait(), 0);
+  ASSERT_EQ(reads, 2);
+
+  eventMgr.Close();
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TYPED_TEST(EventTest, CoalescedWrite)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(0);
+
+  EventCounter counter;
+  int efd = EventFDHelper::CreateNonBlockEventFD(0);
+  ASSERT_TRUE(efd > 0);
+  ASSERT_EQ(eventMgr.SetWrite(efd), -1); // not registered
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read, &EventCounter::Write>(efd, &counter)), 0);
+
+  // repeated arming is one MOD at the next flush
+  for (int i = 0; i < 10; ++i) {
+	 ASSERT_EQ(eventMgr.SetWrite(efd), 0);
+  }
+  ASSERT_EQ(eventMgr.GetCtlCalls(), 0);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._writes, 1);
+  ASSERT_EQ(eventMgr.GetCtlSaved(), 9);
+
+  // write returned 0 so EPOLLOUT was cleared at the end of the iteration
+  ASSERT_EQ(eventMgr.GetCtlCalls(), 2);
+  ASSERT_EQ(eventMgr.Wait(), 0);
+  ASSERT_EQ(counter._writes, 1);
+
+  // clearing an idle fd or set then clear before a flush costs nothing
+  ASSERT_EQ(eventMgr.ClearWrite(efd), 0);
+  ASSERT_EQ(eventMgr.SetWrite(efd), 0);
+  ASSERT_EQ(eventMgr.ClearWrite(efd), 0);
+  eventMgr.FlushInterest();
+  ASSERT_EQ(eventMgr.GetCtlCalls(), 2);
+  ASSERT_EQ(eventMgr.GetCtlSaved(), 12);
+
+  eventMgr.Close();
+  ::close(efd);
+}
+
+TYPED_TEST(EventTest, Timers)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(-1); // timers alone must wake the loop
+
+  int once = 0, repeat = 0;
+  uint64_t repeatId = 0;
+  ASSERT_NE(eventMgr.AddTimer(5, 0, [&once] (uint64_t) { ++once; }), 0);
+  repeatId = eventMgr.AddTimer(2, 2, [&repeat] (uint64_t) { ++repeat; });
+  ASSERT_NE(repeatId, 0);
+  uint64_t cancelled = eventMgr.AddTimer(1, 0, [] (uint64_t) { ASSERT_TRUE(false); });
+  ASSERT_TRUE(eventMgr.CancelTimer(cancelled));
+  ASSERT_FALSE(eventMgr.CancelTimer(cancelled));
+
+  const uint64_t start = event_mgr_now();
+  while (once == 0 || repeat < 3) {
+	 ASSERT_EQ(eventMgr.Wait(), 0);
+  }
+  ASSERT_LT(event_mgr_now() - start, 500);
+  ASSERT_EQ(once, 1);
+
+  ASSERT_TRUE(eventMgr.CancelTimer(repeatId));
+  eventMgr.Close();
+}
+
+TYPED_TEST(EventTest, Spin)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(100);
+  eventMgr.SetSpin(3);
+
+  int fd = EventFDHelper::CreateNonBlockEventFD(0);
+  ASSERT_GT(fd, 0);
+  EventCounter counter;
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read>(fd, &counter)), 0);
+
+  // three empty polls return at once, the fourth blocks for the timeout
+  uint64_t start = event_mgr_now();
+  for (int i = 0; i < 3; ++i) {
+	 ASSERT_EQ(eventMgr.Wait(), 0);
+  }
+  ASSERT_LT(event_mgr_now() - start, 50);
+  start = event_mgr_now();
+  ASSERT_EQ(eventMgr.Wait(), 0);
+  ASSERT_GE(event_mgr_now() - start, 90);
+
+  // an event restarts the spin
+  uint64_t x = 1;
+  ASSERT_EQ(::write(fd, &x, sizeof(x)), sizeof(x));
+  const uint64_t before = __rdtsc();
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(counter._reads, 1);
+  ASSERT_GE(eventMgr.GetWakeTSC(), before);
+  start = event_mgr_now();
+  ASSERT_EQ(eventMgr.Wait(), 0);
+  ASSERT_LT(event_mgr_now() - start, 50);
+
+  eventMgr.SetSpin(SPIN_FOREVER);
+  start = event_mgr_now();
+  for (int i = 0; i < 100; ++i) {
+	 ASSERT_EQ(eventMgr.Wait(), 0);
+  }
+  ASSERT_LT(event_mgr_now() - start, 50);
+
+  eventMgr.Close();
+  ::close(fd);
+}
+
+TYPED_TEST(EventTest, Stats)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(10);
+  eventMgr.SetInstrument(true);
+
+  int okFD = EventFDHelper::CreateNonBlockEventFD(0);
+  int failFD = EventFDHelper::CreateNonBlockEventFD(0);
+  int sv[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+
+  EventCounter counter;
+  ASSERT_EQ((eventMgr.template Register<EventCounter, &EventCounter::Read>(okFD, &counter)), 0);
+  int closes = 0;
+  callback_type fail = [] (int) { return -1; };
+  callback_type close = [&closes] (int) { ++closes; return 0; };
+  ASSERT_EQ(eventMgr.Register(failFD, fail, nullptr, close), 0);
+  ASSERT_EQ(eventMgr.Register(sv[0], nullptr, nullptr, close), 0);
+
+  uint64_t x = 1;
+  ASSERT_EQ(::write(okFD, &x, sizeof(x)), sizeof(x));
+  ASSERT_EQ(::write(failFD, &x, sizeof(x)), sizeof(x));
+  ::close(sv[1]);
+  eventMgr.AddBytes(okFD, 100, 7);
+
+  int events = 0;
+  for (int i = 0; i < 10 && events < 3; ++i) {
+	 int r = eventMgr.Wait();
+	 ASSERT_GE(r, 0);
+	 events += r;
+  }
+  ASSERT_EQ(events, 3);
+  ASSERT_EQ(counter._reads, 1);
+  ASSERT_EQ(closes, 2);
+  ASSERT_EQ(eventMgr.GetCloseReason(failFD), CR_READ);
+  ASSERT_NE(eventMgr.GetCloseReason(sv[0]), CR_NONE);
+  ASSERT_EQ(eventMgr.GetCloseReason(okFD), CR_NONE);
+  ASSERT_EQ(eventMgr.GetCloseCount(CR_READ), 1);
+
+  std::stringstream ss;
+  eventMgr.WriteStats(ss, 2);
+  const std::string stats = ss.str();
+  ASSERT_NE(stats.find("cb read calls[2]"), std::string::npos) << stats;
+  ASSERT_NE(stats.find("close read[1]"), std::string::npos) << stats;
+
+  // header and two fd lines after it
+  const size_t header = stats.find("fd live events");
+  ASSERT_NE(header, std::string::npos) << stats;
+  ASSERT_EQ(std::count(stats.begin() + header, stats.end(), '\n'), 3) << stats;
+
+  // the live fd reports its bytes
+  ASSERT_NE(stats.find(std::to_string(okFD) + " 1 1 1 0 "), std::string::npos) << stats;
+  ASSERT_NE(stats.find(" 100 7 -\n"), std::string::npos) << stats;
+
+  eventMgr.Close();
+  ::close(okFD);
+}
+
+TYPED_TEST(EventTest, MassDisconnect)
+{
+  // 10k peers hang up in the same tick, each needs an fd table slot
+  int count = 10000;
+  struct rlimit rl;
+  ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &rl), 0);
+  if (rl.rlim_cur < static_cast<rlim_t>(count + 64)) {
+	 rl.rlim_cur = std::min(rl.rlim_max, static_cast<rlim_t>(count + 64));
+	 ::setrlimit(RLIMIT_NOFILE, &rl);
+	 ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &rl), 0);
+	 count = std::min(count, static_cast<int>(rl.rlim_cur) - 64);
+  }
+  ASSERT_GT(count, 0);
+
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  ASSERT_EQ(eventMgr.SetMaxEvents(count, count), 0);
+
+  std::vector<int> fds;
+  std::vector<int> closes(count + 64, 0);
+  int minFD = INT_MAX, maxFD = 0;
+  callback_type read = [] (int fd) {
+	 char buf[16];
+	 return ::read(fd, buf, sizeof(buf)) > 0 ? 0 : -1;
+  };
+  callback_type close = [&closes, &minFD, &maxFD] (int fd) {
+	 if (fd >= minFD && fd <= maxFD) ++closes[fd - minFD];
+	 return 0;
+  };
+
+  for (int i = 0; i < count; ++i) {
+	 int sv[2];
+	 ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+	 ASSERT_EQ(eventMgr.Register(sv[0], read, nullptr, close), 0);
+	 ::close(sv[1]); // peer gone before the wait
+	 fds.push_back(sv[0]);
+	 minFD = std::min(minFD, sv[0]);
+	 maxFD = std::max(maxFD, sv[0]);
+  }
+  ASSERT_LT(maxFD - minFD, static_cast<int>(closes.size()));
+
+  // read eof and hangup both mark the fd, it is closed once. epoll reports all of them in one
+  // wait, io_uring is bounded by its completion queue.
+  int events = 0;
+  for (int i = 0; i < 100 && events < count; ++i) {
+	 int r = eventMgr.Wait();
+	 ASSERT_GE(r, 0);
+	 events += r;
+  }
+  ASSERT_EQ(events, count);
+  ASSERT_EQ(eventMgr.GetCloseCount(CR_READ), static_cast<uint64_t>(count));
+
+  for (const int fd : fds) {
+	 ASSERT_EQ(closes[fd - minFD], 1) << fd;
+	 ASSERT_EQ(::fcntl(fd, F_GETFD), -1) << fd;
+	 ASSERT_EQ(eventMgr.Unregister(fd), -1) << fd;
+  }
+
+  eventMgr.Close();
+}
+
+// EF_RECV fds are read with Readv: from the multishot recv's buffers on io_uring, readv on epoll
+TYPED_TEST(EventTest, Recv)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(0);
+  const bool recv = std::is_same<TypeParam, IOUringBackend>::value;
+  ASSERT_EQ(eventMgr.SetRecvBuffers(4, 64), recv ? 0 : -1);
+
+  std::string data;
+  for (int i = 0; i < 300; ++i) data.push_back('a' + i % 26);
+
+  for (int round = 0; round < 2; ++round) {
+	 int sv[2];
+	 ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+
+	 // more than the buffers hold, taken 100 bytes a call
+	 std::string in;
+	 int closes = 0;
+	 callback_type read = [&eventMgr, &in] (int fd) {
+		char buf[100];
+		struct iovec iov[2] = { { buf, 30 }, { buf + 30, 70 } };
+		int r = eventMgr.Readv(fd, iov, 2);
+		if (r < 0) return errno == EAGAIN ? 0 : -1;
+		in.append(buf, r);
+		return 0;
+	 };
+	 callback_type close = [&closes] (int) {
+		++closes;
+		return 0;
+	 };
+	 ASSERT_EQ(::write(sv[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+	 ASSERT_EQ(eventMgr.Register(sv[0], read, nullptr, close, EF_RECV), 0);
+
+	 if (round == 0) {
+		for (int i = 0; i < 20 && in.size() < data.size(); ++i) {
+		  ASSERT_GE(eventMgr.Wait(), 0);
+		}
+		ASSERT_EQ(in, data);
+		if (recv) {
+		  ASSERT_GT(eventMgr.GetRecvNoBufs(), 0);
+		}
+
+		// end of stream after the data
+		::close(sv[1]);
+		for (int i = 0; i < 20 && !closes; ++i) {
+		  ASSERT_GE(eventMgr.Wait(), 0);
+		}
+		ASSERT_EQ(closes, 1);
+	 } else {
+		// the buffers it holds go back when it is unregistered
+		ASSERT_EQ(eventMgr.Wait(), 1);
+		ASSERT_EQ(in, data.substr(0, 100));
+		ASSERT_EQ(eventMgr.Unregister(sv[0]), 0);
+		::close(sv[0]);
+		::close(sv[1]);
+	 }
+  }
+
+  // writes still poll, and the buffers are all back for another fd
+  int sv[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+  std::string in;
+  int writes = 0;
+  callback_type read = [&eventMgr, &in] (int fd) {
+	 char buf[512];
+	 struct iovec iov = { buf, sizeof(buf) };
+	 int r = eventMgr.Readv(fd, &iov, 1);
+	 if (r < 0) return errno == EAGAIN ? 0 : -1;
+	 in.append(buf, r);
+	 return 0;
+  };
+  callback_type write = [&writes] (int) {
+	 ++writes;
+	 return 0;
+  };
+  ASSERT_EQ(eventMgr.Register(sv[0], read, write, nullptr, EF_RECV), 0);
+  ASSERT_EQ(eventMgr.SetWrite(sv[0]), 0);
+  ASSERT_EQ(eventMgr.Wait(), 1);
+  ASSERT_EQ(writes, 1);
+  ASSERT_TRUE(in.empty());
+
+  ASSERT_EQ(::write(sv[1], data.data(), 256), 256);
+  for (int i = 0; i < 20 && in.size() < 256; ++i) {
+	 ASSERT_GE(eventMgr.Wait(), 0);
+  }
+  ASSERT_EQ(in, data.substr(0, 256));
+  ASSERT_EQ(writes, 1);
+
+  eventMgr.Close();
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
+
+// Writes queued by the write callbacks of one Wait go out together, short ones are rewound
+TEST(IOUringTest, BatchedWrites)
+{
+  EventManager <EventDummyLog *, EPollBackend> epollMgr(nullptr);
+  ASSERT_EQ(epollMgr.Init(), 0);
+  ASSERT_EQ(epollMgr.SetWriteBatch(16, nullptr), -1);
+  epollMgr.Close();
+
+  EventManager <EventDummyLog *, IOUringBackend> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(0);
+
+  const size_t clients = 3;
+  std::vector<char> data(8 * 1024 * 1024);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = i % 251;
+
+  // the last client is sent more than its socket takes
+  std::vector<uint64_t> size(clients, 100), offset(clients, 0);
+  size[clients-1] = data.size();
+  int sv[clients][2];
+  std::vector<int> index(1024, -1);
+  for (size_t i = 0; i < clients; ++i) {
+	 ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv[i]), 0);
+	 index[sv[i][0]] = i;
+  }
+
+  uint64_t unsentBytes = 0;
+  std::function<void(int, uint32_t)> unsent = [&index, &offset, &unsentBytes] (int fd, uint32_t bytes) {
+	 offset[index[fd]] -= bytes;
+	 unsentBytes += bytes;
+  };
+  ASSERT_EQ(eventMgr.SetWriteBatch(16, unsent), 0);
+
+  int writes = 0;
+  callback_type write = [&] (int fd) {
+	 const int i = index[fd];
+	 ++writes;
+	 if (offset[i] == size[i]) return 0;
+	 struct iovec iov = { &data[offset[i]], size[i] - offset[i] };
+	 int r = eventMgr.Writev(fd, &iov, 1);
+	 if (r < 0) return r;
+	 offset[i] += r; // all of it, until the flush says otherwise
+	 return 0;
+  };
+  for (size_t i = 0; i < clients; ++i) {
+	 ASSERT_EQ(eventMgr.Register(sv[i][0], nullptr, write, nullptr), 0);
+	 ASSERT_EQ(eventMgr.SetWrite(sv[i][0]), 0);
+  }
+
+  ASSERT_EQ(eventMgr.Wait(), clients);
+  ASSERT_EQ(writes, clients);
+  ASSERT_EQ(eventMgr.GetBatchedWrites(), clients);
+  ASSERT_EQ(eventMgr.GetShortWrites(), 1);
+  ASSERT_GT(unsentBytes, 0);
+
+  // the offsets are where each peer has got to
+  std::vector<char> in(data.size());
+  for (size_t i = 0; i < clients; ++i) {
+	 ssize_t r = 0, got = 0;
+	 while ((r = ::read(sv[i][1], &in[got], in.size() - got)) > 0) got += r;
+	 ASSERT_EQ(got, offset[i]);
+	 ASSERT_EQ(::memcmp(in.data(), data.data(), got), 0);
+  }
+
+  // the short one has write interest again and carries on from its offset
+  for (int i = 0; i < 1000 && offset[clients-1] < size[clients-1]; ++i) {
+	 ASSERT_GE(eventMgr.Wait(), 0);
+	 ssize_t r = 0;
+	 while ((r = ::read(sv[clients-1][1], in.data(), in.size())) > 0) {
+	 }
+  }
+  ASSERT_EQ(offset[clients-1], size[clients-1]);
+
+  std::stringstream ss;
+  eventMgr.WriteStats(ss);
+  ASSERT_NE(ss.str().find("writes batched["), std::string::npos);
+
+  eventMgr.Close();
+  for (size_t i = 0; i < clients; ++i) {
+	 ::close(sv[i][0]);
+	 ::close(sv[i][1]);
+  }
+}
+
+// A write queued out of the read cache goes out before another client's page walk remaps its page
+TEST(IOUringTest, BatchedWritesEvict)
+{
+  using namespace coypu::store;
+  using namespace coypu::file;
+  using namespace coypu::mem;
+
+  char path[1024];
+  int fileFD = FileUtil::MakeTemp("coypu", path, sizeof(path));
+  ASSERT_GT(fileFD, 0);
+  const uint64_t pageSize = MemManager::GetPageSize();
+  std::vector<char> data(200 * pageSize);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = (i / pageSize + i) % 251;
+  ASSERT_EQ(FileUtil::Write(fileFD, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+  LogReadStream<MMapShared, LRUCache, 128> stream(pageSize, data.size(), fileFD);
+
+  EventManager <EventDummyLog *, IOUringBackend> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+  eventMgr.SetTimeout(0);
+
+  // one page for the first client, a full cache of others for the second
+  const size_t clients = 2;
+  std::vector<uint64_t> start = {0, pageSize}, end = {pageSize, 129 * pageSize};
+  std::vector<uint64_t> offset = start;
+  int sv[clients][2];
+  std::vector<int> index(1024, -1);
+  for (size_t i = 0; i < clients; ++i) {
+	 ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv[i]), 0);
+	 index[sv[i][0]] = i;
+  }
+
+  std::function<void(int, uint32_t)> unsent = [&index, &offset] (int fd, uint32_t bytes) {
+	 offset[index[fd]] -= bytes;
+  };
+  ASSERT_EQ(eventMgr.SetWriteBatch(16, unsent), 0);
+  int evicts = 0;
+  stream.SetEvictCB([&eventMgr, &evicts] () {
+		++evicts;
+		eventMgr.FlushWrites();
+	 });
+
+  std::function<int(int, const struct iovec *, int)> writev = [&eventMgr] (int fd, const struct iovec *iov, int count) {
+	 return eventMgr.Writev(fd, iov, count);
+  };
+  callback_type write = [&] (int fd) {
+	 const int i = index[fd];
+	 if (offset[i] == end[i]) return 0;
+	 int r = stream.Writev(offset[i], end[i] - offset[i], fd, writev);
+	 if (r < 0) return r;
+	 offset[i] += r;
+	 return 0;
+  };
+  for (size_t i = 0; i < clients; ++i) {
+	 ASSERT_EQ(eventMgr.Register(sv[i][0], nullptr, write, nullptr), 0);
+	 ASSERT_EQ(eventMgr.SetWrite(sv[i][0]), 0);
+  }
+
+  // whichever goes second evicts a page the first one queued
+  ASSERT_EQ(eventMgr.Wait(), clients);
+  ASSERT_GE(evicts, 1);
+  ASSERT_EQ(eventMgr.GetBatchedWrites(), clients);
+
+  std::vector<char> in(data.size());
+  for (size_t i = 0; i < clients; ++i) {
+	 ssize_t r = 0, got = 0;
+	 while ((r = ::read(sv[i][1], &in[got], in.size() - got)) > 0) got += r;
+	 ASSERT_GT(got, 0);
+	 ASSERT_EQ(static_cast<uint64_t>(got), offset[i] - start[i]);
+	 ASSERT_EQ(::memcmp(in.data(), &data[start[i]], got), 0);
+  }
+
+  eventMgr.Close();
+  for (size_t i = 0; i < clients; ++i) {
+	 ::close(sv[i][0]);
+	 ::close(sv[i][1]);
+  }
+  FileUtil::Close(fileFD);
+  FileUtil::Remove(path);
+}
+
+TEST(TimerWheelTest, Expiry)
+{
+  TimerWheel wheel(1000);
+
+  // delays across every level and past the span of the wheel
+  std::vector<uint64_t> delays = { 1, 2, 63, 64, 65, 127, 4095, 4096, 4097, 70000, 262143, 262144, 300000, (1ULL << 24) + 5 };
+  std::vector<uint64_t> fired(delays.size(), 0);
+  for (size_t i = 0; i < delays.size(); ++i) {
+	 ASSERT_NE(wheel.Add(delays[i], 0, [&wheel, &fired, i] (uint64_t) { fired[i] = wheel.Now(); }), 0);
+  }
+  ASSERT_EQ(wheel.Size(), delays.size());
+  ASSERT_EQ(wheel.NextTimeout(100), 1);
+
+  // uneven steps, jumping straight to the next deadline where the wheel allows
+  uint64_t now = 1000, step = 1;
+  while (wheel.Size()) {
+	 now += std::min(wheel.NextTimeout(UINT64_MAX), step);
+	 wheel.Advance(now);
+	 step = (step * 7) % 1000 + 1;
+  }
+
+  for (size_t i = 0; i < delays.size(); ++i) {
+	 ASSERT_EQ(fired[i], 1000 + delays[i]);
+  }
+}
+
+TEST(TimerWheelTest, RepeatCancel)
+{
+  TimerWheel wheel(0);
+  int count = 0;
+  uint64_t id = 0;
+  id = wheel.Add(10, 10, [&] (uint64_t fid) {
+		ASSERT_EQ(fid, id);
+		if (++count == 3) {
+		  ASSERT_TRUE(wheel.Cancel(fid)); // cancel from its own callback
+		}
+	 });
+
+  ASSERT_EQ(wheel.Advance(100), 3);
+  ASSERT_EQ(count, 3);
+  ASSERT_EQ(wheel.Size(), 0);
+  ASSERT_FALSE(wheel.Cancel(id));
+
+  // slot reused, stale id stays dead
+  uint64_t id2 = wheel.Add(1, 0, [&count] (uint64_t) { ++count; });
+  ASSERT_NE(id2, id);
+  ASSERT_FALSE(wheel.Cancel(id));
+  ASSERT_EQ(wheel.Advance(101), 1);
+  ASSERT_EQ(count, 4);
+}
+
+TYPED_TEST(EventTest, CBManagerThreads)
+{
+  EventManager <EventDummyLog *, TypeParam> eventMgr(nullptr);
+  ASSERT_EQ(eventMgr.Init(), 0);
+
+  struct Payload {
+	 uint32_t _producer;
+	 uint32_t _seq;
+  };
+  typedef std::function<void(const Payload &)> cb_type;
+  typedef EventCBManager<cb_type, Payload, 64> cb_mgr_type;
+
+  int efd = EventFDHelper::CreateNonBlockEventFD(0);
+  ASSERT_TRUE(efd > 0);
+  std::unique_ptr<cb_mgr_type> cbMgr(new cb_mgr_type(efd));
+
+  const uint32_t producers = 3, count = 20000;
+  std::vector<uint32_t> next(producers, 0);
+  uint32_t total = 0;
+  bool ordered = true;
+  cb_type cb = [&] (const Payload &p) {
+	 ordered &= p._seq == next[p._producer]++;
+	 ++total;
+  };
+  ASSERT_TRUE(cbMgr->Register(1, cb));
+  ASSERT_EQ((eventMgr.template Register<cb_mgr_type, &cb_mgr_type::Read, nullptr, &cb_mgr_type::Close>(efd, cbMgr.get())), 0);
+
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < producers; ++p) {
+	 threads.emplace_back([&cbMgr, p, count] () {
+		  for (uint32_t i = 0; i < count; ++i) {
+			 while (!cbMgr->Queue(1, Payload { p, i })) {
+				std::this_thread::yield();
+			 }
+		  }
+		});
+  }
+
+  while (total < producers * count) {
+	 ASSERT_TRUE(eventMgr.Wait() >= 0);
+  }
+  for (auto &t : threads) t.join();
+
+  ASSERT_TRUE(ordered);
+  ASSERT_EQ(total, producers * count);
+  eventMgr.SetTimeout(0);
+  ASSERT_EQ(eventMgr.Wait(), 0); // no stray wake up left behind
+
+  eventMgr.Close();
+  ::close(efd);
+}
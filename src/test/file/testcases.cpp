@@ -3,6 +3,7 @@
 #include "file/file.h" 
 
 #include <string>
+#include <unistd.h>
 
 using namespace coypu::file;
 
@@ -14,3 +15,49 @@ TEST(FileTest, Test1)
   ASSERT_NO_THROW(FileUtil::Remove(buf));
   ASSERT_NO_THROW(FileUtil::Close(fd));
 }
+
+TEST(FileTest, MMapWindow)
+{
+  char buf[1024];
+  int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+  ASSERT_TRUE(fd > 0);
+  ASSERT_EQ(FileUtil::Write(fd, "coypu", 5), 5);
+
+  const size_t extent = 64*1024;
+  {
+    MMapWindow window(fd, 4 * extent, extent);
+    ASSERT_EQ(window.Init(), 0);
+    char *base = window.Base();
+    ASSERT_NE(base, nullptr);
+    ASSERT_EQ(window.Mapped(), extent); // existing file
+    ASSERT_EQ(std::string(base, 5), "coypu");
+
+    ASSERT_EQ(window.Ensure(extent + 1), 0);
+    ASSERT_EQ(window.Mapped(), 2 * extent);
+    ASSERT_EQ(window.Base(), base);
+    base[2 * extent - 1] = 'x';
+
+    off64_t size = 0;
+    ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+    ASSERT_EQ(size, 2 * extent);
+    char c = 0;
+    ASSERT_EQ(::pread(fd, &c, 1, 2 * extent - 1), 1);
+    ASSERT_EQ(c, 'x');
+
+    ASSERT_EQ(window.Ensure(4 * extent), 0);
+    ASSERT_NE(window.Ensure(4 * extent + 1), 0);
+    ASSERT_EQ(window.Trim(5), 0);
+  }
+
+  {
+    MMapWindow anon(-1, 2 * extent, extent);
+    ASSERT_EQ(anon.Init(), 0);
+    ASSERT_EQ(anon.Mapped(), 0);
+    ASSERT_EQ(anon.Ensure(10), 0);
+    anon.Base()[9] = 'y';
+    ASSERT_EQ(anon.Mapped(), extent);
+  }
+
+  ASSERT_NO_THROW(FileUtil::Close(fd));
+  ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
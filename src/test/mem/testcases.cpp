@@ -1,11 +1,15 @@
 
 #include <string>
 #include <string.h>
+#include <memory>
+#include <sstream>
+#include <vector>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 
 #include "gtest/gtest.h"
 #include "mem/mem.h"
+#include "mem/pool.h"
 
 
 using namespace coypu::mem;
@@ -16,3 +20,75 @@ TEST(MemTest, Test1)
     int node = MemManager::GetMaxNumaNode();
     ASSERT_TRUE(node >= 0);
 }
+
+TEST(MemTest, Mirror)
+{
+    const size_t size = MemManager::GetPageSize();
+    ASSERT_EQ(MemManager::MapMirror(size + 1), nullptr);
+
+    char *mem = static_cast<char *>(MemManager::MapMirror(size));
+    ASSERT_NE(mem, nullptr);
+    mem[0] = 'a';
+    mem[size - 1] = 'z';
+    ASSERT_EQ(mem[size], 'a');
+    ASSERT_EQ(mem[2 * size - 1], 'z');
+
+    mem[size + 1] = 'b';
+    ASSERT_EQ(mem[1], 'b');
+    ASSERT_EQ(MemManager::UnmapMirror(mem, size), 0);
+}
+
+TEST(MemTest, BufferPool)
+{
+    auto pool = std::make_shared<BufferPool>(64 * 1024, MemManager::GetCurrentNode());
+    ASSERT_EQ(pool->GetBlocks(), 0);
+
+    // one 2MB chunk holds 32 blocks
+    std::vector<char *> blocks;
+    for (int i = 0; i < 32; ++i) {
+        char *b = static_cast<char *>(pool->Allocate());
+        ASSERT_NE(b, nullptr);
+        ::memset(b, i, 64 * 1024);
+        blocks.push_back(b);
+    }
+    ASSERT_EQ(pool->GetChunks(), 1);
+    ASSERT_EQ(pool->GetInUse(), 32);
+    ASSERT_EQ(blocks[1] - blocks[0], 64 * 1024);
+
+    // recycled last in first out
+    pool->Free(blocks[5]);
+    ASSERT_EQ(pool->Allocate(), blocks[5]);
+
+    char *extra = static_cast<char *>(pool->Allocate());
+    ASSERT_NE(extra, nullptr);
+    ASSERT_EQ(pool->GetChunks(), 2);
+    ASSERT_EQ(pool->GetBlocks(), 64);
+    ASSERT_EQ(pool->GetHighWater(), 33);
+
+    for (char *b : blocks) pool->Free(b);
+    ASSERT_EQ(pool->GetInUse(), 1);
+    pool->Free(extra);
+    ASSERT_EQ(pool->GetInUse(), 0);
+}
+
+TEST(MemTest, PoolBuffer)
+{
+    auto pool = std::make_shared<BufferPool>(100); // rounded to a cache line multiple
+    ASSERT_EQ(pool->GetBlockSize(), 128);
+    {
+        PoolBuffer a(pool, 128);
+        PoolBuffer b(pool, 129); // too big, from the heap
+        PoolBuffer c(nullptr, 64);
+        ASSERT_TRUE(a.IsPooled());
+        ASSERT_FALSE(b.IsPooled());
+        ASSERT_FALSE(c.IsPooled());
+        ASSERT_NE(b.Get(), nullptr);
+        ASSERT_NE(c.Get(), nullptr);
+        ASSERT_EQ(pool->GetInUse(), 1);
+    }
+    ASSERT_EQ(pool->GetInUse(), 0);
+
+    std::stringstream ss;
+    ss << *pool;
+    ASSERT_NE(ss.str().find("in use[0/"), std::string::npos) << ss.str();
+}
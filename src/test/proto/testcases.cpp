@@ -18,6 +18,8 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "gtest/gtest.h"
 #include "store/store.h"
 #include "file/file.h"
@@ -30,6 +32,8 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 using namespace coypu::store;
 using namespace coypu::file;
@@ -258,3 +262,124 @@ TEST(ProtoTest, BufTest3) {
 
 
 
+
+struct ProtoDummyLog {
+};
+
+// Reads 5 byte framed CoinCache messages from fd until count arrive, checking the seqno order
+static void ReadFrames (int fd, int count, std::vector<char> &pending) {
+  char data[64*1024];
+  int seen = 0;
+  while (seen < count) {
+	 ssize_t r = ::read(fd, data, sizeof(data));
+	 ASSERT_GT(r, 0);
+	 pending.insert(pending.end(), data, data + r);
+
+	 size_t pos = 0;
+	 while (pending.size() - pos >= 5) {
+		uint32_t size = 0;
+		::memcpy(&size, &pending[pos+1], sizeof(size));
+		size = ntohl(size);
+		if (pending.size() - pos - 5 < size) break;
+
+		coypu::msg::CoinCache gCC;
+		ASSERT_TRUE(gCC.ParseFromArray(&pending[pos+5], size));
+		ASSERT_EQ(gCC.seqno(), seen);
+		++seen;
+		pos += 5 + size;
+	 }
+	 pending.erase(pending.begin(), pending.begin() + pos);
+  }
+}
+
+TEST(ProtoTest, BatchedWrite) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ASSERT_EQ(::fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+
+  int writeSet = 0;
+  typedef ProtoManager<ProtoDummyLog *, coypu::msg::CoinCache, coypu::msg::CoinCache> manager_type;
+  manager_type mgr(nullptr, [&writeSet] (int) { ++writeSet; return 0; });
+  std::function<int(int,const struct iovec *,int)> readv = ::readv;
+  std::function<int(int,const struct iovec *,int)> writev = ::writev;
+  ASSERT_TRUE(mgr.Register(fds[0], readv, writev));
+  ASSERT_EQ(mgr.Write(fds[0]), 0); // nothing queued
+
+  // more than the 64k write buffer, the tail queues as segments
+  coypu::msg::CoinCache gCC;
+  gCC.set_key(std::string(200, 'k'));
+  const int count = 1024;
+  ASSERT_EQ(mgr.BeginBurst(fds[0], true), 0); // cork fails on a unix socket, still batches
+  for (int i = 0; i < count; ++i) {
+	 gCC.set_seqno(i);
+	 ASSERT_EQ(mgr.WriteResponse(fds[0], gCC), 0);
+  }
+  ASSERT_EQ(writeSet, 0);
+  ASSERT_GT(mgr.Pending(fds[0]), 64*1024);
+
+  std::vector<char> pending;
+  std::thread reader([&] () { ReadFrames(fds[1], count, pending); });
+  int r = mgr.EndBurst(fds[0]);
+  ASSERT_EQ(r, 0);
+  while (mgr.Pending(fds[0]) > 0) {
+	 ASSERT_GE(mgr.Write(fds[0]), 0);
+	 std::this_thread::yield();
+  }
+  reader.join();
+  ASSERT_EQ(mgr.Write(fds[0]), 0);
+
+  // shared segment to several connections, unknown fds skipped
+  int other[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, other), 0);
+  ASSERT_TRUE(mgr.Register(other[0], readv, writev));
+  gCC.set_seqno(0);
+  ASSERT_EQ(mgr.WriteResponse(std::vector<int>{fds[0], other[0], 999}, gCC), 2);
+  ASSERT_EQ(mgr.Write(fds[0]), 0);
+  ASSERT_EQ(mgr.Write(other[0]), 0);
+  ReadFrames(fds[1], 1, pending);
+  std::vector<char> otherPending;
+  ReadFrames(other[1], 1, otherPending);
+
+  ASSERT_EQ(mgr.Unregister(fds[0]), 0);
+  ASSERT_EQ(mgr.Unregister(other[0]), 0);
+  ::close(fds[0]);
+  ::close(fds[1]);
+  ::close(other[0]);
+  ::close(other[1]);
+}
+
+TEST(ProtoTest, SplitRead) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  typedef ProtoManager<ProtoDummyLog *, coypu::msg::CoinCache, coypu::msg::CoinCache> manager_type;
+  manager_type mgr(nullptr, [] (int) { return 0; });
+  std::vector<uint64_t> seen;
+  manager_type::callback_type cb = [&seen] (int, coypu::msg::CoinCache &cc) { seen.push_back(cc.seqno()); };
+  mgr.SetCallback(cb);
+  std::function<int(int,const struct iovec *,int)> readv = ::readv;
+  std::function<int(int,const struct iovec *,int)> writev = ::writev;
+  ASSERT_TRUE(mgr.Register(fds[0], readv, writev));
+
+  // a body shorter than the header, arriving after it
+  coypu::msg::CoinCache gCC;
+  gCC.set_seqno(7);
+  std::string body;
+  ASSERT_TRUE(gCC.SerializeToString(&body));
+  ASSERT_LT(body.size(), 5);
+  char header[5] = {0};
+  const uint32_t size = htonl(body.size());
+  ::memcpy(&header[1], &size, sizeof(size));
+
+  ASSERT_EQ(::write(fds[1], header, sizeof(header)), sizeof(header));
+  ASSERT_GT(mgr.Read(fds[0]), 0);
+  ASSERT_TRUE(seen.empty());
+  ASSERT_EQ(::write(fds[1], body.data(), body.size()), body.size());
+  ASSERT_GT(mgr.Read(fds[0]), 0);
+  ASSERT_EQ(seen.size(), 1);
+  ASSERT_EQ(seen[0], 7);
+
+  ASSERT_EQ(mgr.Unregister(fds[0]), 0);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
@@ -1,7 +1,14 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <list>
 #include <memory>
+#include <thread>
+#include <utility>
 
 #include "gtest/gtest.h"
 #include "store/store.h"
+#include "store/segmented.h"
 #include "file/file.h"
 #include "mem/mem.h"
 
@@ -375,3 +382,819 @@ TEST(StoreTest, MaskTest1)
 	  ASSERT_EQ(a, 'a') << i;
 	}
 }
+
+TEST(StoreTest, FrameView)
+{
+	const uint64_t pageSize = MemManager::GetPageSize();
+	LogRWStream<MMapAnon, OneShotCache, 16> rwBuf(pageSize, 0, -1, true);
+	for (uint64_t i = 0; i < 3*pageSize; ++i) {
+	  char c = static_cast<char>('a' + (i % 26));
+	  rwBuf.Push(&c, 1);
+	}
+
+	coypu::buf::FrameView<char> view;
+	ASSERT_TRUE(rwBuf.View(10, 100, view));
+	ASSERT_TRUE(view.IsContiguous());
+	ASSERT_EQ(view.Size(), 100);
+	ASSERT_EQ(view.Data(0)[0], 'a' + 10);
+
+	// crosses one page, two spans
+	ASSERT_TRUE(rwBuf.View(pageSize - 10, 20, view));
+	ASSERT_FALSE(view.IsContiguous());
+	ASSERT_EQ(view.Length(0), 10);
+	ASSERT_EQ(view.Length(1), 10);
+	char out[20];
+	ASSERT_TRUE(view.CopyTo(out, sizeof(out)));
+	for (uint64_t i = 0; i < sizeof(out); ++i) {
+	  ASSERT_EQ(out[i], 'a' + ((pageSize - 10 + i) % 26)) << i;
+	}
+
+	// three pages do not fit a view, past the end fails
+	ASSERT_FALSE(rwBuf.View(pageSize - 10, pageSize + 20, view));
+	ASSERT_FALSE(rwBuf.View(3*pageSize - 10, 20, view));
+
+	std::shared_ptr<LogRWStream<MMapAnon, OneShotCache, 16>> sp(&rwBuf, [](void *) {});
+	PositionedStream<LogRWStream<MMapAnon, OneShotCache, 16>> stream(sp);
+	ASSERT_TRUE(stream.View(2*pageSize, pageSize, view));
+	ASSERT_TRUE(view.IsContiguous());
+	ASSERT_EQ(view.Data(0)[0], 'a' + ((2*pageSize) % 26));
+}
+
+TEST(StoreTest, ReadStreamThread)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	typedef LogReadStream<MMapShared, LRUCache, 16> read_type;
+	LogRWStream<MMapShared, LRUCache, 16> rwBuf(MemManager::GetPageSize(), 0, fd, false);
+	read_type reader(rwBuf.GetPageSize(), 0, rwBuf.GetFD());
+	ASSERT_TRUE(reader.IsEmpty());
+
+	const int count = 20000;
+	std::thread writer([&rwBuf, &reader, count] () {
+		char outstr[32];
+		for (int i = 0; i < count; ++i) {
+		  int len = snprintf(outstr, sizeof(outstr), "%08d", i);
+		  rwBuf.Push(outstr, len);
+		  reader.Publish(rwBuf.Available());
+		}
+	  });
+
+	uint64_t offset = 0;
+	char dest[9] = {};
+	for (int i = 0; i < count; ) {
+		if (reader.Available() - offset < 8) {
+		  std::this_thread::yield();
+		  continue;
+		}
+		ASSERT_TRUE(reader.Pop(offset, dest, 8)) << i;
+		ASSERT_EQ(atoi(dest), i);
+		offset += 8;
+		++i;
+	}
+	writer.join();
+	ASSERT_EQ(reader.Available(), rwBuf.Available());
+	ASSERT_FALSE(reader.Pop(offset, dest, 1)); // nothing past the published length
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+TEST(StoreTest, LRUCacheOrder)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	// page i is filled with 'a' + i
+	const uint64_t pageSize = MemManager::GetPageSize();
+	const int pages = 16;
+	std::vector<char> page(pageSize);
+	for (int i = 0; i < pages; ++i) {
+		std::fill(page.begin(), page.end(), 'a' + i);
+		ASSERT_EQ(FileUtil::Write(fd, page.data(), pageSize), static_cast<ssize_t>(pageSize));
+	}
+
+	typedef LRUCache<MMapShared, 5> cache_type;
+	cache_type cache(pageSize, 5, fd);
+
+	// a page that stays cached keeps its slot, a miss takes a new slot until full and then the
+	// least recently used one
+	typedef std::pair<uint32_t, cache_type::pair_type *> entry_type;
+	std::list<entry_type> model; // most recent first
+	for (int step = 0; step < 2000; ++step) {
+		const uint32_t pageIndex = (step * 7 + step / 3) % (step < 1000 ? 6 : pages);
+		cache_type::read_cache_type rc;
+		ASSERT_EQ(cache.FindPage(pageIndex * pageSize + step % pageSize, rc), 0);
+		ASSERT_NE(rc, nullptr);
+		ASSERT_EQ(rc->first, pageIndex);
+		ASSERT_EQ(*rc->second->GetBase(step % pageSize), 'a' + pageIndex) << step;
+
+		auto b = model.begin();
+		for (; b != model.end() && (*b).first != pageIndex; ++b);
+		if (b != model.end()) {
+			ASSERT_EQ((*b).second, rc.get()) << step;
+			model.erase(b);
+		} else if (model.size() == 5) {
+			ASSERT_EQ(model.back().second, rc.get()) << step;
+			model.pop_back();
+		}
+		model.push_front(std::make_pair(pageIndex, rc.get()));
+	}
+
+	// RW stream reads back across every page through the cache
+	{
+		LogRWStream<MMapShared, LRUCache, 4> rwBuf(pageSize, pages * pageSize, fd, false);
+		for (int i = pages - 1; i >= 0; --i) {
+			char d = 0;
+			ASSERT_TRUE(rwBuf.Peak(i * pageSize + 1, d));
+			ASSERT_EQ(d, 'a' + i);
+		}
+	}
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+TEST(StoreTest, WindowStream)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	// 64k extents, 1MB reservation
+	typedef LogWindowStream<1024*1024, 64*1024> window_type;
+	const uint64_t pageSize = MemManager::GetPageSize();
+	const char mask[4] = {'a', 'b', 'c', 'd'};
+	const int count = 20000; // 160k, three extents
+	{
+		window_type rwBuf(pageSize, 0, fd, false);
+		ASSERT_TRUE(rwBuf.IsEmpty());
+		ASSERT_EQ(rwBuf.Capacity(), 1024*1024);
+
+		char outstr[32];
+		char *base = rwBuf.begin(0);
+		for (int i = 0; i < count; ++i) {
+			int len = snprintf(outstr, sizeof(outstr), "%08d", i);
+			ASSERT_EQ(rwBuf.Push(outstr, len), 0);
+		}
+		ASSERT_EQ(rwBuf.begin(0), base); // never remapped
+		ASSERT_EQ(rwBuf.Available(), count * 8);
+		ASSERT_EQ(rwBuf.end(rwBuf.Available()) - rwBuf.begin(0), count * 8);
+
+		// a record across the first extent boundary
+		const uint64_t offset = (64*1024 / 8) * 8 - 4;
+		char dest[9] = {};
+		ASSERT_TRUE(rwBuf.Pop(offset, dest, 8));
+		ASSERT_EQ(std::string(dest), "81910000");
+		char d = 0;
+		ASSERT_TRUE(rwBuf.Peak(offset, d));
+		ASSERT_EQ(d, '8');
+		ASSERT_FALSE(rwBuf.Peak(count * 8, d));
+		ASSERT_FALSE(rwBuf.Pop(count * 8 - 4, dest, 8));
+
+		coypu::buf::FrameView<char> view;
+		ASSERT_TRUE(rwBuf.View(offset, 64, view));
+		ASSERT_EQ(view.Count(), 1);
+		ASSERT_TRUE(rwBuf.Unmask(offset, 8, mask, 4));
+		ASSERT_TRUE(rwBuf.Pop(offset, dest, 8));
+		ASSERT_NE(std::string(dest), "81910000");
+		ASSERT_TRUE(rwBuf.Unmask(offset, 8, mask, 4));
+
+		uint64_t found = 0;
+		ASSERT_TRUE(rwBuf.Find(8, '1', found));
+		ASSERT_EQ(found, 15);
+
+		std::string out;
+		std::function<int(int, const struct iovec *, int)> writev = [&out] (int, const struct iovec *iov, int count) {
+			EXPECT_EQ(count, 1);
+			out.append(reinterpret_cast<const char *>(iov[0].iov_base), iov[0].iov_len);
+			return static_cast<int>(iov[0].iov_len);
+		};
+		ASSERT_EQ(rwBuf.Writev(offset, 16, -1, writev), 16);
+		ASSERT_EQ(out, "8191000081920000");
+		ASSERT_EQ(rwBuf.Writev(count * 8, 16, -1, writev), 0);
+
+		// past the reservation
+		std::vector<char> big(1024*1024);
+		ASSERT_NE(rwBuf.Push(big.data(), big.size()), 0);
+		ASSERT_EQ(rwBuf.Available(), count * 8);
+	}
+
+	// file cut back to the written length, page rounded, and appends after it on reopen
+	off64_t size = 0;
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, ((count * 8 + pageSize - 1) / pageSize) * pageSize);
+	{
+		window_type rwBuf(pageSize, size, fd, false);
+		char dest[9] = {};
+		ASSERT_TRUE(rwBuf.Pop((count - 1) * 8, dest, 8));
+		ASSERT_EQ(atoi(dest), count - 1);
+		ASSERT_EQ(rwBuf.Push("end", 3), 0);
+		ASSERT_EQ(rwBuf.Available(), size + 3);
+	}
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+TEST(StoreTest, WindowReadStreamThread)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	typedef LogWindowStream<1024*1024, 64*1024> window_type;
+	typedef LogWindowReadStream<1024*1024, 64*1024> read_type;
+	window_type rwBuf(MemManager::GetPageSize(), 0, fd, false);
+	read_type reader(rwBuf);
+	ASSERT_TRUE(reader.IsEmpty());
+
+	// the writer maps new extents while the reader is reading earlier ones
+	const int count = 20000;
+	std::thread writer([&rwBuf, &reader, count] () {
+		char outstr[32];
+		for (int i = 0; i < count; ++i) {
+		  int len = snprintf(outstr, sizeof(outstr), "%08d", i);
+		  rwBuf.Push(outstr, len);
+		  reader.Publish(rwBuf.Available());
+		}
+	  });
+
+	uint64_t offset = 0;
+	char dest[9] = {};
+	for (int i = 0; i < count; ) {
+		if (reader.Available() - offset < 8) {
+		  std::this_thread::yield();
+		  continue;
+		}
+		ASSERT_TRUE(reader.Pop(offset, dest, 8)) << i;
+		ASSERT_EQ(atoi(dest), i);
+		offset += 8;
+		++i;
+	}
+	writer.join();
+	ASSERT_EQ(reader.Available(), rwBuf.Available());
+	ASSERT_FALSE(reader.Pop(offset, dest, 1));
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+TEST(StoreTest, SegmentAllocator)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	const off64_t pageSize = MemManager::GetPageSize();
+	const int count = 20000;
+	{
+	  std::shared_ptr<SegmentAllocator> segments = std::make_shared<SegmentAllocator>(fd, pageSize, 0, 4);
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, 0, fd, false);
+	  ASSERT_TRUE(rwBuf.SetSegmentAllocator(segments));
+	  ASSERT_EQ(segments->Start(), 0);
+	  ASSERT_NE(segments->Start(), 0);
+	  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	  char outstr[32];
+	  for (int i = 0; i < count; ++i) {
+		 int len = snprintf(outstr, sizeof(outstr), "%08d", i);
+		 ASSERT_EQ(rwBuf.Push(outstr, len), 0);
+		 std::this_thread::yield();
+	  }
+	  ASSERT_GT(segments->Hits(), 0);
+	  ASSERT_EQ(segments->Hits() + segments->Misses(), (count * 8 + pageSize - 1) / pageSize);
+	  ASSERT_EQ(segments->Errors(), 0);
+
+	  char dest[9] = {};
+	  for (int i = 0; i < count; ++i) {
+		 ASSERT_TRUE(rwBuf.Pop(i * 8, dest, 8)) << i;
+		 ASSERT_EQ(atoi(dest), i);
+	  }
+	}
+
+	// pages mapped ahead and not written are cut off
+	off64_t size = 0;
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, ((count * 8 + pageSize - 1) / pageSize) * pageSize);
+
+	{
+	  // not started, every page is a miss and the writer grows the file itself
+	  std::shared_ptr<SegmentAllocator> segments = std::make_shared<SegmentAllocator>(fd, pageSize, size, 4);
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, size, fd, false);
+	  ASSERT_TRUE(rwBuf.SetSegmentAllocator(segments));
+	  ASSERT_EQ(rwBuf.Push("12345678", 8), 0);
+	  ASSERT_EQ(segments->Hits(), 0);
+	  ASSERT_EQ(segments->Misses(), 1);
+	}
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, ((count * 8 + pageSize - 1) / pageSize + 1) * pageSize);
+
+	{
+	  // the writer got well ahead mapping pages itself, the allocator starts from there
+	  SegmentAllocator segments(fd, pageSize, size, 4);
+	  const off64_t ahead = size + 100 * pageSize;
+	  ASSERT_EQ(segments.Extend(ahead), 0);
+	  ASSERT_EQ(segments.Start(), 0);
+	  char *page = nullptr;
+	  for (int i = 0; i < 1000 && !segments.Take(ahead, page); ++i) {
+		 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	  }
+	  ASSERT_EQ(segments.Hits(), 1);
+	  ASSERT_LT(segments.Misses(), 10); // not 25 rounds of retiring pages it passed
+	  ASSERT_TRUE(segments.Retire(page));
+	}
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, ((count * 8 + pageSize - 1) / pageSize + 102) * pageSize);
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+static bool WaitDurable (const std::shared_ptr<StoreFlusher> &flusher, uint64_t durable) {
+	for (int i = 0; i < 2000 && flusher->Durable() != durable; ++i) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return flusher->Durable() == durable;
+}
+
+TEST(StoreTest, FlushPolicy)
+{
+	char buf[1024];
+	int fd = FileUtil::MakeTemp("coypu", buf, sizeof(buf));
+	ASSERT_TRUE(fd > 0);
+
+	const off64_t pageSize = MemManager::GetPageSize();
+	FlushConfig config;
+	ASSERT_EQ(StoreFlusher(fd, pageSize, 0, config).Start(), -1);
+
+	uint64_t written = 0;
+	{
+	  // whole pages only, the rest on Stop
+	  config._policy = FLUSH_ROLL;
+	  std::shared_ptr<StoreFlusher> flusher = std::make_shared<StoreFlusher>(fd, pageSize, 0, config);
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, 0, fd, false);
+	  rwBuf.SetFlusher(flusher);
+	  ASSERT_EQ(flusher->Start(), 0);
+
+	  std::string data(pageSize * 2 + 100, 'r');
+	  ASSERT_EQ(rwBuf.Push(data.data(), data.size()), 0);
+	  ASSERT_TRUE(WaitDurable(flusher, 2 * pageSize));
+	  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	  ASSERT_EQ(flusher->Durable(), 2 * pageSize);
+
+	  flusher->Stop();
+	  written = rwBuf.Available();
+	  ASSERT_EQ(flusher->Durable(), written);
+	  ASSERT_EQ(flusher->Errors(), 0);
+	}
+
+	// a restart appends after the written page, as main opens the stores
+	off64_t size = 0;
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, 3 * pageSize);
+	written = size;
+
+	{
+	  // what is in the file at open counts as durable
+	  config._policy = FLUSH_BYTES;
+	  config._bytes = 1000;
+	  std::shared_ptr<StoreFlusher> flusher = std::make_shared<StoreFlusher>(fd, pageSize, written, config);
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, written, fd, false);
+	  rwBuf.SetFlusher(flusher);
+	  ASSERT_EQ(flusher->Durable(), written);
+	  ASSERT_EQ(flusher->Start(), 0);
+
+	  std::string data(999, 'b');
+	  ASSERT_EQ(rwBuf.Push(data.data(), data.size()), 0);
+	  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	  ASSERT_EQ(flusher->Durable(), written);
+	  ASSERT_EQ(rwBuf.Push("b", 1), 0);
+	  ASSERT_TRUE(WaitDurable(flusher, written + 1000));
+	}
+
+	ASSERT_EQ(FileUtil::GetSize(fd, size), 0);
+	ASSERT_EQ(size, 4 * pageSize);
+	written = size;
+
+	{
+	  config._policy = FLUSH_INTERVAL;
+	  config._intervalMs = 1;
+	  std::shared_ptr<StoreFlusher> flusher = std::make_shared<StoreFlusher>(fd, pageSize, written, config);
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, written, fd, false);
+	  rwBuf.SetFlusher(flusher);
+	  ASSERT_EQ(flusher->Start(), 0);
+
+	  ASSERT_EQ(rwBuf.Push("interval", 8), 0);
+	  ASSERT_TRUE(WaitDurable(flusher, written + 8));
+	  ASSERT_GT(flusher->Flushes(), 0);
+	}
+
+	{
+	  // a flush that keeps failing backs off rather than spinning
+	  int pipefd[2];
+	  ASSERT_EQ(::pipe(pipefd), 0);
+	  config._policy = FLUSH_BYTES;
+	  config._bytes = 1;
+	  StoreFlusher flusher(pipefd[1], pageSize, 0, config);
+	  ASSERT_EQ(flusher.Start(), 0);
+	  flusher.Written(100);
+	  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	  ASSERT_GT(flusher.Errors(), 0);
+	  ASSERT_LT(flusher.Errors(), 20);
+	  ASSERT_EQ(flusher.Durable(), 0);
+	  flusher.Stop();
+	  ::close(pipefd[0]);
+	  ::close(pipefd[1]);
+	}
+
+	ASSERT_NO_THROW(FileUtil::Close(fd));
+	ASSERT_NO_THROW(FileUtil::Remove(buf));
+}
+
+typedef LogRWStream<MMapShared, LRUCache, 16> SegmentBufType;
+typedef LogReadStream<MMapShared, LRUCache, 16> SegmentReadBufType;
+
+// a directory of its own for a segmented log, path is dir/log
+static std::string SegmentedLogPath (char *dir, size_t len) {
+  int fd = FileUtil::MakeTemp("coypu", dir, len);
+  FileUtil::Close(fd);
+  FileUtil::Remove(dir);
+  ::mkdir(dir, 0700);
+  return std::string(dir) + "/log";
+}
+
+static void RemoveSegmentedLog (const std::string &path, const char *dir) {
+  for (uint32_t i = 0; i < 64; ++i) {
+	 FileUtil::Remove(SegmentIndex::SegmentPath(path, i).c_str());
+  }
+  FileUtil::Remove((path + ".index").c_str());
+  ::rmdir(dir);
+}
+
+static void PushRecords (SegmentedLog<SegmentBufType> &log, uint64_t count, uint64_t size) {
+  std::string data(size, 0);
+  for (uint64_t i = 0; i < count; ++i) {
+	 for (uint64_t j = 0; j < size; ++j) data[j] = (log.Available() + j) % 251;
+	 ASSERT_EQ(log.Push(data.data(), data.size()), 0);
+	 log.Checkpoint();
+  }
+}
+
+template <typename LogType>
+static bool CheckRange (LogType &log, uint64_t offset, uint64_t size) {
+  std::vector<char> data(size);
+  if (!log.Pop(offset, data.data(), size)) return false;
+  for (uint64_t i = 0; i < size; ++i) {
+	 if (data[i] != static_cast<char>((offset + i) % 251)) return false;
+  }
+  return true;
+}
+
+TEST(StoreTest, SegmentedLog)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	SegmentConfig config;
+	config._segmentBytes = 2 * pageSize;
+	{
+	  SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	  ASSERT_EQ(log.Open(), 0);
+	  ASSERT_EQ(log.Open(), -1);
+	  ASSERT_TRUE(log.IsEmpty());
+	  ASSERT_FALSE(log.Checkpoint());
+
+	  // rolls between records once the head is full
+	  PushRecords(log, 20, 1000);
+	  ASSERT_EQ(log.Available(), 20000);
+	  ASSERT_EQ(log.Segments(), 3);
+	  ASSERT_EQ(log.First(), 0);
+
+	  ASSERT_TRUE(CheckRange(log, 0, 20000));
+	  ASSERT_TRUE(CheckRange(log, 8500, 1000)); // across the roll at 9000
+	  ASSERT_FALSE(CheckRange(log, 19500, 1000));
+	  char c = 0;
+	  ASSERT_TRUE(log.Peak(9000, c));
+	  ASSERT_EQ(c, static_cast<char>(9000 % 251));
+	  ASSERT_FALSE(log.Peak(20000, c));
+
+	  // one gather over both sides of the roll
+	  std::vector<char> out;
+	  std::function <int(int, const struct iovec *, int)> cb = [&out] (int, const struct iovec *iov, int count) {
+		 int len = 0;
+		 for (int i = 0; i < count; ++i) {
+			out.insert(out.end(), static_cast<char *>(iov[i].iov_base), static_cast<char *>(iov[i].iov_base) + iov[i].iov_len);
+			len += iov[i].iov_len;
+		 }
+		 return len;
+	  };
+	  ASSERT_EQ(log.Writev(8500, 1000, 0, cb), 1000);
+	  for (size_t i = 0; i < out.size(); ++i) {
+		 ASSERT_EQ(out[i], static_cast<char>((8500 + i) % 251));
+	  }
+	  out.clear();
+	  ASSERT_EQ(log.Writev(19500, 1000, 0, cb), 500);
+	  ASSERT_EQ(log.Writev(20000, 1000, 0, cb), 0);
+
+	  // iterates across segments too
+	  MultiPositionedStreamLog<SegmentedLog<SegmentBufType>> stream(std::shared_ptr<SegmentedLog<SegmentBufType>>(&log, [] (SegmentedLog<SegmentBufType> *) {}));
+	  ASSERT_EQ(*stream.begin(8999), static_cast<char>(8999 % 251));
+	  ASSERT_EQ(*stream.begin(9000), static_cast<char>(9000 % 251));
+
+	  // a batched write that came back short gives the unsent tail back to the fd
+	  ASSERT_EQ(stream.Register(3, 8500), 0);
+	  out.clear();
+	  ASSERT_EQ(stream.Writev(1000, 3, cb), 1000);
+	  ASSERT_EQ(stream.Available(3), 10500);
+	  ASSERT_TRUE(stream.Rewind(3, 400));
+	  ASSERT_EQ(stream.Available(3), 10900);
+	  ASSERT_FALSE(stream.Rewind(3, 10000));
+	  ASSERT_FALSE(stream.Rewind(4, 1));
+	  ASSERT_EQ(stream.Unregister(3), 0);
+	  ASSERT_FALSE(stream.Rewind(3, 1));
+	}
+
+	bool exists = false;
+	FileUtil::Exists(SegmentIndex::SegmentPath(path, 2).c_str(), exists);
+	ASSERT_TRUE(exists);
+	{
+	  // the head was cut back to what was written, a restart carries on in a new segment
+	  SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	  ASSERT_EQ(log.Open(), 0);
+	  ASSERT_EQ(log.Available(), 20000);
+	  ASSERT_EQ(log.Segments(), 4);
+	  ASSERT_TRUE(CheckRange(log, 0, 20000));
+
+	  PushRecords(log, 5, 1000);
+	  ASSERT_EQ(log.Available(), 25000);
+	  ASSERT_TRUE(CheckRange(log, 15000, 10000));
+	  ASSERT_EQ(log.Roll(), 0);
+	  ASSERT_EQ(log.Roll(), 0); // empty head
+	  ASSERT_EQ(log.Segments(), 5);
+	}
+
+	config._retainBytes = 10000;
+	{
+	  // oldest segments go once over the limit, never the head
+	  SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	  ASSERT_EQ(log.Open(), 0);
+	  ASSERT_EQ(log.Available(), 25000);
+	  ASSERT_EQ(log.First(), 18000);
+	  ASSERT_EQ(log.Segments(), 3);
+
+	  FileUtil::Exists(SegmentIndex::SegmentPath(path, 0).c_str(), exists);
+	  ASSERT_FALSE(exists);
+	  ASSERT_FALSE(CheckRange(log, 17000, 1000));
+	  ASSERT_TRUE(CheckRange(log, 18000, 7000));
+
+	  std::function <int(int, const struct iovec *, int)> cb = [] (int, const struct iovec *, int) { return 0; };
+	  ASSERT_EQ(log.Writev(0, 1000, 0, cb), -4);
+	}
+	RemoveSegmentedLog(path, dir);
+}
+
+TEST(StoreTest, SegmentedLogAge)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	SegmentConfig config;
+	config._segmentSeconds = 60;
+	config._retainSeconds = 600;
+	SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	ASSERT_EQ(log.Open(), 0);
+	const time_t now = ::time(nullptr);
+
+	// empty heads never roll
+	log.Tick(now + 120);
+	ASSERT_FALSE(log.Checkpoint());
+
+	PushRecords(log, 2, 100);
+	log.Tick(now + 30);
+	ASSERT_FALSE(log.Checkpoint());
+	log.Tick(now + 60);
+	ASSERT_TRUE(log.Checkpoint());
+	ASSERT_EQ(log.Segments(), 2);
+
+	// the first segment is all older than the second's start
+	PushRecords(log, 1, 100);
+	log.Tick(now + 300);
+	ASSERT_EQ(log.Segments(), 2);
+	log.Tick(now + 601);
+	ASSERT_EQ(log.Segments(), 1);
+	ASSERT_EQ(log.First(), 200);
+	ASSERT_TRUE(CheckRange(log, 200, 100));
+	RemoveSegmentedLog(path, dir);
+}
+
+TEST(StoreTest, SegmentedLogDurable)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	SegmentConfig config;
+	config._segmentBytes = 2 * pageSize;
+	{
+	  SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	  ASSERT_EQ(log.Open(), 0);
+	  PushRecords(log, 3, 1000);
+	  ASSERT_EQ(log.Durable(), 0);
+	  ASSERT_EQ(log.Written(), 0);
+	}
+
+	FlushConfig flush;
+	flush._policy = FLUSH_BYTES;
+	flush._bytes = 1;
+	{
+	  // offsets across every segment, not in the head file
+	  SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	  log.SetFlushConfig(flush);
+	  ASSERT_EQ(log.Open(), 0);
+	  PushRecords(log, 20, 1000);
+	  ASSERT_EQ(log.Segments(), 4);
+	  ASSERT_EQ(log.Written(), 23000);
+	  for (int i = 0; i < 2000 && log.Durable() != log.Available(); ++i) {
+		 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	  }
+	  ASSERT_EQ(log.Durable(), 23000);
+	  ASSERT_EQ(log.Errors(), 0);
+	}
+	RemoveSegmentedLog(path, dir);
+}
+
+TEST(StoreTest, SegmentRoller)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	SegmentIndex index(path);
+	std::vector<SegmentIndex::Entry> entries;
+	ASSERT_EQ(index.Open(entries), 0);
+
+	FlushConfig flush;
+	flush._policy = FLUSH_ROLL;
+	{
+	  SegmentRoller roller(path, index, pageSize, 2, flush);
+	  ASSERT_EQ(roller.Start(1), 0);
+
+	  // made ready on the thread
+	  bool exists = false;
+	  for (int i = 0; i < 2000 && !exists; ++i) {
+		 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		 FileUtil::Exists(SegmentIndex::SegmentPath(path, 1).c_str(), exists);
+	  }
+	  ASSERT_TRUE(exists);
+	  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	  SegmentRoller::Head head;
+	  ASSERT_EQ(roller.Take(head), 0);
+	  ASSERT_EQ(roller.Misses(), 0);
+	  ASSERT_EQ(head._number, 1);
+	  ASSERT_GE(head._fd, 0);
+	  ASSERT_TRUE(head._segments);
+	  ASSERT_TRUE(head._flusher);
+
+	  // stopped, then the next head's record
+	  LogRWStream<MMapShared, LRUCache, 16> rwBuf(pageSize, 0, head._fd, false);
+	  rwBuf.SetSegmentAllocator(head._segments);
+	  rwBuf.SetFlusher(head._flusher);
+	  std::string data(100, 'r');
+	  ASSERT_EQ(rwBuf.Push(data.data(), data.size()), 0);
+	  rwBuf.SetSegmentAllocator(nullptr);
+	  rwBuf.SetFlusher(nullptr);
+
+	  std::shared_ptr<StoreFlusher> flusher = head._flusher;
+	  SegmentIndex::Entry entry;
+	  ::memset(&entry, 0, sizeof(entry));
+	  entry._base = 100;
+	  entry._number = 2;
+	  roller.Release(std::make_shared<LogSegment>(1, 0, head._fd, 0), head._segments, flusher, entry);
+	  head._segments.reset();
+	  head._flusher.reset();
+	  for (int i = 0; i < 2000 && roller.Released() == 0; ++i) {
+		 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	  }
+	  ASSERT_EQ(roller.Released(), 1);
+	  ASSERT_EQ(flusher->Durable(), 100);
+	  ASSERT_EQ(roller.Errors(), 0);
+
+	  roller.Remove(1);
+	  for (int i = 0; i < 2000 && exists; ++i) {
+		 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		 FileUtil::Exists(SegmentIndex::SegmentPath(path, 1).c_str(), exists);
+	  }
+	  ASSERT_FALSE(exists);
+	}
+
+	// the head made ready and not taken goes on Stop
+	bool exists = true;
+	FileUtil::Exists(SegmentIndex::SegmentPath(path, 2).c_str(), exists);
+	ASSERT_FALSE(exists);
+
+	SegmentIndex reopened(path);
+	ASSERT_EQ(reopened.Open(entries), 0);
+	ASSERT_EQ(entries.size(), 1);
+	ASSERT_EQ(entries[0]._base, 100);
+	ASSERT_EQ(entries[0]._number, 2);
+	RemoveSegmentedLog(path, dir);
+}
+
+TEST(StoreTest, SegmentedReadLog)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	SegmentConfig config;
+	config._segmentBytes = pageSize;
+	config._retainBytes = 4 * pageSize;
+	SegmentedLog<SegmentBufType> log(path, pageSize, config);
+	ASSERT_EQ(log.Open(), 0);
+	PushRecords(log, 3, 1500);
+
+	SegmentedReadLog<SegmentReadBufType, SegmentBufType> reader(log);
+	ASSERT_EQ(reader.Available(), 4500);
+	ASSERT_TRUE(CheckRange(reader, 0, 4500));
+	int evicts = 0;
+	reader.SetEvictCB([&evicts] () { ++evicts; });
+
+	// a roll does not stall the writer, so it waits for the reader rather than retain what is unread
+	std::atomic<uint64_t> read(0);
+	std::thread t([&log, &reader, &read, pageSize] () {
+		for (int i = 0; i < 20; ++i) {
+		  while (log.Available() - read.load() > 2 * static_cast<uint64_t>(pageSize)) {
+			 std::this_thread::yield();
+		  }
+		  PushRecords(log, 1, 1500);
+		  reader.Publish(log.Available());
+		}
+	  });
+
+	// picks up segments as the writer rolls, and drops the ones retention removed
+	uint64_t offset = 0;
+	while (offset < 30000) {
+	  const uint64_t available = reader.Available();
+	  if (available == offset) {
+		 std::this_thread::yield();
+		 continue;
+	  }
+	  offset = std::max(offset, reader.First());
+	  ASSERT_TRUE(CheckRange(reader, offset, available - offset));
+	  offset = available;
+	  read.store(offset);
+	}
+	t.join();
+
+	ASSERT_TRUE(CheckRange(reader, reader.Available() - 1500, 1500));
+	ASSERT_LT(reader.Segments(), 10);
+	ASSERT_GT(evicts, 0); // told before it dropped those
+	char c = 0;
+	ASSERT_FALSE(reader.Peak(0, c));
+	RemoveSegmentedLog(path, dir);
+}
+
+TEST(StoreTest, SegmentIndexMigrate)
+{
+	char dir[1024];
+	const std::string path = SegmentedLogPath(dir, sizeof(dir));
+	const off64_t pageSize = MemManager::GetPageSize();
+
+	// as CreateRollingStore left them, each a whole number of pages
+	for (uint32_t n = 0; n < 2; ++n) {
+	  std::string data(pageSize, 0);
+	  for (off64_t j = 0; j < pageSize; ++j) data[j] = (n * pageSize + j) % 251;
+	  int fd = FileUtil::Open(SegmentIndex::SegmentPath(path, n).c_str(), O_CREAT|O_RDWR, 0600);
+	  ASSERT_GT(fd, 0);
+	  ASSERT_EQ(FileUtil::Write(fd, data.data(), data.size()), pageSize);
+	  FileUtil::Close(fd);
+	}
+
+	{
+	  SegmentedLog<SegmentBufType> log(path, pageSize, SegmentConfig());
+	  ASSERT_EQ(log.Open(), 0);
+	  ASSERT_EQ(log.Available(), 2 * pageSize);
+	  ASSERT_EQ(log.Segments(), 3);
+	  ASSERT_TRUE(CheckRange(log, 0, 2 * pageSize));
+	}
+
+	// a record cut short is dropped
+	int fd = FileUtil::Open((path + ".index").c_str(), O_RDWR|O_APPEND, 0600);
+	ASSERT_GT(fd, 0);
+	ASSERT_EQ(FileUtil::Write(fd, "x", 1), 1);
+	FileUtil::Close(fd);
+
+	SegmentIndex index(path);
+	std::vector<SegmentIndex::Entry> entries;
+	ASSERT_EQ(index.Open(entries), 0);
+	ASSERT_EQ(entries.size(), 3);
+	ASSERT_EQ(entries[1]._base, pageSize);
+	ASSERT_EQ(entries[2]._base, 2 * pageSize);
+	ASSERT_EQ(entries[2]._number, 2);
+	RemoveSegmentedLog(path, dir);
+}
@@ -0,0 +1,41 @@
+#include "gtest/gtest.h"
+#include "util/histogram.h"
+
+using namespace coypu::util;
+
+TEST(HistogramTest, Buckets)
+{
+  ASSERT_EQ(Histogram::Bucket(0), 0);
+  ASSERT_EQ(Histogram::Bucket(1), 1);
+  ASSERT_EQ(Histogram::Bucket(2), 2);
+  ASSERT_EQ(Histogram::Bucket(3), 2);
+  ASSERT_EQ(Histogram::Bucket(1024), 11);
+  ASSERT_EQ(Histogram::Bucket(UINT64_MAX), 64);
+}
+
+TEST(HistogramTest, Percentile)
+{
+  Histogram h;
+  ASSERT_EQ(h.GetCount(), 0);
+  ASSERT_EQ(h.GetPercentile(50), 0);
+
+  for (uint64_t i = 1; i <= 1000; ++i) {
+	 h.Record(i);
+  }
+  ASSERT_EQ(h.GetCount(), 1000);
+  ASSERT_EQ(h.GetMin(), 1);
+  ASSERT_EQ(h.GetMax(), 1000);
+  ASSERT_EQ(h.GetMean(), 500);
+  ASSERT_EQ(h.GetPercentile(50), 511);   // 500 is in [256, 512)
+  ASSERT_EQ(h.GetPercentile(99), 1000);  // capped at max
+  ASSERT_EQ(h.GetBucket(9), 256);       // [256, 512)
+  ASSERT_EQ(h.GetBucket(10), 1000 - 511);
+
+  h.Record(1ULL << 40);
+  ASSERT_EQ(h.GetPercentile(100), 1ULL << 40);
+
+  h.Reset();
+  ASSERT_EQ(h.GetCount(), 0);
+  ASSERT_EQ(h.GetMin(), 0);
+  ASSERT_EQ(h.GetMax(), 0);
+}
@@ -1,14 +1,24 @@
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #include "gtest/gtest.h"
 #include "http/websocket.h"
+#include "event/event_mgr.h"
+#include "buf/buf.h"
+#include "buf/fixed.h"
 
 
+using namespace coypu::http;
 using namespace coypu::http::websocket;
+using namespace coypu::event;
 
 
 TEST(WebsocketTest, Test1) 
@@ -31,3 +41,346 @@ TEST(WebsocketTest, Test1)
     const char *result = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
     ASSERT_STREQ(result, reinterpret_cast<char *>(base64));
 }
+
+struct WSDummyLog {
+  void perror (int, const char *) { }
+  template <typename... Args> void warn(const char *msg, Args... args) { }
+  template <typename... Args> void info(const char *msg, Args... args) { }
+  template <typename... Args> void debug(const char *msg, Args... args) { }
+  template <typename... Args> void error(const char *msg, Args... args) { }
+};
+
+struct WSDummyPublish {
+  uint64_t Available (int fd) const { return 0; }
+  bool IsEmpty (int fd) const { return true; }
+  int Writev (uint64_t len, int fd, std::function<int(int,const struct iovec *,int)> &writev) { return 0; }
+};
+
+template <typename BackendType>
+class WebsocketEventTest : public ::testing::Test {
+};
+
+typedef ::testing::Types<EPollBackend, IOUringBackend> ws_backend_types;
+TYPED_TEST_CASE(WebsocketEventTest, ws_backend_types);
+
+// Server connection driven by the event manager, raw client on the other end of a socketpair
+TYPED_TEST(WebsocketEventTest, OpenAndText)
+{
+  typedef coypu::buf::BipBuf<char, uint64_t> stream_type;
+  typedef WebSocketManager<WSDummyLog *, stream_type, WSDummyPublish> ws_type;
+
+  WSDummyLog log;
+  EventManager <WSDummyLog *, TypeParam> eventMgr(&log);
+  ASSERT_EQ(eventMgr.Init(), 0);
+
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  const int server = fds[0], client = fds[1];
+
+  std::function<int(int)> setWrite = [&eventMgr] (int fd) { return eventMgr.SetWrite(fd); };
+  ws_type ws(&log, setWrite);
+
+  std::function<int(int,const struct iovec *,int)> readv = [] (int fd, const struct iovec *iov, int count) { return ::readv(fd, iov, count); };
+  std::function<int(int,const struct iovec *,int)> writev = [] (int fd, const struct iovec *iov, int count) { return ::writev(fd, iov, count); };
+
+  int opened = 0;
+  std::function<void(int)> onOpen = [&opened] (int) { ++opened; };
+  ASSERT_TRUE(ws.RegisterConnection(server, true, readv, writev, onOpen, nullptr, nullptr, nullptr));
+  ASSERT_EQ((eventMgr.template Register<ws_type, &ws_type::Read, &ws_type::Write, &ws_type::Unregister>(server, &ws)), 0);
+
+  const char *request = "GET / HTTP/1.1\r\n"
+	 "Host: localhost\r\n"
+	 "Upgrade: websocket\r\n"
+	 "Connection: Upgrade\r\n"
+	 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	 "Sec-WebSocket-Version: 13\r\n"
+	 "\r\n";
+  ASSERT_EQ(::write(client, request, strlen(request)), strlen(request));
+  for (int i = 0; i < 16 && !opened; ++i) {
+	 ASSERT_TRUE(eventMgr.Wait() >= 0);
+  }
+  ASSERT_EQ(opened, 1);
+
+  ASSERT_TRUE(ws.Queue(server, WS_OP_TEXT_FRAME, "hello", 5));
+  std::string response;
+  char buf[1024];
+  for (int i = 0; i < 16 && response.find("hello") == std::string::npos; ++i) {
+	 ASSERT_TRUE(eventMgr.Wait() >= 0);
+	 int r = ::read(client, buf, sizeof(buf));
+	 if (r > 0) response.append(buf, r);
+  }
+
+  ASSERT_EQ(response.find("HTTP/1.1 101 Switching Protocols\r\n"), 0);
+  ASSERT_NE(response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo="), std::string::npos);
+  ASSERT_EQ(response.substr(response.size()-7), std::string("\x81\x05hello"));
+
+  eventMgr.Close();
+  ::close(server);
+  ::close(client);
+}
+
+// Server connection on a socketpair, upgraded by hand so Write can be driven directly
+template <typename WS>
+static void OpenServer (WS &ws, int fds[2]) {
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  std::function<int(int,const struct iovec *,int)> readv = [] (int fd, const struct iovec *iov, int count) { return ::readv(fd, iov, count); };
+  std::function<int(int,const struct iovec *,int)> writev = [] (int fd, const struct iovec *iov, int count) { return ::writev(fd, iov, count); };
+  ASSERT_TRUE(ws.RegisterConnection(fds[0], true, readv, writev, nullptr, nullptr, nullptr, nullptr));
+
+  const char *request = "GET / HTTP/1.1\r\n"
+	 "Host: localhost\r\n"
+	 "Upgrade: websocket\r\n"
+	 "Connection: Upgrade\r\n"
+	 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	 "Sec-WebSocket-Version: 13\r\n"
+	 "\r\n";
+  ASSERT_EQ(::write(fds[1], request, strlen(request)), strlen(request));
+  ASSERT_EQ(ws.Read(fds[0]), 0);
+  ASSERT_EQ(ws.Write(fds[0]), 0);
+  char buf[1024];
+  ASSERT_GT(::read(fds[1], buf, sizeof(buf)), 0); // 101 response
+}
+
+// Writes and reads until the server has nothing left, returning the sequence number of each
+// 1000 byte text frame
+template <typename WS>
+static void DrainFrames (WS &ws, int fds[2], std::vector<int> &seqs) {
+  std::string in;
+  char buf[64*1024];
+  int w = 1;
+  while (w > 0) {
+	 w = ws.Write(fds[0]);
+	 ASSERT_GE(w, 0);
+	 int r = 0;
+	 while ((r = ::read(fds[1], buf, sizeof(buf))) > 0) in.append(buf, r);
+  }
+
+  size_t pos = 0;
+  while (pos < in.size()) {
+	 ASSERT_EQ(in[pos], '\x81');
+	 ASSERT_EQ(in[pos+1], 126);
+	 uint16_t len = 0;
+	 ::memcpy(&len, &in[pos+2], sizeof(len));
+	 ASSERT_EQ(ntohs(len), 1000);
+	 seqs.push_back(atoi(in.substr(pos+4, 8).c_str()));
+	 pos += 4 + 1000;
+  }
+}
+
+TEST(WebsocketTest, Backpressure)
+{
+  typedef coypu::buf::BipBuf<char, uint64_t> stream_type;
+  typedef WebSocketManager<WSDummyLog *, stream_type, WSDummyPublish> ws_type;
+
+  WSDummyLog log;
+  std::function<int(int)> setWrite = [] (int) { return 0; };
+  char frame[1000];
+  ::memset(frame, 'x', sizeof(frame));
+  auto queue = [&frame] (ws_type &ws, int fd, int i, uint64_t key) {
+	 ::snprintf(frame, 9, "%08d", i);
+	 return ws.Queue(fd, WS_OP_TEXT_FRAME, frame, sizeof(frame), key);
+  };
+
+  {
+	 // default: write buffer only, frames that do not fit are counted
+	 ws_type ws(&log, setWrite);
+	 int fds[2];
+	 OpenServer(ws, fds);
+	 int queued = 0;
+	 for (int i = 0; i < 100; ++i) {
+		if (queue(ws, fds[0], i, 0)) ++queued;
+	 }
+	 ASSERT_EQ(queued, 65);
+	 BackpressureStats stats;
+	 ASSERT_TRUE(ws.GetBackpressureStats(fds[0], stats));
+	 ASSERT_EQ(stats._frames, 65);
+	 ASSERT_EQ(stats._dropped, 35);
+	 ASSERT_EQ(stats._congested, 1);
+
+	 std::vector<int> seqs;
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size(), 65);
+	 ::close(fds[0]);
+	 ::close(fds[1]);
+  }
+
+  {
+	 // grows into two chunks then spills, nothing lost and in order
+	 ws_type ws(&log, setWrite);
+	 BackpressureConfig config;
+	 config._highWater = 1024*1024;
+	 config._lowWater = 512*1024;
+	 config._maxChunks = 2;
+	 config._spill = true;
+	 ws.SetBackpressure(config);
+	 int fds[2];
+	 OpenServer(ws, fds);
+	 for (int i = 0; i < 500; ++i) {
+		ASSERT_TRUE(queue(ws, fds[0], i, 0)) << i;
+	 }
+	 ASSERT_EQ(ws.GetBackpressureStats()._spilled, 500 - 65 - (2*64*1024)/1004);
+	 ASSERT_EQ(ws.GetBackpressureStats()._dropped, 0);
+
+	 std::vector<int> seqs;
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size(), 500);
+	 for (int i = 0; i < 500; ++i) {
+		ASSERT_EQ(seqs[i], i);
+	 }
+
+	 // spill released, queues again
+	 ASSERT_TRUE(queue(ws, fds[0], 0, 0));
+	 seqs.clear();
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size(), 1);
+	 ::close(fds[0]);
+	 ::close(fds[1]);
+  }
+
+  {
+	 // oldest queued frames go first, the newest always arrive
+	 ws_type ws(&log, setWrite);
+	 BackpressureConfig config;
+	 config._highWater = 128*1024;
+	 config._lowWater = 96*1024;
+	 config._maxChunks = 4;
+	 ws.SetBackpressure(config);
+	 int fds[2];
+	 OpenServer(ws, fds);
+	 for (int i = 0; i < 300; ++i) {
+		ASSERT_TRUE(queue(ws, fds[0], i, 0)) << i;
+	 }
+	 BackpressureStats stats;
+	 ASSERT_TRUE(ws.GetBackpressureStats(fds[0], stats));
+	 ASSERT_GT(stats._dropped, 0);
+	 ASSERT_EQ(stats._congested, 1);
+
+	 std::vector<int> seqs;
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size() + stats._dropped, 300);
+	 ASSERT_EQ(seqs.front(), 0); // already in the write buffer
+	 ASSERT_EQ(seqs.back(), 299);
+	 for (size_t i = 1; i < seqs.size(); ++i) {
+		ASSERT_LT(seqs[i-1], seqs[i]);
+	 }
+	 ::close(fds[0]);
+	 ::close(fds[1]);
+  }
+
+  {
+	 // keyed frames replace the waiting frame with the same key
+	 ws_type ws(&log, setWrite);
+	 BackpressureConfig config;
+	 config._highWater = 96*1024;
+	 config._lowWater = 64*1024;
+	 config._maxChunks = 4;
+	 config._policy = BP_CONFLATE;
+	 ws.SetBackpressure(config);
+	 int fds[2];
+	 OpenServer(ws, fds);
+	 for (int i = 0; i < 300; ++i) {
+		ASSERT_TRUE(queue(ws, fds[0], i, 1 + (i % 4))) << i;
+	 }
+	 BackpressureStats stats;
+	 ASSERT_TRUE(ws.GetBackpressureStats(fds[0], stats));
+	 ASSERT_GT(stats._conflated, 0);
+
+	 std::vector<int> seqs;
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size() + stats._conflated + stats._dropped, 300);
+	 std::vector<int> last(seqs.end() - 4, seqs.end());
+	 std::sort(last.begin(), last.end());
+	 ASSERT_EQ(last, (std::vector<int>{296, 297, 298, 299}));
+	 ::close(fds[0]);
+	 ::close(fds[1]);
+  }
+
+  {
+	 // a slow consumer past the high watermark is closed by the event loop
+	 ws_type ws(&log, setWrite);
+	 BackpressureConfig config;
+	 config._highWater = 8*1024;
+	 config._policy = BP_DISCONNECT;
+	 ws.SetBackpressure(config);
+	 int fds[2];
+	 OpenServer(ws, fds);
+	 int i = 0;
+	 while (queue(ws, fds[0], i, 0)) ++i;
+	 ASSERT_EQ(i, 8);
+	 ASSERT_LT(ws.Write(fds[0]), 0);
+	 ASSERT_EQ(ws.GetBackpressureStats()._disconnects, 1);
+	 ::close(fds[0]);
+	 ::close(fds[1]);
+  }
+}
+
+TEST(WebsocketTest, FixedBuffers)
+{
+  typedef coypu::buf::FixedBipBuf<char, uint64_t, 64*1024> buf_type;
+  typedef WebSocketManager<WSDummyLog *, coypu::buf::BipBuf<char, uint64_t>, WSDummyPublish, buf_type> ws_type;
+
+  WSDummyLog log;
+  std::function<int(int)> setWrite = [] (int) { return 0; };
+  ws_type ws(&log, setWrite);
+  int fds[2];
+  OpenServer(ws, fds);
+
+  // several passes so the write buffer wraps
+  char frame[1000];
+  ::memset(frame, 'x', sizeof(frame));
+  for (int pass = 0; pass < 3; ++pass) {
+	 for (int i = 0; i < 50; ++i) {
+		::snprintf(frame, 9, "%08d", i);
+		ASSERT_TRUE(ws.Queue(fds[0], WS_OP_TEXT_FRAME, frame, sizeof(frame)));
+	 }
+	 std::vector<int> seqs;
+	 DrainFrames(ws, fds, seqs);
+	 ASSERT_EQ(seqs.size(), 50);
+	 for (int i = 0; i < 50; ++i) {
+		ASSERT_EQ(seqs[i], i);
+	 }
+  }
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST(WebsocketTest, SplitHandshake)
+{
+  typedef WebSocketManager<WSDummyLog *, coypu::buf::BipBuf<char, uint64_t>, WSDummyPublish> ws_type;
+
+  WSDummyLog log;
+  std::function<int(int)> setWrite = [] (int) { return 0; };
+  ws_type ws(&log, setWrite);
+
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  std::function<int(int,const struct iovec *,int)> readv = [] (int fd, const struct iovec *iov, int count) { return ::readv(fd, iov, count); };
+  std::function<int(int,const struct iovec *,int)> writev = [] (int fd, const struct iovec *iov, int count) { return ::writev(fd, iov, count); };
+  int opened = 0;
+  std::function<void(int)> onOpen = [&opened] (int) { ++opened; };
+  ASSERT_TRUE(ws.RegisterConnection(fds[0], true, readv, writev, onOpen, nullptr, nullptr, nullptr));
+
+  // nothing is parsed until the blank line, so the start line is not taken from the second read
+  const std::string request = "GET / HTTP/1.1\r\n"
+	 "Host: localhost\r\n"
+	 "Upgrade: websocket\r\n"
+	 "Connection: Upgrade\r\n"
+	 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	 "Sec-WebSocket-Version: 13\r\n"
+	 "\r\n";
+  const size_t split = request.find("Connection") + 4;
+  ASSERT_EQ(::write(fds[1], request.data(), split), split);
+  ASSERT_EQ(ws.Read(fds[0]), 0);
+  ASSERT_EQ(opened, 0);
+  ASSERT_EQ(::write(fds[1], request.data() + split, request.size() - split), request.size() - split);
+  ASSERT_EQ(ws.Read(fds[0]), 0);
+  ASSERT_EQ(opened, 1);
+
+  ASSERT_EQ(ws.Write(fds[0]), 0);
+  char buf[1024];
+  int r = ::read(fds[1], buf, sizeof(buf));
+  ASSERT_GT(r, 0);
+  ASSERT_EQ(std::string(buf, r).find("HTTP/1.1 101 Switching Protocols\r\n"), 0);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}